@@ -0,0 +1,585 @@
+// Generated-code quality benchmark: compile every kernel in a directory
+// with croc, and its C equivalent with a C compiler at -O0 and -O2, then
+// link and run each natively and print, as JSON, the static instruction
+// count, the code size and the cycles and instructions each run took.
+// Runs are counted with perf_event_open() where the kernel allows it and
+// timed with rdtsc, process start included, where it does not. A kernel
+// is <name>.croc next to <name>.c; the exit codes of all three builds must
+// agree, and the benchmark fails when they do not. Linux only.
+//
+// usage: croc_codegen_bench --croc=<path> --kernels=<dir> [options]
+//     --cc=<path>         C compiler building the references, assembling and
+//                         linking (default gcc)
+//     --repetitions=N     runs of every binary, the fewest cycles kept
+//                         (default 5)
+//     --kernel=<name>     run only this kernel
+//     --keep=<dir>        build in <dir> and keep what was built instead of
+//                         using a temporary directory
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef enum QualityVariant {
+    QUALITY_CROC = 0,
+    QUALITY_C_O0,
+    QUALITY_C_O2,
+    QUALITY_VARIANT_COUNT,
+} QualityVariant;
+
+const char* quality_variant_names[QUALITY_VARIANT_COUNT] = { "croc", "c_O0", "c_O2" };
+
+typedef struct QualityOptions {
+    char* croc;
+    char* kernels;
+    char* cc;
+    char* kernel;
+    char* keep;
+    size_t repetitions;
+} QualityOptions;
+
+typedef struct QualityResult {
+    int built;
+    int exit_code;
+    size_t static_instructions;
+    size_t code_bytes;
+    // The fewest of any run; instructions are zero when only rdtsc was
+    // available.
+    unsigned long long cycles;
+    unsigned long long instructions;
+} QualityResult;
+
+// Whether runs are counted by the kernel rather than timed with rdtsc.
+int quality_use_perf = 0;
+
+char* quality_path(const char* directory, const char* name, const char* extension) {
+    size_t length = strlen(directory) + strlen(name) + strlen(extension) + 2;
+    char* path = malloc(length);
+    assert(path && "quality_path: could not allocate memory for path");
+
+    snprintf(path, length, "%s/%s%s", directory, name, extension);
+
+    return path;
+}
+
+// Run `argv` to completion with its output thrown away, returning its exit
+// code or -1 if it could not be run.
+int quality_run(char** argv) {
+    pid_t child = fork();
+
+    if (child < 0) {
+        return -1;
+    }
+
+    if (child == 0) {
+        int null = open("/dev/null", O_WRONLY);
+
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status = 0;
+
+    if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+
+    return WEXITSTATUS(status);
+}
+
+int quality_perf_open(pid_t child, unsigned long long config) {
+    struct perf_event_attr attributes;
+
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = config;
+    attributes.disabled = 1;
+    attributes.enable_on_exec = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attributes, child, -1, -1, 0);
+}
+
+// Whether hardware counters can be opened at all, as they cannot in many
+// virtual machines and containers or with a strict perf_event_paranoid.
+int quality_perf_available(void) {
+    int counter = quality_perf_open(0, PERF_COUNT_HW_CPU_CYCLES);
+
+    if (counter < 0) {
+        return 0;
+    }
+
+    close(counter);
+
+    return 1;
+}
+
+unsigned long long quality_timestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+#endif
+}
+
+// Run the binary at `path` once. The child waits on a pipe until its
+// counters are open, so that they count from its exec() on and nothing of
+// the benchmark itself.
+int quality_measure(char* path, int* exit_code, unsigned long long* cycles, unsigned long long* instructions) {
+    int start[2];
+
+    if (pipe(start) < 0) {
+        return 0;
+    }
+
+    pid_t child = fork();
+
+    if (child < 0) {
+        close(start[0]);
+        close(start[1]);
+
+        return 0;
+    }
+
+    if (child == 0) {
+        char go = 0;
+        int null = open("/dev/null", O_WRONLY);
+
+        close(start[1]);
+
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+
+        if (read(start[0], &go, 1) != 1) {
+            _exit(127);
+        }
+
+        execl(path, path, (char*)NULL);
+        _exit(127);
+    }
+
+    close(start[0]);
+
+    int cycle_counter = -1;
+    int instruction_counter = -1;
+
+    if (quality_use_perf) {
+        cycle_counter = quality_perf_open(child, PERF_COUNT_HW_CPU_CYCLES);
+        instruction_counter = quality_perf_open(child, PERF_COUNT_HW_INSTRUCTIONS);
+    }
+
+    unsigned long long began = quality_timestamp();
+    int status = 0;
+
+    if (write(start[1], "", 1) != 1) {
+        kill(child, SIGKILL);
+    }
+
+    close(start[1]);
+
+    int waited = waitpid(child, &status, 0) == child;
+    unsigned long long ended = quality_timestamp();
+    int counted = 1;
+
+    *cycles = ended - began;
+    *instructions = 0;
+
+    if (quality_use_perf) {
+        counted = cycle_counter >= 0 && instruction_counter >= 0
+            && read(cycle_counter, cycles, sizeof(*cycles)) == sizeof(*cycles)
+            && read(instruction_counter, instructions, sizeof(*instructions)) == sizeof(*instructions);
+    }
+
+    if (cycle_counter >= 0) {
+        close(cycle_counter);
+    }
+
+    if (instruction_counter >= 0) {
+        close(instruction_counter);
+    }
+
+    if (!counted || !waited || !WIFEXITED(status)) {
+        return 0;
+    }
+
+    *exit_code = WEXITSTATUS(status);
+
+    return 1;
+}
+
+// Lines of assembly that are instructions: neither labels, directives nor
+// comments.
+size_t quality_count_instructions(char* path) {
+    char line[4096];
+    size_t count = 0;
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char* text = line + strspn(line, " \t");
+        size_t length = strcspn(text, "#\r\n");
+
+        while (length && (text[length - 1] == ' ' || text[length - 1] == '\t')) {
+            length--;
+        }
+
+        if (!length || text[0] == '.' || text[length - 1] == ':') {
+            continue;
+        }
+
+        count++;
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+// Bytes of every executable section of the ELF64 object at `path`.
+size_t quality_code_bytes(char* path) {
+    size_t bytes = 0;
+    FILE* file = fopen(path, "rb");
+    Elf64_Ehdr header;
+
+    if (!file) {
+        return 0;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0
+        || header.e_ident[EI_CLASS] != ELFCLASS64
+        || header.e_shentsize != sizeof(Elf64_Shdr)) {
+        fclose(file);
+
+        return 0;
+    }
+
+    for (size_t i = 0; i < header.e_shnum; ++i) {
+        Elf64_Shdr section;
+
+        if (fseek(file, (long)(header.e_shoff + i * sizeof(Elf64_Shdr)), SEEK_SET) != 0
+            || fread(&section, sizeof(section), 1, file) != 1) {
+            break;
+        }
+
+        if (section.sh_type == SHT_PROGBITS && (section.sh_flags & SHF_EXECINSTR)) {
+            bytes += section.sh_size;
+        }
+    }
+
+    fclose(file);
+
+    return bytes;
+}
+
+// Build one variant of a kernel into `work` as <name>.<variant>.S, .o and
+// the binary, then measure it.
+void quality_kernel_variant(QualityOptions* options, char* work, char* name, QualityVariant variant, QualityResult* result) {
+    char extension[64];
+
+    memset(result, 0, sizeof(QualityResult));
+
+    snprintf(extension, sizeof(extension), ".%s.S", quality_variant_names[variant]);
+    char* assembly = quality_path(work, name, extension);
+    snprintf(extension, sizeof(extension), ".%s.o", quality_variant_names[variant]);
+    char* object = quality_path(work, name, extension);
+    snprintf(extension, sizeof(extension), ".%s", quality_variant_names[variant]);
+    char* binary = quality_path(work, name, extension);
+    char* source = quality_path(options->kernels, name, variant == QUALITY_CROC ? ".croc" : ".c");
+    int status = 0;
+
+    if (variant == QUALITY_CROC) {
+        char* compile[] = { options->croc, source, "-o", assembly, NULL };
+
+        status = quality_run(compile);
+    } else {
+        char* compile[] = { options->cc, variant == QUALITY_C_O0 ? "-O0" : "-O2", "-S", source, "-o", assembly, NULL };
+
+        status = quality_run(compile);
+    }
+
+    char* assemble[] = { options->cc, "-c", assembly, "-o", object, NULL };
+    char* link[] = { options->cc, object, "-o", binary, NULL };
+
+    if (status == 0 && quality_run(assemble) == 0 && quality_run(link) == 0) {
+        result->built = 1;
+        result->static_instructions = quality_count_instructions(assembly);
+        result->code_bytes = quality_code_bytes(object);
+
+        for (size_t run = 0; run < options->repetitions; ++run) {
+            unsigned long long cycles = 0;
+            unsigned long long instructions = 0;
+
+            if (!quality_measure(binary, &result->exit_code, &cycles, &instructions)) {
+                result->built = 0;
+                break;
+            }
+
+            if (run == 0 || cycles < result->cycles) {
+                result->cycles = cycles;
+            }
+
+            if (run == 0 || instructions < result->instructions) {
+                result->instructions = instructions;
+            }
+        }
+    } else {
+        fprintf(stderr, "croc_codegen_bench: could not build %s of \"%s\"\n", quality_variant_names[variant], name);
+    }
+
+    free(assembly);
+    free(object);
+    free(binary);
+    free(source);
+}
+
+int quality_compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Names of the kernels in `directory`, sorted: every <name>.croc with a
+// <name>.c next to it.
+char** quality_kernels(char* directory, size_t* count) {
+    char** names = NULL;
+    size_t capacity = 0;
+    DIR* listing = opendir(directory);
+    struct dirent* found = NULL;
+
+    *count = 0;
+
+    if (!listing) {
+        return NULL;
+    }
+
+    while ((found = readdir(listing))) {
+        size_t length = strlen(found->d_name);
+        struct stat status;
+
+        if (length <= 5 || strcmp(found->d_name + length - 5, ".croc") != 0) {
+            continue;
+        }
+
+        char* name = strndup(found->d_name, length - 5);
+        char* reference = quality_path(directory, name, ".c");
+        assert(name && "quality_kernels: could not allocate memory for name");
+
+        if (stat(reference, &status) != 0) {
+            fprintf(stderr, "croc_codegen_bench: skipping \"%s\", which has no \"%s.c\"\n", found->d_name, name);
+            free(reference);
+            free(name);
+            continue;
+        }
+
+        free(reference);
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            names = realloc(names, capacity * sizeof(char*));
+            assert(names && "quality_kernels: could not allocate memory for names");
+        }
+
+        names[(*count)++] = name;
+    }
+
+    closedir(listing);
+
+    if (*count) {
+        qsort(names, *count, sizeof(char*), quality_compare_names);
+    }
+
+    return names;
+}
+
+double quality_ratio(unsigned long long a, unsigned long long b) {
+    return b ? (double)a / (double)b : 0.0;
+}
+
+int quality_option(char* argument, const char* name, char** value) {
+    size_t length = strlen(name);
+
+    if (strncmp(argument, name, length) || argument[length] != '=') {
+        return 0;
+    }
+
+    *value = argument + length + 1;
+
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    QualityOptions options = { NULL, NULL, "gcc", NULL, NULL, 5 };
+    char* value = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (quality_option(argv[i], "--croc", &value)) {
+            options.croc = value;
+        } else if (quality_option(argv[i], "--kernels", &value)) {
+            options.kernels = value;
+        } else if (quality_option(argv[i], "--cc", &value)) {
+            options.cc = value;
+        } else if (quality_option(argv[i], "--repetitions", &value)) {
+            options.repetitions = strtoull(value, NULL, 10);
+        } else if (quality_option(argv[i], "--kernel", &value)) {
+            options.kernel = value;
+        } else if (quality_option(argv[i], "--keep", &value)) {
+            options.keep = value;
+        } else {
+            fprintf(stderr, "unknown option: \"%s\"\n", argv[i]);
+
+            return 1;
+        }
+    }
+
+    if (!options.croc || !options.kernels) {
+        fprintf(stderr, "usage: croc_codegen_bench --croc=<path> --kernels=<dir> [options]\n");
+
+        return 1;
+    }
+
+    if (!options.repetitions) {
+        options.repetitions = 1;
+    }
+
+    quality_use_perf = quality_perf_available();
+
+    char temporary[] = "/tmp/croc_codegen_bench.XXXXXX";
+    char* work = options.keep;
+
+    if (work) {
+        mkdir(work, 0755);
+    } else if (!(work = mkdtemp(temporary))) {
+        fprintf(stderr, "could not create a temporary directory\n");
+
+        return 1;
+    }
+
+    size_t kernel_count = 0;
+    char** kernels = quality_kernels(options.kernels, &kernel_count);
+    int failed = 0;
+    int first = 1;
+
+    if (!kernel_count) {
+        fprintf(stderr, "no kernels in \"%s\"\n", options.kernels);
+        failed = 1;
+    }
+
+    printf("{\n");
+    printf("  \"cc\": \"%s\",\n", options.cc);
+    printf("  \"repetitions\": %zu,\n", options.repetitions);
+    printf("  \"kernels\": {");
+
+    for (size_t i = 0; i < kernel_count; ++i) {
+        QualityResult results[QUALITY_VARIANT_COUNT];
+
+        if (options.kernel && strcmp(options.kernel, kernels[i]) != 0) {
+            continue;
+        }
+
+        for (size_t variant = 0; variant < QUALITY_VARIANT_COUNT; ++variant) {
+            quality_kernel_variant(&options, work, kernels[i], (QualityVariant)variant, results + variant);
+        }
+
+        int built = results[QUALITY_CROC].built && results[QUALITY_C_O0].built && results[QUALITY_C_O2].built;
+        int agree = built
+            && results[QUALITY_CROC].exit_code == results[QUALITY_C_O0].exit_code
+            && results[QUALITY_CROC].exit_code == results[QUALITY_C_O2].exit_code;
+
+        if (!agree) {
+            fprintf(stderr, "croc_codegen_bench: \"%s\" %s\n", kernels[i], built ? "gives different results" : "did not build or run");
+            failed = 1;
+        }
+
+        printf("%s\n    \"%s\": {\n", first ? "" : ",", kernels[i]);
+        printf("      \"agree\": %s,\n", agree ? "true" : "false");
+        first = 0;
+
+        for (size_t variant = 0; variant < QUALITY_VARIANT_COUNT; ++variant) {
+            QualityResult* result = results + variant;
+
+            printf("      \"%s\": { \"exit_code\": %d, \"static_instructions\": %zu, \"code_bytes\": %zu, \"cycles\": %llu, \"instructions\": ",
+                quality_variant_names[variant], result->exit_code, result->static_instructions, result->code_bytes, result->cycles);
+
+            if (quality_use_perf) {
+                printf("%llu },\n", result->instructions);
+            } else {
+                printf("null },\n");
+            }
+        }
+
+        // Above one, croc is that many times worse.
+        printf("      \"croc_vs_c_O0\": { \"cycles\": %.3f, \"code_bytes\": %.3f },\n",
+            quality_ratio(results[QUALITY_CROC].cycles, results[QUALITY_C_O0].cycles),
+            quality_ratio(results[QUALITY_CROC].code_bytes, results[QUALITY_C_O0].code_bytes));
+        printf("      \"croc_vs_c_O2\": { \"cycles\": %.3f, \"code_bytes\": %.3f }\n",
+            quality_ratio(results[QUALITY_CROC].cycles, results[QUALITY_C_O2].cycles),
+            quality_ratio(results[QUALITY_CROC].code_bytes, results[QUALITY_C_O2].code_bytes));
+        printf("    }");
+    }
+
+    printf("\n  },\n");
+    printf("  \"counter\": \"%s\"\n", quality_use_perf ? "perf_event_open" : "rdtsc");
+    printf("}\n");
+
+    if (!options.keep) {
+        for (size_t i = 0; i < kernel_count; ++i) {
+            for (size_t variant = 0; variant < QUALITY_VARIANT_COUNT; ++variant) {
+                const char* extensions[] = { ".S", ".o", "" };
+
+                for (size_t e = 0; e < 3; ++e) {
+                    char extension[64];
+
+                    snprintf(extension, sizeof(extension), ".%s%s", quality_variant_names[variant], extensions[e]);
+
+                    char* path = quality_path(work, kernels[i], extension);
+                    remove(path);
+                    free(path);
+                }
+            }
+        }
+
+        rmdir(work);
+    }
+
+    for (size_t i = 0; i < kernel_count; ++i) {
+        free(kernels[i]);
+    }
+
+    free(kernels);
+
+    return failed;
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Measure what --instrument costs on a call-heavy program: f<i> calls f<i-1>
+# twice, so f<depth> makes 2^depth calls, each doing almost nothing besides
+# the instrumentation. A global is threaded through the calls so CTFE cannot
+# fold them.
+#
+# usage: bench/instrument_overhead.sh <path/to/croc> [depth]
+
+set -e
+
+croc=${1:?usage: $0 <path/to/croc> [depth]}
+depth=${2:-24}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+{
+    echo "n : integer = 0"
+    echo "defun f0 (x:integer):integer {"
+    echo "    n := x"
+    echo "    x"
+    echo "}"
+
+    i=1
+    while [ "$i" -le "$depth" ]; do
+        echo "defun f$i (x:integer):integer {"
+        echo "    f$((i - 1))(x)"
+        echo "    f$((i - 1))(n)"
+        echo "}"
+        i=$((i + 1))
+    done
+
+    printf "f%s(1)" "$depth"
+} > "$work/bench.croc"
+
+# Milliseconds since the epoch.
+now() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+cd "$work"
+
+"$croc" bench.croc > /dev/null
+cc code.S -o plain
+
+"$croc" --instrument=report.txt bench.croc > /dev/null
+cc code.S -o instrumented
+
+start=$(now)
+./plain || true
+plain=$(($(now) - start))
+
+start=$(now)
+./instrumented || true
+instrumented=$(($(now) - start))
+
+calls=$((1 << (depth + 1)))
+
+echo "calls:            $calls"
+echo "plain:            ${plain}ms"
+echo "instrumented:     ${instrumented}ms"
+echo "overhead:         $(((instrumented - plain) * 1000000 / calls))ns per call"
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Compare `croc --interpret` against the native code croc generates on a
+# call-heavy program: f<i> calls f<i-1> twice, so f<depth> makes 2^depth
+# calls. A global is threaded through the calls so CTFE cannot fold them.
+#
+# usage: bench/interpret_vs_native.sh <path/to/croc> [depth]
+
+set -e
+
+croc=${1:?usage: $0 <path/to/croc> [depth]}
+depth=${2:-22}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+{
+    echo "n : integer = 0"
+    echo "defun f0 (x:integer):integer {"
+    echo "    n := x"
+    echo "    x"
+    echo "}"
+
+    i=1
+    while [ "$i" -le "$depth" ]; do
+        echo "defun f$i (x:integer):integer {"
+        echo "    f$((i - 1))(x)"
+        echo "    f$((i - 1))(n)"
+        echo "}"
+        i=$((i + 1))
+    done
+
+    printf "f%s(1)" "$depth"
+} > "$work/bench.croc"
+
+# Milliseconds since the epoch.
+now() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+cd "$work"
+
+start=$(now)
+"$croc" --interpret bench.croc > /dev/null || true
+interpret=$(($(now) - start))
+
+start=$(now)
+"$croc" bench.croc > /dev/null
+cc code.S -o bench
+build=$(($(now) - start))
+
+start=$(now)
+./bench || true
+native=$(($(now) - start))
+
+echo "calls:            $((1 << depth))"
+echo "interpret:        ${interpret}ms"
+echo "native build:     ${build}ms"
+echo "native run:       ${native}ms"
@@ -0,0 +1,12 @@
+/* Arithmetic: division and remainder by constants, shifts and masks in a
+ * loop. */
+long long n = 20000000;
+long long s = 0;
+
+int main(void) {
+    for (long long i = 0; i < n; i = i + 1) {
+        s = (s + i / 7 + i % 10 * 3 + (i << 2) / 5 - (s >> 3)) & 1048575;
+    }
+
+    return (int)(s & 255);
+}
@@ -0,0 +1,20 @@
+/* Call-heavy: small functions called through two levels from a loop. */
+long long n = 20000000;
+long long seed = 7;
+long long x = 0;
+
+long long mix(long long a, long long b) {
+    return (a * 31 + b) & 65535;
+}
+
+long long step(long long x, long long i) {
+    return mix(mix(x, i), seed);
+}
+
+int main(void) {
+    for (long long i = 0; i < n; i = i + 1) {
+        x = step(x, i);
+    }
+
+    return (int)(x & 255);
+}
@@ -0,0 +1,16 @@
+/* Recursive arithmetic: the naive Fibonacci recursion. */
+long long depth = 32;
+
+long long fib(long long n) {
+    long long r = n;
+
+    if (n > 1) {
+        r = fib(n - 1) + fib(n - 2);
+    }
+
+    return r;
+}
+
+int main(void) {
+    return (int)(fib(depth) & 255);
+}
@@ -0,0 +1,42 @@
+/* Many globals: sixteen of them, each updated from its neighbour on every
+ * pass of a loop. */
+long long n = 2000000;
+long long g0 = 1;
+long long g1 = 2;
+long long g2 = 3;
+long long g3 = 4;
+long long g4 = 5;
+long long g5 = 6;
+long long g6 = 7;
+long long g7 = 8;
+long long g8 = 9;
+long long g9 = 10;
+long long g10 = 11;
+long long g11 = 12;
+long long g12 = 13;
+long long g13 = 14;
+long long g14 = 15;
+long long g15 = 16;
+
+int main(void) {
+    for (long long i = 0; i < n; i = i + 1) {
+        g0 = (g0 + g15 * 3 + (i ^ g0)) & 1048575;
+        g1 = (g1 + g0 * 5 + (i ^ g1)) & 1048575;
+        g2 = (g2 + g1 * 7 + (i ^ g2)) & 1048575;
+        g3 = (g3 + g2 * 9 + (i ^ g3)) & 1048575;
+        g4 = (g4 + g3 * 11 + (i ^ g4)) & 1048575;
+        g5 = (g5 + g4 * 13 + (i ^ g5)) & 1048575;
+        g6 = (g6 + g5 * 15 + (i ^ g6)) & 1048575;
+        g7 = (g7 + g6 * 17 + (i ^ g7)) & 1048575;
+        g8 = (g8 + g7 * 19 + (i ^ g8)) & 1048575;
+        g9 = (g9 + g8 * 21 + (i ^ g9)) & 1048575;
+        g10 = (g10 + g9 * 23 + (i ^ g10)) & 1048575;
+        g11 = (g11 + g10 * 25 + (i ^ g11)) & 1048575;
+        g12 = (g12 + g11 * 27 + (i ^ g12)) & 1048575;
+        g13 = (g13 + g12 * 29 + (i ^ g13)) & 1048575;
+        g14 = (g14 + g13 * 31 + (i ^ g14)) & 1048575;
+        g15 = (g15 + g14 * 33 + (i ^ g15)) & 1048575;
+    }
+
+    return (int)((g0 + g1 + g2 + g3 + g4 + g5 + g6 + g7 + g8 + g9 + g10 + g11 + g12 + g13 + g14 + g15) & 255);
+}
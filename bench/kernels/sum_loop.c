@@ -0,0 +1,17 @@
+/* Loops against recursion: a sum over a range computed by a loop.
+ * sum_recursion computes the same sum by a recursion. */
+long long count = 16777216;
+
+long long sum(long long lo, long long hi) {
+    long long total = 0;
+
+    for (long long i = lo; i < hi; i = i + 1) {
+        total = total + i % 7;
+    }
+
+    return total;
+}
+
+int main(void) {
+    return (int)(sum(0, count) & 255);
+}
@@ -0,0 +1,17 @@
+/* Loops against recursion: the sum of sum_loop computed by halving the
+ * range until it holds one number. */
+long long count = 16777216;
+
+long long sum(long long lo, long long hi) {
+    long long total = lo % 7;
+
+    if (hi - lo > 1) {
+        total = sum(lo, (lo + hi) / 2) + sum((lo + hi) / 2, hi);
+    }
+
+    return total;
+}
+
+int main(void) {
+    return (int)(sum(0, count) & 255);
+}
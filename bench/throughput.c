@@ -0,0 +1,451 @@
+// Compiler throughput benchmark: generate a synthetic program of a given
+// shape, then time the lexer, parse_source(), typecheck_program() and
+// codegen_program_file() on it separately and print the results as JSON.
+//
+// usage: croc_bench [options]
+//     --functions=N       functions to define (default 200)
+//     --parameters=N      parameters of every function (default 3)
+//     --statements=N      statements in every function body (default 20)
+//     --depth=N           nesting depth of calls in arguments (default 3)
+//     --comments=P        chance of a comment line before a statement (default 0.2)
+//     --seed=N            seed of the generator (default 1)
+//     --warmup=N          untimed runs before measuring (default 2)
+//     --repetitions=N     timed runs (default 10)
+//     --lazy              parse only the bodies of functions the program calls,
+//                         as --lazy-parse does; --depth=0 leaves all but the
+//                         last function unused
+//     --emit=<path>       write the generated program to <path> and exit
+
+#include "allocator.h"
+#include "codegen.h"
+#include "dead_code.h"
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+#include "time_report.h"
+#include "typechecker.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define BENCH_NULL_DEVICE "NUL"
+#else
+#define BENCH_NULL_DEVICE "/dev/null"
+#endif
+
+typedef struct BenchShape {
+    size_t functions;
+    size_t parameters;
+    size_t statements;
+    size_t depth;
+    double comment_density;
+    unsigned long long seed;
+} BenchShape;
+
+typedef struct BenchBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+} BenchBuffer;
+
+void bench_append(BenchBuffer* buffer, const char* format, ...) {
+    va_list arguments;
+
+    for (;;) {
+        size_t available = buffer->capacity - buffer->length;
+
+        va_start(arguments, format);
+        int written = vsnprintf(buffer->data ? buffer->data + buffer->length : NULL, available, format, arguments);
+        va_end(arguments);
+
+        assert(written >= 0 && "bench_append: formatting failed");
+
+        if ((size_t)written < available) {
+            buffer->length += (size_t)written;
+
+            return;
+        }
+
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (buffer->capacity - buffer->length <= (size_t)written) {
+            buffer->capacity *= 2;
+        }
+
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        assert(buffer->data && "bench_append: could not allocate memory for source");
+    }
+}
+
+// xorshift64*, so every platform generates the same program from a seed.
+unsigned long long bench_random(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ull;
+}
+
+size_t bench_random_below(unsigned long long* state, size_t bound) {
+    return bound ? (size_t)(bench_random(state) % bound) : 0;
+}
+
+// A variable in scope or a literal.
+void bench_leaf(BenchBuffer* buffer, BenchShape* shape, unsigned long long* state, size_t locals) {
+    size_t choice = bench_random_below(state, 4);
+
+    if (choice == 0 && shape->parameters) {
+        bench_append(buffer, "p%zu", bench_random_below(state, shape->parameters));
+    } else if (choice == 1 && locals) {
+        bench_append(buffer, "v%zu", bench_random_below(state, locals));
+    } else if (choice == 2) {
+        bench_append(buffer, "g");
+    } else {
+        bench_append(buffer, "%zu", bench_random_below(state, 1000));
+    }
+}
+
+// Calls only go to functions defined earlier. The first argument nests
+// another call until `depth` runs out.
+void bench_expression(BenchBuffer* buffer, BenchShape* shape, unsigned long long* state, size_t function, size_t locals, size_t depth) {
+    if (!depth || !function) {
+        bench_leaf(buffer, shape, state, locals);
+
+        return;
+    }
+
+    bench_append(buffer, "f%zu(", bench_random_below(state, function));
+
+    for (size_t i = 0; i < shape->parameters; ++i) {
+        if (i) {
+            bench_append(buffer, ", ");
+        }
+
+        if (i == 0) {
+            bench_expression(buffer, shape, state, function, locals, depth - 1);
+        } else {
+            bench_leaf(buffer, shape, state, locals);
+        }
+    }
+
+    bench_append(buffer, ")");
+}
+
+void bench_comment(BenchBuffer* buffer, BenchShape* shape, unsigned long long* state, const char* indent) {
+    if ((double)bench_random_below(state, 1000000) / 1000000.0 < shape->comment_density) {
+        bench_append(buffer, "%s; generated comment %llu, which the lexer skips\n", indent, bench_random(state) % 100000);
+    }
+}
+
+char* bench_generate(BenchShape* shape) {
+    BenchBuffer buffer = { NULL, 0, 0 };
+    unsigned long long state = shape->seed ? shape->seed : 1;
+
+    bench_append(&buffer, "g : integer = 1\n");
+
+    for (size_t function = 0; function < shape->functions; ++function) {
+        size_t locals = 0;
+
+        bench_comment(&buffer, shape, &state, "");
+        bench_append(&buffer, "defun f%zu (", function);
+
+        for (size_t i = 0; i < shape->parameters; ++i) {
+            bench_append(&buffer, i ? ", p%zu:integer" : "p%zu:integer", i);
+        }
+
+        bench_append(&buffer, "):integer {\n");
+
+        for (size_t statement = 0; statement < shape->statements; ++statement) {
+            bench_comment(&buffer, shape, &state, "    ");
+            bench_append(&buffer, "    ");
+
+            switch (statement % 3) {
+            case 0:
+                bench_append(&buffer, "v%zu : integer = ", locals);
+                bench_expression(&buffer, shape, &state, function, locals, shape->depth);
+                locals++;
+
+                break;
+
+            case 1:
+                bench_append(&buffer, "g := ");
+                bench_expression(&buffer, shape, &state, function, locals, shape->depth);
+
+                break;
+
+            default:
+                bench_expression(&buffer, shape, &state, function, locals, shape->depth);
+
+                break;
+            }
+
+            bench_append(&buffer, "\n");
+        }
+
+        bench_append(&buffer, "    ");
+        bench_leaf(&buffer, shape, &state, locals);
+        bench_append(&buffer, "\n}\n");
+    }
+
+    if (shape->functions) {
+        bench_append(&buffer, "f%zu(", shape->functions - 1);
+
+        for (size_t i = 0; i < shape->parameters; ++i) {
+            bench_append(&buffer, i ? ", %zu" : "%zu", i);
+        }
+
+        bench_append(&buffer, ")\n");
+    }
+
+    return buffer.data;
+}
+
+size_t bench_count_nodes(Node* node) {
+    size_t count = 0;
+
+    for (; node; node = node->next_child) {
+        count += 1 + bench_count_nodes(node->children);
+    }
+
+    return count;
+}
+
+typedef enum BenchPhase {
+    BENCH_PHASE_LEX = 0,
+    BENCH_PHASE_PARSE,
+    BENCH_PHASE_TYPECHECK,
+    BENCH_PHASE_CODEGEN,
+    BENCH_PHASE_COUNT,
+} BenchPhase;
+
+const char* bench_phase_names[BENCH_PHASE_COUNT] = { "lex", "parse", "typecheck", "codegen" };
+
+size_t bench_lex(char* source) {
+    Token token;
+    size_t tokens = 0;
+
+    token.beginning = source;
+    token.end = source;
+
+    while (lex(token.end, &token).type == ERROR_NONE && token.end && token.end != token.beginning) {
+        tokens++;
+    }
+
+    return tokens;
+}
+
+// One run of every phase, recording how long each took. Memory is managed
+// as the driver does, scratch memory released between phases. A lazy parse
+// includes parsing the bodies the program reaches; the functions it does
+// not are removed, untimed, before type checking.
+Error bench_run(char* source, int lazy, FILE* sink, double* seconds, size_t* tokens, size_t* nodes) {
+    CodegenOptions options = { .format = CG_FMT_x86_64_SYSV };
+    CrocArena program_arena;
+    CrocArena phase_arena;
+    double start = time_report_wall_seconds();
+
+    *tokens = bench_lex(source);
+    seconds[BENCH_PHASE_LEX] = time_report_wall_seconds() - start;
+
+    arena_init(&program_arena, &croc_heap);
+    arena_init(&phase_arena, &croc_heap);
+
+    start = time_report_wall_seconds();
+    Node* program = node_allocate(&program_arena.allocator);
+    ParsingContext* context = parse_context_default_create(&program_arena.allocator, &phase_arena.allocator);
+    context->lazy = lazy;
+
+    Error err = parse_source(source, context, program);
+
+    if (!err.type && lazy) {
+        err = dead_code_parse_reachable(context, program);
+    }
+
+    seconds[BENCH_PHASE_PARSE] = time_report_wall_seconds() - start;
+
+    if (!err.type) {
+        *nodes = bench_count_nodes(program);
+        arena_reset(&phase_arena);
+
+        if (lazy) {
+            DeadCodeStats dead_code;
+
+            dead_code_eliminate_program(context, program, &dead_code);
+            dead_code_stats_free(&dead_code);
+            arena_reset(&phase_arena);
+        }
+
+        start = time_report_wall_seconds();
+        err = typecheck_program(context, program);
+        seconds[BENCH_PHASE_TYPECHECK] = time_report_wall_seconds() - start;
+    }
+
+    if (!err.type) {
+        arena_reset(&phase_arena);
+
+        start = time_report_wall_seconds();
+        err = codegen_program_file(&options, context, program, sink);
+        fflush(sink);
+        seconds[BENCH_PHASE_CODEGEN] = time_report_wall_seconds() - start;
+    }
+
+    arena_free(&phase_arena);
+    arena_free(&program_arena);
+
+    return err;
+}
+
+int bench_compare_seconds(const void* a, const void* b) {
+    double seconds_a = *(const double*)a;
+    double seconds_b = *(const double*)b;
+
+    return (seconds_a > seconds_b) - (seconds_a < seconds_b);
+}
+
+int bench_option(char* argument, const char* name, char** value) {
+    size_t length = strlen(name);
+
+    if (strncmp(argument, name, length) || argument[length] != '=') {
+        return 0;
+    }
+
+    *value = argument + length + 1;
+
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    BenchShape shape = { 200, 3, 20, 3, 0.2, 1 };
+    size_t warmup = 2;
+    size_t repetitions = 10;
+    char* emit_path = NULL;
+    char* value = NULL;
+    int lazy = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (bench_option(argv[i], "--functions", &value)) {
+            shape.functions = strtoull(value, NULL, 10);
+        } else if (bench_option(argv[i], "--parameters", &value)) {
+            shape.parameters = strtoull(value, NULL, 10);
+        } else if (bench_option(argv[i], "--statements", &value)) {
+            shape.statements = strtoull(value, NULL, 10);
+        } else if (bench_option(argv[i], "--depth", &value)) {
+            shape.depth = strtoull(value, NULL, 10);
+        } else if (bench_option(argv[i], "--comments", &value)) {
+            shape.comment_density = strtod(value, NULL);
+        } else if (bench_option(argv[i], "--seed", &value)) {
+            shape.seed = strtoull(value, NULL, 10);
+        } else if (bench_option(argv[i], "--warmup", &value)) {
+            warmup = strtoull(value, NULL, 10);
+        } else if (bench_option(argv[i], "--repetitions", &value)) {
+            repetitions = strtoull(value, NULL, 10);
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (bench_option(argv[i], "--emit", &value)) {
+            emit_path = value;
+        } else {
+            fprintf(stderr, "unknown option: \"%s\"\n", argv[i]);
+
+            return 1;
+        }
+    }
+
+    if (!repetitions) {
+        repetitions = 1;
+    }
+
+    char* source = bench_generate(&shape);
+    size_t source_bytes = strlen(source);
+
+    if (emit_path) {
+        FILE* file = fopen(emit_path, "w");
+
+        if (!file) {
+            fprintf(stderr, "could not open \"%s\"\n", emit_path);
+
+            return 1;
+        }
+
+        fwrite(source, 1, source_bytes, file);
+        fclose(file);
+        free(source);
+
+        return 0;
+    }
+
+    // The compiler reports to stdout, which is where the JSON goes.
+    FILE* sink = fopen(BENCH_NULL_DEVICE, "w");
+    if (!sink) {
+        fprintf(stderr, "could not open \"%s\"\n", BENCH_NULL_DEVICE);
+
+        return 1;
+    }
+
+    double* seconds = calloc(repetitions * BENCH_PHASE_COUNT, sizeof(double));
+    double run_seconds[BENCH_PHASE_COUNT];
+    size_t tokens = 0;
+    size_t nodes = 0;
+
+    assert(seconds && "croc_bench: could not allocate memory for timings");
+
+    for (size_t run = 0; run < warmup + repetitions; ++run) {
+        Error err = bench_run(source, lazy, sink, run_seconds, &tokens, &nodes);
+
+        if (err.type) {
+            print_error(err);
+
+            return 2;
+        }
+
+        if (run >= warmup) {
+            for (size_t phase = 0; phase < BENCH_PHASE_COUNT; ++phase) {
+                seconds[phase * repetitions + run - warmup] = run_seconds[phase];
+            }
+        }
+    }
+
+    fclose(sink);
+
+    printf("{\n");
+    printf("  \"shape\": { \"functions\": %zu, \"parameters\": %zu, \"statements\": %zu, \"depth\": %zu, \"comments\": %g, \"seed\": %llu },\n",
+        shape.functions, shape.parameters, shape.statements, shape.depth, shape.comment_density, shape.seed);
+    printf("  \"lazy\": %s,\n", lazy ? "true" : "false");
+    printf("  \"source_bytes\": %zu,\n", source_bytes);
+    printf("  \"tokens\": %zu,\n", tokens);
+    printf("  \"nodes\": %zu,\n", nodes);
+    printf("  \"warmup\": %zu,\n", warmup);
+    printf("  \"repetitions\": %zu,\n", repetitions);
+    printf("  \"phases\": {\n");
+
+    for (size_t phase = 0; phase < BENCH_PHASE_COUNT; ++phase) {
+        double* samples = seconds + phase * repetitions;
+        double mean = 0;
+
+        for (size_t i = 0; i < repetitions; ++i) {
+            mean += samples[i] / (double)repetitions;
+        }
+
+        qsort(samples, repetitions, sizeof(double), bench_compare_seconds);
+
+        double median = repetitions % 2 ? samples[repetitions / 2]
+            : (samples[repetitions / 2 - 1] + samples[repetitions / 2]) / 2;
+
+        printf("    \"%s\": { \"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f, \"mb_per_s\": %.2f, \"nodes_per_s\": %.0f }%s\n",
+            bench_phase_names[phase], samples[0] * 1000.0, median * 1000.0, mean * 1000.0,
+            median > 0 ? (double)source_bytes / 1e6 / median : 0.0,
+            median > 0 ? (double)nodes / median : 0.0,
+            phase + 1 < BENCH_PHASE_COUNT ? "," : "");
+    }
+
+    printf("  }\n");
+    printf("}\n");
+
+    free(seconds);
+    free(source);
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include "allocator.h"
+#include "error.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What every allocation is aligned to, enough for any type the compiler
+// keeps.
+#define ALLOCATOR_ALIGNMENT 16
+
+#define ALLOCATOR_ALIGN(size)   (((size) + ALLOCATOR_ALIGNMENT - 1) & ~(size_t)(ALLOCATOR_ALIGNMENT - 1))
+
+void* heap_allocate(CrocAllocator* allocator, size_t size, const char* site) {
+    (void)allocator;
+    (void)site;
+
+    void* memory = calloc(1, size ? size : 1);
+    assert(memory && "heap_allocate: could not allocate memory");
+
+    return memory;
+}
+
+void heap_release(CrocAllocator* allocator, void* memory) {
+    (void)allocator;
+
+    free(memory);
+}
+
+CrocAllocator croc_heap = { heap_allocate, heap_release };
+
+void* arena_allocate(CrocAllocator* allocator, size_t size, const char* site) {
+    CrocArena* arena = (CrocArena*)allocator;
+    ArenaBlock* block = arena->blocks;
+    size_t header = ALLOCATOR_ALIGN(sizeof(ArenaBlock));
+
+    (void)site;
+    size = ALLOCATOR_ALIGN(size ? size : 1);
+
+    if (!block || block->size - block->used < size) {
+        // Large allocations get a block of their own, behind the current
+        // one, so that what is left of it is not wasted.
+        size_t block_size = size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock* new_block = arena->parent->allocate(arena->parent, header + block_size, "arena_allocate");
+
+        new_block->size = block_size;
+        new_block->used = 0;
+
+        if (block && block_size != ARENA_BLOCK_SIZE) {
+            new_block->next = block->next;
+            block->next = new_block;
+        } else {
+            new_block->next = block;
+            arena->blocks = new_block;
+        }
+
+        block = new_block;
+    }
+
+    void* memory = (char*)block + header + block->used;
+
+    block->used += size;
+    arena->bytes += size;
+
+    if (arena->bytes > arena->peak_bytes) {
+        arena->peak_bytes = arena->bytes;
+    }
+
+    return memory;
+}
+
+void arena_release(CrocAllocator* allocator, void* memory) {
+    (void)allocator;
+    (void)memory;
+}
+
+void arena_init(CrocArena* arena, CrocAllocator* parent) {
+    memset(arena, 0, sizeof(CrocArena));
+
+    arena->allocator.allocate = arena_allocate;
+    arena->allocator.release = arena_release;
+    arena->parent = parent;
+}
+
+void arena_reset(CrocArena* arena) {
+    ArenaBlock* block = arena->blocks;
+
+    while (block) {
+        ArenaBlock* next = block->next;
+
+        croc_release(arena->parent, block);
+        block = next;
+    }
+
+    arena->blocks = NULL;
+    arena->bytes = 0;
+}
+
+void arena_free(CrocArena* arena) {
+    arena_reset(arena);
+}
+
+// Precedes every allocation, keeping it aligned.
+typedef struct CountingHeader {
+    size_t size;
+    size_t site;
+} CountingHeader;
+
+size_t counting_site(CountingAllocator* counting, const char* name) {
+    // Site names are __func__, so the same site is nearly always the same
+    // pointer.
+    for (size_t i = 0; i < counting->site_count; ++i) {
+        if (counting->sites[i].name == name || strcmp(counting->sites[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (counting->site_count == counting->site_capacity) {
+        counting->site_capacity = counting->site_capacity ? counting->site_capacity * 2 : 32;
+        counting->sites = realloc(counting->sites, counting->site_capacity * sizeof(AllocationSite));
+        assert(counting->sites && "counting_site: could not allocate memory for allocation sites");
+    }
+
+    memset(counting->sites + counting->site_count, 0, sizeof(AllocationSite));
+    counting->sites[counting->site_count].name = name;
+
+    return counting->site_count++;
+}
+
+void* counting_allocate(CrocAllocator* allocator, size_t size, const char* site) {
+    CountingAllocator* counting = (CountingAllocator*)allocator;
+    CountingHeader* header = counting->parent->allocate(counting->parent, sizeof(CountingHeader) + size, site);
+    size_t index = counting_site(counting, site);
+    AllocationSite* entry = counting->sites + index;
+
+    header->size = size;
+    header->site = index;
+
+    entry->allocations++;
+    entry->bytes += size;
+    entry->live_bytes += size;
+    counting->live_bytes += size;
+
+    if (entry->live_bytes > entry->peak_bytes) {
+        entry->peak_bytes = entry->live_bytes;
+    }
+
+    if (counting->live_bytes > counting->peak_bytes) {
+        counting->peak_bytes = counting->live_bytes;
+    }
+
+    return header + 1;
+}
+
+void counting_release(CrocAllocator* allocator, void* memory) {
+    CountingAllocator* counting = (CountingAllocator*)allocator;
+
+    if (!memory) {
+        return;
+    }
+
+    CountingHeader* header = (CountingHeader*)memory - 1;
+
+    counting->sites[header->site].live_bytes -= header->size;
+    counting->live_bytes -= header->size;
+
+    croc_release(counting->parent, header);
+}
+
+void counting_allocator_init(CountingAllocator* counting, CrocAllocator* parent) {
+    memset(counting, 0, sizeof(CountingAllocator));
+
+    counting->allocator.allocate = counting_allocate;
+    counting->allocator.release = counting_release;
+    counting->parent = parent;
+}
+
+void counting_allocator_reset(CountingAllocator* counting) {
+    for (size_t i = 0; i < counting->site_count; ++i) {
+        counting->sites[i].live_bytes = 0;
+    }
+
+    counting->live_bytes = 0;
+}
+
+void counting_allocator_free(CountingAllocator* counting) {
+    free(counting->sites);
+
+    counting->sites = NULL;
+    counting->site_count = 0;
+    counting->site_capacity = 0;
+}
+
+int allocation_site_compare(const void* a, const void* b) {
+    size_t peak_a = ((const AllocationSite*)a)->peak_bytes;
+    size_t peak_b = ((const AllocationSite*)b)->peak_bytes;
+
+    return (peak_a < peak_b) - (peak_a > peak_b);
+}
+
+void print_allocation_sites(CountingAllocator* counting, const char* name) {
+    // Sorted apart from the sites themselves, which allocations refer to by
+    // index.
+    AllocationSite* sites = malloc((counting->site_count + 1) * sizeof(AllocationSite));
+    assert(sites && "print_allocation_sites: could not allocate memory for sorted sites");
+
+    if (counting->site_count) {
+        memcpy(sites, counting->sites, counting->site_count * sizeof(AllocationSite));
+        qsort(sites, counting->site_count, sizeof(AllocationSite), allocation_site_compare);
+    }
+
+    fprintf(diagnostic_stream(), "%-28s %12s %12s %12s\n", name, "allocs", "bytes", "peak bytes");
+
+    for (size_t i = 0; i < counting->site_count; ++i) {
+        AllocationSite* site = sites + i;
+
+        fprintf(diagnostic_stream(), "%-28s %12zu %12zu %12zu\n", site->name, site->allocations, site->bytes, site->peak_bytes);
+    }
+
+    fprintf(diagnostic_stream(), "%-28s %12s %12s %12zu\n", "peak", "", "", counting->peak_bytes);
+
+    free(sites);
+}
@@ -0,0 +1,78 @@
+#ifndef COMPILER_ALLOCATOR_H
+#define COMPILER_ALLOCATOR_H
+
+#include <stddef.h>
+
+// Where the compiler gets its memory. A compile takes what lives as long as
+// the program, like its nodes, from one allocator, and what only one phase
+// needs from another, released all at once when the phase ends.
+typedef struct CrocAllocator CrocAllocator;
+
+struct CrocAllocator {
+    // `size` zeroed bytes for the function named `site`; never NULL.
+    void* (*allocate)(CrocAllocator* allocator, size_t size, const char* site);
+    // Give back memory from `allocate`, or NULL. Arenas keep it until they
+    // are reset.
+    void (*release)(CrocAllocator* allocator, void* memory);
+};
+
+#define croc_allocate(allocator, size)      ((allocator)->allocate((allocator), (size), __func__))
+#define croc_release(allocator, memory)     ((allocator)->release((allocator), (memory)))
+
+// calloc() and free().
+extern CrocAllocator croc_heap;
+
+#define ARENA_BLOCK_SIZE    (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// Hands out memory from blocks it takes from `parent`, all of which go back
+// when the arena is reset.
+typedef struct CrocArena {
+    CrocAllocator allocator;
+    CrocAllocator* parent;
+    ArenaBlock* blocks;
+    // Bytes handed out since the arena was last reset, and the most it ever
+    // held at once.
+    size_t bytes;
+    size_t peak_bytes;
+} CrocArena;
+
+void arena_init(CrocArena* arena, CrocAllocator* parent);
+void arena_reset(CrocArena* arena);
+void arena_free(CrocArena* arena);
+
+typedef struct AllocationSite {
+    const char* name;
+    size_t allocations;
+    size_t bytes;
+    // Bytes not given back yet, and the most there ever were.
+    size_t live_bytes;
+    size_t peak_bytes;
+} AllocationSite;
+
+// Passes allocations on to `parent`, counting them by the function that
+// asked for them.
+typedef struct CountingAllocator {
+    CrocAllocator allocator;
+    CrocAllocator* parent;
+    AllocationSite* sites;
+    size_t site_count;
+    size_t site_capacity;
+    size_t live_bytes;
+    size_t peak_bytes;
+} CountingAllocator;
+
+void counting_allocator_init(CountingAllocator* counting, CrocAllocator* parent);
+// Everything counted was released at once, as by resetting an arena parent.
+void counting_allocator_reset(CountingAllocator* counting);
+void counting_allocator_free(CountingAllocator* counting);
+
+// Sites by the most bytes they held at once, under the heading `name`.
+void print_allocation_sites(CountingAllocator* counting, const char* name);
+
+#endif
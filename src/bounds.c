@@ -0,0 +1,311 @@
+#include "bounds.h"
+#include "error.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A variable a counted loop keeps in [0, bound) while its body runs.
+typedef struct BoundsRange {
+    char* name;
+    long long bound;
+} BoundsRange;
+
+// Ranges of the loops around what is being walked, innermost last. A
+// function runs when it is called, not in the loops it is defined in, so
+// its body only sees the ranges from `floor` on.
+typedef struct BoundsWalk {
+    ParsingContext* context;
+    BoundsStats* stats;
+    int in_function;
+
+    BoundsRange* ranges;
+    size_t range_count;
+    size_t range_capacity;
+    size_t floor;
+} BoundsWalk;
+
+// How many times `node` declares or reassigns `name`, leaving out the
+// functions and lambdas defined in it.
+size_t bounds_assignments(Node* node, char* name) {
+    size_t count = 0;
+
+    if (node->type == NODE_TYPE_FUNCTION || node->type == NODE_TYPE_LAMBDA) {
+        return 0;
+    }
+
+    if ((node->type == NODE_TYPE_VARIABLE_DECLARATION || node->type == NODE_TYPE_VARIABLE_REASSIGNMENT)
+        && strcmp(node->children->value.symbol, name) == 0) {
+        count++;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        count += bounds_assignments(child, name);
+    }
+
+    return count;
+}
+
+int bounds_callsp(Node* node) {
+    if (node->type == NODE_TYPE_FUNCTION || node->type == NODE_TYPE_LAMBDA) {
+        return 0;
+    }
+
+    if (node->type == NODE_TYPE_FUNCTION_CALL) {
+        return 1;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        if (bounds_callsp(child)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Whether `sum` is `name + increment` or `increment + name`, and if so
+// the constant increment.
+int bounds_incrementp(Node* sum, char* name, long long* increment) {
+    if (sum->type != NODE_TYPE_BINARY_OPERATOR || sum->value.integer != BINARY_OPERATOR_ADD) {
+        return 0;
+    }
+
+    Node* left = sum->children;
+    Node* right = left->next_child;
+
+    if (integerp(*left)) {
+        Node* swap = left;
+        left = right;
+        right = swap;
+    }
+
+    if (!symbolp(*left) || strcmp(left->value.symbol, name) || !integerp(*right)) {
+        return 0;
+    }
+
+    *increment = right->value.integer;
+
+    return 1;
+}
+
+// Whether `loop`, the statement after `previous`, counts a variable up
+// from a constant: its condition compares the variable to a constant
+// bound, its step, the loop's own or else the last statement of its body,
+// adds a positive constant the variable's type holds past the bound, and
+// `previous` sets the variable to a constant its type keeps nonnegative.
+// Nothing else in the loop may assign the variable, and unless it is a
+// local of the function, which calls cannot see, the loop may make no
+// calls. If so, `range` gets what the variable stays in during the body.
+int bounds_counted_loopp(BoundsWalk* walk, Node* loop, Node* previous, BoundsRange* range) {
+    Node* condition = loop->children;
+    Node* body = condition->next_child;
+    Node* step = body->next_child;
+    Node* variable = NULL;
+    Node* limit = NULL;
+    long long inclusive = 0;
+    long long increment = 0;
+
+    if (!step) {
+        for (step = body->children; step && step->next_child; step = step->next_child);
+    }
+
+    if (!previous || !step || condition->type != NODE_TYPE_BINARY_OPERATOR) {
+        return 0;
+    }
+
+    switch (condition->value.integer) {
+    default:
+        return 0;
+
+    case BINARY_OPERATOR_LESS:
+    case BINARY_OPERATOR_LESS_EQUAL:
+        variable = condition->children;
+        limit = variable->next_child;
+
+        break;
+
+    case BINARY_OPERATOR_GREATER:
+    case BINARY_OPERATOR_GREATER_EQUAL:
+        limit = condition->children;
+        variable = limit->next_child;
+
+        break;
+    }
+
+    inclusive = condition->value.integer == BINARY_OPERATOR_LESS_EQUAL || condition->value.integer == BINARY_OPERATOR_GREATER_EQUAL;
+
+    if (!symbolp(*variable) || !integerp(*limit) || limit->value.integer < 0 || limit->value.integer >= ARRAY_SIZE_MAX) {
+        return 0;
+    }
+
+    char* name = variable->value.symbol;
+    long long bound = limit->value.integer + inclusive;
+
+    if (step->type != NODE_TYPE_VARIABLE_REASSIGNMENT || strcmp(step->children->value.symbol, name)
+        || !bounds_incrementp(step->children->next_child, name, &increment)
+        || increment < 1 || increment > ARRAY_SIZE_MAX + 1) {
+        return 0;
+    }
+
+    if ((previous->type != NODE_TYPE_VARIABLE_DECLARATION && previous->type != NODE_TYPE_VARIABLE_REASSIGNMENT)
+        || strcmp(previous->children->value.symbol, name)
+        || !(integerp(*previous->children->next_child) || nonep(*previous->children->next_child))) {
+        return 0;
+    }
+
+    TypeLayout layout = parse_type_layout(walk->context, step->value.symbol);
+    long long start = integerp(*previous->children->next_child) ? previous->children->next_child->value.integer : 0;
+    long long past = bound - 1 + increment;
+
+    if (type_layout_narrow(layout, start) < 0 || type_layout_narrow(layout, past) != past) {
+        return 0;
+    }
+
+    size_t assignments = bounds_assignments(condition, name) + bounds_assignments(body, name);
+
+    if (loop->children->next_child->next_child) {
+        assignments += bounds_assignments(step, name);
+    }
+
+    if (assignments != 1) {
+        return 0;
+    }
+
+    int local = walk->in_function && previous->type == NODE_TYPE_VARIABLE_DECLARATION;
+
+    if (!local && bounds_callsp(loop)) {
+        return 0;
+    }
+
+    range->name = name;
+    range->bound = bound;
+
+    return 1;
+}
+
+void bounds_access(BoundsWalk* walk, Node* access) {
+    TypeLayout element;
+    long long length = parse_array_layout(walk->context, parse_variable_type(walk->context, access->children), &element);
+    Node* index = access->children->next_child;
+    int proven = 0;
+
+    if (integerp(*index)) {
+        proven = index->value.integer >= 0 && index->value.integer < length;
+    } else if (symbolp(*index)) {
+        for (size_t i = walk->range_count; i-- > walk->floor;) {
+            if (strcmp(walk->ranges[i].name, index->value.symbol) == 0) {
+                proven = walk->ranges[i].bound <= length;
+
+                break;
+            }
+        }
+    }
+
+    access->value.integer = proven;
+    walk->stats->accesses++;
+    walk->stats->checks_removed += (size_t)proven;
+}
+
+void bounds_walk(BoundsWalk* walk, Node* node);
+
+void bounds_walk_statements(BoundsWalk* walk, Node* statements);
+
+// The condition and a step of the loop's own are walked outside of the
+// range the loop keeps its variable in.
+void bounds_walk_loop(BoundsWalk* walk, Node* loop, Node* previous) {
+    BoundsRange range;
+    int counted = bounds_counted_loopp(walk, loop, previous, &range);
+
+    bounds_walk(walk, loop->children);
+
+    if (counted) {
+        if (walk->range_count == walk->range_capacity) {
+            walk->range_capacity = walk->range_capacity ? walk->range_capacity * 2 : 16;
+            walk->ranges = realloc(walk->ranges, walk->range_capacity * sizeof(BoundsRange));
+            assert(walk->ranges && "bounds_walk_loop: could not allocate memory for ranges");
+        }
+
+        walk->ranges[walk->range_count++] = range;
+    }
+
+    bounds_walk_statements(walk, loop->children->next_child->children);
+
+    if (counted) {
+        walk->range_count--;
+    }
+
+    if (loop->children->next_child->next_child) {
+        bounds_walk(walk, loop->children->next_child->next_child);
+    }
+}
+
+void bounds_walk_statements(BoundsWalk* walk, Node* statements) {
+    Node* previous = NULL;
+
+    for (Node* statement = statements; statement; statement = statement->next_child) {
+        if (statement->type == NODE_TYPE_WHILE) {
+            bounds_walk_loop(walk, statement, previous);
+        } else {
+            bounds_walk(walk, statement);
+        }
+
+        previous = statement;
+    }
+}
+
+void bounds_walk(BoundsWalk* walk, Node* node) {
+    switch (node->type) {
+    default:
+        break;
+
+    case NODE_TYPE_FUNCTION:
+    case NODE_TYPE_LAMBDA: {
+        size_t floor = walk->floor;
+        int in_function = walk->in_function;
+
+        walk->floor = walk->range_count;
+        walk->in_function = 1;
+
+        bounds_walk_statements(walk, node->children->next_child->next_child->children);
+
+        walk->floor = floor;
+        walk->in_function = in_function;
+
+        return;
+    }
+
+    case NODE_TYPE_WHILE:
+        bounds_walk_loop(walk, node, NULL);
+
+        return;
+
+    case NODE_TYPE_INDEX:
+        bounds_access(walk, node);
+
+        break;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        bounds_walk(walk, child);
+    }
+}
+
+void bounds_check_eliminate(ParsingContext* context, Node* program, BoundsStats* stats) {
+    BoundsWalk walk;
+
+    memset(&walk, 0, sizeof(BoundsWalk));
+    memset(stats, 0, sizeof(BoundsStats));
+
+    walk.context = context;
+    walk.stats = stats;
+
+    bounds_walk_statements(&walk, program->children);
+
+    free(walk.ranges);
+}
+
+void print_bounds_stats(BoundsStats stats) {
+    fprintf(diagnostic_stream(), "bounds: %zu of %zu checks removed\n", stats.checks_removed, stats.accesses);
+}
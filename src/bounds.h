@@ -0,0 +1,23 @@
+#ifndef COMPILER_BOUNDS_H
+#define COMPILER_BOUNDS_H
+
+#include <stddef.h>
+
+#include "parser.h"
+
+typedef struct BoundsStats {
+    // Array accesses walked, and those proven in range, whose native code
+    // does not check their index.
+    size_t accesses;
+    size_t checks_removed;
+} BoundsStats;
+
+// Mark the array accesses of `program` whose index is always in range:
+// constant indices below the array's length, and the variable a counted
+// loop like `for i : integer = 0, i < n, i := i + 1` steps from a constant
+// up to a constant no larger than the length, used in the body.
+void bounds_check_eliminate(ParsingContext* context, Node* program, BoundsStats* stats);
+
+void print_bounds_stats(BoundsStats stats);
+
+#endif
@@ -0,0 +1,725 @@
+#include "bytecode.h"
+#include "closure.h"
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(OP_NOT_EQUAL - OP_ADD == BINARY_OPERATOR_NOT_EQUAL, "operator opcodes must follow the order of BinaryOperator");
+
+typedef struct BytecodeCompiler {
+    BytecodeModule* module;
+    ParsingContext* context;
+
+    // Symbol to index into the module's functions, globals and arrays.
+    Environment* functions;
+    Environment* globals;
+    Environment* arrays;
+
+    // Function being compiled, its locals bound to their registers, and the
+    // first register not holding a local or a live temporary.
+    BytecodeFunction* function;
+    Environment* locals;
+    size_t next_register;
+
+    // What the function being compiled returns its result as.
+    TypeLayout result_layout;
+
+    // Lambdas whose bodies are compiled after the top level, in order.
+    Node** lambdas;
+    size_t lambda_count;
+    size_t lambda_capacity;
+} BytecodeCompiler;
+
+void bytecode_emit(BytecodeFunction* function, Opcode opcode, size_t a, size_t b, size_t c) {
+    if (function->code_length == function->code_capacity) {
+        function->code_capacity = function->code_capacity ? function->code_capacity * 2 : 64;
+        function->code = realloc(function->code, function->code_capacity * sizeof(Instruction));
+        assert(function->code && "bytecode_emit: could not allocate memory for instructions");
+    }
+
+    Instruction* instruction = function->code + function->code_length++;
+    instruction->opcode = (uint8_t)opcode;
+    instruction->a = (uint8_t)a;
+    instruction->b = (uint8_t)b;
+    instruction->c = (uint8_t)c;
+}
+
+void bytecode_emit_bx(BytecodeFunction* function, Opcode opcode, size_t a, size_t bx) {
+    bytecode_emit(function, opcode, a, bx & 0xff, (bx >> 8) & 0xff);
+}
+
+size_t bytecode_constant(BytecodeModule* module, long long value) {
+    for (size_t i = 0; i < module->constant_count; ++i) {
+        if (module->constants[i] == value) {
+            return i;
+        }
+    }
+
+    if (module->constant_count == module->constant_capacity) {
+        module->constant_capacity = module->constant_capacity ? module->constant_capacity * 2 : 16;
+        module->constants = realloc(module->constants, module->constant_capacity * sizeof(long long));
+        assert(module->constants && "bytecode_constant: could not allocate memory for constants");
+    }
+
+    module->constants[module->constant_count] = value;
+
+    return module->constant_count++;
+}
+
+Error bytecode_register_reserve(BytecodeCompiler* compiler, size_t count, size_t* first) {
+    Error err = ok;
+
+    *first = compiler->next_register;
+    compiler->next_register += count;
+
+    if (compiler->next_register > BYTECODE_REGISTER_MAX) {
+        fprintf(diagnostic_stream(), "function: \"%s\"\n", compiler->function->name);
+        ERROR_PREP(err, ERROR_GENERIC, "function needs more registers than the bytecode can address");
+
+        return err;
+    }
+
+    if (compiler->next_register > compiler->function->register_count) {
+        compiler->function->register_count = compiler->next_register;
+    }
+
+    return err;
+}
+
+int bytecode_lookup(Environment* env, Node* id, size_t* index) {
+    if (!env) {
+        return 0;
+    }
+
+    Node* value = node_allocate(env->allocator);
+    int status = environment_get(*env, id, value);
+
+    if (status) {
+        *index = (size_t)value->value.integer;
+    }
+
+    croc_release(env->allocator, value);
+
+    return status;
+}
+
+Error bytecode_expression(BytecodeCompiler* compiler, Node* expression, size_t target);
+Error bytecode_operand(BytecodeCompiler* compiler, Node* operand, size_t* target, size_t* operand_register);
+
+// Index of the function holding the body of `lambda`.
+size_t bytecode_lambda(BytecodeCompiler* compiler, Node* lambda) {
+    size_t index = 0;
+
+    while (index < compiler->lambda_count && compiler->lambdas[index] != lambda) {
+        index++;
+    }
+
+    if (index == compiler->lambda_count) {
+        if (compiler->lambda_count == compiler->lambda_capacity) {
+            compiler->lambda_capacity = compiler->lambda_capacity ? compiler->lambda_capacity * 2 : 16;
+            compiler->lambdas = realloc(compiler->lambdas, compiler->lambda_capacity * sizeof(Node*));
+            assert(compiler->lambdas && "bytecode_lambda: could not allocate memory for lambdas");
+        }
+
+        compiler->lambdas[compiler->lambda_count++] = lambda;
+    }
+
+    return compiler->module->entry + 1 + index;
+}
+
+// The closure gets the values it captures from registers in a row after
+// the one it is made in.
+Error bytecode_closure(BytecodeCompiler* compiler, Node* lambda, size_t target) {
+    Error err = ok;
+    size_t saved_next_register = compiler->next_register;
+    size_t function_index = bytecode_lambda(compiler, lambda);
+    Node* captures = closure_captures(lambda);
+    size_t first = 0;
+    size_t index = 0;
+
+    err = bytecode_register_reserve(compiler, 1 + node_count_children(captures), &first);
+    if (err.type) { return err; }
+
+    for (Node* capture = captures->children; capture; capture = capture->next_child) {
+        err = bytecode_expression(compiler, capture, first + 1 + index++);
+        if (err.type) { return err; }
+    }
+
+    bytecode_emit_bx(compiler->function, OP_CLOSURE, first, function_index);
+    bytecode_emit(compiler->function, OP_MOVE, target, first, 0);
+
+    compiler->next_register = saved_next_register;
+
+    return err;
+}
+
+// A call through a variable calls the closure it holds, unless closure
+// analysis knows it holds a lambda that captures nothing.
+Error bytecode_call(BytecodeCompiler* compiler, Node* call, size_t target, int tail) {
+    Error err = ok;
+    size_t saved_next_register = compiler->next_register;
+    size_t function_index = 0;
+    size_t closure_register = 0;
+    size_t argument_count = 0;
+    size_t base = 0;
+    size_t argument_register = 0;
+    Node* lambda = call->value.node;
+    int closure = lambda != NULL;
+
+    if (closure && lambda->type == NODE_TYPE_LAMBDA && closure_placement(lambda) == CLOSURE_STATIC) {
+        function_index = bytecode_lambda(compiler, lambda);
+        closure = 0;
+    } else if (!closure && !bytecode_lookup(compiler->functions, call->children, &function_index)) {
+        fprintf(diagnostic_stream(), "function: \"%s\"\n", call->children->value.symbol);
+        ERROR_PREP(err, ERROR_GENERIC, "call to undefined function");
+
+        return err;
+    }
+
+    err = bytecode_register_reserve(compiler, 1, &base);
+    if (err.type) { return err; }
+
+    Node* argument = call->children->next_child->children;
+
+    while (argument) {
+        err = bytecode_register_reserve(compiler, 1, &argument_register);
+        if (err.type) { return err; }
+
+        err = bytecode_expression(compiler, argument, argument_register);
+        if (err.type) { return err; }
+
+        argument = argument->next_child;
+        argument_count++;
+    }
+
+    if (closure) {
+        err = bytecode_operand(compiler, call->children, NULL, &closure_register);
+        if (err.type) { return err; }
+
+        bytecode_emit(compiler->function, OP_CALL_CLOSURE, base, closure_register, argument_count);
+    } else {
+        bytecode_emit_bx(compiler->function, tail ? OP_TAIL_CALL : OP_CALL, base, function_index);
+    }
+
+    if (!tail && base != target) {
+        bytecode_emit(compiler->function, OP_MOVE, target, base, 0);
+    }
+
+    compiler->next_register = saved_next_register;
+
+    return err;
+}
+
+// Locals are read where they live; anything else is computed into
+// `target` or, if that is NULL, a new temporary.
+Error bytecode_operand(BytecodeCompiler* compiler, Node* operand, size_t* target, size_t* operand_register) {
+    Error err = ok;
+
+    if (symbolp(*operand) && bytecode_lookup(compiler->locals, operand, operand_register)) {
+        return err;
+    }
+
+    if (target) {
+        *operand_register = *target;
+    } else {
+        err = bytecode_register_reserve(compiler, 1, operand_register);
+        if (err.type) { return err; }
+    }
+
+    return bytecode_expression(compiler, operand, *operand_register);
+}
+
+Error bytecode_binary_operator(BytecodeCompiler* compiler, Node* expression, size_t target) {
+    Error err = ok;
+    size_t saved_next_register = compiler->next_register;
+    size_t left = 0;
+    size_t right = 0;
+
+    err = bytecode_operand(compiler, expression->children, &target, &left);
+    if (err.type) { return err; }
+
+    err = bytecode_operand(compiler, expression->children->next_child, NULL, &right);
+    if (err.type) { return err; }
+
+    bytecode_emit(compiler->function, (Opcode)(OP_ADD + expression->value.integer), target, left, right);
+
+    compiler->next_register = saved_next_register;
+
+    return err;
+}
+
+// Leave what a variable of `layout` would keep of the value in `source`
+// there.
+void bytecode_narrow(BytecodeCompiler* compiler, TypeLayout layout, size_t source) {
+    if (layout.size < 8) {
+        bytecode_emit(compiler->function, OP_NARROW, source, (size_t)layout.size, (size_t)layout.is_signed);
+    }
+}
+
+// Store the value in `source` to the variable `assignment` declares or
+// reassigns, narrowing it in place to the variable's type.
+Error bytecode_store(BytecodeCompiler* compiler, Node* assignment, size_t source) {
+    Error err = ok;
+    Node* symbol = assignment->children;
+    size_t index = 0;
+
+    bytecode_narrow(compiler, parse_type_layout(compiler->context, assignment->value.symbol), source);
+
+    if (bytecode_lookup(compiler->locals, symbol, &index)) {
+        if (index != source) {
+            bytecode_emit(compiler->function, OP_MOVE, index, source, 0);
+        }
+    } else if (bytecode_lookup(compiler->globals, symbol, &index)) {
+        bytecode_emit_bx(compiler->function, OP_SET_GLOBAL, source, index);
+    } else {
+        fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+        ERROR_PREP(err, ERROR_GENERIC, "assignment to unknown variable");
+    }
+
+    return err;
+}
+
+// Elements are read into the register their index is computed in. A store
+// computes the index and then the value into two registers in a row, and
+// leaves no value.
+Error bytecode_element(BytecodeCompiler* compiler, Node* access, size_t target) {
+    Error err = ok;
+    size_t saved_next_register = compiler->next_register;
+    Node* index = access->children->next_child;
+    size_t array = 0;
+    size_t first = 0;
+
+    if (!bytecode_lookup(compiler->arrays, access->children, &array)) {
+        fprintf(diagnostic_stream(), "array: \"%s\"\n", access->children->value.symbol);
+        ERROR_PREP(err, ERROR_GENERIC, "reference to unknown array");
+
+        return err;
+    }
+
+    if (!index->next_child) {
+        err = bytecode_expression(compiler, index, target);
+        if (err.type) { return err; }
+
+        bytecode_emit_bx(compiler->function, OP_GET_ELEMENT, target, array);
+
+        return err;
+    }
+
+    err = bytecode_register_reserve(compiler, 2, &first);
+    if (err.type) { return err; }
+
+    err = bytecode_expression(compiler, index, first);
+    if (err.type) { return err; }
+
+    err = bytecode_expression(compiler, index->next_child, first + 1);
+    if (err.type) { return err; }
+
+    bytecode_emit_bx(compiler->function, OP_SET_ELEMENT, first, array);
+
+    compiler->next_register = saved_next_register;
+
+    return err;
+}
+
+// Point the jump at `jump` to the instruction at `destination`.
+Error bytecode_jump_patch(BytecodeCompiler* compiler, size_t jump, size_t destination) {
+    Error err = ok;
+    long long offset = (long long)destination - (long long)(jump + 1);
+
+    if (offset < INT16_MIN || offset > INT16_MAX) {
+        fprintf(diagnostic_stream(), "function: \"%s\"\n", compiler->function->name);
+        ERROR_PREP(err, ERROR_GENERIC, "loop is too long for the bytecode to jump across");
+
+        return err;
+    }
+
+    compiler->function->code[jump].b = (uint8_t)((uint16_t)offset & 0xff);
+    compiler->function->code[jump].c = (uint8_t)((uint16_t)offset >> 8);
+
+    return err;
+}
+
+Error bytecode_statement(BytecodeCompiler* compiler, Node* expression, size_t* target);
+
+// The condition is tested at the bottom, after a jump to it on entry, so
+// every pass through the loop takes a single branch.
+Error bytecode_while(BytecodeCompiler* compiler, Node* loop) {
+    Error err = ok;
+    BytecodeFunction* function = compiler->function;
+    size_t saved_next_register = 0;
+    size_t target = 0;
+    size_t condition = 0;
+    size_t entry = function->code_length;
+
+    bytecode_emit_bx(function, OP_JUMP, 0, 0);
+
+    size_t body = function->code_length;
+
+    for (Node* statement = loop->children->next_child->children; statement; statement = statement->next_child) {
+        err = bytecode_statement(compiler, statement, &target);
+        if (err.type) { return err; }
+    }
+
+    if (loop->children->next_child->next_child) {
+        err = bytecode_statement(compiler, loop->children->next_child->next_child, &target);
+        if (err.type) { return err; }
+    }
+
+    err = bytecode_jump_patch(compiler, entry, function->code_length);
+    if (err.type) { return err; }
+
+    saved_next_register = compiler->next_register;
+
+    err = bytecode_operand(compiler, loop->children, NULL, &condition);
+    if (err.type) { return err; }
+
+    bytecode_emit_bx(function, OP_JUMP_IF, condition, 0);
+    err = bytecode_jump_patch(compiler, function->code_length - 1, body);
+
+    compiler->next_register = saved_next_register;
+
+    return err;
+}
+
+Error bytecode_expression(BytecodeCompiler* compiler, Node* expression, size_t target) {
+    Error err = ok;
+    size_t index = 0;
+    long long value = 0;
+    TypeLayout element;
+
+    switch (expression->type) {
+    default:
+        break;
+
+    case NODE_TYPE_NONE:
+        bytecode_emit_bx(compiler->function, OP_LOAD_IMMEDIATE, target, 0);
+
+        break;
+
+    case NODE_TYPE_INTEGER:
+        value = expression->value.integer;
+
+        if (value >= INT16_MIN && value <= INT16_MAX) {
+            bytecode_emit_bx(compiler->function, OP_LOAD_IMMEDIATE, target, (uint16_t)value);
+        } else {
+            bytecode_emit_bx(compiler->function, OP_LOAD_CONSTANT, target, bytecode_constant(compiler->module, value));
+        }
+
+        break;
+
+    case NODE_TYPE_SYMBOL:
+        if (bytecode_lookup(compiler->locals, expression, &index)) {
+            if (index != target) {
+                bytecode_emit(compiler->function, OP_MOVE, target, index, 0);
+            }
+        } else if (bytecode_lookup(compiler->globals, expression, &index)) {
+            bytecode_emit_bx(compiler->function, OP_GET_GLOBAL, target, index);
+        } else {
+            fprintf(diagnostic_stream(), "variable: \"%s\"\n", expression->value.symbol);
+            ERROR_PREP(err, ERROR_GENERIC, "reference to unknown variable");
+        }
+
+        break;
+
+    case NODE_TYPE_LAMBDA:
+        err = bytecode_closure(compiler, expression, target);
+
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        err = bytecode_call(compiler, expression, target, 0);
+
+        break;
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        err = bytecode_binary_operator(compiler, expression, target);
+
+        break;
+
+    case NODE_TYPE_WHILE:
+        err = bytecode_while(compiler, expression);
+
+        break;
+
+    case NODE_TYPE_INDEX:
+        err = bytecode_element(compiler, expression, target);
+
+        break;
+
+    // Declarations of locals are compiled by bytecode_statement(); globals
+    // are stored through the temporary.
+    case NODE_TYPE_VARIABLE_DECLARATION:
+        err = bytecode_expression(compiler, expression->children->next_child, target);
+        if (err.type) { break; }
+
+        // Arrays have no initializer and their memory starts zeroed.
+        if (parse_array_layout(compiler->context, expression->value.symbol, &element)) {
+            break;
+        }
+
+        err = bytecode_store(compiler, expression, target);
+
+        break;
+
+    case NODE_TYPE_VARIABLE_REASSIGNMENT:
+        err = bytecode_expression(compiler, expression->children->next_child, target);
+        if (err.type) { break; }
+
+        err = bytecode_store(compiler, expression, target);
+
+        break;
+    }
+
+    return err;
+}
+
+int bytecode_valuep(Node* expression) {
+    return expression->type == NODE_TYPE_INTEGER
+        || expression->type == NODE_TYPE_SYMBOL
+        || expression->type == NODE_TYPE_FUNCTION_CALL
+        || expression->type == NODE_TYPE_LAMBDA
+        || expression->type == NODE_TYPE_BINARY_OPERATOR
+        || (expression->type == NODE_TYPE_INDEX && !expression->children->next_child->next_child);
+}
+
+// Compile `expression` as a statement, leaving its value, if any, in
+// `target`, which only stays reserved if it holds a new local: a local keeps
+// the register it is initialized in for the rest of the function.
+Error bytecode_statement(BytecodeCompiler* compiler, Node* expression, size_t* target) {
+    Error err = ok;
+    size_t saved_next_register = compiler->next_register;
+
+    err = bytecode_register_reserve(compiler, 1, target);
+    if (err.type) { return err; }
+
+    if (compiler->locals && expression->type == NODE_TYPE_VARIABLE_DECLARATION) {
+        err = bytecode_expression(compiler, expression->children->next_child, *target);
+        if (err.type) { return err; }
+
+        bytecode_narrow(compiler, parse_type_layout(compiler->context, expression->value.symbol), *target);
+        environment_set(compiler->locals, expression->children, node_integer(compiler->locals->allocator, (long long)*target));
+        saved_next_register = compiler->next_register;
+    } else {
+        err = bytecode_expression(compiler, expression, *target);
+        if (err.type) { return err; }
+    }
+
+    compiler->next_register = saved_next_register;
+
+    return err;
+}
+
+// Whether the call `call` ending a function body gives what the function
+// returns without narrowing it again. Calls through variables are never
+// tail calls.
+int bytecode_tail_callp(BytecodeCompiler* compiler, Node* call) {
+    Node* callee = node_allocate(compiler->context->phase_allocator);
+    int status = environment_get(*compiler->context->functions, call->children, callee)
+        && (compiler->result_layout.size >= 8
+            || type_layout_containsp(compiler->result_layout, parse_type_layout(compiler->context, callee->children->next_child->value.symbol)));
+
+    croc_release(compiler->context->phase_allocator, callee);
+
+    return status;
+}
+
+// Compile a body of statements, returning the value of the last one, or
+// zero if it has none. `locals` is NULL for the top level.
+Error bytecode_body(BytecodeCompiler* compiler, BytecodeFunction* function, Environment* locals, Node* expression) {
+    Error err = ok;
+    size_t target = 0;
+
+    compiler->function = function;
+    compiler->locals = locals;
+
+    while (expression) {
+        int last = node_last_statementp(expression);
+
+        if (last && locals && expression->type == NODE_TYPE_FUNCTION_CALL && bytecode_tail_callp(compiler, expression)) {
+            return bytecode_call(compiler, expression, 0, 1);
+        }
+
+        err = bytecode_statement(compiler, expression, &target);
+        if (err.type) { return err; }
+
+        if (last) {
+            if (!bytecode_valuep(expression)) {
+                bytecode_emit_bx(function, OP_LOAD_IMMEDIATE, target, 0);
+            } else {
+                bytecode_narrow(compiler, compiler->result_layout, target);
+            }
+
+            bytecode_emit(function, OP_RETURN, target, 0, 0);
+
+            return err;
+        }
+
+        expression = expression->next_child;
+    }
+
+    err = bytecode_register_reserve(compiler, 1, &target);
+    if (err.type) { return err; }
+
+    bytecode_emit_bx(function, OP_LOAD_IMMEDIATE, target, 0);
+    bytecode_emit(function, OP_RETURN, target, 0, 0);
+
+    return err;
+}
+
+Error bytecode_function(BytecodeCompiler* compiler, BytecodeFunction* function, Node* definition) {
+    Environment* locals = environment_create(compiler->context->phase_allocator, NULL);
+    Node* parameter = definition->children->children;
+
+    compiler->function = function;
+    compiler->next_register = 0;
+    compiler->result_layout = parse_type_layout(compiler->context, definition->children->next_child->value.symbol);
+
+    // Arguments arrive as 64 bits and are narrowed on entry, which tail
+    // calls jump back to as well.
+    while (parameter) {
+        bytecode_narrow(compiler, parse_type_layout(compiler->context, parameter->children->next_child->value.symbol), compiler->next_register);
+        environment_set(locals, parameter->children, node_integer(locals->allocator, (long long)compiler->next_register++));
+
+        parameter = parameter->next_child;
+    }
+
+    function->parameter_count = compiler->next_register;
+
+    if (definition->type == NODE_TYPE_LAMBDA) {
+        for (Node* capture = closure_captures(definition)->children; capture; capture = capture->next_child) {
+            environment_set(locals, capture, node_integer(locals->allocator, (long long)compiler->next_register++));
+        }
+
+        function->capture_count = compiler->next_register - function->parameter_count;
+    }
+
+    function->register_count = compiler->next_register;
+
+    Error err = bytecode_body(compiler, function, locals, definition->children->next_child->next_child->children);
+
+    for (Binding* binding = locals->bind; binding; binding = binding->next) {
+        croc_release(locals->allocator, binding->value);
+    }
+
+    environment_free(locals);
+
+    return err;
+}
+
+Error bytecode_compile_program(ParsingContext* context, Node* program, BytecodeModule* module) {
+    Error err = ok;
+    BytecodeCompiler compiler;
+    TypeLayout element;
+
+    memset(module, 0, sizeof(BytecodeModule));
+    memset(&compiler, 0, sizeof(BytecodeCompiler));
+
+    compiler.module = module;
+    compiler.context = context;
+    compiler.functions = environment_create(context->phase_allocator, NULL);
+    compiler.globals = environment_create(context->phase_allocator, NULL);
+    compiler.arrays = environment_create(context->phase_allocator, NULL);
+
+    for (Binding* it = context->variables->bind; it; it = it->next) {
+        if (parse_array_layout(context, it->value->value.symbol, &element)) {
+            module->array_count++;
+        } else {
+            environment_set(compiler.globals, it->id, node_integer(context->phase_allocator, (long long)module->global_count++));
+        }
+    }
+
+    module->arrays = calloc(module->array_count + 1, sizeof(BytecodeArray));
+    assert(module->arrays && "bytecode_compile_program: could not allocate memory for arrays");
+
+    size_t index = 0;
+
+    for (Binding* it = context->variables->bind; it; it = it->next) {
+        long long length = parse_array_layout(context, it->value->value.symbol, &element);
+
+        if (length) {
+            module->arrays[index].length = length;
+            module->arrays[index].element = element;
+            environment_set(compiler.arrays, it->id, node_integer(context->phase_allocator, (long long)index++));
+        }
+    }
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        environment_set(compiler.functions, it->id, node_integer(context->phase_allocator, (long long)module->function_count++));
+    }
+
+    module->entry = module->function_count;
+    module->functions = calloc(module->function_count + 1, sizeof(BytecodeFunction));
+    assert(module->functions && "bytecode_compile_program: could not allocate memory for functions");
+
+    index = 0;
+    for (Binding* it = context->functions->bind; it; it = it->next, index++) {
+        module->functions[index].name = it->id->value.symbol;
+
+        err = bytecode_function(&compiler, module->functions + index, it->value);
+        if (err.type) {
+            free(compiler.lambdas);
+
+            return err;
+        }
+    }
+
+    module->functions[module->entry].name = "main";
+    module->function_count++;
+
+    compiler.next_register = 0;
+    compiler.result_layout = parse_type_layout(context, NULL);
+    err = bytecode_body(&compiler, module->functions + module->entry, NULL, program->children);
+
+    // Lambdas found in the bodies of lambdas are added as they are compiled.
+    for (size_t i = 0; !err.type && i < compiler.lambda_count; ++i) {
+        module->functions = realloc(module->functions, (module->function_count + 1) * sizeof(BytecodeFunction));
+        assert(module->functions && "bytecode_compile_program: could not allocate memory for functions");
+
+        memset(module->functions + module->function_count, 0, sizeof(BytecodeFunction));
+        module->functions[module->function_count].name = compiler.lambdas[i]->value.symbol;
+
+        err = bytecode_function(&compiler, module->functions + module->function_count, compiler.lambdas[i]);
+        module->function_count++;
+    }
+
+    free(compiler.lambdas);
+
+    return err;
+}
+
+void bytecode_module_free(BytecodeModule* module) {
+    for (size_t i = 0; i < module->function_count; ++i) {
+        free(module->functions[i].code);
+    }
+
+    free(module->functions);
+    free(module->constants);
+    free(module->arrays);
+}
+
+void print_bytecode_module(BytecodeModule* module) {
+    const char* names[OP_COUNT] = {
+        "loadi", "loadk", "move", "getg", "setg", "call", "tailcall", "ret", "jmp", "jmpif", "narrow", "getel", "setel", "closure", "callc",
+        "add", "sub", "mul", "div", "mod", "shl", "shr", "and", "or", "xor",
+        "lt", "le", "gt", "ge", "eq", "ne",
+    };
+
+    for (size_t f = 0; f < module->function_count; ++f) {
+        BytecodeFunction* function = module->functions + f;
+
+        fprintf(diagnostic_stream(), "%s: %zu parameters, %zu registers\n", function->name, function->parameter_count, function->register_count);
+
+        for (size_t i = 0; i < function->code_length; ++i) {
+            Instruction instruction = function->code[i];
+
+            fprintf(diagnostic_stream(), "    %-8s %3u %3u %3u\n", names[instruction.opcode], instruction.a, instruction.b, instruction.c);
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef COMPILER_BYTECODE_H
+#define COMPILER_BYTECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+
+// Register-based instruction set. Every function runs in a window of the VM's
+// register stack; parameters occupy its first registers, then locals, then
+// temporaries. A call with operand A places its arguments in A+1 onwards,
+// which become the callee's first registers, and receives the result in A.
+// The bodies of lambdas are functions that take what their closure captured
+// in the registers after their parameters.
+typedef enum Opcode {
+    // R[A] = sign-extended Bx
+    OP_LOAD_IMMEDIATE = 0,
+    // R[A] = K[Bx]
+    OP_LOAD_CONSTANT,
+    // R[A] = R[B]
+    OP_MOVE,
+    // R[A] = G[Bx]
+    OP_GET_GLOBAL,
+    // G[Bx] = R[A]
+    OP_SET_GLOBAL,
+    // R[A] = F[Bx](R[A+1], ...)
+    OP_CALL,
+    // Replace the current call with F[Bx](R[A+1], ...)
+    OP_TAIL_CALL,
+    // Return R[A] to the caller
+    OP_RETURN,
+    // pc += sBx, counted from the next instruction
+    OP_JUMP,
+    // if R[A] != 0 then pc += sBx
+    OP_JUMP_IF,
+    // R[A] = R[A] truncated to B bytes and extended with its sign if C,
+    // with zeros otherwise
+    OP_NARROW,
+    // R[A] = A[Bx][R[A]], stopping with an error if R[A] is out of bounds
+    OP_GET_ELEMENT,
+    // A[Bx][R[A]] = R[A+1], keeping what fits in an element, stopping with
+    // an error if R[A] is out of bounds
+    OP_SET_ELEMENT,
+    // R[A] = closure of F[Bx] holding the values it captures, R[A+1]
+    // onwards
+    OP_CLOSURE,
+    // R[A] = call of the closure R[B] with the C arguments in R[A+1]
+    // onwards, whose function finds what the closure captured after them
+    OP_CALL_CLOSURE,
+    // R[A] = R[B] op R[C], one opcode per BinaryOperator in its order
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_MODULO,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_COUNT,
+} Opcode;
+
+typedef struct Instruction {
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+} Instruction;
+
+#define BYTECODE_REGISTER_MAX   256
+#define INSTRUCTION_BX(i)       ((uint16_t)((i).b | ((i).c << 8)))
+#define INSTRUCTION_SBX(i)      ((int16_t)INSTRUCTION_BX(i))
+
+typedef struct BytecodeFunction {
+    char* name;
+    Instruction* code;
+    size_t code_length;
+    size_t code_capacity;
+    size_t parameter_count;
+    size_t capture_count;
+    size_t register_count;
+} BytecodeFunction;
+
+// Arrays live apart from the globals, each in memory of its own with its
+// elements at their width.
+typedef struct BytecodeArray {
+    long long length;
+    TypeLayout element;
+} BytecodeArray;
+
+typedef struct BytecodeModule {
+    BytecodeFunction* functions;
+    size_t function_count;
+
+    long long* constants;
+    size_t constant_count;
+    size_t constant_capacity;
+
+    size_t global_count;
+
+    BytecodeArray* arrays;
+    size_t array_count;
+
+    // Index of the function holding the top-level statements, which the
+    // bodies of lambdas follow.
+    size_t entry;
+} BytecodeModule;
+
+Error bytecode_compile_program(ParsingContext* context, Node* program, BytecodeModule* module);
+void bytecode_module_free(BytecodeModule* module);
+
+void print_bytecode_module(BytecodeModule* module);
+
+#endif
@@ -0,0 +1,430 @@
+#include "cache.h"
+#include "codegen.h"
+#include "sha256.h"
+#include "version.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+// Changes whenever what goes into a key does.
+#define CACHE_KEY_FORMAT "croc-cache-v2"
+
+// Temporary files of one thread are told apart by its counter's address.
+static _Thread_local unsigned long cache_temporary_count = 0;
+
+typedef struct CacheEntry {
+    char* path;
+    unsigned long long size;
+    time_t used;
+} CacheEntry;
+
+void cache_default_directory(char* buffer, size_t size) {
+#ifdef _WIN32
+    char* local = getenv("LOCALAPPDATA");
+
+    snprintf(buffer, size, "%s\\croc", local ? local : ".");
+#else
+    char* cache_home = getenv("XDG_CACHE_HOME");
+    char* home = getenv("HOME");
+
+    if (cache_home && *cache_home) {
+        snprintf(buffer, size, "%s/croc", cache_home);
+    } else {
+        snprintf(buffer, size, "%s/.cache/croc", home ? home : ".");
+    }
+#endif
+}
+
+// Hash the length of a field before its bytes, so no two lists of fields
+// hash the same bytes.
+void cache_hash_field(SHA256* hash, const void* data, size_t length) {
+    unsigned char prefix[8];
+
+    for (size_t i = 0; i < 8; ++i) {
+        prefix[i] = (unsigned char)((unsigned long long)length >> (8 * i));
+    }
+
+    sha256_update(hash, prefix, sizeof(prefix));
+    sha256_update(hash, data, length);
+}
+
+void cache_hash_string(SHA256* hash, char* string) {
+    cache_hash_field(hash, string ? string : "", string ? strlen(string) : 0);
+    // Tells NULL from "".
+    sha256_update(hash, string ? "s" : "n", 1);
+}
+
+// An unreadable file hashes as empty; compiling with it fails anyway.
+void cache_hash_file(SHA256* hash, char* path) {
+    SHA256 file_hash;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    unsigned char buffer[4096];
+    size_t length = 0;
+    FILE* file = fopen(path, "rb");
+
+    sha256_init(&file_hash);
+
+    if (file) {
+        while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            sha256_update(&file_hash, buffer, length);
+        }
+
+        fclose(file);
+    }
+
+    sha256_final(&file_hash, digest);
+    sha256_update(hash, digest, sizeof(digest));
+}
+
+void cache_key(CodegenOptions* options, char* profile_path, char** interface_paths, size_t interface_count, char* source, char key[CACHE_KEY_SIZE]) {
+    static const char hex[] = "0123456789abcdef";
+    SHA256 hash;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    unsigned char format = (unsigned char)codegen_output_format(options);
+    unsigned char instrument = (unsigned char)(options->instrument != 0);
+    unsigned char debug_info = (unsigned char)(options->debug_info != 0);
+
+    sha256_init(&hash);
+    cache_hash_string(&hash, CACHE_KEY_FORMAT);
+    cache_hash_string(&hash, CROC_VERSION);
+    cache_hash_field(&hash, &format, 1);
+    cache_hash_string(&hash, options->profile_generate);
+    cache_hash_field(&hash, &instrument, 1);
+    cache_hash_string(&hash, options->instrument_output);
+    cache_hash_string(&hash, profile_path);
+    cache_hash_field(&hash, &debug_info, 1);
+
+    // The source is named in the line information.
+    if (debug_info) {
+        cache_hash_string(&hash, options->source_path);
+    }
+
+    if (profile_path) {
+        cache_hash_file(&hash, profile_path);
+    }
+
+    cache_hash_field(&hash, &interface_count, sizeof(interface_count));
+
+    for (size_t i = 0; i < interface_count; ++i) {
+        cache_hash_string(&hash, interface_paths[i]);
+        cache_hash_file(&hash, interface_paths[i]);
+    }
+
+    cache_hash_string(&hash, source);
+    sha256_final(&hash, digest);
+
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+        key[2 * i] = hex[digest[i] >> 4];
+        key[2 * i + 1] = hex[digest[i] & 0xf];
+    }
+
+    key[CACHE_KEY_SIZE - 1] = '\0';
+}
+
+char* cache_entry_path(char* directory, char* name) {
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char* path = malloc(length);
+    assert(path && "cache_entry_path: could not allocate memory for path");
+
+    snprintf(path, length, "%s/%s", directory, name);
+
+    return path;
+}
+
+// Copy `from` to `to`, returning zero on failure.
+int cache_copy(char* from, char* to) {
+    unsigned char buffer[65536];
+    size_t length = 0;
+    int status = 1;
+    FILE* source = fopen(from, "rb");
+
+    if (!source) {
+        return 0;
+    }
+
+    FILE* destination = fopen(to, "wb");
+
+    if (!destination) {
+        fclose(source);
+
+        return 0;
+    }
+
+    while ((length = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+        if (fwrite(buffer, 1, length, destination) != length) {
+            status = 0;
+            break;
+        }
+    }
+
+    if (ferror(source)) {
+        status = 0;
+    }
+
+    fclose(source);
+
+    if (fclose(destination) != 0) {
+        status = 0;
+    }
+
+    return status;
+}
+
+// Create `directory` and any missing parents; zero on failure.
+int cache_make_directory(char* directory) {
+    size_t length = strlen(directory);
+    char* path = malloc(length + 1);
+    assert(path && "cache_make_directory: could not allocate memory for path");
+
+    memcpy(path, directory, length + 1);
+
+    // Skips the root, and on Windows a drive letter's colon.
+    for (size_t i = 1; i <= length; ++i) {
+        if (path[i] != '/' && path[i] != '\\' && path[i] != '\0') {
+            continue;
+        }
+
+        char separator = path[i];
+        path[i] = '\0';
+
+#ifdef _WIN32
+        if (path[i - 1] != ':') {
+            _mkdir(path);
+        }
+#else
+        mkdir(path, 0755);
+#endif
+
+        path[i] = separator;
+    }
+
+    free(path);
+
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(directory);
+
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat status;
+
+    return stat(directory, &status) == 0 && S_ISDIR(status.st_mode);
+#endif
+}
+
+int cache_lookup(char* directory, char* key, char* output_path) {
+    char name[CACHE_KEY_SIZE + 2];
+    snprintf(name, sizeof(name), "%s.S", key);
+
+    char* path = cache_entry_path(directory, name);
+    int hit = cache_copy(path, output_path);
+
+    // The modification time doubles as the time of last use.
+    if (hit) {
+        utime(path, NULL);
+    }
+
+    free(path);
+
+    return hit;
+}
+
+// An entry is a file named after a key with a ".S" extension; anything else
+// in the directory is left alone.
+int cache_entry_name(char* name) {
+    size_t length = strlen(name);
+
+    if (length != CACHE_KEY_SIZE - 1 + 2 || strcmp(name + CACHE_KEY_SIZE - 1, ".S") != 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < CACHE_KEY_SIZE - 1; ++i) {
+        if (!strchr("0123456789abcdef", name[i])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void cache_entry_add(CacheEntry** entries, size_t* count, size_t* capacity, char* path, unsigned long long size, time_t used) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *entries = realloc(*entries, *capacity * sizeof(CacheEntry));
+        assert(*entries && "cache_entry_add: could not allocate memory for entries");
+    }
+
+    (*entries)[*count].path = path;
+    (*entries)[*count].size = size;
+    (*entries)[*count].used = used;
+    (*count)++;
+}
+
+int cache_entry_compare(const void* a, const void* b) {
+    time_t used_a = ((const CacheEntry*)a)->used;
+    time_t used_b = ((const CacheEntry*)b)->used;
+
+    return (used_a > used_b) - (used_a < used_b);
+}
+
+// Delete the least recently used entries until the rest fit in `max_size`.
+size_t cache_evict(char* directory, unsigned long long max_size) {
+    CacheEntry* entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t evicted = 0;
+    unsigned long long total = 0;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    char* pattern = cache_entry_path(directory, "*.S");
+    HANDLE search = FindFirstFileA(pattern, &found);
+
+    free(pattern);
+
+    if (search == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    do {
+        if (!cache_entry_name(found.cFileName)) {
+            continue;
+        }
+
+        unsigned long long size = ((unsigned long long)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+        unsigned long long written = ((unsigned long long)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+
+        cache_entry_add(&entries, &count, &capacity, cache_entry_path(directory, found.cFileName), size, (time_t)(written / 10000000ull));
+        total += size;
+    } while (FindNextFileA(search, &found));
+
+    FindClose(search);
+#else
+    DIR* listing = opendir(directory);
+
+    if (!listing) {
+        return 0;
+    }
+
+    struct dirent* found = NULL;
+
+    while ((found = readdir(listing))) {
+        struct stat status;
+
+        if (!cache_entry_name(found->d_name)) {
+            continue;
+        }
+
+        char* path = cache_entry_path(directory, found->d_name);
+
+        if (stat(path, &status) != 0) {
+            free(path);
+            continue;
+        }
+
+        cache_entry_add(&entries, &count, &capacity, path, (unsigned long long)status.st_size, status.st_mtime);
+        total += (unsigned long long)status.st_size;
+    }
+
+    closedir(listing);
+#endif
+
+    if (total > max_size) {
+        qsort(entries, count, sizeof(CacheEntry), cache_entry_compare);
+
+        for (size_t i = 0; i < count && total > max_size; ++i) {
+            // Another compiler may have evicted it first.
+            if (remove(entries[i].path) == 0) {
+                evicted++;
+            }
+
+            total -= entries[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(entries[i].path);
+    }
+
+    free(entries);
+
+    return evicted;
+}
+
+// Whether `path` is a regular file with something in it. Output sent to a
+// device or a pipe, such as /dev/null, cannot be read back.
+int cache_regular_filep(char* path) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    return GetFileAttributesExA(path, GetFileExInfoStandard, &data)
+        && !(data.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE))
+        && (data.nFileSizeHigh || data.nFileSizeLow);
+#else
+    struct stat status;
+
+    return stat(path, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0;
+#endif
+}
+
+int cache_store(char* directory, char* key, char* output_path, unsigned long long max_size, size_t* evicted) {
+    char name[CACHE_KEY_SIZE + 64];
+    int stored = 0;
+
+    *evicted = 0;
+
+    if (!cache_regular_filep(output_path) || !cache_make_directory(directory)) {
+        return 0;
+    }
+
+#ifdef _WIN32
+    unsigned long process = (unsigned long)_getpid();
+#else
+    unsigned long process = (unsigned long)getpid();
+#endif
+
+    // Unique per process and thread, so concurrent compilers of the same
+    // input never write the same file.
+    snprintf(name, sizeof(name), "%s.%lu.%zx.%lu.tmp", key, process, (size_t)&cache_temporary_count, cache_temporary_count++);
+
+    char* temporary = cache_entry_path(directory, name);
+
+    snprintf(name, sizeof(name), "%s.S", key);
+
+    char* path = cache_entry_path(directory, name);
+
+    if (cache_copy(output_path, temporary)) {
+#ifdef _WIN32
+        stored = MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        stored = rename(temporary, path) == 0;
+#endif
+    }
+
+    if (!stored) {
+        remove(temporary);
+    }
+
+    free(temporary);
+    free(path);
+
+    if (stored) {
+        *evicted = cache_evict(directory, max_size);
+    }
+
+    return stored;
+}
@@ -0,0 +1,36 @@
+#ifndef COMPILER_CACHE_H
+#define COMPILER_CACHE_H
+
+#include <stddef.h>
+
+#include "codegen.h"
+#include "sha256.h"
+
+// The cache is a directory of assembly files named after the hex SHA-256 of
+// everything that went into them: the compiler version, the output format,
+// the options that change the output, the profile used, the interfaces of
+// imported modules and the source.
+// Entries are written to a temporary file and renamed into place, so readers
+// never see a partial one, and the least recently used are deleted once the
+// directory outgrows its limit.
+#define CACHE_KEY_SIZE          (SHA256_DIGEST_SIZE * 2 + 1)
+#define CACHE_DEFAULT_MAX_SIZE  (256ull << 20)
+
+// $XDG_CACHE_HOME/croc, ~/.cache/croc or %LOCALAPPDATA%\croc.
+void cache_default_directory(char* buffer, size_t size);
+
+// `profile_path` is NULL when no profile is used; `interface_paths` are the
+// interfaces of the modules the source imports.
+void cache_key(CodegenOptions* options, char* profile_path, char** interface_paths, size_t interface_count, char* source, char key[CACHE_KEY_SIZE]);
+
+// Copy the entry for `key` to `output_path` and mark it used. Returns zero
+// if there is no such entry.
+int cache_lookup(char* directory, char* key, char* output_path);
+
+// Store `output_path` as the entry for `key`, then evict until the cache
+// holds at most `max_size` bytes. Output that is not a regular, non-empty
+// file is never stored. Returns zero if it was not stored; `evicted`
+// receives the number of entries deleted.
+int cache_store(char* directory, char* key, char* output_path, unsigned long long max_size, size_t* evicted);
+
+#endif
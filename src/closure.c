@@ -0,0 +1,1056 @@
+#include "closure.h"
+#include "environment.h"
+#include "error.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLOSURE_NONE SIZE_MAX
+
+// What holds a function value: a variable, parameters included, or the
+// closure of a lambda, which holds the values it captures. A value that
+// escapes may outlive the call of the function it belongs to.
+typedef struct ClosureValue {
+    // Name of the variable; NULL for a closure.
+    char* name;
+    // Lambda of the closure, or the one the variable is initialized with.
+    Node* lambda;
+    // Functions and lambdas around the variable or where the closure is
+    // made; zero for globals.
+    size_t depth;
+    int function;
+    // Parameter list of the function or lambda the parameter belongs to,
+    // and its position in it; NULL for the other variables.
+    Node* owner;
+    size_t position;
+    size_t assignments;
+    // Where a local is in the scope, and the local of the same name it
+    // hides, or CLOSURE_NONE.
+    size_t scope_index;
+    size_t shadowed;
+    // Whether the initializer of the variable is being walked, and whether
+    // the closure is made in a loop of its function, so that each pass
+    // makes it anew.
+    int initializing;
+    int in_loop;
+    int escapes;
+    // Whether the value is stored on to a variable or closure, not only
+    // passed to parameters, and whether the closure is stored to a variable
+    // whose value is.
+    int stored_on;
+    int copied;
+} ClosureValue;
+
+// The value `source` is stored to `destination` or, if that is
+// CLOSURE_NONE, passed as argument `position` of `call` to the parameter
+// of `owner`, or of the lambda the call turns out to reach if `owner` is
+// NULL.
+typedef struct ClosureFlow {
+    size_t source;
+    size_t destination;
+    Node* owner;
+    Node* call;
+    size_t position;
+} ClosureFlow;
+
+// Open addressing table from a name, or from a parameter list and a
+// position, to the index of a value. Entries are never removed: a local
+// going out of scope leaves the one it hid, or CLOSURE_NONE.
+typedef struct ClosureEntry {
+    char* name;
+    Node* owner;
+    size_t position;
+    size_t value;
+} ClosureEntry;
+
+typedef struct ClosureTable {
+    ClosureEntry* entries;
+    size_t count;
+    size_t capacity;
+} ClosureTable;
+
+// A call through `variable`.
+typedef struct ClosureCall {
+    Node* call;
+    size_t variable;
+} ClosureCall;
+
+typedef struct ClosureWalk {
+    ParsingContext* context;
+    ClosureStats* stats;
+
+    ClosureValue* values;
+    size_t value_count;
+    size_t value_capacity;
+
+    // Locals in scope, innermost last, of which the function being walked
+    // sees those from `visible` on, the innermost local and the global of
+    // each name, and the parameters by their list and position.
+    size_t* scope;
+    size_t scope_count;
+    size_t scope_capacity;
+    size_t visible;
+    ClosureTable locals;
+    ClosureTable globals;
+    ClosureTable parameters;
+
+    // The functions of the context and those around it, by name.
+    ClosureTable functions;
+    Node** definitions;
+    size_t definition_count;
+    size_t definition_capacity;
+
+    // Closures of the functions and lambdas being walked, innermost last,
+    // CLOSURE_NONE for functions, and the loops of the innermost around
+    // what is being walked.
+    size_t* frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    size_t loop_depth;
+
+    ClosureFlow* flows;
+    size_t flow_count;
+    size_t flow_capacity;
+    ClosureCall* calls;
+    size_t call_count;
+    size_t call_capacity;
+} ClosureWalk;
+
+// `items`, with room for at least one more than `count` of `size` bytes.
+void* closure_reserve(void* items, size_t count, size_t* capacity, size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+
+    *capacity = *capacity ? *capacity * 2 : 16;
+    items = realloc(items, *capacity * size);
+    assert(items && "closure_reserve: could not allocate memory for the analysis");
+
+    return items;
+}
+
+Node* closure_captures(Node* lambda) {
+    return lambda->children->next_child->next_child->next_child;
+}
+
+ClosurePlacement closure_placement(Node* lambda) {
+    return (ClosurePlacement)closure_captures(lambda)->value.integer;
+}
+
+size_t closure_hash(char* name, Node* owner, size_t position) {
+    uint64_t hash = 14695981039346656037ull;
+
+    if (!name) {
+        hash = ((uint64_t)(uintptr_t)owner * 31 + position) * 11400714819323198485ull;
+
+        return (size_t)(hash ^ (hash >> 32));
+    }
+
+    for (; *name; ++name) {
+        hash = (hash ^ (unsigned char)*name) * 1099511628211ull;
+    }
+
+    return (size_t)hash;
+}
+
+// The entry of a name, or of a parameter list and a position if `name` is
+// NULL. A missing one is added with CLOSURE_NONE if `add` is set, and
+// otherwise gives NULL.
+ClosureEntry* closure_table_find(ClosureTable* table, char* name, Node* owner, size_t position, int add) {
+    if (!add && !table->count) {
+        return NULL;
+    }
+
+    if (add && (table->count + 1) * 2 > table->capacity) {
+        ClosureTable grown = { NULL, 0, table->capacity ? table->capacity * 2 : 64 };
+
+        grown.entries = calloc(grown.capacity, sizeof(ClosureEntry));
+        assert(grown.entries && "closure_table_find: could not allocate memory for the analysis");
+
+        for (size_t i = 0; i < table->capacity; ++i) {
+            ClosureEntry* entry = table->entries + i;
+
+            if (entry->name || entry->owner) {
+                closure_table_find(&grown, entry->name, entry->owner, entry->position, 1)->value = entry->value;
+            }
+        }
+
+        free(table->entries);
+        *table = grown;
+    }
+
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = closure_hash(name, owner, position) & mask;; i = (i + 1) & mask) {
+        ClosureEntry* entry = table->entries + i;
+
+        if (!entry->name && !entry->owner) {
+            if (!add) {
+                return NULL;
+            }
+
+            entry->name = name;
+            entry->owner = owner;
+            entry->position = position;
+            entry->value = CLOSURE_NONE;
+            table->count++;
+
+            return entry;
+        }
+
+        if (name ? entry->name && strcmp(entry->name, name) == 0 : entry->owner == owner && entry->position == position) {
+            return entry;
+        }
+    }
+}
+
+// Bind every function a call can reach by name, the innermost context's
+// first.
+void closure_functions_add(ClosureWalk* walk) {
+    for (ParsingContext* context = walk->context; context; context = context->parent) {
+        for (Binding* it = context->functions->bind; it; it = it->next) {
+            ClosureEntry* entry = closure_table_find(&walk->functions, it->id->value.symbol, NULL, 0, 1);
+
+            if (entry->value != CLOSURE_NONE) {
+                continue;
+            }
+
+            walk->definitions = closure_reserve(walk->definitions, walk->definition_count, &walk->definition_capacity, sizeof(Node*));
+            walk->definitions[walk->definition_count] = it->value;
+            entry->value = walk->definition_count++;
+        }
+    }
+}
+
+// The definition of the function `symbol` names, or NULL.
+Node* closure_function_find(ClosureWalk* walk, Node* symbol) {
+    ClosureEntry* entry = closure_table_find(&walk->functions, symbol->value.symbol, NULL, 0, 0);
+
+    return entry ? walk->definitions[entry->value] : NULL;
+}
+
+// Whether the type named `type_name` is `function`, or one like it.
+int closure_function_typep(ParsingContext* context, char* type_name) {
+    for (; context && type_name; context = context->parent) {
+        for (Binding* it = context->types->bind; it; it = it->next) {
+            if (strcmp(it->id->value.symbol, type_name) == 0) {
+                return it->value->type == NODE_TYPE_FUNCTION;
+            }
+        }
+    }
+
+    return 0;
+}
+
+size_t closure_value_add(ClosureWalk* walk, char* name, Node* lambda, int function) {
+    walk->values = closure_reserve(walk->values, walk->value_count, &walk->value_capacity, sizeof(ClosureValue));
+
+    ClosureValue* value = walk->values + walk->value_count;
+
+    memset(value, 0, sizeof(ClosureValue));
+
+    value->name = name;
+    value->lambda = lambda;
+    value->depth = walk->frame_count;
+    value->function = function;
+    value->in_loop = walk->loop_depth > 0;
+    value->shadowed = CLOSURE_NONE;
+
+    return walk->value_count++;
+}
+
+// Globals outlive every call, so what is stored to them escapes.
+size_t closure_global_add(ClosureWalk* walk, char* name, int function) {
+    size_t variable = closure_value_add(walk, name, NULL, function);
+
+    walk->values[variable].depth = 0;
+    walk->values[variable].escapes = 1;
+
+    closure_table_find(&walk->globals, name, NULL, 0, 1)->value = variable;
+
+    return variable;
+}
+
+// Bind a variable declared in what is being walked, or a parameter of
+// `owner`.
+Error closure_declare(ClosureWalk* walk, Node* symbol, char* type_name, Node* owner, size_t position, size_t* variable) {
+    Error err = ok;
+    int function = closure_function_typep(walk->context, type_name);
+
+    // Calls by the name would reach the function, not the variable.
+    if (function) {
+        Node* callee = node_allocate(walk->context->phase_allocator);
+
+        if (environment_get_function(walk->context, symbol, callee)) {
+            fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+            ERROR_PREP(err, ERROR_TYPE, "a variable of type function cannot have the name of a function");
+        }
+
+        croc_release(walk->context->phase_allocator, callee);
+
+        if (err.type) {
+            return err;
+        }
+    }
+
+    if (!walk->frame_count) {
+        *variable = closure_global_add(walk, symbol->value.symbol, function);
+
+        return err;
+    }
+
+    *variable = closure_value_add(walk, symbol->value.symbol, NULL, function);
+    walk->values[*variable].owner = owner;
+    walk->values[*variable].position = position;
+    walk->values[*variable].scope_index = walk->scope_count;
+
+    ClosureEntry* local = closure_table_find(&walk->locals, symbol->value.symbol, NULL, 0, 1);
+
+    walk->values[*variable].shadowed = local->value;
+    local->value = *variable;
+
+    if (owner) {
+        closure_table_find(&walk->parameters, NULL, owner, position, 1)->value = *variable;
+    }
+
+    walk->scope = closure_reserve(walk->scope, walk->scope_count, &walk->scope_capacity, sizeof(size_t));
+    walk->scope[walk->scope_count++] = *variable;
+
+    return err;
+}
+
+// Unbind the locals declared since the scope held `scope_count`.
+void closure_scope_pop(ClosureWalk* walk, size_t scope_count) {
+    while (walk->scope_count > scope_count) {
+        ClosureValue* local = walk->values + walk->scope[--walk->scope_count];
+
+        closure_table_find(&walk->locals, local->name, NULL, 0, 0)->value = local->shadowed;
+    }
+}
+
+// The variable `symbol` names where it is, or CLOSURE_NONE. Globals of
+// imported modules are bound the first time they are named.
+size_t closure_lookup(ClosureWalk* walk, Node* symbol) {
+    // The locals a local hides come before it in the scope, so if the
+    // function being walked does not see it, it sees none of them either.
+    ClosureEntry* entry = closure_table_find(&walk->locals, symbol->value.symbol, NULL, 0, 0);
+
+    if (entry && entry->value != CLOSURE_NONE && walk->values[entry->value].scope_index >= walk->visible) {
+        return entry->value;
+    }
+
+    entry = closure_table_find(&walk->globals, symbol->value.symbol, NULL, 0, 0);
+
+    if (entry) {
+        return entry->value;
+    }
+
+    char* type_name = parse_variable_type(walk->context, symbol);
+
+    if (!type_name) {
+        return CLOSURE_NONE;
+    }
+
+    return closure_global_add(walk, symbol->value.symbol, closure_function_typep(walk->context, type_name));
+}
+
+void closure_flow(ClosureWalk* walk, size_t source, size_t destination, Node* owner, Node* call, size_t position) {
+    if (source == CLOSURE_NONE) {
+        return;
+    }
+
+    walk->flows = closure_reserve(walk->flows, walk->flow_count, &walk->flow_capacity, sizeof(ClosureFlow));
+
+    ClosureFlow* flow = walk->flows + walk->flow_count++;
+
+    flow->source = source;
+    flow->destination = destination;
+    flow->owner = owner;
+    flow->call = call;
+    flow->position = position;
+}
+
+// Look up the variable `symbol` reads. A local of a function or lambda
+// around the lambdas being walked is captured by each of them, the
+// outermost copying it from where it lives and the others from the
+// closure around them.
+Error closure_reference(ClosureWalk* walk, Node* symbol, size_t* variable) {
+    Error err = ok;
+
+    *variable = closure_lookup(walk, symbol);
+
+    if (*variable == CLOSURE_NONE || !walk->values[*variable].depth || walk->values[*variable].depth == walk->frame_count) {
+        return err;
+    }
+
+    // The lambda would copy the variable before it has a value.
+    if (walk->values[*variable].initializing) {
+        fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+        ERROR_PREP(err, ERROR_GENERIC, "a lambda cannot capture the variable it initializes");
+
+        return err;
+    }
+
+    for (size_t depth = walk->values[*variable].depth; depth < walk->frame_count; ++depth) {
+        size_t closure = walk->frames[depth];
+
+        assert(closure != CLOSURE_NONE && "closure_reference: a function sees no locals of the functions around it");
+
+        Node* captures = closure_captures(walk->values[closure].lambda);
+        Node* capture = captures->children;
+
+        while (capture && strcmp(capture->value.symbol, symbol->value.symbol)) {
+            capture = capture->next_child;
+        }
+
+        if (!capture) {
+            node_add_child(captures, node_symbol(walk->context->allocator, symbol->value.symbol));
+        }
+
+        if (walk->values[*variable].function) {
+            closure_flow(walk, *variable, closure, NULL, NULL, 0);
+        }
+    }
+
+    return err;
+}
+
+Error closure_expression(ClosureWalk* walk, Node* expression, int* function, size_t* source);
+
+// Walk `first` and the statements after it, giving what the last one
+// leaves.
+Error closure_statements(ClosureWalk* walk, Node* first, int* function, size_t* source) {
+    Error err = ok;
+
+    *function = 0;
+    *source = CLOSURE_NONE;
+
+    for (Node* statement = first; statement; statement = statement->next_child) {
+        err = closure_expression(walk, statement, function, source);
+        if (err.type) { return err; }
+    }
+
+    return err;
+}
+
+Error closure_assignment_check(Node* symbol, int variable_function, int value_function) {
+    Error err = ok;
+
+    if (variable_function != value_function) {
+        fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+        ERROR_PREP(err, ERROR_TYPE, "a variable of type function only holds functions, and one of an integer type only integers");
+    }
+
+    return err;
+}
+
+Error closure_declaration(ClosureWalk* walk, Node* declaration) {
+    Error err = ok;
+    Node* symbol = declaration->children;
+    Node* initializer = symbol->next_child;
+    size_t variable = 0;
+    size_t source = CLOSURE_NONE;
+    int function = 0;
+
+    err = closure_declare(walk, symbol, declaration->value.symbol, NULL, 0, &variable);
+    if (err.type) { return err; }
+
+    if (nonep(*initializer)) {
+        if (walk->values[variable].function) {
+            fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+            ERROR_PREP(err, ERROR_TYPE, "a variable of type function must be initialized");
+        }
+
+        return err;
+    }
+
+    walk->values[variable].initializing = 1;
+    err = closure_expression(walk, initializer, &function, &source);
+    walk->values[variable].initializing = 0;
+
+    if (err.type) { return err; }
+
+    err = closure_assignment_check(symbol, walk->values[variable].function, function);
+    if (err.type) { return err; }
+
+    walk->values[variable].assignments++;
+
+    if (initializer->type == NODE_TYPE_LAMBDA) {
+        walk->values[variable].lambda = initializer;
+    }
+
+    closure_flow(walk, source, variable, NULL, NULL, 0);
+
+    return err;
+}
+
+// Captured variables are copied into the closure when it is made, so the
+// lambda cannot assign the variable itself.
+Error closure_reassignment(ClosureWalk* walk, Node* reassignment) {
+    Error err = ok;
+    Node* symbol = reassignment->children;
+    size_t variable = closure_lookup(walk, symbol);
+    size_t source = CLOSURE_NONE;
+    int function = 0;
+
+    if (variable == CLOSURE_NONE) {
+        return err;
+    }
+
+    if (walk->values[variable].depth && walk->values[variable].depth < walk->frame_count) {
+        fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+        ERROR_PREP(err, ERROR_GENERIC, "a lambda cannot assign the variables it captures");
+
+        return err;
+    }
+
+    err = closure_expression(walk, symbol->next_child, &function, &source);
+    if (err.type) { return err; }
+
+    err = closure_assignment_check(symbol, walk->values[variable].function, function);
+    if (err.type) { return err; }
+
+    walk->values[variable].assignments++;
+    closure_flow(walk, source, variable, NULL, NULL, 0);
+
+    return err;
+}
+
+Error closure_loop(ClosureWalk* walk, Node* loop) {
+    Error err = ok;
+    size_t source = CLOSURE_NONE;
+    int function = 0;
+
+    walk->loop_depth++;
+
+    err = closure_expression(walk, loop->children, &function, &source);
+    if (err.type) { return err; }
+
+    if (function) {
+        ERROR_PREP(err, ERROR_TYPE, "loop condition must be an integer, not a function");
+
+        return err;
+    }
+
+    err = closure_statements(walk, loop->children->next_child->children, &function, &source);
+    if (err.type) { return err; }
+
+    if (loop->children->next_child->next_child) {
+        err = closure_expression(walk, loop->children->next_child->next_child, &function, &source);
+        if (err.type) { return err; }
+    }
+
+    walk->loop_depth--;
+
+    return err;
+}
+
+// Walk the body of a function, or of a lambda if `closure` is not
+// CLOSURE_NONE, in a frame of its own with its parameters bound. A function
+// sees no locals of the functions around it, and a lambda sees them all.
+Error closure_frame(ClosureWalk* walk, Node* definition, size_t closure, int* function, size_t* source) {
+    Error err = ok;
+    size_t scope_count = walk->scope_count;
+    size_t visible = walk->visible;
+    size_t loop_depth = walk->loop_depth;
+    size_t position = 0;
+
+    walk->frames = closure_reserve(walk->frames, walk->frame_count, &walk->frame_capacity, sizeof(size_t));
+    walk->frames[walk->frame_count++] = closure;
+    walk->loop_depth = 0;
+
+    if (closure == CLOSURE_NONE) {
+        walk->visible = walk->scope_count;
+    }
+
+    for (Node* parameter = definition->children->children; parameter; parameter = parameter->next_child, position++) {
+        size_t variable = 0;
+
+        err = closure_declare(walk, parameter->children, parameter->children->next_child->value.symbol, definition->children, position, &variable);
+        if (err.type) { return err; }
+    }
+
+    err = closure_statements(walk, definition->children->next_child->next_child->children, function, source);
+    if (err.type) { return err; }
+
+    walk->frame_count--;
+    closure_scope_pop(walk, scope_count);
+    walk->visible = visible;
+    walk->loop_depth = loop_depth;
+
+    return err;
+}
+
+// What a function returns escapes, and has to be of the type it returns.
+Error closure_function(ClosureWalk* walk, Node* definition) {
+    Error err = ok;
+    size_t source = CLOSURE_NONE;
+    int function = 0;
+
+    err = closure_frame(walk, definition, CLOSURE_NONE, &function, &source);
+    if (err.type) { return err; }
+
+    // Bodies a lazy parse skipped, which nothing calls, are empty.
+    Node* body = definition->children->next_child->next_child;
+
+    if (body->children && function != closure_function_typep(walk->context, definition->children->next_child->value.symbol)) {
+        char* name = parse_function_name(walk->context, definition);
+
+        fprintf(diagnostic_stream(), "function: \"%s\"\n", name ? name : "<nested>");
+        ERROR_PREP(err, ERROR_TYPE, "a function of return type function must end with a function, and any other function with an integer");
+
+        return err;
+    }
+
+    if (function && source != CLOSURE_NONE) {
+        walk->values[source].escapes = 1;
+    }
+
+    return err;
+}
+
+// Lambdas return integers, so calls through variables always give one.
+Error closure_lambda(ClosureWalk* walk, Node* lambda, size_t* closure) {
+    Error err = ok;
+    Node* return_type = lambda->children->next_child;
+    Node type;
+    size_t source = CLOSURE_NONE;
+    int function = 0;
+
+    if (!return_type->next_child->next_child) {
+        node_add_child(lambda, node_none(walk->context->allocator));
+    }
+
+    if (parse_get_type(walk->context, return_type, &type).type || type.type != NODE_TYPE_INTEGER) {
+        fprintf(diagnostic_stream(), "return type: \"%s\"\n", return_type->value.symbol);
+        ERROR_PREP(err, ERROR_TYPE, "a lambda must return an integer type");
+
+        return err;
+    }
+
+    *closure = closure_value_add(walk, NULL, lambda, 1);
+
+    err = closure_frame(walk, lambda, *closure, &function, &source);
+    if (err.type) { return err; }
+
+    if (function) {
+        ERROR_PREP(err, ERROR_TYPE, "a lambda must end with an integer, which it returns, not a function");
+    }
+
+    return err;
+}
+
+// Calls by name reach the function of the name if there is one, and
+// otherwise go through the variable of the name, or to a function croc
+// did not compile if there is neither.
+Error closure_call(ClosureWalk* walk, Node* call, int* function) {
+    Error err = ok;
+    Node* callee = closure_function_find(walk, call->children);
+    Node* parameter = NULL;
+    size_t variable = CLOSURE_NONE;
+    size_t position = 0;
+
+    *function = 0;
+
+    if (callee) {
+        parameter = callee->children->children;
+        *function = closure_function_typep(walk->context, callee->children->next_child->value.symbol);
+    } else {
+        err = closure_reference(walk, call->children, &variable);
+
+        if (!err.type && variable != CLOSURE_NONE && !walk->values[variable].function) {
+            fprintf(diagnostic_stream(), "variable: \"%s\"\n", call->children->value.symbol);
+            ERROR_PREP(err, ERROR_TYPE, "called variable is not a function");
+        }
+
+        if (!err.type && variable != CLOSURE_NONE) {
+            walk->calls = closure_reserve(walk->calls, walk->call_count, &walk->call_capacity, sizeof(ClosureCall));
+            walk->calls[walk->call_count].call = call;
+            walk->calls[walk->call_count].variable = variable;
+            walk->call_count++;
+        }
+    }
+
+    for (Node* argument = call->children->next_child->children; argument && !err.type; argument = argument->next_child, position++) {
+        size_t source = CLOSURE_NONE;
+        int argument_function = 0;
+
+        err = closure_expression(walk, argument, &argument_function, &source);
+        if (err.type) { break; }
+
+        if (parameter) {
+            if (argument_function != closure_function_typep(walk->context, parameter->children->next_child->value.symbol)) {
+                fprintf(diagnostic_stream(), "function: \"%s\"\n", call->children->value.symbol);
+                ERROR_PREP(err, ERROR_TYPE, "argument type does not match declared type");
+
+                break;
+            }
+
+            closure_flow(walk, source, CLOSURE_NONE, callee->children, call, position);
+            parameter = parameter->next_child;
+        } else if (variable != CLOSURE_NONE) {
+            closure_flow(walk, source, CLOSURE_NONE, NULL, call, position);
+        } else if (source != CLOSURE_NONE) {
+            walk->values[source].escapes = 1;
+        }
+    }
+
+    return err;
+}
+
+// Walk `expression`, giving whether its value is a function and, if it is
+// read from a variable or made by a lambda, what holds it.
+Error closure_expression(ClosureWalk* walk, Node* expression, int* function, size_t* source) {
+    Error err = ok;
+    size_t operand_source = CLOSURE_NONE;
+    int operand_function = 0;
+
+    *function = 0;
+    *source = CLOSURE_NONE;
+
+    switch (expression->type) {
+    default:
+        break;
+
+    case NODE_TYPE_SYMBOL:
+        err = closure_reference(walk, expression, source);
+
+        if (!err.type && *source != CLOSURE_NONE) {
+            *function = walk->values[*source].function;
+        }
+
+        break;
+
+    case NODE_TYPE_LAMBDA:
+        err = closure_lambda(walk, expression, source);
+        *function = 1;
+
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        err = closure_function(walk, expression);
+
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        err = closure_call(walk, expression, function);
+
+        break;
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        for (Node* operand = expression->children; operand; operand = operand->next_child) {
+            err = closure_expression(walk, operand, &operand_function, &operand_source);
+            if (err.type) { break; }
+
+            if (operand_function) {
+                fprintf(diagnostic_stream(), "operator: \"%s\"\n", binary_operator_name((int)expression->value.integer));
+                ERROR_PREP(err, ERROR_TYPE, "operands of arithmetic, bitwise and comparison operators must be integers, not functions");
+
+                break;
+            }
+        }
+
+        break;
+
+    case NODE_TYPE_INDEX:
+        for (Node* operand = expression->children->next_child; operand; operand = operand->next_child) {
+            err = closure_expression(walk, operand, &operand_function, &operand_source);
+            if (err.type) { break; }
+
+            if (operand_function) {
+                fprintf(diagnostic_stream(), "array: \"%s\"\n", expression->children->value.symbol);
+                ERROR_PREP(err, ERROR_TYPE, "the index of an array and the values stored in it must be integers, not functions");
+
+                break;
+            }
+        }
+
+        break;
+
+    case NODE_TYPE_WHILE:
+        err = closure_loop(walk, expression);
+
+        break;
+
+    case NODE_TYPE_VARIABLE_DECLARATION:
+        err = closure_declaration(walk, expression);
+
+        break;
+
+    case NODE_TYPE_VARIABLE_REASSIGNMENT:
+        err = closure_reassignment(walk, expression);
+
+        break;
+    }
+
+    return err;
+}
+
+// A call through a variable only ever assigned the lambda it is declared
+// with reaches that lambda; the others are marked with the variable's
+// symbol.
+Error closure_resolve_calls(ClosureWalk* walk) {
+    Error err = ok;
+
+    for (size_t i = 0; i < walk->call_count; ++i) {
+        ClosureCall* call = walk->calls + i;
+        ClosureValue* variable = walk->values + call->variable;
+
+        if (variable->owner || variable->assignments != 1 || !variable->lambda) {
+            call->call->value.node = call->call->children;
+            walk->stats->indirect_calls++;
+
+            continue;
+        }
+
+        if (node_count_children(call->call->children->next_child) != node_count_children(variable->lambda->children)) {
+            fprintf(diagnostic_stream(), "variable: \"%s\"\n", variable->name);
+            ERROR_PREP(err, ERROR_ARGUMENTS, "call passes a different number of arguments than the lambda of the variable takes");
+
+            return err;
+        }
+
+        call->call->value.node = variable->lambda;
+        walk->stats->direct_calls++;
+    }
+
+    return err;
+}
+
+// Point every argument at the parameter it is passed to, and let those
+// passed to a function or lambda that is not known escape. Then whatever
+// flows into something that escapes escapes too.
+void closure_resolve_flows(ClosureWalk* walk) {
+    for (size_t i = 0; i < walk->flow_count; ++i) {
+        ClosureFlow* flow = walk->flows + i;
+        Node* owner = flow->owner;
+
+        if (flow->destination != CLOSURE_NONE) {
+            continue;
+        }
+
+        if (!owner && flow->call->value.node->type == NODE_TYPE_LAMBDA) {
+            owner = flow->call->value.node->children;
+        }
+
+        ClosureEntry* parameter = owner ? closure_table_find(&walk->parameters, NULL, owner, flow->position, 0) : NULL;
+
+        if (parameter) {
+            flow->destination = parameter->value;
+        } else {
+            walk->values[flow->source].escapes = 1;
+        }
+    }
+
+    // The flows into each value are `incoming` from `first` of the value to
+    // `first` of the next.
+    size_t* first = calloc(walk->value_count + 1, sizeof(size_t));
+    size_t* incoming = malloc((walk->flow_count + 1) * sizeof(size_t));
+    size_t* pending = malloc((walk->value_count + 1) * sizeof(size_t));
+    size_t pending_count = 0;
+
+    assert(first && incoming && pending && "closure_resolve_flows: could not allocate memory for the analysis");
+
+    for (size_t i = 0; i < walk->flow_count; ++i) {
+        if (walk->flows[i].destination != CLOSURE_NONE) {
+            first[walk->flows[i].destination]++;
+        }
+    }
+
+    for (size_t i = 1; i <= walk->value_count; ++i) {
+        first[i] += first[i - 1];
+    }
+
+    for (size_t i = 0; i < walk->flow_count; ++i) {
+        if (walk->flows[i].destination != CLOSURE_NONE) {
+            incoming[--first[walk->flows[i].destination]] = i;
+        }
+    }
+
+    for (size_t i = 0; i < walk->value_count; ++i) {
+        if (walk->values[i].escapes) {
+            pending[pending_count++] = i;
+        }
+    }
+
+    while (pending_count) {
+        size_t value = pending[--pending_count];
+
+        for (size_t i = first[value]; i < first[value + 1]; ++i) {
+            size_t source = walk->flows[incoming[i]].source;
+
+            if (!walk->values[source].escapes) {
+                walk->values[source].escapes = 1;
+                pending[pending_count++] = source;
+            }
+        }
+    }
+
+    free(pending);
+    free(incoming);
+    free(first);
+}
+
+// Mark the closures that, made again by each pass of a loop, could still be
+// held by a variable or closure of their function when the next pass
+// rebuilds them in the same place: they are copied on from a variable they
+// are stored to. Parameters of the functions they are passed to are gone
+// by then.
+void closure_mark_copies(ClosureWalk* walk) {
+    for (size_t i = 0; i < walk->flow_count; ++i) {
+        size_t copy = walk->flows[i].destination;
+
+        if (copy != CLOSURE_NONE && !walk->values[copy].owner) {
+            walk->values[walk->flows[i].source].stored_on = 1;
+        }
+    }
+
+    for (size_t i = 0; i < walk->flow_count; ++i) {
+        size_t holder = walk->flows[i].destination;
+
+        if (holder != CLOSURE_NONE && walk->values[holder].name && walk->values[holder].stored_on) {
+            walk->values[walk->flows[i].source].copied = 1;
+        }
+    }
+}
+
+void closure_place(ClosureWalk* walk) {
+    size_t index = 0;
+
+    for (size_t i = 0; i < walk->value_count; ++i) {
+        ClosureValue* value = walk->values + i;
+        Node* captures = NULL;
+        ClosurePlacement placement = CLOSURE_STACK;
+
+        if (value->name) {
+            continue;
+        }
+
+        captures = closure_captures(value->lambda);
+
+        if (!captures->children) {
+            placement = CLOSURE_STATIC;
+            walk->stats->static_closures++;
+        } else if (value->escapes || (value->in_loop && value->copied)) {
+            placement = CLOSURE_HEAP;
+            walk->stats->heap_closures++;
+        } else {
+            walk->stats->stack_closures++;
+        }
+
+        captures->value.integer = placement;
+
+        int length = snprintf(NULL, 0, "__croc_lambda%zu", index);
+        value->lambda->value.symbol = croc_allocate(walk->context->allocator, (size_t)length + 1);
+        snprintf(value->lambda->value.symbol, (size_t)length + 1, "__croc_lambda%zu", index);
+
+        index++;
+        walk->stats->lambdas++;
+    }
+}
+
+// Whether `node` makes a lambda, declares a variable, parameter or
+// function of type `function`, or calls something that is not a function.
+// A program that does none of these has no function values to follow and
+// no calls through variables to check.
+int closure_usedp(ClosureWalk* walk, Node* node) {
+    ParsingContext* context = walk->context;
+
+    switch (node->type) {
+    default:
+        break;
+
+    case NODE_TYPE_LAMBDA:
+        return 1;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        if (!closure_function_find(walk, node->children)) {
+            return 1;
+        }
+
+        break;
+
+    case NODE_TYPE_VARIABLE_DECLARATION:
+        if (closure_function_typep(context, node->value.symbol)) {
+            return 1;
+        }
+
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        if (closure_function_typep(context, node->children->next_child->value.symbol)) {
+            return 1;
+        }
+
+        for (Node* parameter = node->children->children; parameter; parameter = parameter->next_child) {
+            if (closure_function_typep(context, parameter->children->next_child->value.symbol)) {
+                return 1;
+            }
+        }
+
+        break;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        if (closure_usedp(walk, child)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+Error closure_analyze_program(ParsingContext* context, Node* program, ClosureStats* stats) {
+    Error err = ok;
+    ClosureWalk walk;
+    size_t source = CLOSURE_NONE;
+    int function = 0;
+
+    memset(&walk, 0, sizeof(ClosureWalk));
+    memset(stats, 0, sizeof(ClosureStats));
+
+    walk.context = context;
+    walk.stats = stats;
+
+    closure_functions_add(&walk);
+
+    if (!closure_usedp(&walk, program)) {
+        free(walk.definitions);
+        free(walk.functions.entries);
+
+        return err;
+    }
+
+    err = closure_statements(&walk, program->children, &function, &source);
+
+    if (!err.type) {
+        err = closure_resolve_calls(&walk);
+    }
+
+    if (!err.type) {
+        closure_resolve_flows(&walk);
+        closure_mark_copies(&walk);
+        closure_place(&walk);
+    }
+
+    free(walk.calls);
+    free(walk.flows);
+    free(walk.frames);
+    free(walk.definitions);
+    free(walk.functions.entries);
+    free(walk.parameters.entries);
+    free(walk.globals.entries);
+    free(walk.locals.entries);
+    free(walk.scope);
+    free(walk.values);
+
+    return err;
+}
+
+void print_closure_stats(ClosureStats stats) {
+    fprintf(diagnostic_stream(), "closures: %zu lambdas, %zu static, %zu on the stack, %zu on the heap; %zu direct and %zu indirect calls through variables\n",
+        stats.lambdas, stats.static_closures, stats.stack_closures, stats.heap_closures, stats.direct_calls, stats.indirect_calls);
+}
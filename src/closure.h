@@ -0,0 +1,52 @@
+#ifndef COMPILER_CLOSURE_H
+#define COMPILER_CLOSURE_H
+
+#include <stddef.h>
+
+#include "error.h"
+#include "parser.h"
+
+// Where the closure of a lambda lives: the record of the label of its body
+// and the values of the variables it captures, in order, eight bytes each,
+// which a value of type `function` points to.
+typedef enum ClosurePlacement {
+    // A lambda that captures nothing has a single record in the data
+    // section.
+    CLOSURE_STATIC = 0,
+    // One that never outlives the call of the function making it is built
+    // in that function's frame.
+    CLOSURE_STACK,
+    // The rest are built on the heap, by a bump allocator that never frees.
+    CLOSURE_HEAP,
+} ClosurePlacement;
+
+typedef struct ClosureStats {
+    size_t lambdas;
+    size_t static_closures;
+    size_t stack_closures;
+    size_t heap_closures;
+
+    // Calls through variables, those whose lambda is known and so call its
+    // body directly, and the others.
+    size_t direct_calls;
+    size_t indirect_calls;
+} ClosureStats;
+
+// Find the variables every lambda of `program` captures and where its
+// closure can live, label the lambdas, and point the calls through
+// variables that always hold the same lambda at it. A closure escapes the
+// function making it once it may be stored to a global, returned, passed
+// to a function whose parameter lets it escape or to one croc did not
+// compile, or captured by a closure that escapes. Values of type
+// `function` are checked to be stored, passed, returned and called, never
+// computed with.
+Error closure_analyze_program(ParsingContext* context, Node* program, ClosureStats* stats);
+
+// The node of the variables `lambda` captures, whose children are their
+// symbols, once closure_analyze_program() has run.
+Node* closure_captures(Node* lambda);
+ClosurePlacement closure_placement(Node* lambda);
+
+void print_closure_stats(ClosureStats stats);
+
+#endif
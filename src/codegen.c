@@ -1,17 +1,35 @@
 #include "codegen.h"
+#include "closure.h"
 #include "environment.h"
 #include "error.h"
+#include "time_report.h"
+#include "trace.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <parser.h>
+#include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-CodegenContext* codegen_context_create(CodegenContext* parent) {
-    CodegenContext* cg_ctx = calloc(1, sizeof(CodegenContext));
+CodegenContext* codegen_context_create(CrocAllocator* allocator, CodegenContext* parent) {
+    CodegenContext* cg_ctx = croc_allocate(allocator, sizeof(CodegenContext));
     cg_ctx->parent = parent;
-    cg_ctx->locals = environment_create(NULL);
+    cg_ctx->allocator = allocator;
+    cg_ctx->locals = environment_create(allocator, NULL);
+
+    if (parent) {
+        cg_ctx->options = parent->options;
+        cg_ctx->profile_counters = parent->profile_counters;
+        cg_ctx->instrumented_functions = parent->instrumented_functions;
+        cg_ctx->scratch = parent->scratch;
+        cg_ctx->narrow_globals = parent->narrow_globals;
+        cg_ctx->narrow_global_count = parent->narrow_global_count;
+    }
+
+    cg_ctx->instrument_index = -1;
 
     return cg_ctx;
 }
@@ -20,46 +38,40 @@ void print_registers(Register* base) {
     Register* it = base;
 
     while (it) {
-        printf("%s:%i\n", it->name, it->in_use);
+        fprintf(diagnostic_stream(), "%s:%i\n", it->name, it->in_use);
         
         it = it->next;
     }
 }
 
-Register* register_create(char* name) {
-    Register* r = calloc(1, sizeof(Register));
-    assert(r && "register_create: failed to allocate memory for new register");
+Register* register_create(CrocAllocator* allocator, char* name) {
+    Register* r = croc_allocate(allocator, sizeof(Register));
 
     r->name = name;
 
     return r;
 }
 
-void register_add(Register* base, char* name) {
+void register_add(CrocAllocator* allocator, Register* base, char* name) {
     while (base->next) {
         base = base->next;
     }
 
-    base->next = register_create(name);
+    base->next = register_create(allocator, name);
 }
 
-// FIXME: THIS IS BROKEN WHY IS IT BROEKEN
-void register_free(Register* base) {
-    Register* to_free = NULL;
-
+void register_free(CrocAllocator* allocator, Register* base) {
     while (base) {
-        to_free = base;
-
-        if (base->name) {
-            free(base->name);
-        }
-
-        base = base->next;
+        Register* next = base->next;
 
-        free(to_free);
+        croc_release(allocator, base);
+        base = next;
     }
 }
 
+#define CODEGEN_REGISTERS_EXHAUSTED "expression needs more registers than codegen has"
+
+// Returns -1 if every register is in use; codegen reports that as an error.
 RegisterDescriptor register_allocate(Register* base) {
     RegisterDescriptor register_descriptor = 0;
     
@@ -74,14 +86,13 @@ RegisterDescriptor register_allocate(Register* base) {
         register_descriptor++;
     }
 
-    printf("register_allocate: ERROR - failed to allocate register\n");
-    exit(1);
-
     return -1;
 }
 
+// Descriptors that name no register, like the -1 of a failed allocation,
+// are ignored.
 void register_deallocate(Register* base, RegisterDescriptor register_descriptor) {
-    while (base) {
+    while (base && register_descriptor >= 0) {
         if (register_descriptor == 0) {
             base->in_use = 0;
 
@@ -91,9 +102,26 @@ void register_deallocate(Register* base, RegisterDescriptor register_descriptor)
         base = base->next;
         register_descriptor--;
     }
+}
+
+int register_in_usep(Register* base, char* name) {
+    for (; base; base = base->next) {
+        if (strcmp(base->name, name) == 0) {
+            return base->in_use;
+        }
+    }
+
+    return 0;
+}
+
+size_t register_available(Register* base) {
+    size_t count = 0;
+
+    for (; base; base = base->next) {
+        count += !base->in_use;
+    }
 
-    printf("register_deallocate: ERROR - failed to deallocate register\n");
-    exit(1);
+    return count;
 }
 
 char* register_name(Register* base, RegisterDescriptor register_descriptor) {
@@ -106,233 +134,3406 @@ char* register_name(Register* base, RegisterDescriptor register_descriptor) {
         register_descriptor--;
     }
 
-    printf("register_name: ERROR - failed to find register with descriptor of %d\n", register_descriptor);
+    fprintf(diagnostic_stream(), "register_name: ERROR - failed to find register with descriptor of %d\n", register_descriptor);
 
     return NULL;
 }
 
-#define label_buffer_size 1024
-char label_buffer[label_buffer_size];
-size_t label_index = 0;
-size_t label_count = 0;
-
-char* label_generate() {
-    char* label = label_buffer + label_index;
-    label_index += snprintf(label, label_buffer_size - label_index, ".L%d:\n", label_count);
-    label_index++;
+char* label_generate(CodegenContext* cg_context) {
+    CodegenScratch* scratch = cg_context->scratch;
+    char* label = scratch->labels + scratch->label_index;
+    scratch->label_index += snprintf(label, CODEGEN_SCRATCH_SIZE - scratch->label_index, ".L%zu", scratch->label_count);
+    scratch->label_index++;
 
-    if (label_index >= label_buffer_size) {
-        label_index = 0;
+    if (scratch->label_index >= CODEGEN_SCRATCH_SIZE) {
+        scratch->label_index = 0;
 
-        return label_generate();
+        return label_generate(cg_context);
     }
 
-    label_count++;
+    scratch->label_count++;
 
     return label;
 }
 
-#define symbol_buffer_size 1024
-char symbol_buffer[symbol_buffer_size];
-size_t symbol_index = 0;
-size_t symbol_count = 0;
+char* symbol_to_address(CodegenContext* cg_context, Node* symbol) {
+    CodegenScratch* scratch = cg_context->scratch;
 
-char* symbol_to_address(Node* symbol) {
-    char* symbol_string = symbol_buffer + symbol_index;
-    symbol_index += snprintf(symbol_string, symbol_buffer_size - symbol_index, "%s(%%rip)", symbol->value.symbol);
-    symbol_index++;
+    if (scratch->operand_index + strlen(symbol->value.symbol) + 8 >= CODEGEN_SCRATCH_SIZE) {
+        scratch->operand_index = 0;
+    }
+
+    char* symbol_string = scratch->operands + scratch->operand_index;
+    scratch->operand_index += snprintf(symbol_string, CODEGEN_SCRATCH_SIZE - scratch->operand_index, "%s(%%rip)", symbol->value.symbol);
+    scratch->operand_index++;
+
+    return symbol_string;
+}
 
-    if (symbol_index >= label_buffer_size) {
-        symbol_index = 0;
+// Address of the byte `offset` bytes into the global `symbol` names.
+char* element_to_address(CodegenContext* cg_context, Node* symbol, long long offset) {
+    CodegenScratch* scratch = cg_context->scratch;
 
-        return label_generate();
+    if (scratch->operand_index + strlen(symbol->value.symbol) + 32 >= CODEGEN_SCRATCH_SIZE) {
+        scratch->operand_index = 0;
     }
 
-    return symbol_string;
+    char* element_string = scratch->operands + scratch->operand_index;
+    scratch->operand_index += snprintf(element_string, CODEGEN_SCRATCH_SIZE - scratch->operand_index, "%s+%lld(%%rip)", symbol->value.symbol, offset);
+    scratch->operand_index++;
+
+    return element_string;
 }
 
-Error codegen_function_x86_64_att_mswin(Register* r, CodegenContext* cg_context, ParsingContext* context, char* name, Node* function, FILE* code);
-Error codegen_expression_x86_64_mswin(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* expression) {
-    Error err = ok;
-    char* result = NULL;
+char* local_to_address(CodegenContext* cg_context, long long offset) {
+    CodegenScratch* scratch = cg_context->scratch;
 
-    switch (expression->type) {
-    default:
-        break;
+    if (scratch->operand_index + 32 >= CODEGEN_SCRATCH_SIZE) {
+        scratch->operand_index = 0;
+    }
 
-    case NODE_TYPE_FUNCTION:
-        if (!cg_context->parent) { break; }
+    char* local_string = scratch->operands + scratch->operand_index;
+    scratch->operand_index += snprintf(local_string, CODEGEN_SCRATCH_SIZE - scratch->operand_index, "%lld(%%rbp)", offset);
+    scratch->operand_index++;
 
-        result = label_generate();
-        err = codegen_function_x86_64_att_mswin(r, cg_context, context, result, expression, code);
+    return local_string;
+}
 
-        if (err.type) { return err; }
+// Register a loop keeps `node` in, or NULL. Symbols stand for the variable
+// they name, and hoisted expressions for any expression like them.
+const char* codegen_promoted_register(CodegenContext* cg_context, Node* node) {
+    for (size_t i = 0; i < cg_context->promotion_count; ++i) {
+        Node* promoted = cg_context->promotions[i].node;
 
-        break;
+        if (promoted->type != node->type) {
+            continue;
+        }
 
-    case NODE_TYPE_INTEGER:
-        expression->result_register = register_allocate(r);
+        if (symbolp(*node) ? strcmp(promoted->value.symbol, node->value.symbol) == 0 : node_compare(promoted, node)) {
+            return cg_context->promotions[i].register_name;
+        }
+    }
 
-        fprintf(code, "mov $%lld, %s\n", expression->value.integer, register_name(r, expression->result_register));
+    return NULL;
+}
 
-        break;
+// Register the parameter `symbol` stays in, or NULL if it is not a
+// parameter or was stored to the frame.
+const char* codegen_parameter_register(CodegenContext* cg_context, Node* symbol) {
+    for (size_t i = 0; i < cg_context->parameter_register_count; ++i) {
+        if (strcmp(cg_context->parameter_registers[i].node->value.symbol, symbol->value.symbol) == 0) {
+            return cg_context->parameter_registers[i].register_name;
+        }
+    }
 
-    case NODE_TYPE_VARIABLE_DECLARATION:
-        if (!cg_context->parent) { break; }
+    return NULL;
+}
 
-        printf("TODO: local variables");
+// Locals and parameters are bound to their frame offset in the function's
+// codegen context; anything else is a global. Variables a loop promoted and
+// parameters that stay where they arrived are in their register.
+char* variable_to_address(CodegenContext* cg_context, Node* symbol) {
+    const char* promoted = codegen_promoted_register(cg_context, symbol);
 
-        break;
+    if (!promoted) {
+        promoted = codegen_parameter_register(cg_context, symbol);
+    }
 
-    case NODE_TYPE_VARIABLE_REASSIGNMENT:
-        if (cg_context->parent) {
-            // TODO: local variables
-        } else {
-            if (expression->children->next_child->type == NODE_TYPE_INTEGER) {
-                result = malloc(64);
+    if (promoted) {
+        return (char*)promoted;
+    }
 
-                if (!result) {
-                    ERROR_PREP(err, ERROR_GENERIC, "failed to allocate integer result buffer");
+    Node* offset = node_allocate(cg_context->allocator);
+    char* address = NULL;
 
-                    break;
-                }
+    if (environment_get(*cg_context->locals, symbol, offset)) {
+        address = local_to_address(cg_context, offset->value.integer);
+    } else {
+        address = symbol_to_address(cg_context, symbol);
+    }
 
-                snprintf(result, 64, "$%lld", expression->children->next_child->value.integer);
-                fprintf(code, "movq %s, %s\n", result, symbol_to_address(expression->children));
-                free(result);
-            } else {
-                err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression->children->next_child);
-                if (err.type) { break; }
+    croc_release(cg_context->allocator, offset);
 
-                result = register_name(r, expression->children->next_child->result_register);
-                fprintf(code, "mov %s, %s\n", result, symbol_to_address(expression->children));
-                register_deallocate(r, expression->children->next_child->result_register);
-            }
+    return address;
+}
+
+int codegen_narrow_global_compare(const void* a, const void* b) {
+    return strcmp(((const CodegenNarrowGlobal*)a)->name, ((const CodegenNarrowGlobal*)b)->name);
+}
+
+int codegen_localp(CodegenContext* cg_context, Node* symbol);
+int codegen_imm32p(long long value);
+
+// Layout of the global `symbol` names if it is narrower than 64 bits and
+// is read where it lives in memory, not from a register or the frame;
+// NULL otherwise.
+const TypeLayout* codegen_narrow_global(CodegenContext* cg_context, Node* symbol) {
+    CodegenNarrowGlobal key = { symbol->value.symbol, { 0, 0, 0 } };
+    CodegenNarrowGlobal* global = NULL;
+
+    if (cg_context->narrow_global_count) {
+        global = bsearch(&key, cg_context->narrow_globals, cg_context->narrow_global_count, sizeof(CodegenNarrowGlobal), codegen_narrow_global_compare);
+    }
+
+    if (!global || codegen_promoted_register(cg_context, symbol) || codegen_parameter_register(cg_context, symbol) || codegen_localp(cg_context, symbol)) {
+        return NULL;
+    }
+
+    return &global->layout;
+}
+
+// Name of the low `size` bytes of the 64-bit register `name`.
+const char* codegen_register_part(const char* name, long long size) {
+    static const char* parts[][4] = {
+        { "%rax", "%eax", "%ax", "%al" }, { "%rbx", "%ebx", "%bx", "%bl" },
+        { "%rcx", "%ecx", "%cx", "%cl" }, { "%rdx", "%edx", "%dx", "%dl" },
+        { "%rsi", "%esi", "%si", "%sil" }, { "%rdi", "%edi", "%di", "%dil" },
+        { "%rbp", "%ebp", "%bp", "%bpl" }, { "%rsp", "%esp", "%sp", "%spl" },
+        { "%r8", "%r8d", "%r8w", "%r8b" }, { "%r9", "%r9d", "%r9w", "%r9b" },
+        { "%r10", "%r10d", "%r10w", "%r10b" }, { "%r11", "%r11d", "%r11w", "%r11b" },
+        { "%r12", "%r12d", "%r12w", "%r12b" }, { "%r13", "%r13d", "%r13w", "%r13b" },
+        { "%r14", "%r14d", "%r14w", "%r14b" }, { "%r15", "%r15d", "%r15w", "%r15b" },
+    };
+    size_t part = size >= 8 ? 0 : size >= 4 ? 1 : size >= 2 ? 2 : 3;
+
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+        if (strcmp(parts[i][0], name) == 0) {
+            return parts[i][part];
         }
+    }
 
-        break;
+    assert(0 && "codegen_register_part: not a 64-bit general purpose register");
+
+    return name;
+}
+
+// Suffix of instructions on `size` bytes.
+char codegen_size_suffix(long long size) {
+    return size >= 8 ? 'q' : size >= 4 ? 'l' : size >= 2 ? 'w' : 'b';
+}
+
+// Read `source`, memory or a register part of the size of `layout`, into
+// the 64-bit register `destination`, extended as `layout` says. A 32-bit
+// move clears the upper half by itself.
+void codegen_extend(FILE* code, TypeLayout layout, const char* source, const char* destination) {
+    if (layout.size >= 8) {
+        if (strcmp(source, destination)) {
+            fprintf(code, "mov %s, %s\n", source, destination);
+        }
+    } else if (layout.size == 4 && !layout.is_signed) {
+        fprintf(code, "movl %s, %s\n", source, codegen_register_part(destination, 4));
+    } else {
+        fprintf(code, "mov%c%cq %s, %s\n", layout.is_signed ? 's' : 'z', codegen_size_suffix(layout.size), source, destination);
     }
+}
 
-    return err;
+// Leave what a variable of `layout` keeps of the value in the 64-bit
+// register `name` there.
+void codegen_narrow_register(FILE* code, TypeLayout layout, const char* name) {
+    if (layout.size < 8) {
+        codegen_extend(code, layout, codegen_register_part(name, layout.size), name);
+    }
 }
 
-const char* function_header_x86_64 =
-    "push %rbp\n"
-    "mov %rsp, %rbp\n"
-    "sub $32, %rsp\n";
+// Read the variable `symbol` into the 64-bit register `destination`.
+void codegen_load_variable(FILE* code, CodegenContext* cg_context, Node* symbol, const char* destination) {
+    const TypeLayout* layout = codegen_narrow_global(cg_context, symbol);
 
-const char* function_footer_x86_64 =
-    "add $32, %rsp\n"
-    "pop %rbp\n"
-    "ret\n";
+    if (layout) {
+        codegen_extend(code, *layout, symbol_to_address(cg_context, symbol), destination);
+    } else {
+        fprintf(code, "mov %s, %s\n", variable_to_address(cg_context, symbol), destination);
+    }
+}
 
-Error codegen_function_x86_64_att_mswin(Register* r, CodegenContext* cg_context, ParsingContext* context, char* name, Node* function, FILE* code) {
-    Error err = ok;
-    cg_context = codegen_context_create(cg_context);
-    size_t param_count = 1;
-    Node* parameter = function->children->children;
+// Write the 64-bit register `source`, which holds a value of the variable's
+// type, to the variable `symbol`.
+void codegen_store_variable(FILE* code, CodegenContext* cg_context, Node* symbol, const char* source) {
+    const TypeLayout* layout = codegen_narrow_global(cg_context, symbol);
 
-    while (parameter) {
-        param_count++;
+    if (layout) {
+        fprintf(code, "mov%c %s, %s\n", codegen_size_suffix(layout->size), codegen_register_part(source, layout->size), symbol_to_address(cg_context, symbol));
+    } else {
+        fprintf(code, "mov %s, %s\n", source, variable_to_address(cg_context, symbol));
+    }
+}
 
-        // FIXME: STOP ASSUMING THE FUCKING REGISTERS ARE 8 BYTES ABIWDIUADWAUDAWD
-        environment_set(cg_context->locals, parameter->children, node_integer(-param_count * 8));
+// Store the value `assignment` computed into the 64-bit register `source`
+// to the variable it declares or reassigns. Values bound for the frame or a
+// register are narrowed there first; memory of the variable's width
+// narrows them by itself.
+void codegen_assign(FILE* code, CodegenContext* cg_context, ParsingContext* context, Node* assignment, const char* source) {
+    TypeLayout layout = parse_type_layout(context, assignment->value.symbol);
 
-        parameter = parameter->next_child;
+    if (layout.size < 8 && !codegen_narrow_global(cg_context, assignment->children)) {
+        char* destination = variable_to_address(cg_context, assignment->children);
+
+        // A register is narrowed into straight away.
+        if (!strchr(destination, '(')) {
+            codegen_extend(code, layout, codegen_register_part(source, layout.size), destination);
+
+            return;
+        }
+
+        codegen_narrow_register(code, layout, source);
     }
 
-    fprintf(code, "jmp after%s\n", name);
-    fprintf(code, "%s:\n", name);
-    fprintf(code, "%s", function_header_x86_64);
+    codegen_store_variable(code, cg_context, assignment->children, source);
+}
+
+// Store the constant `value` to the variable `assignment` declares or
+// reassigns. Narrowing may leave it too wide for an immediate, which then
+// goes through %rdx.
+void codegen_assign_constant(FILE* code, CodegenContext* cg_context, ParsingContext* context, Node* assignment, long long value) {
+    TypeLayout layout = parse_type_layout(context, assignment->value.symbol);
+    const TypeLayout* narrow = codegen_narrow_global(cg_context, assignment->children);
+
+    value = type_layout_narrow(layout, value);
+
+    if (narrow) {
+        fprintf(code, "mov%c $%lld, %s\n", codegen_size_suffix(narrow->size), value, symbol_to_address(cg_context, assignment->children));
+    } else if (codegen_imm32p(value)) {
+        fprintf(code, "movq $%lld, %s\n", value, variable_to_address(cg_context, assignment->children));
+    } else {
+        fprintf(code, "movabs $%lld, %%rdx\nmov %%rdx, %s\n", value, variable_to_address(cg_context, assignment->children));
+    }
+}
+
+size_t codegen_count_locals(Node* expression) {
+    size_t count = 0;
 
-    Node* expression = function->children->next_child->next_child->children;
     while (expression) {
-        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression);
-        if (err.type) {
-            print_error(err);
+        if (expression->type == NODE_TYPE_VARIABLE_DECLARATION) {
+            count++;
+        }
 
-            break;
+        // Declarations in a loop's body have a slot of their own too.
+        if (expression->type == NODE_TYPE_WHILE) {
+            count += codegen_count_locals(expression->children->next_child->children);
         }
 
         expression = expression->next_child;
     }
 
-    fprintf(code, "%s", function_footer_x86_64);
-    fprintf(code, "after%s:\n", name);
+    return count;
+}
 
-    cg_context = cg_context->parent;
+// With -g, attribute the code that follows to the line `node` starts on.
+// Nodes the compiler made up have no location and stay with the line before.
+void codegen_debug_location(FILE* code, CodegenContext* cg_context, Node* node) {
+    CodegenOptions* options = cg_context->options;
+    size_t line = 0;
+    size_t column = 0;
 
-    return ok;
+    if (!options->debug_info || !options->lines || !node->location) {
+        return;
+    }
+
+    line_table_locate(options->lines, node->location, &line, &column);
+
+    if (!line || line == cg_context->scratch->debug_line) {
+        return;
+    }
+
+    cg_context->scratch->debug_line = line;
+    fprintf(code, ".loc 1 %zu %zu\n", line, column);
 }
 
-Error codegen_program_x86_64_mswin(FILE* code, CodegenContext* cg_context, ParsingContext* context, Node* program) {
-    Error err = ok;
-    Register* r = register_create("%rax");
-    register_add(r, "%r10");
-    register_add(r, "%r11");
+// Call frame information lets profilers unwind through generated code. Only
+// SysV output carries it, and only with -g.
+int codegen_cfip(CodegenContext* cg_context) {
+    return cg_context->options->debug_info && cg_context->options->format == CG_FMT_x86_64_SYSV;
+}
 
-    fprintf(code, "%s", ".section .data\n");
+void codegen_cfi(FILE* code, CodegenContext* cg_context, const char* directives) {
+    if (codegen_cfip(cg_context)) {
+        fprintf(code, "%s", directives);
+    }
+}
 
-    Binding* var_it = context->variables->bind;
-    while (var_it) {
-        Node* var_id = var_it->id;
-        Node* type = var_it->value;
-        Node* type_info = node_allocate();
+// Set up a frame of `frame_size` bytes below the saved frame pointer.
+void codegen_prologue(FILE* code, CodegenContext* cg_context, long long frame_size) {
+    codegen_cfi(code, cg_context, ".cfi_startproc\n");
+    fprintf(code, "push %%rbp\n");
+    codegen_cfi(code, cg_context,
+        ".cfi_def_cfa_offset 16\n"
+        ".cfi_offset %rbp, -16\n");
+    fprintf(code, "mov %%rsp, %%rbp\n");
+    codegen_cfi(code, cg_context, ".cfi_def_cfa_register %rbp\n");
+
+    if (frame_size) {
+        fprintf(code, "sub $%lld, %%rsp\n", frame_size);
+    }
 
-        if (!environment_get(*context->types, type, type_info)) {
-            printf("type: \"%s\"\n", type->value.symbol);
-            ERROR_PREP(err, ERROR_GENERIC, "failed to get type info from types environment");
-        }
+    cg_context->frame_size = frame_size;
+}
+
+// Tear the frame down; what follows is either `ret` or a jump.
+void codegen_epilogue(FILE* code, CodegenContext* cg_context) {
+    fprintf(code,
+        "mov %%rbp, %%rsp\n"
+        "pop %%rbp\n");
+    codegen_cfi(code, cg_context, ".cfi_def_cfa %rsp, 8\n");
+}
+
+Error codegen_function_x86_64_att_mswin(Register* r, CodegenContext* cg_context, ParsingContext* context, char* name, Node* function, FILE* code);
+Error codegen_expression_x86_64_mswin(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* expression);
+
+size_t codegen_count_calls(Node* node);
+int codegen_localp(CodegenContext* cg_context, Node* symbol);
 
-        var_it = var_it->next;
+// Registers the first integer arguments of a call go in, whether into the C
+// runtime or to a function croc generated. Windows has every caller reserve
+// 32 bytes of shadow space below the arguments on the stack, where the
+// callee may store the first four.
+const char* codegen_argument_registers_mswin[] = { "%rcx", "%rdx", "%r8", "%r9" };
+const char* codegen_argument_registers_sysv[] = { "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9" };
 
-        fprintf(code, "%s: .space %lld\n", var_id->value.symbol, type_info->children->value.integer);
-        free(type_info);
+#define CODEGEN_SHADOW_BYTES_MSWIN 32
+
+const char* codegen_argument_register(CodegenOptions* options, size_t index) {
+    if (options->format == CG_FMT_x86_64_SYSV) {
+        return codegen_argument_registers_sysv[index];
     }
 
-    fprintf(code, ".section .text\n");
+    return codegen_argument_registers_mswin[index];
+}
+
+size_t codegen_argument_register_count(CodegenOptions* options) {
+    return options->format == CG_FMT_x86_64_SYSV ? 6 : 4;
+}
+
+long long codegen_shadow_bytes(CodegenOptions* options) {
+    return options->format == CG_FMT_x86_64_SYSV ? 0 : CODEGEN_SHADOW_BYTES_MSWIN;
+}
+
+void codegen_profile_counter(FILE* code, CodegenContext* cg_context, char* name) {
+    if (!cg_context->options->profile_generate) {
+        return;
+    }
+
+    size_t index = profile_counter_add(cg_context->profile_counters, name);
+
+    fprintf(code, "incq __croc_profile+%zu(%%rip)\n", (index + 1) * PROFILE_RECORD_SIZE);
+}
+
+void codegen_profile_call_site(FILE* code, CodegenContext* cg_context, Node* call) {
+    char name[PROFILE_NAME_SIZE];
+    size_t ordinal = cg_context->call_count++;
+
+    if (!cg_context->options->profile_generate) {
+        return;
+    }
+
+    profile_site_name(name, sizeof(name), cg_context->function_name ? cg_context->function_name : "main", ordinal, call->children->value.symbol);
+    codegen_profile_counter(code, cg_context, name);
+}
 
-    Binding* function_it = context->functions->bind;
-    while (function_it) {
-        Node* function_id = function_it->id;
-        Node* function = function_it->value;
-        function_it = function_it->next;
-        err = codegen_function_x86_64_att_mswin(r, cg_context, context, function_id->value.symbol, function, code);
+// Every instrumented function has a record in __croc_instrument holding its
+// call count, inclusive and exclusive cycles, and a pointer to its name.
+#define INSTRUMENT_RECORD_SIZE          32
+
+// Frame slots of an instrumented function holding the cycle counter at entry
+// and the callee cycles its caller had accumulated before the call.
+#define INSTRUMENT_START_OFFSET         -8
+#define INSTRUMENT_CALLER_CHILD_OFFSET  -16
+#define INSTRUMENT_FRAME_SIZE           16
+
+// __croc_instrument_child accumulates the cycles spent in the callees of the
+// running function, which its exclusive cycles leave out. Only %rax and %rdx
+// are clobbered, and nothing is live in them at function entry.
+void codegen_instrument_entry(FILE* code, CodegenContext* cg_context) {
+    if (cg_context->instrument_index < 0) {
+        return;
     }
 
     fprintf(code,
-        ".global main\n"
-        "main:\n"
-        "%s", function_header_x86_64);
+        "incq __croc_instrument+%lld(%%rip)\n"
+        "mov __croc_instrument_child(%%rip), %%rax\n"
+        "mov %%rax, %d(%%rbp)\n"
+        "movq $0, __croc_instrument_child(%%rip)\n"
+        "rdtsc\n"
+        "shl $32, %%rdx\n"
+        "or %%rdx, %%rax\n"
+        "mov %%rax, %d(%%rbp)\n",
+        cg_context->instrument_index * INSTRUMENT_RECORD_SIZE,
+        INSTRUMENT_CALLER_CHILD_OFFSET, INSTRUMENT_START_OFFSET);
+}
 
-    Node* last_expression = program->children;
-    Node* expression = program->children;
-    while (expression) {
-        codegen_expression_x86_64_mswin(code, r, cg_context, context, expression);
-        
-        last_expression = expression;
-        expression = expression->next_child;
+// Add the cycles since entry to the function's record and to its caller's
+// callee cycles. The return value in %rax is kept in %r11.
+void codegen_instrument_exit(FILE* code, CodegenContext* cg_context) {
+    long long record = cg_context->instrument_index * INSTRUMENT_RECORD_SIZE;
+
+    if (cg_context->instrument_index < 0) {
+        return;
     }
 
-    char* name = register_name(r, last_expression->result_register);
-    if (strcmp(name, "%rax")) {
-        fprintf(code, "mov $0, %%rax\n");
+    fprintf(code,
+        "mov %%rax, %%r11\n"
+        "rdtsc\n"
+        "shl $32, %%rdx\n"
+        "or %%rdx, %%rax\n"
+        "sub %d(%%rbp), %%rax\n"
+        "add %%rax, __croc_instrument+%lld(%%rip)\n"
+        "mov %%rax, %%rdx\n"
+        "sub __croc_instrument_child(%%rip), %%rdx\n"
+        "add %%rdx, __croc_instrument+%lld(%%rip)\n"
+        "add %d(%%rbp), %%rax\n"
+        "mov %%rax, __croc_instrument_child(%%rip)\n"
+        "mov %%r11, %%rax\n",
+        INSTRUMENT_START_OFFSET, record + 8, record + 16, INSTRUMENT_CALLER_CHILD_OFFSET);
+}
+
+void codegen_restore_registers(FILE* code, Register* it, RegisterDescriptor descriptor, unsigned long long saved) {
+    if (!it) {
+        return;
     }
 
-    fprintf(code, "%s", function_footer_x86_64);
+    codegen_restore_registers(code, it->next, descriptor + 1, saved);
 
-    return ok;
+    if (saved & (1ull << descriptor)) {
+        fprintf(code, "pop %s\n", it->name);
+    }
 }
 
-Error codegen_program(enum CodegenOutputFormat format, ParsingContext* context, Node* program) {
-    Error err = ok;
-    CodegenContext* cg_context = codegen_context_create(NULL);
+// Integers fit in an instruction's operand, symbols are read from memory
+// and hoisted expressions from their register, so none of them needs a
+// register of the pool as a right operand. Globals narrower than 64 bits
+// have to be extended into one first.
+int codegen_direct_operandp(CodegenContext* cg_context, Node* node) {
+    return integerp(*node) || (symbolp(*node) && !codegen_narrow_global(cg_context, node)) || codegen_promoted_register(cg_context, node);
+}
+
+int codegen_callsp(Node* node) {
+    if (node->type == NODE_TYPE_FUNCTION_CALL) {
+        return 1;
+    }
+
+    for (Node* child = node->type == NODE_TYPE_BINARY_OPERATOR || node->type == NODE_TYPE_INDEX ? node->children : NULL; child; child = child->next_child) {
+        if (codegen_callsp(child)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Whether `node` may see what a call writes: it reads a global or makes a
+// call of its own.
+int codegen_reads_globalsp(CodegenContext* cg_context, Node* node) {
+    int status = 0;
+
+    switch (node->type) {
+    default:
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+    case NODE_TYPE_INDEX:
+        return 1;
+
+    case NODE_TYPE_SYMBOL: {
+        Node* offset = node_allocate(cg_context->allocator);
+        status = !environment_get(*cg_context->locals, node, offset);
+        croc_release(cg_context->allocator, offset);
+
+        break;
+    }
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        status = codegen_reads_globalsp(cg_context, node->children) || codegen_reads_globalsp(cg_context, node->children->next_child);
+
+        break;
+    }
+
+    return status;
+}
 
-    FILE* code = fopen("code.S", "w");
-    if (format == CG_FMT_DEFAULT || format == CG_FMT_x86_64_MSWIN) {
-        err = codegen_program_x86_64_mswin(code, cg_context, context, program);
+// Operands may be evaluated in either order unless one of them calls a
+// function that could change what the other reads.
+int codegen_reorderablep(CodegenContext* cg_context, Node* a, Node* b) {
+    return !(codegen_callsp(a) && codegen_reads_globalsp(cg_context, b))
+        && !(codegen_callsp(b) && codegen_reads_globalsp(cg_context, a));
+}
+
+// Commutative operators with a direct left operand are evaluated with the
+// operands swapped, which makes the right operand direct instead.
+int codegen_swap_operandsp(CodegenContext* cg_context, Node* expression) {
+    Node* left = expression->children;
+    Node* right = left->next_child;
+
+    return binary_operator_commutativep((int)expression->value.integer)
+        && codegen_direct_operandp(cg_context, left)
+        && !codegen_direct_operandp(cg_context, right)
+        && codegen_reorderablep(cg_context, left, right);
+}
+
+// Registers of the pool evaluating `node` takes, counted the way of Sethi
+// and Ullman: of two operands that both need registers, the one needing
+// more goes first, so the other can use what it gave back. A call holds
+// nothing but its result across the calls in its arguments.
+size_t codegen_register_need(CodegenContext* cg_context, Node* node) {
+    size_t need = 1;
+
+    if (codegen_promoted_register(cg_context, node)) {
+        return need;
+    }
+
+    switch (node->type) {
+    default:
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        for (Node* argument = node->children->next_child->children; argument; argument = argument->next_child) {
+            size_t argument_need = codegen_register_need(cg_context, argument);
+
+            if (argument_need > need) {
+                need = argument_need;
+            }
+        }
+
+        break;
+
+    // An element is read into the register its index is computed in.
+    case NODE_TYPE_INDEX:
+        return codegen_register_need(cg_context, node->children->next_child);
+
+    case NODE_TYPE_BINARY_OPERATOR: {
+        Node* left = node->children;
+        Node* right = left->next_child;
+
+        if (codegen_swap_operandsp(cg_context, node)) {
+            return codegen_register_need(cg_context, right);
+        }
+
+        size_t left_need = codegen_register_need(cg_context, left);
+
+        if (codegen_direct_operandp(cg_context, right)) {
+            return left_need;
+        }
+
+        size_t right_need = codegen_register_need(cg_context, right);
+
+        if (left_need == right_need) {
+            need = left_need + 1;
+        } else {
+            need = left_need > right_need ? left_need : right_need;
+        }
+
+        break;
+    }
+    }
+
+    return need;
+}
+
+int codegen_imm32p(long long value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Operand string of a direct operand. Integers too wide for an immediate go
+// through %rdx.
+char* codegen_direct_operand(FILE* code, CodegenContext* cg_context, Node* node, char* buffer, size_t size) {
+    const char* promoted = codegen_promoted_register(cg_context, node);
+
+    if (promoted) {
+        return (char*)promoted;
+    }
+
+    if (symbolp(*node)) {
+        return variable_to_address(cg_context, node);
+    }
+
+    if (codegen_imm32p(node->value.integer)) {
+        snprintf(buffer, size, "$%lld", node->value.integer);
+
+        return buffer;
+    }
+
+    fprintf(code, "movabs $%lld, %%rdx\n", node->value.integer);
+
+    return "%rdx";
+}
+
+// Whether `argument` can be read once all the arguments of its call are
+// computed: it is a direct operand no call in the arguments after it can
+// change.
+int codegen_argument_deferrablep(CodegenContext* cg_context, Node* argument) {
+    if (!codegen_direct_operandp(cg_context, argument)) {
+        return 0;
+    }
+
+    for (Node* later = argument->next_child; later; later = later->next_child) {
+        if (codegen_callsp(later) && codegen_reads_globalsp(cg_context, argument)) {
+            return 0;
+        }
     }
 
+    return 1;
+}
+
+// Compute the arguments of `call` that cannot be read later, in order. Each
+// stays in its register of the pool while that leaves enough for the ones
+// after it, unless `keep` is zero, and is pushed otherwise; `pushed` gets
+// the push of every argument, counting from the first, or -1.
+Error codegen_compute_arguments(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* call, int keep, long long* pushed, size_t* pushed_count) {
+    Error err = ok;
+    size_t index = 0;
+
+    for (Node* argument = call->children->next_child->children; argument; argument = argument->next_child, index++) {
+        size_t need = 0;
+
+        pushed[index] = -1;
+        argument->result_register = -1;
+
+        if (codegen_argument_deferrablep(cg_context, argument)) {
+            continue;
+        }
+
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, argument);
+        if (err.type) { break; }
+
+        for (Node* later = argument->next_child; later; later = later->next_child) {
+            size_t later_need = codegen_argument_deferrablep(cg_context, later) ? 0 : codegen_register_need(cg_context, later);
+
+            if (later_need > need) {
+                need = later_need;
+            }
+        }
+
+        if (keep && register_available(r) >= need) {
+            continue;
+        }
+
+        fprintf(code, "push %s\n", register_name(r, argument->result_register));
+        register_deallocate(r, argument->result_register);
+        argument->result_register = -1;
+        pushed[index] = (long long)(*pushed_count)++;
+    }
+
+    return err;
+}
+
+// Load an argument that is not in a register of the pool into
+// `destination`. Pushed arguments are above the `base` bytes reserved
+// after them.
+void codegen_load_argument(FILE* code, CodegenContext* cg_context, Node* argument, long long pushed, size_t pushed_count, long long base, const char* destination) {
+    if (pushed >= 0) {
+        fprintf(code, "mov %lld(%%rsp), %s\n", base + ((long long)pushed_count - 1 - pushed) * 8, destination);
+    } else if (integerp(*argument)) {
+        fprintf(code, "%s $%lld, %s\n", codegen_imm32p(argument->value.integer) ? "mov" : "movabs", argument->value.integer, destination);
+    } else {
+        fprintf(code, "mov %s, %s\n", codegen_direct_operand(code, cg_context, argument, NULL, 0), destination);
+    }
+}
+
+// Move the computed arguments of `call` where the callee expects them. The
+// stack arguments go first, to slots above the shadow space, as until the
+// register arguments are loaded the first argument register is free to
+// carry them there.
+void codegen_place_arguments(FILE* code, Register* r, CodegenContext* cg_context, Node* call, long long* pushed, size_t pushed_count, long long base) {
+    CodegenOptions* options = cg_context->options;
+    size_t register_count = codegen_argument_register_count(options);
+    const char* scratch = codegen_argument_register(options, 0);
+    char slot[32];
+    size_t index = 0;
+
+    for (Node* argument = call->children->next_child->children; argument; argument = argument->next_child, index++) {
+        if (index < register_count) {
+            continue;
+        }
+
+        snprintf(slot, sizeof(slot), "%lld(%%rsp)", codegen_shadow_bytes(options) + (long long)(index - register_count) * 8);
+
+        if (argument->result_register >= 0) {
+            fprintf(code, "mov %s, %s\n", register_name(r, argument->result_register), slot);
+            register_deallocate(r, argument->result_register);
+        } else if (pushed[index] < 0 && integerp(*argument) && codegen_imm32p(argument->value.integer)) {
+            fprintf(code, "movq $%lld, %s\n", argument->value.integer, slot);
+        } else {
+            codegen_load_argument(code, cg_context, argument, pushed[index], pushed_count, base, scratch);
+            fprintf(code, "mov %s, %s\n", scratch, slot);
+        }
+    }
+
+    index = 0;
+
+    for (Node* argument = call->children->next_child->children; argument && index < register_count; argument = argument->next_child, index++) {
+        const char* destination = codegen_argument_register(options, index);
+
+        if (argument->result_register >= 0) {
+            fprintf(code, "mov %s, %s\n", register_name(r, argument->result_register), destination);
+            register_deallocate(r, argument->result_register);
+        } else {
+            codegen_load_argument(code, cg_context, argument, pushed[index], pushed_count, base, destination);
+        }
+    }
+}
+
+// A call through a variable passes the closure it holds in %r10, which is
+// free once the arguments are placed, and calls the body the closure
+// records. If closure analysis knows the lambda, its body is called
+// directly, and a closure that captures nothing is not even loaded.
+void codegen_call_target_x86_64(FILE* code, CodegenContext* cg_context, Node* call) {
+    Node* lambda = call->value.node;
+
+    if (!lambda) {
+        fprintf(code, "call %s\n", call->children->value.symbol);
+
+        return;
+    }
+
+    if (lambda->type != NODE_TYPE_LAMBDA) {
+        lambda = NULL;
+    }
+
+    if (lambda && closure_placement(lambda) == CLOSURE_STATIC) {
+        fprintf(code, "call %s\n", lambda->value.symbol);
+
+        return;
+    }
+
+    codegen_load_variable(code, cg_context, call->children, "%r10");
+
+    if (lambda) {
+        fprintf(code, "call %s\n", lambda->value.symbol);
+    } else {
+        fprintf(code, "call *(%%r10)\n");
+    }
+}
+
+// The first arguments go in registers and the rest on the stack, as the
+// target's C calling convention has it, and the result comes back in %rax.
+// Every register in the pool is caller-saved, so the ones live across the
+// call are pushed around it.
+Error codegen_call_x86_64_mswin(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* call) {
+    Error err = ok;
+    CodegenOptions* options = cg_context->options;
+    size_t argument_count = node_count_children(call->children->next_child);
+    size_t register_count = codegen_argument_register_count(options);
+    long long* pushed = calloc(argument_count + 1, sizeof(long long));
+    size_t pushed_count = 0;
+    size_t saved_count = 0;
+    unsigned long long saved = 0;
+    RegisterDescriptor descriptor = 0;
+
+    assert(pushed && "codegen_call_x86_64_mswin: could not allocate argument push list");
+
+    codegen_profile_call_site(code, cg_context, call);
+
+    for (Register* it = r; it; it = it->next, descriptor++) {
+        if (it->in_use) {
+            saved |= 1ull << descriptor;
+            saved_count++;
+            fprintf(code, "push %s\n", it->name);
+        }
+    }
+
+    err = codegen_compute_arguments(code, r, cg_context, context, call, 1, pushed, &pushed_count);
+    if (err.type) {
+        free(pushed);
+
+        return err;
+    }
+
+    long long reserved = codegen_shadow_bytes(options);
+
+    if (argument_count > register_count) {
+        reserved += (long long)(argument_count - register_count) * 8;
+    }
+
+    // The callee finds the stack as aligned as it was before the call.
+    if ((reserved + (long long)(saved_count + pushed_count) * 8) % 16) {
+        reserved += 8;
+    }
+
+    if (reserved) {
+        fprintf(code, "sub $%lld, %%rsp\n", reserved);
+    }
+
+    codegen_place_arguments(code, r, cg_context, call, pushed, pushed_count, reserved);
+    codegen_call_target_x86_64(code, cg_context, call);
+
+    if (reserved + (long long)pushed_count * 8) {
+        fprintf(code, "add $%lld, %%rsp\n", reserved + (long long)pushed_count * 8);
+    }
+
+    free(pushed);
+
+    call->result_register = register_allocate(r);
+    if (call->result_register < 0) {
+        ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+        return err;
+    }
+
+    char* result = register_name(r, call->result_register);
+
+    if (strcmp(result, "%rax")) {
+        fprintf(code, "mov %%rax, %s\n", result);
+    }
+
+    codegen_restore_registers(code, r, 0, saved);
+
+    return err;
+}
+
+// A call in tail position can reuse the caller's frame: a call of the
+// function itself writes the parameters and jumps back to its body, and a
+// call of any other is a jump once its arguments, which must all go in
+// registers, are loaded.
+int codegen_tail_callp(CodegenContext* cg_context, ParsingContext* context, Node* call) {
+    if (!cg_context->function || call->type != NODE_TYPE_FUNCTION_CALL || cg_context->closure_slots) {
+        return 0;
+    }
+
+    Node* callee = node_allocate(cg_context->allocator);
+    int status = environment_get_function(context, call->children, callee);
+
+    // Another function's result has to be what this one would return.
+    if (status && strcmp(call->children->value.symbol, cg_context->function_name)) {
+        status = node_count_children(call->children->next_child) <= codegen_argument_register_count(cg_context->options)
+            && type_layout_containsp(parse_type_layout(context, cg_context->function->children->next_child->value.symbol),
+                                     parse_type_layout(context, callee->children->next_child->value.symbol));
+    }
+
+    croc_release(cg_context->allocator, callee);
+
+    return status;
+}
+
+// Passing a parameter straight back into where it lives needs no store.
+int codegen_tail_argument_changesp(Node* argument, Node* parameter) {
+    return !symbolp(*argument) || !node_compare(argument, parameter->children);
+}
+
+// Self-recursion overwrites the parameters and jumps back to the body of the
+// current frame, so it runs as a loop. Every argument is computed before any
+// parameter is written, as arguments may read the parameters they replace;
+// all but the last changed one wait on the stack. A function that calls
+// itself makes calls, so its parameters all live in the frame.
+Error codegen_self_tail_call_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* call) {
+    Error err = ok;
+    size_t argument_count = node_count_children(call->children->next_child);
+    Node** pushed = calloc(argument_count + 1, sizeof(Node*));
+    size_t pushed_count = 0;
+    Node* last_changed = NULL;
+
+    assert(pushed && "codegen_self_tail_call_x86_64: could not allocate parameter list");
+
+    codegen_profile_call_site(code, cg_context, call);
+
+    Node* argument = call->children->next_child->children;
+    Node* parameter = cg_context->function->children->children;
+
+    while (argument) {
+        if (codegen_tail_argument_changesp(argument, parameter)) {
+            last_changed = argument;
+        }
+
+        argument = argument->next_child;
+        parameter = parameter->next_child;
+    }
+
+    argument = call->children->next_child->children;
+    parameter = cg_context->function->children->children;
+
+    while (last_changed) {
+        if (codegen_tail_argument_changesp(argument, parameter)) {
+            err = codegen_expression_x86_64_mswin(code, r, cg_context, context, argument);
+            if (err.type) { break; }
+
+            if (argument == last_changed) {
+                fprintf(code, "mov %s, %s\n", register_name(r, argument->result_register), variable_to_address(cg_context, parameter->children));
+                register_deallocate(r, argument->result_register);
+
+                break;
+            }
+
+            fprintf(code, "push %s\n", register_name(r, argument->result_register));
+            register_deallocate(r, argument->result_register);
+            pushed[pushed_count++] = parameter;
+        }
+
+        argument = argument->next_child;
+        parameter = parameter->next_child;
+    }
+
+    while (!err.type && pushed_count--) {
+        fprintf(code, "popq %s\n", variable_to_address(cg_context, pushed[pushed_count]->children));
+    }
+
+    free(pushed);
+
+    if (!err.type) {
+        fprintf(code, "jmp %s.body\n", cg_context->function_name);
+    }
+
+    return err;
+}
+
+// Load the arguments where the callee expects them and jump to it from the
+// caller's caller. Instrumentation clobbers the pool before the jump, so
+// then every argument waits on the stack.
+Error codegen_tail_call_x86_64_mswin(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* call) {
+    Error err = ok;
+    char* callee = call->children->value.symbol;
+    size_t argument_count = node_count_children(call->children->next_child);
+    long long* pushed = NULL;
+    size_t pushed_count = 0;
+
+    if (strcmp(callee, cg_context->function_name) == 0) {
+        return codegen_self_tail_call_x86_64(code, r, cg_context, context, call);
+    }
+
+    pushed = calloc(argument_count + 1, sizeof(long long));
+    assert(pushed && "codegen_tail_call_x86_64_mswin: could not allocate argument push list");
+
+    codegen_profile_call_site(code, cg_context, call);
+
+    err = codegen_compute_arguments(code, r, cg_context, context, call, cg_context->instrument_index < 0, pushed, &pushed_count);
+
+    if (!err.type) {
+        // The callee's cycles are its own, not the caller's.
+        codegen_instrument_exit(code, cg_context);
+        codegen_place_arguments(code, r, cg_context, call, pushed, pushed_count, 0);
+        // The frame is only gone on this path; the code after it still has
+        // one.
+        codegen_cfi(code, cg_context, ".cfi_remember_state\n");
+        codegen_epilogue(code, cg_context);
+        fprintf(code, "jmp %s\n", callee);
+        codegen_cfi(code, cg_context, ".cfi_restore_state\n");
+    }
+
+    free(pushed);
+
+    return err;
+}
+
+// Index of the single set bit of `value`, or -1 if it is not a power of two.
+int codegen_log2(unsigned long long value) {
+    if (!value || (value & (value - 1))) {
+        return -1;
+    }
+
+    int shift = 0;
+
+    while (value >>= 1) {
+        shift++;
+    }
+
+    return shift;
+}
+
+// Multiplications by constants become shifts, `lea` and additions where
+// those do it in fewer cycles than imul.
+void codegen_multiply_constant(FILE* code, char* result, long long constant) {
+    static const unsigned long long lea_factors[] = { 3, 5, 9 };
+    unsigned long long magnitude = constant < 0 ? 0ull - (unsigned long long)constant : (unsigned long long)constant;
+    int shift = codegen_log2(magnitude);
+    size_t factor = 0;
+
+    if (constant == 0) {
+        fprintf(code, "mov $0, %s\n", result);
+
+        return;
+    }
+
+    // A multiple of 3, 5 or 9 by a power of two is one lea and a shift.
+    while (shift < 0 && factor < sizeof(lea_factors) / sizeof(*lea_factors)) {
+        if (magnitude % lea_factors[factor] == 0 && (shift = codegen_log2(magnitude / lea_factors[factor])) >= 0) {
+            fprintf(code, "lea (%s,%s,%llu), %s\n", result, result, lea_factors[factor] - 1, result);
+        }
+
+        factor++;
+    }
+
+    if (shift < 0 && (shift = codegen_log2(magnitude - 1)) >= 0) {
+        fprintf(code, "mov %s, %%rdx\nsal $%d, %%rdx\nadd %%rdx, %s\n", result, shift, result);
+        shift = 0;
+    } else if (shift < 0 && (shift = codegen_log2(magnitude + 1)) >= 0) {
+        fprintf(code, "mov %s, %%rdx\nsal $%d, %%rdx\nsub %s, %%rdx\nmov %%rdx, %s\n", result, shift, result, result);
+        shift = 0;
+    } else if (shift < 0) {
+        if (codegen_imm32p(constant)) {
+            fprintf(code, "imul $%lld, %s, %s\n", constant, result, result);
+        } else {
+            fprintf(code, "movabs $%lld, %%rdx\nimul %%rdx, %s\n", constant, result);
+        }
+
+        return;
+    }
+
+    if (shift) {
+        fprintf(code, "sal $%d, %s\n", shift, result);
+    }
+
+    if (constant < 0) {
+        fprintf(code, "neg %s\n", result);
+    }
+}
+
+// Multiplier and shift that divide by `divisor` in a multiplication of the
+// high half, as in Hacker's Delight, 10-4. `divisor` is neither 0, 1, -1
+// nor LLONG_MIN.
+void codegen_division_magic(long long divisor, long long* multiplier, int* shift) {
+    const unsigned long long two63 = 1ull << 63;
+    unsigned long long magnitude = divisor < 0 ? 0ull - (unsigned long long)divisor : (unsigned long long)divisor;
+    unsigned long long t = two63 + ((unsigned long long)divisor >> 63);
+    unsigned long long anc = t - 1 - t % magnitude;
+    unsigned long long q1 = two63 / anc;
+    unsigned long long r1 = two63 - q1 * anc;
+    unsigned long long q2 = two63 / magnitude;
+    unsigned long long r2 = two63 - q2 * magnitude;
+    unsigned long long delta = 0;
+    int p = 63;
+
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+
+        q2 *= 2;
+        r2 *= 2;
+
+        if (r2 >= magnitude) {
+            q2++;
+            r2 -= magnitude;
+        }
+
+        delta = magnitude - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *multiplier = (long long)(q2 + 1);
+
+    if (divisor < 0) {
+        *multiplier = (long long)(0ull - (unsigned long long)*multiplier);
+    }
+
+    *shift = p - 64;
+}
+
+// Divide `result` by the register or memory `operand` with idiv, which
+// takes %rax and %rdx, saving %rax if another value lives in it.
+void codegen_divide_variable(FILE* code, Register* r, char* result, char* operand, int modulo) {
+    int save = register_in_usep(r, "%rax") && strcmp(result, "%rax") && strcmp(operand, "%rax");
+
+    if (strcmp(operand, "%rcx")) {
+        fprintf(code, "mov %s, %%rcx\n", operand);
+    }
+
+    if (save) {
+        fprintf(code, "push %%rax\n");
+    }
+
+    if (strcmp(result, "%rax")) {
+        fprintf(code, "mov %s, %%rax\n", result);
+    }
+
+    fprintf(code, "cqo\nidiv %%rcx\n");
+
+    if (modulo) {
+        fprintf(code, "mov %%rdx, %s\n", result);
+    } else if (strcmp(result, "%rax")) {
+        fprintf(code, "mov %%rax, %s\n", result);
+    }
+
+    if (save) {
+        fprintf(code, "pop %%rax\n");
+    }
+}
+
+// Division by a constant: powers of two are shifts, rounded toward zero by
+// adding the divisor less one to negative dividends first; any other
+// divisor is a multiplication by its magic number. Division by -1 keeps
+// idiv, so LLONG_MIN / -1 traps as it stops the VM.
+void codegen_divide_constant(FILE* code, Register* r, char* result, long long divisor, int modulo) {
+    unsigned long long magnitude = divisor < 0 ? 0ull - (unsigned long long)divisor : (unsigned long long)divisor;
+    int shift = codegen_log2(magnitude);
+
+    if (divisor == 1) {
+        if (modulo) {
+            fprintf(code, "mov $0, %s\n", result);
+        }
+
+        return;
+    }
+
+    if (divisor == 0 || divisor == -1 || divisor == LLONG_MIN) {
+        char operand[32];
+        snprintf(operand, sizeof(operand), "$%lld", divisor);
+        fprintf(code, "movabs %s, %%rcx\n", operand);
+        codegen_divide_variable(code, r, result, "%rcx", modulo);
+
+        return;
+    }
+
+    if (shift > 0) {
+        fprintf(code, "mov %s, %%rdx\nsar $63, %%rdx\nshr $%d, %%rdx\n", result, 64 - shift);
+
+        if (!modulo) {
+            fprintf(code, "add %%rdx, %s\nsar $%d, %s\n", result, shift, result);
+
+            if (divisor < 0) {
+                fprintf(code, "neg %s\n", result);
+            }
+
+            return;
+        }
+
+        fprintf(code, "lea (%s,%%rdx), %%rcx\n", result);
+
+        if (shift <= 31) {
+            fprintf(code, "and $%lld, %%rcx\n", -(1ll << shift));
+        } else {
+            fprintf(code, "sar $%d, %%rcx\nsal $%d, %%rcx\n", shift, shift);
+        }
+
+        fprintf(code, "sub %%rcx, %s\n", result);
+
+        return;
+    }
+
+    long long multiplier = 0;
+    int magic_shift = 0;
+    int save = register_in_usep(r, "%rax") && strcmp(result, "%rax");
+
+    codegen_division_magic(divisor, &multiplier, &magic_shift);
+
+    if (save) {
+        fprintf(code, "push %%rax\n");
+    }
+
+    fprintf(code, "mov %s, %%rcx\nmovabs $%lld, %%rax\nimul %%rcx\n", result, multiplier);
+
+    if (divisor > 0 && multiplier < 0) {
+        fprintf(code, "add %%rcx, %%rdx\n");
+    } else if (divisor < 0 && multiplier > 0) {
+        fprintf(code, "sub %%rcx, %%rdx\n");
+    }
+
+    if (magic_shift) {
+        fprintf(code, "sar $%d, %%rdx\n", magic_shift);
+    }
+
+    fprintf(code, "mov %%rdx, %%rax\nshr $63, %%rax\nadd %%rax, %%rdx\n");
+
+    if (modulo) {
+        if (codegen_imm32p(divisor)) {
+            fprintf(code, "imul $%lld, %%rdx, %%rdx\n", divisor);
+        } else {
+            fprintf(code, "movabs $%lld, %%rax\nimul %%rax, %%rdx\n", divisor);
+        }
+
+        fprintf(code, "sub %%rdx, %%rcx\nmov %%rcx, %s\n", result);
+    } else {
+        fprintf(code, "mov %%rdx, %s\n", result);
+    }
+
+    if (save) {
+        fprintf(code, "pop %%rax\n");
+    }
+}
+
+// Condition codes of the comparison operators, for set and jump.
+const char* codegen_conditions[BINARY_OPERATOR_COUNT] = {
+    [BINARY_OPERATOR_LESS] = "l",
+    [BINARY_OPERATOR_LESS_EQUAL] = "le",
+    [BINARY_OPERATOR_GREATER] = "g",
+    [BINARY_OPERATOR_GREATER_EQUAL] = "ge",
+    [BINARY_OPERATOR_EQUAL] = "e",
+    [BINARY_OPERATOR_NOT_EQUAL] = "ne",
+};
+
+// Apply `binary_operator` to `result` and `operand`, leaving the value in
+// `result`. `constant` is the operand's value if it is an integer. Given a
+// `branch` label, comparisons jump there if they hold instead.
+void codegen_binary_instruction(FILE* code, Register* r, int binary_operator, char* result, char* operand, Node* constant, char* branch) {
+    static const char* instructions[BINARY_OPERATOR_COUNT] = {
+        [BINARY_OPERATOR_ADD] = "add",
+        [BINARY_OPERATOR_SUBTRACT] = "sub",
+        [BINARY_OPERATOR_MULTIPLY] = "imul",
+        [BINARY_OPERATOR_SHIFT_LEFT] = "sal",
+        [BINARY_OPERATOR_SHIFT_RIGHT] = "sar",
+        [BINARY_OPERATOR_AND] = "and",
+        [BINARY_OPERATOR_OR] = "or",
+        [BINARY_OPERATOR_XOR] = "xor",
+    };
+
+    switch (binary_operator) {
+    default:
+        if (codegen_conditions[binary_operator] && branch) {
+            fprintf(code, "cmp %s, %s\nj%s %s\n", operand, result, codegen_conditions[binary_operator], branch);
+        } else if (codegen_conditions[binary_operator]) {
+            fprintf(code, "cmp %s, %s\nset%s %%dl\nmovzbq %%dl, %s\n", operand, result, codegen_conditions[binary_operator], result);
+        } else {
+            fprintf(code, "%s %s, %s\n", instructions[binary_operator], operand, result);
+        }
+
+        break;
+
+    case BINARY_OPERATOR_MULTIPLY:
+        if (constant) {
+            codegen_multiply_constant(code, result, constant->value.integer);
+        } else {
+            fprintf(code, "imul %s, %s\n", operand, result);
+        }
+
+        break;
+
+    case BINARY_OPERATOR_DIVIDE:
+    case BINARY_OPERATOR_MODULO:
+        if (constant) {
+            codegen_divide_constant(code, r, result, constant->value.integer, binary_operator == BINARY_OPERATOR_MODULO);
+        } else {
+            codegen_divide_variable(code, r, result, operand, binary_operator == BINARY_OPERATOR_MODULO);
+        }
+
+        break;
+
+    case BINARY_OPERATOR_SHIFT_LEFT:
+    case BINARY_OPERATOR_SHIFT_RIGHT:
+        if (constant) {
+            fprintf(code, "%s $%lld, %s\n", instructions[binary_operator], constant->value.integer & 63, result);
+        } else {
+            if (strcmp(operand, "%rcx")) {
+                fprintf(code, "mov %s, %%rcx\n", operand);
+            }
+
+            fprintf(code, "%s %%cl, %s\n", instructions[binary_operator], result);
+        }
+
+        break;
+    }
+}
+
+// The operand that needs more registers is evaluated first, when that
+// cannot change what either one reads. A second operand that needs more
+// registers than are left waits for it on the stack. `branch` is as for
+// codegen_binary_instruction().
+Error codegen_binary_operator_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* expression, char* branch) {
+    Error err = ok;
+    int binary_operator = (int)expression->value.integer;
+    Node* left = expression->children;
+    Node* right = left->next_child;
+    char buffer[32];
+
+    if (codegen_swap_operandsp(cg_context, expression)) {
+        Node* swap = left;
+        left = right;
+        right = swap;
+    }
+
+    if (codegen_direct_operandp(cg_context, right)) {
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, left);
+        if (err.type) { return err; }
+
+        char* result = register_name(r, left->result_register);
+        char* operand = codegen_direct_operand(code, cg_context, right, buffer, sizeof(buffer));
+
+        codegen_binary_instruction(code, r, binary_operator, result, operand, integerp(*right) ? right : NULL, branch);
+        expression->result_register = left->result_register;
+
+        return err;
+    }
+
+    Node* first = left;
+    Node* second = right;
+
+    if (codegen_reorderablep(cg_context, left, right) && codegen_register_need(cg_context, right) > codegen_register_need(cg_context, left)) {
+        first = right;
+        second = left;
+    }
+
+    err = codegen_expression_x86_64_mswin(code, r, cg_context, context, first);
+    if (err.type) { return err; }
+
+    if (codegen_register_need(cg_context, second) <= register_available(r)) {
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, second);
+        if (err.type) { return err; }
+
+        codegen_binary_instruction(code, r, binary_operator, register_name(r, left->result_register), register_name(r, right->result_register), NULL, branch);
+        register_deallocate(r, right->result_register);
+        expression->result_register = left->result_register;
+
+        return err;
+    }
+
+    fprintf(code, "push %s\n", register_name(r, first->result_register));
+    register_deallocate(r, first->result_register);
+
+    err = codegen_expression_x86_64_mswin(code, r, cg_context, context, second);
+    if (err.type) { return err; }
+
+    char* result = register_name(r, second->result_register);
+
+    // The left operand ends up in the second's register, the right one in
+    // %rcx.
+    fprintf(code, "pop %%rcx\n");
+
+    if (first == left) {
+        fprintf(code, "xchg %%rcx, %s\n", result);
+    }
+
+    codegen_binary_instruction(code, r, binary_operator, result, "%rcx", NULL, branch);
+    expression->result_register = second->result_register;
+
+    return err;
+}
+
+// Compare the index in the 64-bit register `index` to the length of the
+// array `access` reads or writes, unless the bounds pass proved it in
+// range. Negative indices are too large unsigned.
+void codegen_bounds_check(FILE* code, CodegenContext* cg_context, Node* access, long long length, const char* index) {
+    if (access->value.integer) {
+        return;
+    }
+
+    fprintf(code, "cmp $%lld, %s\njae %s\n", length, index, CODEGEN_BOUNDS_TRAP);
+    cg_context->scratch->bounds_checks++;
+}
+
+// Elements of a constant index proven in range are addressed from the
+// array's symbol; others from its address in %rcx, with the index scaled.
+// An index a loop or the calling convention keeps in a register is used
+// where it is. A store evaluates its index, then its value, keeping the
+// index in a register of the pool if that leaves enough for the value and
+// pushing it to pop into %rdx otherwise.
+Error codegen_index_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* access) {
+    Error err = ok;
+    Node* array = access->children;
+    Node* index = array->next_child;
+    Node* value = index->next_child;
+    TypeLayout element;
+    long long length = parse_array_layout(context, parse_variable_type(context, array), &element);
+    const char* index_register = NULL;
+    RegisterDescriptor index_descriptor = -1;
+    char operand[64];
+
+    if (!length) {
+        fprintf(diagnostic_stream(), "array: \"%s\"\n", array->value.symbol);
+        ERROR_PREP(err, ERROR_GENERIC, "reference to unknown array");
+
+        return err;
+    }
+
+    int constant = access->value.integer && integerp(*index);
+    // Narrowing leaves every constant of an element narrower than 64 bits
+    // fit the immediate of its width.
+    int immediate = value && integerp(*value) && (element.size < 8 || codegen_imm32p(value->value.integer));
+
+    if (!value && constant) {
+        access->result_register = register_allocate(r);
+        if (access->result_register < 0) {
+            ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+            return err;
+        }
+
+        codegen_extend(code, element, element_to_address(cg_context, array, index->value.integer * element.size), register_name(r, access->result_register));
+
+        return err;
+    }
+
+    if (!constant && symbolp(*index)) {
+        index_register = codegen_promoted_register(cg_context, index);
+
+        if (!index_register) {
+            index_register = codegen_parameter_register(cg_context, index);
+        }
+    }
+
+    if (!constant && !index_register) {
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, index);
+        if (err.type) { return err; }
+
+        index_descriptor = index->result_register;
+        index_register = register_name(r, index_descriptor);
+    }
+
+    if (!value) {
+        access->result_register = index_descriptor >= 0 ? index_descriptor : register_allocate(r);
+        if (access->result_register < 0) {
+            ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+            return err;
+        }
+
+        codegen_bounds_check(code, cg_context, access, length, index_register);
+        fprintf(code, "lea %s, %%rcx\n", symbol_to_address(cg_context, array));
+        snprintf(operand, sizeof(operand), "(%%rcx,%s,%lld)", index_register, element.size);
+        codegen_extend(code, element, operand, register_name(r, access->result_register));
+
+        return err;
+    }
+
+    if (!immediate) {
+        int pushed = index_descriptor >= 0 && codegen_register_need(cg_context, value) > register_available(r);
+
+        if (pushed) {
+            fprintf(code, "push %s\n", index_register);
+            register_deallocate(r, index_descriptor);
+            index_descriptor = -1;
+            index_register = "%rdx";
+        }
+
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, value);
+        if (err.type) { return err; }
+
+        if (pushed) {
+            fprintf(code, "pop %%rdx\n");
+        }
+    }
+
+    char* source = NULL;
+
+    if (immediate) {
+        snprintf(operand, sizeof(operand), "$%lld", type_layout_narrow(element, value->value.integer));
+        source = operand;
+    } else {
+        source = (char*)codegen_register_part(register_name(r, value->result_register), element.size);
+    }
+
+    if (constant) {
+        fprintf(code, "mov%c %s, %s\n", codegen_size_suffix(element.size), source, element_to_address(cg_context, array, index->value.integer * element.size));
+    } else {
+        codegen_bounds_check(code, cg_context, access, length, index_register);
+        fprintf(code, "lea %s, %%rcx\n", symbol_to_address(cg_context, array));
+        fprintf(code, "mov%c %s, (%%rcx,%s,%lld)\n", codegen_size_suffix(element.size), source, index_register, element.size);
+    }
+
+    if (!immediate) {
+        register_deallocate(r, value->result_register);
+    }
+
+    if (index_descriptor >= 0) {
+        register_deallocate(r, index_descriptor);
+    }
+
+    return err;
+}
+
+// Statements leave their value, if any, in a register; everything but the
+// last statement of a body is discarded.
+void codegen_discard_result(Register* r, Node* expression) {
+    if (expression->result_register >= 0) {
+        register_deallocate(r, expression->result_register);
+    }
+}
+
+// `x := x op y` updates `x` where it lives for the operators with an x86
+// instruction that does, as long as `y` needs no register of its own. A
+// variable narrower than 64 bits is only updated in place in memory of its
+// width, which wraps around the way narrowing would.
+int codegen_update_in_place(FILE* code, CodegenContext* cg_context, ParsingContext* context, Node* reassignment) {
+    static const char* instructions[BINARY_OPERATOR_COUNT] = {
+        [BINARY_OPERATOR_ADD] = "add",
+        [BINARY_OPERATOR_SUBTRACT] = "sub",
+        [BINARY_OPERATOR_AND] = "and",
+        [BINARY_OPERATOR_OR] = "or",
+        [BINARY_OPERATOR_XOR] = "xor",
+    };
+    Node* target = reassignment->children;
+    Node* value = target->next_child;
+    Node* operand = NULL;
+    char buffer[32];
+
+    if (value->type != NODE_TYPE_BINARY_OPERATOR || !instructions[value->value.integer] || codegen_promoted_register(cg_context, value)) {
+        return 0;
+    }
+
+    Node* left = value->children;
+    Node* right = left->next_child;
+
+    if (symbolp(*left) && strcmp(left->value.symbol, target->value.symbol) == 0) {
+        operand = right;
+    } else if (binary_operator_commutativep((int)value->value.integer) && symbolp(*right) && strcmp(right->value.symbol, target->value.symbol) == 0) {
+        operand = left;
+    }
+
+    if (!operand || !codegen_direct_operandp(cg_context, operand)) {
+        return 0;
+    }
+
+    TypeLayout layout = parse_type_layout(context, reassignment->value.symbol);
+    const TypeLayout* narrow = codegen_narrow_global(cg_context, target);
+    char* destination = narrow ? symbol_to_address(cg_context, target) : variable_to_address(cg_context, target);
+
+    // Registers and the frame keep narrow values extended to 64 bits,
+    // which updating them in place would not.
+    if (layout.size < 8 && !narrow) {
+        return 0;
+    }
+
+    // No instruction takes two memory operands.
+    if (strchr(destination, '(') && symbolp(*operand) && !codegen_promoted_register(cg_context, operand)) {
+        return 0;
+    }
+
+    char* source = NULL;
+
+    if (!narrow) {
+        source = codegen_direct_operand(code, cg_context, operand, buffer, sizeof(buffer));
+    } else if (integerp(*operand)) {
+        snprintf(buffer, sizeof(buffer), "$%lld", type_layout_narrow(*narrow, operand->value.integer));
+        source = buffer;
+    } else {
+        source = (char*)codegen_register_part(codegen_direct_operand(code, cg_context, operand, buffer, sizeof(buffer)), narrow->size);
+    }
+
+    fprintf(code, "%s%c %s, %s\n", instructions[value->value.integer], codegen_size_suffix(layout.size), source, destination);
+
+    return 1;
+}
+
+// Jump to `label` if `condition` holds. Comparisons jump on their flags,
+// straight from where their operands live if they can.
+Error codegen_branch_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* condition, char* label) {
+    Error err = ok;
+    char left_buffer[32];
+    char right_buffer[32];
+
+    codegen_debug_location(code, cg_context, condition);
+
+    if (integerp(*condition)) {
+        if (condition->value.integer) {
+            fprintf(code, "jmp %s\n", label);
+        }
+
+        return err;
+    }
+
+    if (condition->type == NODE_TYPE_BINARY_OPERATOR && codegen_conditions[condition->value.integer] && !codegen_promoted_register(cg_context, condition)) {
+        Node* left = condition->children;
+        Node* right = left->next_child;
+
+        if (!integerp(*left) && codegen_direct_operandp(cg_context, left) && codegen_direct_operandp(cg_context, right)
+            && !(strchr(variable_to_address(cg_context, left), '(') && symbolp(*right) && !codegen_promoted_register(cg_context, right))) {
+            char* left_operand = codegen_direct_operand(code, cg_context, left, left_buffer, sizeof(left_buffer));
+            char* right_operand = codegen_direct_operand(code, cg_context, right, right_buffer, sizeof(right_buffer));
+
+            fprintf(code, "cmpq %s, %s\nj%s %s\n", right_operand, left_operand, codegen_conditions[condition->value.integer], label);
+
+            return err;
+        }
+
+        err = codegen_binary_operator_x86_64(code, r, cg_context, context, condition, label);
+        if (err.type) { return err; }
+
+        register_deallocate(r, condition->result_register);
+
+        return err;
+    }
+
+    if (codegen_direct_operandp(cg_context, condition)) {
+        fprintf(code, "cmpq $0, %s\njne %s\n", codegen_direct_operand(code, cg_context, condition, left_buffer, sizeof(left_buffer)), label);
+
+        return err;
+    }
+
+    err = codegen_expression_x86_64_mswin(code, r, cg_context, context, condition);
+    if (err.type) { return err; }
+
+    char* result = register_name(r, condition->result_register);
+
+    fprintf(code, "test %s, %s\njnz %s\n", result, result, label);
+    register_deallocate(r, condition->result_register);
+
+    return err;
+}
+
+// Callee-saved on both targets, so they survive the calls in a loop, and
+// used by nothing else codegen emits.
+const char* codegen_promotion_registers[CODEGEN_PROMOTION_MAX] = { "%rbx", "%r12", "%r13", "%r14", "%r15" };
+
+// Uses inside a nested loop count this many times as much as the uses
+// around it.
+#define CODEGEN_LOOP_NESTING_WEIGHT 8
+
+typedef struct CodegenLoopName {
+    char* name;
+    int declared;
+} CodegenLoopName;
+
+typedef struct CodegenLoopCandidate {
+    Node* node;
+    size_t weight;
+} CodegenLoopCandidate;
+
+// What a loop, nested loops included, assigns and declares, whether it
+// makes calls, and what it could keep in registers.
+typedef struct CodegenLoop {
+    CodegenLoopName* names;
+    size_t name_count;
+    size_t name_capacity;
+    int calls;
+
+    CodegenLoopCandidate* candidates;
+    size_t candidate_count;
+    size_t candidate_capacity;
+} CodegenLoop;
+
+CodegenLoopName* codegen_loop_name(CodegenLoop* loop, char* name) {
+    for (size_t i = 0; i < loop->name_count; ++i) {
+        if (strcmp(loop->names[i].name, name) == 0) {
+            return loop->names + i;
+        }
+    }
+
+    return NULL;
+}
+
+void codegen_loop_effects(CodegenLoop* loop, Node* node) {
+    CodegenLoopName* name = NULL;
+
+    switch (node->type) {
+    default:
+        break;
+
+    // A function or lambda defined in the loop only runs when called.
+    case NODE_TYPE_FUNCTION:
+    case NODE_TYPE_LAMBDA:
+        return;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        loop->calls = 1;
+
+        for (Node* argument = node->children->next_child->children; argument; argument = argument->next_child) {
+            codegen_loop_effects(loop, argument);
+        }
+
+        return;
+
+    case NODE_TYPE_VARIABLE_DECLARATION:
+    case NODE_TYPE_VARIABLE_REASSIGNMENT:
+        name = codegen_loop_name(loop, node->children->value.symbol);
+
+        if (!name) {
+            if (loop->name_count == loop->name_capacity) {
+                loop->name_capacity = loop->name_capacity ? loop->name_capacity * 2 : 16;
+                loop->names = realloc(loop->names, loop->name_capacity * sizeof(CodegenLoopName));
+                assert(loop->names && "codegen_loop_effects: could not allocate memory for assigned names");
+            }
+
+            name = loop->names + loop->name_count++;
+            name->name = node->children->value.symbol;
+            name->declared = 0;
+        }
+
+        name->declared |= node->type == NODE_TYPE_VARIABLE_DECLARATION;
+
+        codegen_loop_effects(loop, node->children->next_child);
+
+        return;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        codegen_loop_effects(loop, child);
+    }
+}
+
+int codegen_localp(CodegenContext* cg_context, Node* symbol) {
+    Node* offset = node_allocate(cg_context->allocator);
+    int status = environment_get(*cg_context->locals, symbol, offset);
+
+    croc_release(cg_context->allocator, offset);
+
+    return status;
+}
+
+// A variable the loop declares lives and dies inside it. A global may be
+// read and written by the functions the loop calls.
+int codegen_loop_promotablep(CodegenContext* cg_context, CodegenLoop* loop, Node* symbol) {
+    CodegenLoopName* name = codegen_loop_name(loop, symbol->value.symbol);
+
+    return !(name && name->declared) && (!loop->calls || codegen_localp(cg_context, symbol));
+}
+
+// Whether `node` has the same value every time the loop evaluates it. Only
+// division by a constant other than zero and -1 is moved, as the loop might
+// never have evaluated one that traps.
+int codegen_loop_invariantp(CodegenContext* cg_context, CodegenLoop* loop, Node* node) {
+    Node* right = NULL;
+
+    switch (node->type) {
+    default:
+        return 0;
+
+    case NODE_TYPE_INTEGER:
+        return 1;
+
+    case NODE_TYPE_SYMBOL:
+        return !codegen_loop_name(loop, node->value.symbol) && codegen_loop_promotablep(cg_context, loop, node);
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        right = node->children->next_child;
+
+        if ((node->value.integer == BINARY_OPERATOR_DIVIDE || node->value.integer == BINARY_OPERATOR_MODULO)
+            && !(integerp(*right) && right->value.integer != 0 && right->value.integer != -1)) {
+            return 0;
+        }
+
+        return codegen_loop_invariantp(cg_context, loop, node->children) && codegen_loop_invariantp(cg_context, loop, right);
+    }
+}
+
+void codegen_loop_candidate(CodegenLoop* loop, Node* node, size_t weight) {
+    for (size_t i = 0; i < loop->candidate_count; ++i) {
+        Node* candidate = loop->candidates[i].node;
+
+        if (candidate->type == node->type && (symbolp(*node) ? strcmp(candidate->value.symbol, node->value.symbol) == 0 : node_compare(candidate, node))) {
+            loop->candidates[i].weight += weight;
+
+            return;
+        }
+    }
+
+    if (loop->candidate_count == loop->candidate_capacity) {
+        loop->candidate_capacity = loop->candidate_capacity ? loop->candidate_capacity * 2 : 16;
+        loop->candidates = realloc(loop->candidates, loop->candidate_capacity * sizeof(CodegenLoopCandidate));
+        assert(loop->candidates && "codegen_loop_candidate: could not allocate memory for candidates");
+    }
+
+    loop->candidates[loop->candidate_count].node = node;
+    loop->candidates[loop->candidate_count].weight = weight;
+    loop->candidate_count++;
+}
+
+// Collect the variables and the largest loop-invariant expressions in
+// `node`, weighed by how often they are used.
+void codegen_loop_candidates(CodegenContext* cg_context, CodegenLoop* loop, Node* node, size_t weight) {
+    switch (node->type) {
+    default:
+        break;
+
+    case NODE_TYPE_FUNCTION:
+    case NODE_TYPE_LAMBDA:
+        return;
+
+    case NODE_TYPE_SYMBOL:
+        // A parameter left in its register gains nothing from another.
+        if (!codegen_promoted_register(cg_context, node) && !codegen_parameter_register(cg_context, node)
+            && codegen_loop_promotablep(cg_context, loop, node)) {
+            codegen_loop_candidate(loop, node, weight);
+        }
+
+        return;
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        if (codegen_promoted_register(cg_context, node)) {
+            return;
+        }
+
+        if (codegen_loop_invariantp(cg_context, loop, node)) {
+            codegen_loop_candidate(loop, node, weight);
+
+            return;
+        }
+
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        for (Node* argument = node->children->next_child->children; argument; argument = argument->next_child) {
+            codegen_loop_candidates(cg_context, loop, argument, weight);
+        }
+
+        return;
+
+    // The array itself stays in memory.
+    case NODE_TYPE_INDEX:
+        for (Node* child = node->children->next_child; child; child = child->next_child) {
+            codegen_loop_candidates(cg_context, loop, child, weight);
+        }
+
+        return;
+
+    case NODE_TYPE_WHILE:
+        if (weight <= SIZE_MAX / CODEGEN_LOOP_NESTING_WEIGHT) {
+            weight *= CODEGEN_LOOP_NESTING_WEIGHT;
+        }
+
+        break;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        codegen_loop_candidates(cg_context, loop, child, weight);
+    }
+}
+
+int codegen_loop_candidate_compare(const void* a, const void* b) {
+    size_t weight_a = ((const CodegenLoopCandidate*)a)->weight;
+    size_t weight_b = ((const CodegenLoopCandidate*)b)->weight;
+
+    return (weight_a < weight_b) - (weight_a > weight_b);
+}
+
+size_t codegen_count_calls(Node* node) {
+    size_t count = node->type == NODE_TYPE_FUNCTION_CALL;
+
+    if (node->type == NODE_TYPE_FUNCTION || node->type == NODE_TYPE_LAMBDA) {
+        return 0;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        count += codegen_count_calls(child);
+    }
+
+    return count;
+}
+
+// Slots the closures `node` builds in the frame take. Functions and lambdas
+// defined in it build theirs in frames of their own.
+size_t codegen_count_closure_slots(Node* node) {
+    size_t count = 0;
+
+    if (node->type == NODE_TYPE_FUNCTION) {
+        return 0;
+    }
+
+    if (node->type == NODE_TYPE_LAMBDA) {
+        return closure_placement(node) == CLOSURE_STACK ? 1 + node_count_children(closure_captures(node)) : 0;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        count += codegen_count_closure_slots(child);
+    }
+
+    return count;
+}
+
+// Loops keep the variables and loop-invariant expressions they use most in
+// callee-saved registers, loaded and computed before the loop starts and
+// stored back after it ends, and test their condition at the bottom, after
+// a jump to it on entry.
+Error codegen_while_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* expression) {
+    Error err = ok;
+    CodegenLoop loop;
+    char body_label[32];
+    char test_label[32];
+    size_t first = cg_context->promotion_count;
+    size_t count = 0;
+    long long saved_bytes = 0;
+
+    memset(&loop, 0, sizeof(CodegenLoop));
+    codegen_loop_effects(&loop, expression);
+
+    for (Node* child = expression->children; child; child = child->next_child) {
+        codegen_loop_candidates(cg_context, &loop, child, 1);
+    }
+
+    if (loop.candidate_count) {
+        qsort(loop.candidates, loop.candidate_count, sizeof(CodegenLoopCandidate), codegen_loop_candidate_compare);
+    }
+
+    count = loop.candidate_count < CODEGEN_PROMOTION_MAX - first ? loop.candidate_count : CODEGEN_PROMOTION_MAX - first;
+    // Calls in the loop find the stack as aligned as before it.
+    saved_bytes = (long long)(count + count % 2) * 8;
+
+    for (size_t i = 0; i < count; ++i) {
+        const char* name = codegen_promotion_registers[first + i];
+
+        fprintf(code, "push %s\n", name);
+
+        if (codegen_cfip(cg_context)) {
+            fprintf(code, ".cfi_offset %s, %lld\n", name, -(cg_context->frame_size + cg_context->loop_saved_bytes + (long long)(i + 1) * 8 + 16));
+        }
+    }
+
+    if (count % 2) {
+        fprintf(code, "sub $8, %%rsp\n");
+    }
+
+    cg_context->loop_saved_bytes += saved_bytes;
+
+    // Variables first, as the hoisted expressions may read them.
+    for (size_t i = 0; i < count; ++i) {
+        if (symbolp(*loop.candidates[i].node)) {
+            codegen_load_variable(code, cg_context, loop.candidates[i].node, codegen_promotion_registers[cg_context->promotion_count]);
+
+            cg_context->promotions[cg_context->promotion_count].node = loop.candidates[i].node;
+            cg_context->promotions[cg_context->promotion_count].register_name = codegen_promotion_registers[cg_context->promotion_count];
+            cg_context->promotion_count++;
+        }
+    }
+
+    for (size_t i = 0; i < count && !err.type; ++i) {
+        Node* hoisted = loop.candidates[i].node;
+
+        if (symbolp(*hoisted)) {
+            continue;
+        }
+
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, hoisted);
+        if (err.type) { break; }
+
+        fprintf(code, "mov %s, %s\n", register_name(r, hoisted->result_register), codegen_promotion_registers[cg_context->promotion_count]);
+        register_deallocate(r, hoisted->result_register);
+
+        cg_context->promotions[cg_context->promotion_count].node = hoisted;
+        cg_context->promotions[cg_context->promotion_count].register_name = codegen_promotion_registers[cg_context->promotion_count];
+        cg_context->promotion_count++;
+    }
+
+    snprintf(body_label, sizeof(body_label), "%s", label_generate(cg_context));
+    snprintf(test_label, sizeof(test_label), "%s", label_generate(cg_context));
+
+    // Call sites are numbered in source order, condition first.
+    size_t condition_call = cg_context->call_count;
+    cg_context->call_count += codegen_count_calls(expression->children);
+
+    if (!err.type) {
+        fprintf(code, "jmp %s\n%s:\n", test_label, body_label);
+    }
+
+    cg_context->loop_depth++;
+
+    for (Node* statement = expression->children->next_child->children; statement && !err.type; statement = statement->next_child) {
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, statement);
+        if (err.type) { break; }
+
+        codegen_discard_result(r, statement);
+    }
+
+    if (!err.type && expression->children->next_child->next_child) {
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression->children->next_child->next_child);
+        codegen_discard_result(r, expression->children->next_child->next_child);
+    }
+
+    cg_context->loop_depth--;
+
+    size_t after_loop_call = cg_context->call_count;
+    cg_context->call_count = condition_call;
+
+    if (!err.type) {
+        fprintf(code, "%s:\n", test_label);
+        err = codegen_branch_x86_64(code, r, cg_context, context, expression->children, body_label);
+    }
+
+    cg_context->call_count = after_loop_call;
+
+    // The variables the loop changed go back where they live.
+    size_t promoted = cg_context->promotion_count;
+    cg_context->promotion_count = first;
+
+    for (size_t i = first; i < promoted && !err.type; ++i) {
+        Node* node = cg_context->promotions[i].node;
+
+        if (symbolp(*node) && codegen_loop_name(&loop, node->value.symbol)) {
+            codegen_store_variable(code, cg_context, node, cg_context->promotions[i].register_name);
+        }
+    }
+
+    if (count % 2) {
+        fprintf(code, "add $8, %%rsp\n");
+    }
+
+    for (size_t i = count; i-- > 0;) {
+        fprintf(code, "pop %s\n", codegen_promotion_registers[first + i]);
+
+        if (codegen_cfip(cg_context)) {
+            fprintf(code, ".cfi_restore %s\n", codegen_promotion_registers[first + i]);
+        }
+    }
+
+    cg_context->loop_saved_bytes -= saved_bytes;
+
+    free(loop.candidates);
+    free(loop.names);
+
+    return err;
+}
+
+void codegen_lambda_add(CodegenScratch* scratch, Node* lambda) {
+    for (size_t i = 0; i < scratch->lambda_count; ++i) {
+        if (scratch->lambdas[i] == lambda) {
+            return;
+        }
+    }
+
+    if (scratch->lambda_count == scratch->lambda_capacity) {
+        scratch->lambda_capacity = scratch->lambda_capacity ? scratch->lambda_capacity * 2 : 16;
+        scratch->lambdas = realloc(scratch->lambdas, scratch->lambda_capacity * sizeof(Node*));
+        assert(scratch->lambdas && "codegen_lambda_add: could not allocate memory for lambdas");
+    }
+
+    scratch->lambdas[scratch->lambda_count++] = lambda;
+}
+
+// Build the closure of `lambda` where closure analysis placed it: the
+// label of its body, then the values it captures. A closure that captures
+// nothing is built once, in the data section.
+Error codegen_lambda_x86_64(FILE* code, Register* r, CodegenContext* cg_context, Node* lambda) {
+    Error err = ok;
+    Node* captures = closure_captures(lambda);
+    long long size = (long long)(node_count_children(captures) + 1) * 8;
+    long long index = 1;
+    int saved = 0;
+
+    codegen_lambda_add(cg_context->scratch, lambda);
+
+    lambda->result_register = register_allocate(r);
+    if (lambda->result_register < 0) {
+        ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+        return err;
+    }
+
+    char* result = register_name(r, lambda->result_register);
+
+    switch (closure_placement(lambda)) {
+    case CLOSURE_STATIC:
+        fprintf(code, "lea %s.closure(%%rip), %s\n", lambda->value.symbol, result);
+
+        return err;
+
+    case CLOSURE_STACK:
+        cg_context->locals_offset -= size;
+        fprintf(code, "lea %s, %s\n", local_to_address(cg_context, cg_context->locals_offset), result);
+
+        break;
+
+    case CLOSURE_HEAP:
+        saved = strcmp(result, "%rax") && register_in_usep(r, "%rax");
+
+        if (saved) {
+            fprintf(code, "push %%rax\n");
+        }
+
+        fprintf(code, "mov $%lld, %%rax\ncall %s\n", size, CODEGEN_CLOSURE_ALLOCATE);
+
+        if (strcmp(result, "%rax")) {
+            fprintf(code, "mov %%rax, %s\n", result);
+        }
+
+        if (saved) {
+            fprintf(code, "pop %%rax\n");
+        }
+
+        cg_context->scratch->closure_allocations = 1;
+
+        break;
+    }
+
+    fprintf(code, "lea %s(%%rip), %%rdx\nmov %%rdx, (%s)\n", lambda->value.symbol, result);
+
+    for (Node* capture = captures->children; capture; capture = capture->next_child, index++) {
+        codegen_load_variable(code, cg_context, capture, "%rdx");
+        fprintf(code, "mov %%rdx, %lld(%s)\n", index * 8, result);
+    }
+
+    return err;
+}
+
+Error codegen_expression_x86_64_mswin(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context, Node* expression) {
+    Error err = ok;
+    char* result = NULL;
+    TypeLayout element;
+
+    expression->result_register = -1;
+
+    codegen_debug_location(code, cg_context, expression);
+
+    // A loop computed this before it started.
+    if (expression->type == NODE_TYPE_BINARY_OPERATOR && (result = (char*)codegen_promoted_register(cg_context, expression))) {
+        expression->result_register = register_allocate(r);
+        if (expression->result_register < 0) {
+            ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+            return err;
+        }
+
+        fprintf(code, "mov %s, %s\n", result, register_name(r, expression->result_register));
+
+        return err;
+    }
+
+    switch (expression->type) {
+    default:
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        if (!cg_context->parent) { break; }
+
+        result = label_generate(cg_context);
+        err = codegen_function_x86_64_att_mswin(r, cg_context, context, result, expression, code);
+
+        if (err.type) { return err; }
+
+        break;
+
+    case NODE_TYPE_LAMBDA:
+        err = codegen_lambda_x86_64(code, r, cg_context, expression);
+
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        err = codegen_call_x86_64_mswin(code, r, cg_context, context, expression);
+
+        break;
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        err = codegen_binary_operator_x86_64(code, r, cg_context, context, expression, NULL);
+
+        break;
+
+    case NODE_TYPE_WHILE:
+        err = codegen_while_x86_64(code, r, cg_context, context, expression);
+
+        break;
+
+    case NODE_TYPE_INDEX:
+        err = codegen_index_x86_64(code, r, cg_context, context, expression);
+
+        break;
+
+    case NODE_TYPE_INTEGER:
+        expression->result_register = register_allocate(r);
+        if (expression->result_register < 0) {
+            ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+            break;
+        }
+
+        fprintf(code, "mov $%lld, %s\n", expression->value.integer, register_name(r, expression->result_register));
+
+        break;
+
+    case NODE_TYPE_SYMBOL:
+        expression->result_register = register_allocate(r);
+        if (expression->result_register < 0) {
+            ERROR_PREP(err, ERROR_GENERIC, CODEGEN_REGISTERS_EXHAUSTED);
+
+            break;
+        }
+
+        codegen_load_variable(code, cg_context, expression, register_name(r, expression->result_register));
+
+        break;
+
+    case NODE_TYPE_VARIABLE_DECLARATION:
+        if (!cg_context->parent) {
+            // Arrays start zeroed in .bss and are never initialized.
+            if (parse_array_layout(context, expression->value.symbol, &element)) { break; }
+
+            // Constant initializers of globals are already in the data
+            // section, unless a loop runs them again.
+            if (!cg_context->loop_depth && (integerp(*expression->children->next_child) || nonep(*expression->children->next_child))) { break; }
+
+            if (nonep(*expression->children->next_child)) {
+                codegen_assign_constant(code, cg_context, context, expression, 0);
+
+                break;
+            }
+
+            err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression->children->next_child);
+            if (err.type) { break; }
+
+            codegen_assign(code, cg_context, context, expression, register_name(r, expression->children->next_child->result_register));
+            register_deallocate(r, expression->children->next_child->result_register);
+
+            break;
+        }
+
+        // Locals take eight bytes whatever their type, holding their value
+        // extended to 64 bits.
+        cg_context->locals_offset -= 8;
+        environment_set(cg_context->locals, expression->children, node_integer(cg_context->allocator, cg_context->locals_offset));
+
+        if (nonep(*expression->children->next_child)) {
+            codegen_assign_constant(code, cg_context, context, expression, 0);
+
+            break;
+        }
+
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression->children->next_child);
+        if (err.type) { break; }
+
+        codegen_assign(code, cg_context, context, expression, register_name(r, expression->children->next_child->result_register));
+        register_deallocate(r, expression->children->next_child->result_register);
+
+        break;
+
+    case NODE_TYPE_VARIABLE_REASSIGNMENT:
+        if (codegen_update_in_place(code, cg_context, context, expression)) {
+            break;
+        }
+
+        if (integerp(*expression->children->next_child) && codegen_imm32p(expression->children->next_child->value.integer)) {
+            codegen_assign_constant(code, cg_context, context, expression, expression->children->next_child->value.integer);
+        } else {
+            err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression->children->next_child);
+            if (err.type) { break; }
+
+            codegen_assign(code, cg_context, context, expression, register_name(r, expression->children->next_child->result_register));
+            register_deallocate(r, expression->children->next_child->result_register);
+        }
+
+        break;
+    }
+
+    return err;
+}
+
+// Leave the value of the last statement of a body in %rax, or zero if it has
+// none.
+void codegen_return_result(FILE* code, Register* r, Node* expression) {
+    if (!expression || expression->result_register < 0) {
+        fprintf(code, "mov $0, %%rax\n");
+
+        return;
+    }
+
+    char* name = register_name(r, expression->result_register);
+    if (strcmp(name, "%rax")) {
+        fprintf(code, "mov %s, %%rax\n", name);
+    }
+
+    register_deallocate(r, expression->result_register);
+}
+
+Error codegen_function_x86_64_att_mswin(Register* r, CodegenContext* cg_context, ParsingContext* context, char* name, Node* function, FILE* code) {
+    Error err = ok;
+    int top_level = !cg_context->parent;
+    size_t depth = 0;
+    size_t debug_line = cg_context->scratch->debug_line;
+
+    for (CodegenContext* it = cg_context; it; it = it->parent) {
+        depth += it->function != NULL;
+    }
+
+    cg_context = codegen_context_create(cg_context->allocator, cg_context);
+    cg_context->function = function;
+    cg_context->function_name = name;
+
+    if (top_level && cg_context->options->instrument) {
+        cg_context->instrument_index = (long long)profile_counter_add(cg_context->instrumented_functions, name);
+        cg_context->locals_offset = -INSTRUMENT_FRAME_SIZE;
+    }
+
+    Node* expression = function->children->next_child->next_child->children;
+    CodegenOptions* options = cg_context->options;
+    size_t register_count = codegen_argument_register_count(options);
+    size_t calls = 0;
+    size_t index = 0;
+
+    for (Node* it = expression; it; it = it->next_child) {
+        calls += codegen_count_calls(it);
+    }
+
+    // Parameters stay in the registers they arrive in unless a call, or the
+    // division and wide constants that go through %rcx and %rdx, could
+    // clobber them. The others are stored on entry, on Windows to the shadow
+    // space above the return address, and parameters past the registers are
+    // on the stack above that.
+    for (Node* parameter = function->children->children; parameter; parameter = parameter->next_child, index++) {
+        const char* name = index < register_count ? codegen_argument_register(options, index) : NULL;
+        long long offset = 0;
+
+        if (!name) {
+            offset = 16 + codegen_shadow_bytes(options) + (long long)(index - register_count) * 8;
+        } else if (!calls && strcmp(name, "%rcx") && strcmp(name, "%rdx")) {
+            cg_context->parameter_registers[cg_context->parameter_register_count].node = parameter->children;
+            cg_context->parameter_registers[cg_context->parameter_register_count].register_name = name;
+            cg_context->parameter_register_count++;
+        } else if (codegen_shadow_bytes(options)) {
+            offset = 16 + (long long)index * 8;
+        } else {
+            cg_context->locals_offset -= 8;
+            offset = cg_context->locals_offset;
+        }
+
+        environment_set(cg_context->locals, parameter->children, node_integer(cg_context->allocator, offset));
+    }
+
+    // A lambda copies the values it captures out of its closure, which
+    // arrives in %r10, to slots of its own.
+    if (function->type == NODE_TYPE_LAMBDA) {
+        for (Node* capture = closure_captures(function)->children; capture; capture = capture->next_child) {
+            cg_context->locals_offset -= 8;
+            environment_set(cg_context->locals, capture, node_integer(cg_context->allocator, cg_context->locals_offset));
+        }
+    }
+
+    for (Node* it = expression; it; it = it->next_child) {
+        cg_context->closure_slots += codegen_count_closure_slots(it);
+    }
+
+    // Locals and the closures built in the frame sit directly below the
+    // saved frame pointer. Calls reserve the stack their arguments need
+    // themselves.
+    long long frame_size = -cg_context->locals_offset + (long long)(codegen_count_locals(expression) + cg_context->closure_slots) * 8;
+    if (frame_size % 16) {
+        frame_size += 8;
+    }
+
+    fprintf(code, "jmp after%s\n", name);
+
+    if (top_level && cg_context->options->module && function->type == NODE_TYPE_FUNCTION) {
+        fprintf(code, ".global %s\n", name);
+    }
+
+    // A function defined in another is generated in the middle of it, but
+    // the assembler keeps call frame information for one function at a
+    // time per subsection.
+    if (depth && codegen_cfip(cg_context)) {
+        fprintf(code, ".subsection %zu\n", depth);
+    }
+
+    fprintf(code, "%s:\n", name);
+    cg_context->scratch->debug_line = 0;
+    codegen_debug_location(code, cg_context, function);
+    codegen_prologue(code, cg_context, frame_size);
+
+    index = 0;
+
+    for (Node* parameter = function->children->children; parameter && index < register_count; parameter = parameter->next_child, index++) {
+        if (!codegen_parameter_register(cg_context, parameter->children)) {
+            fprintf(code, "mov %s, %s\n", codegen_argument_register(options, index), variable_to_address(cg_context, parameter->children));
+        }
+    }
+
+    if (function->type == NODE_TYPE_LAMBDA) {
+        index = 1;
+
+        for (Node* capture = closure_captures(function)->children; capture; capture = capture->next_child, index++) {
+            fprintf(code, "mov %zu(%%r10), %%r11\nmov %%r11, %s\n", index * 8, variable_to_address(cg_context, capture));
+        }
+    }
+
+    codegen_profile_counter(code, cg_context, name);
+    codegen_instrument_entry(code, cg_context);
+    fprintf(code, "%s.body:\n", name);
+
+    // Arguments arrive as 64 bits, so parameters of narrower types are
+    // narrowed where they live, here where self tail calls jump back to as
+    // well. Nothing is live in %rax yet.
+    for (Node* parameter = function->children->children; parameter; parameter = parameter->next_child) {
+        TypeLayout layout = parse_type_layout(context, parameter->children->next_child->value.symbol);
+        const char* kept = codegen_parameter_register(cg_context, parameter->children);
+
+        if (layout.size >= 8) {
+            continue;
+        }
+
+        if (kept) {
+            codegen_narrow_register(code, layout, kept);
+        } else {
+            char* address = variable_to_address(cg_context, parameter->children);
+
+            codegen_extend(code, layout, address, "%rax");
+            fprintf(code, "mov %%rax, %s\n", address);
+        }
+    }
+
+    Node* last_expression = NULL;
+
+    while (expression) {
+        if (!expression->next_child && codegen_tail_callp(cg_context, context, expression)) {
+            err = codegen_tail_call_x86_64_mswin(code, r, cg_context, context, expression);
+        } else {
+            err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression);
+        }
+
+        if (err.type) {
+            fprintf(diagnostic_stream(), "function: \"%s\"\n", name);
+
+            return err;
+        }
+
+        if (expression->next_child) {
+            codegen_discard_result(r, expression);
+        }
+
+        last_expression = expression;
+        expression = expression->next_child;
+    }
+
+    codegen_return_result(code, r, last_expression);
+    codegen_narrow_register(code, parse_type_layout(context, function->children->next_child->value.symbol), "%rax");
+    codegen_instrument_exit(code, cg_context);
+    codegen_epilogue(code, cg_context);
+    fprintf(code, "ret\n");
+    codegen_cfi(code, cg_context, ".cfi_endproc\n");
+
+    if (depth && codegen_cfip(cg_context)) {
+        fprintf(code, ".subsection %zu\n", depth - 1);
+    }
+
+    cg_context->scratch->debug_line = debug_line;
+    fprintf(code, "after%s:\n", name);
+
+    cg_context = cg_context->parent;
+
+    return ok;
+}
+
+// Value of `expression` if it is known before main runs, given the static
+// values of the globals initialized so far.
+int codegen_constant_value(Environment* values, Node* expression, long long* result) {
+    Node* value = NULL;
+    int status = 0;
+
+    switch (expression->type) {
+    default:
+        break;
+
+    case NODE_TYPE_NONE:
+        *result = 0;
+
+        return 1;
+
+    case NODE_TYPE_INTEGER:
+        *result = expression->value.integer;
+
+        return 1;
+
+    case NODE_TYPE_BINARY_OPERATOR: {
+        long long left = 0;
+        long long right = 0;
+
+        status = codegen_constant_value(values, expression->children, &left)
+            && codegen_constant_value(values, expression->children->next_child, &right)
+            && binary_operator_evaluate((int)expression->value.integer, left, right, result);
+
+        break;
+    }
+
+    case NODE_TYPE_SYMBOL:
+        value = node_allocate(values->allocator);
+        status = environment_get(*values, expression, value);
+
+        if (status) {
+            *result = value->value.integer;
+        }
+
+        croc_release(values->allocator, value);
+
+        break;
+    }
+
+    return status;
+}
+
+// Fold the leading top-level declarations and assignments whose values are
+// known at compile time into the initial values of the globals, and return
+// the first statement that needs to run in main. Nothing can observe a
+// global before its declaration, so constant initializers further down are
+// static as well. Values are narrowed to the types of their globals.
+Node* codegen_static_initializers(ParsingContext* context, Environment* values, Node* program) {
+    Node* first_runtime_expression = NULL;
+    Node* expression = program->children;
+    long long value = 0;
+
+    while (expression) {
+        switch (expression->type) {
+        default:
+            if (!first_runtime_expression) {
+                first_runtime_expression = expression;
+            }
+
+            break;
+
+        case NODE_TYPE_NONE:
+        case NODE_TYPE_FUNCTION:
+            break;
+
+        case NODE_TYPE_VARIABLE_DECLARATION:
+        case NODE_TYPE_VARIABLE_REASSIGNMENT:
+            if (first_runtime_expression) {
+                if (expression->type == NODE_TYPE_VARIABLE_DECLARATION
+                    && (integerp(*expression->children->next_child) || nonep(*expression->children->next_child))) {
+                    codegen_constant_value(values, expression->children->next_child, &value);
+                    value = type_layout_narrow(parse_type_layout(context, expression->value.symbol), value);
+                    environment_set(values, expression->children, node_integer(values->allocator, value));
+                }
+
+                break;
+            }
+
+            if (codegen_constant_value(values, expression->children->next_child, &value)) {
+                value = type_layout_narrow(parse_type_layout(context, expression->value.symbol), value);
+                environment_set(values, expression->children, node_integer(values->allocator, value));
+            } else {
+                first_runtime_expression = expression;
+            }
+
+            break;
+        }
+
+        expression = expression->next_child;
+    }
+
+    return first_runtime_expression;
+}
+
+char* codegen_data_directive(long long size) {
+    switch (size) {
+    case 1: return ".byte";
+    case 2: return ".short";
+    case 4: return ".long";
+    default: return ".quad";
+    }
+}
+
+typedef struct CodegenGlobalPlacement {
+    Binding* binding;
+    TypeLayout layout;
+    long long value;
+    size_t index;
+} CodegenGlobalPlacement;
+
+// Most aligned first, then largest first, so that globals follow each other
+// without padding; ties keep the order of the bindings.
+int codegen_global_placement_compare(const void* a, const void* b) {
+    const CodegenGlobalPlacement* placement_a = a;
+    const CodegenGlobalPlacement* placement_b = b;
+
+    if (placement_a->layout.alignment != placement_b->layout.alignment) {
+        return placement_a->layout.alignment < placement_b->layout.alignment ? 1 : -1;
+    }
+
+    if (placement_a->layout.size != placement_b->layout.size) {
+        return placement_a->layout.size < placement_b->layout.size ? 1 : -1;
+    }
+
+    return (placement_a->index > placement_b->index) - (placement_a->index < placement_b->index);
+}
+
+// Globals with a nonzero initial value are emitted with it into .data, all
+// others take no space in the binary in .bss. Each section starts on a
+// cache line and is laid out by codegen_global_placement_compare(), each
+// global at its own size and alignment, so that many small globals share
+// a few lines; one that fits in a line but would straddle two starts the
+// next instead.
+Error codegen_globals_x86_64(FILE* code, ParsingContext* context, Environment* initial_values, int module) {
+    Error err = ok;
+    Node* type_info = node_allocate(context->phase_allocator);
+    Node* value = node_allocate(context->phase_allocator);
+    size_t count = 0;
+
+    for (Binding* it = context->variables->bind; it; it = it->next) {
+        count++;
+    }
+
+    CodegenGlobalPlacement* placements = calloc(count + 1, sizeof(CodegenGlobalPlacement));
+    assert(placements && "codegen_globals_x86_64: could not allocate memory for global placements");
+
+    count = 0;
+
+    for (Binding* it = context->variables->bind; it; it = it->next, count++) {
+        if (!environment_get(*context->types, it->value, type_info)) {
+            fprintf(diagnostic_stream(), "type: \"%s\"\n", it->value->value.symbol);
+            ERROR_PREP(err, ERROR_GENERIC, "failed to get type info from types environment");
+
+            break;
+        }
+
+        placements[count].binding = it;
+        placements[count].layout = parse_type_layout(context, it->value->value.symbol);
+        placements[count].value = environment_get(*initial_values, it->id, value) ? value->value.integer : 0;
+        placements[count].index = count;
+    }
+
+    if (!err.type) {
+        qsort(placements, count, sizeof(CodegenGlobalPlacement), codegen_global_placement_compare);
+    }
+
+    for (int bss = 0; bss < 2 && !err.type; ++bss) {
+        long long offset = 0;
+
+        fprintf(code, bss ? ".section .bss\n" : ".section .data\n");
+        fprintf(code, ".balign %d\n", CODEGEN_CACHE_LINE_SIZE);
+
+        for (size_t i = 0; i < count; ++i) {
+            CodegenGlobalPlacement* placement = placements + i;
+            char* name = placement->binding->id->value.symbol;
+            long long size = placement->layout.size;
+            long long boundary = placement->layout.alignment;
+
+            if ((placement->value == 0) != bss) {
+                continue;
+            }
+
+            if (size <= CODEGEN_CACHE_LINE_SIZE && (offset + boundary - 1) / boundary * boundary % CODEGEN_CACHE_LINE_SIZE + size > CODEGEN_CACHE_LINE_SIZE) {
+                boundary = CODEGEN_CACHE_LINE_SIZE;
+            }
+
+            if (offset % boundary) {
+                fprintf(code, ".balign %lld\n", boundary);
+                offset += boundary - offset % boundary;
+            }
+
+            if (module) {
+                fprintf(code, ".global %s\n", name);
+            }
+
+            if (bss) {
+                fprintf(code, "%s: .space %lld\n", name, size);
+            } else {
+                fprintf(code, "%s: %s %lld\n", name, codegen_data_directive(size), placement->value);
+            }
+
+            offset += size;
+        }
+    }
+
+    free(placements);
+    croc_release(context->phase_allocator, value);
+    croc_release(context->phase_allocator, type_info);
+
+    return err;
+}
+
+typedef struct CodegenFunctionOrder {
+    Binding* binding;
+    long long count;
+    size_t index;
+} CodegenFunctionOrder;
+
+// Hottest functions first, then functions the profile does not know about,
+// then functions that never ran; ties keep definition order.
+int codegen_function_order_compare(const void* a, const void* b) {
+    const CodegenFunctionOrder* order_a = a;
+    const CodegenFunctionOrder* order_b = b;
+    int group_a = order_a->count > 0 ? 0 : order_a->count < 0 ? 1 : 2;
+    int group_b = order_b->count > 0 ? 0 : order_b->count < 0 ? 1 : 2;
+
+    if (group_a != group_b) {
+        return group_a - group_b;
+    }
+
+    if (order_a->count != order_b->count) {
+        return order_a->count < order_b->count ? 1 : -1;
+    }
+
+    return (order_a->index > order_b->index) - (order_a->index < order_b->index);
+}
+
+// Where a function traced from now on is generated to instead of `code`.
+FILE* codegen_trace_begin(CodegenContext* cg_context, ParsingContext* context, FILE* code) {
+    if (!context->trace || !cg_context->scratch->trace_code) {
+        return code;
+    }
+
+    fseek(cg_context->scratch->trace_code, 0, SEEK_SET);
+
+    return cg_context->scratch->trace_code;
+}
+
+// Copy what the function `name` generated since codegen_trace_begin() to
+// `code`, counting as instructions the lines that are neither directives
+// nor labels, and record it.
+void codegen_trace_end(CodegenContext* cg_context, ParsingContext* context, FILE* code, const char* name, double start) {
+    FILE* trace_code = cg_context->scratch->trace_code;
+    char buffer[4096];
+    size_t instructions = 0;
+    size_t line_length = 0;
+    char first = 0;
+    char last = 0;
+
+    if (!context->trace) {
+        return;
+    }
+
+    if (!trace_code) {
+        trace_span(context->trace, "codegen", name, start, NULL, 0);
+
+        return;
+    }
+
+    long remaining = ftell(trace_code);
+
+    fseek(trace_code, 0, SEEK_SET);
+
+    while (remaining > 0) {
+        size_t length = fread(buffer, 1, remaining < (long)sizeof(buffer) ? (size_t)remaining : sizeof(buffer), trace_code);
+
+        if (!length) {
+            break;
+        }
+
+        fwrite(buffer, 1, length, code);
+        remaining -= (long)length;
+
+        for (size_t i = 0; i < length; ++i) {
+            if (buffer[i] != '\n') {
+                if (!line_length++) {
+                    first = buffer[i];
+                }
+
+                last = buffer[i];
+
+                continue;
+            }
+
+            instructions += line_length && first != '.' && last != ':';
+            line_length = 0;
+        }
+    }
+
+    cg_context->scratch->instructions += instructions;
+
+    trace_span(context->trace, "codegen", name, start, "instructions", instructions);
+    trace_counter(context->trace, "instructions", cg_context->scratch->instructions);
+}
+
+Error codegen_functions_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context) {
+    Error err = ok;
+    Profile* profile = cg_context->options->profile_use;
+    size_t count = 0;
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        count++;
+    }
+
+    CodegenFunctionOrder* order = calloc(count + 1, sizeof(CodegenFunctionOrder));
+    assert(order && "codegen_functions_x86_64: could not allocate memory for function order");
+
+    count = 0;
+    for (Binding* it = context->functions->bind; it; it = it->next, count++) {
+        order[count].binding = it;
+        order[count].count = profile ? profile_count(profile, it->id->value.symbol) : -1;
+        order[count].index = count;
+    }
+
+    qsort(order, count, sizeof(CodegenFunctionOrder), codegen_function_order_compare);
+
+    int cold = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        // Keep code that never ran out of the way of the code that did.
+        if (!cold && order[i].count == 0) {
+            cold = 1;
+
+            if (cg_context->options->format == CG_FMT_x86_64_SYSV) {
+                fprintf(code, ".section .text.unlikely,\"ax\",@progbits\n");
+            } else {
+                fprintf(code, ".section .text.unlikely,\"x\"\n");
+            }
+        }
+
+        double start = context->trace ? time_report_wall_seconds() : 0;
+
+        err = codegen_function_x86_64_att_mswin(r, cg_context, context, order[i].binding->id->value.symbol, order[i].binding->value, codegen_trace_begin(cg_context, context, code));
+        if (err.type) { break; }
+
+        codegen_trace_end(cg_context, context, code, order[i].binding->id->value.symbol, start);
+    }
+
+    if (cold) {
+        fprintf(code, ".section .text\n");
+    }
+
+    free(order);
+
+    return err;
+}
+
+// `string` as an assembler string literal.
+void codegen_quoted_x86_64(FILE* code, char* string) {
+    fputc('"', code);
+
+    for (; *string; ++string) {
+        if (*string == '\n') {
+            fprintf(code, "\\n");
+
+            continue;
+        }
+
+        if (*string == '"' || *string == '\\') {
+            fputc('\\', code);
+        }
+
+        fputc(*string, code);
+    }
+
+    fputc('"', code);
+}
+
+void codegen_string_x86_64(FILE* code, char* string) {
+    fprintf(code, ".asciz ");
+    codegen_quoted_x86_64(code, string);
+    fputc('\n', code);
+}
+
+// Emit the counter table in the layout profile_read() expects, and the
+// routine main calls to write it out.
+void codegen_profile_table_x86_64(FILE* code, CodegenContext* cg_context) {
+    ProfileCounters* counters = cg_context->profile_counters;
+    CodegenOptions* options = cg_context->options;
+    char name[PROFILE_NAME_SIZE];
+
+    fprintf(code,
+        ".section .data\n"
+        ".balign 64\n"
+        "__croc_profile:\n"
+        ".ascii \"%s\"\n"
+        ".quad %zu\n"
+        ".space %d\n", PROFILE_MAGIC, counters->count, PROFILE_RECORD_SIZE - 16);
+
+    for (size_t i = 0; i < counters->count; ++i) {
+        snprintf(name, sizeof(name), "%s", counters->names[i]);
+
+        fprintf(code, ".quad 0\n");
+        codegen_string_x86_64(code, name);
+        fprintf(code, ".space %zu\n", PROFILE_NAME_SIZE - strlen(name) - 1);
+    }
+
+    fprintf(code, "__croc_profile_path:\n");
+    codegen_string_x86_64(code, options->profile_generate);
+    fprintf(code, "__croc_profile_mode:\n");
+    codegen_string_x86_64(code, "wb");
+
+    fprintf(code,
+        ".section .text\n"
+        "__croc_profile_dump:\n"
+        "push %%rbp\n"
+        "mov %%rsp, %%rbp\n"
+        "sub $48, %%rsp\n"
+        "lea __croc_profile_path(%%rip), %s\n"
+        "lea __croc_profile_mode(%%rip), %s\n"
+        "call fopen\n"
+        "test %%rax, %%rax\n"
+        "jz .Lcroc_profile_dump_done\n"
+        "mov %%rax, -8(%%rbp)\n",
+        codegen_argument_register(options, 0),
+        codegen_argument_register(options, 1));
+
+    fprintf(code,
+        "lea __croc_profile(%%rip), %s\n"
+        "mov $1, %s\n"
+        "mov $%zu, %s\n"
+        "mov %%rax, %s\n"
+        "call fwrite\n",
+        codegen_argument_register(options, 0),
+        codegen_argument_register(options, 1),
+        (counters->count + 1) * PROFILE_RECORD_SIZE, codegen_argument_register(options, 2),
+        codegen_argument_register(options, 3));
+
+    fprintf(code,
+        "mov -8(%%rbp), %s\n"
+        "call fclose\n"
+        ".Lcroc_profile_dump_done:\n"
+        "mov %%rbp, %%rsp\n"
+        "pop %%rbp\n"
+        "ret\n",
+        codegen_argument_register(options, 0));
+}
+
+// Generate the bodies of the lambdas the code builds closures of, which may
+// build more, the closures of those capturing nothing, and the allocator of
+// the closures on the heap if any are.
+Error codegen_lambdas_x86_64(FILE* code, Register* r, CodegenContext* cg_context, ParsingContext* context) {
+    Error err = ok;
+    CodegenScratch* scratch = cg_context->scratch;
+    CodegenOptions* options = cg_context->options;
+    int records = 0;
+
+    for (size_t i = 0; i < scratch->lambda_count; ++i) {
+        Node* lambda = scratch->lambdas[i];
+        double start = context->trace ? time_report_wall_seconds() : 0;
+
+        err = codegen_function_x86_64_att_mswin(r, cg_context, context, lambda->value.symbol, lambda, codegen_trace_begin(cg_context, context, code));
+        if (err.type) { return err; }
+
+        codegen_trace_end(cg_context, context, code, lambda->value.symbol, start);
+    }
+
+    for (size_t i = 0; i < scratch->lambda_count; ++i) {
+        Node* lambda = scratch->lambdas[i];
+
+        if (closure_placement(lambda) != CLOSURE_STATIC) {
+            continue;
+        }
+
+        if (!records++) {
+            fprintf(code, ".section .data\n.balign 8\n");
+        }
+
+        fprintf(code, "%s.closure: .quad %s\n", lambda->value.symbol, lambda->value.symbol);
+    }
+
+    if (records) {
+        fprintf(code, ".section .text\n");
+    }
+
+    if (!scratch->closure_allocations) {
+        return err;
+    }
+
+    // Closures are never freed. A block too small for the next closure is
+    // left behind for a new one from malloc, with room for that closure
+    // and CODEGEN_CLOSURE_BLOCK_SIZE more bytes; the first call finds no
+    // block at all.
+    fprintf(code,
+        ".section .bss\n"
+        ".balign 8\n"
+        "__croc_closure_next: .space 8\n"
+        "__croc_closure_end: .space 8\n"
+        ".section .text\n"
+        "%s:\n"
+        "push %%rdx\n"
+        "mov __croc_closure_next(%%rip), %%rdx\n"
+        "add %%rax, %%rdx\n"
+        "cmp __croc_closure_end(%%rip), %%rdx\n"
+        "ja .Lcroc_closure_block\n"
+        "mov %%rdx, __croc_closure_next(%%rip)\n"
+        "sub %%rax, %%rdx\n"
+        "mov %%rdx, %%rax\n"
+        "pop %%rdx\n"
+        "ret\n", CODEGEN_CLOSURE_ALLOCATE);
+
+    fprintf(code,
+        ".Lcroc_closure_block:\n"
+        "push %%rcx\n"
+        "push %%rsi\n"
+        "push %%rdi\n"
+        "push %%r8\n"
+        "push %%r9\n"
+        "push %%r10\n"
+        "push %%r11\n"
+        "push %%rbp\n"
+        "mov %%rsp, %%rbp\n"
+        "push %%rax\n"
+        "and $-16, %%rsp\n"
+        "sub $%lld, %%rsp\n"
+        "lea %d(%%rax), %s\n"
+        "call malloc\n"
+        "test %%rax, %%rax\n"
+        "jnz .Lcroc_closure_block_done\n"
+        "ud2\n",
+        codegen_shadow_bytes(options), CODEGEN_CLOSURE_BLOCK_SIZE, codegen_argument_register(options, 0));
+
+    fprintf(code,
+        ".Lcroc_closure_block_done:\n"
+        "mov -8(%%rbp), %%rdx\n"
+        "lea (%%rax,%%rdx), %%rcx\n"
+        "mov %%rcx, __croc_closure_next(%%rip)\n"
+        "lea %d(%%rcx), %%rcx\n"
+        "mov %%rcx, __croc_closure_end(%%rip)\n"
+        "mov %%rbp, %%rsp\n"
+        "pop %%rbp\n"
+        "pop %%r11\n"
+        "pop %%r10\n"
+        "pop %%r9\n"
+        "pop %%r8\n"
+        "pop %%rdi\n"
+        "pop %%rsi\n"
+        "pop %%rcx\n"
+        "pop %%rdx\n"
+        "ret\n", CODEGEN_CLOSURE_BLOCK_SIZE);
+
+    return err;
+}
+
+// Emit the instrumentation table and the routine main calls to sort it by
+// inclusive cycles and print it, one line per function that ran.
+void codegen_instrument_table_x86_64(FILE* code, CodegenContext* cg_context) {
+    ProfileCounters* functions = cg_context->instrumented_functions;
+    CodegenOptions* options = cg_context->options;
+    char header[128];
+
+    fprintf(code,
+        ".section .data\n"
+        ".balign 8\n"
+        "__croc_instrument_child: .quad 0\n"
+        "__croc_instrument:\n");
+
+    for (size_t i = 0; i < functions->count; ++i) {
+        fprintf(code, ".quad 0, 0, 0, __croc_instrument_name_%zu\n", i);
+    }
+
+    for (size_t i = 0; i < functions->count; ++i) {
+        fprintf(code, "__croc_instrument_name_%zu:\n", i);
+        codegen_string_x86_64(code, functions->names[i]);
+    }
+
+    snprintf(header, sizeof(header), "%-32s %12s %16s %16s %12s\n", "function", "calls", "inclusive", "exclusive", "cycles/call");
+
+    fprintf(code, "__croc_instrument_header:\n");
+    codegen_string_x86_64(code, header);
+    fprintf(code, "__croc_instrument_format:\n");
+    codegen_string_x86_64(code, "%-32s %12lld %16lld %16lld %12lld\n");
+    fprintf(code, "__croc_instrument_mode:\n");
+    codegen_string_x86_64(code, "w");
+
+    if (options->instrument_output) {
+        fprintf(code, "__croc_instrument_path:\n");
+        codegen_string_x86_64(code, options->instrument_output);
+    }
+
+    // Most inclusive cycles first; ties keep table order.
+    fprintf(code,
+        ".section .text\n"
+        "__croc_instrument_compare:\n"
+        "mov 8(%s), %%r8\n"
+        "mov 8(%s), %%r9\n"
+        "cmp %%r9, %%r8\n"
+        "jne .Lcroc_instrument_compare_order\n"
+        "mov 24(%s), %%r8\n"
+        "mov 24(%s), %%r9\n"
+        ".Lcroc_instrument_compare_order:\n"
+        "xor %%eax, %%eax\n"
+        "xor %%r10d, %%r10d\n"
+        "cmp %%r9, %%r8\n"
+        "seta %%al\n"
+        "setb %%r10b\n"
+        "sub %%r10d, %%eax\n"
+        "ret\n",
+        codegen_argument_register(options, 1), codegen_argument_register(options, 0),
+        codegen_argument_register(options, 0), codegen_argument_register(options, 1));
+
+    // %rbx walks the table, %r12 counts the records left and %r13 holds the
+    // stream; all three are callee-saved in both ABIs.
+    fprintf(code,
+        "__croc_instrument_report:\n"
+        "push %%rbp\n"
+        "mov %%rsp, %%rbp\n"
+        "push %%rbx\n"
+        "push %%r12\n"
+        "push %%r13\n"
+        "sub $72, %%rsp\n");
+
+    if (options->instrument_output) {
+        fprintf(code, "lea __croc_instrument_path(%%rip), %s\n", codegen_argument_register(options, 0));
+    } else {
+        fprintf(code, "mov $2, %s\n", codegen_argument_register(options, 0));
+    }
+
+    fprintf(code,
+        "lea __croc_instrument_mode(%%rip), %s\n"
+        "call %s\n"
+        "test %%rax, %%rax\n"
+        "jz .Lcroc_instrument_report_done\n"
+        "mov %%rax, %%r13\n",
+        codegen_argument_register(options, 1), options->instrument_output ? "fopen" : "fdopen");
+
+    fprintf(code,
+        "lea __croc_instrument(%%rip), %s\n"
+        "mov $%zu, %s\n"
+        "mov $%d, %s\n"
+        "lea __croc_instrument_compare(%%rip), %s\n"
+        "call qsort\n",
+        codegen_argument_register(options, 0),
+        functions->count, codegen_argument_register(options, 1),
+        INSTRUMENT_RECORD_SIZE, codegen_argument_register(options, 2),
+        codegen_argument_register(options, 3));
+
+    fprintf(code,
+        "lea __croc_instrument_header(%%rip), %s\n"
+        "mov %%r13, %s\n"
+        "call fputs\n"
+        "lea __croc_instrument(%%rip), %%rbx\n"
+        "mov $%zu, %%r12\n"
+        ".Lcroc_instrument_report_loop:\n"
+        "test %%r12, %%r12\n"
+        "jz .Lcroc_instrument_report_close\n"
+        "mov 0(%%rbx), %%rax\n"
+        "test %%rax, %%rax\n"
+        "jz .Lcroc_instrument_report_next\n"
+        "mov 8(%%rbx), %%rax\n"
+        "xor %%edx, %%edx\n"
+        "divq 0(%%rbx)\n",
+        codegen_argument_register(options, 0), codegen_argument_register(options, 1),
+        functions->count);
+
+    // fprintf(stream, format, name, calls, inclusive, exclusive, cycles per
+    // call): the last three go on the stack for MSWIN, the last one for SysV,
+    // which also wants the number of vector arguments in %al.
+    if (options->format == CG_FMT_x86_64_SYSV) {
+        fprintf(code,
+            "mov %%rax, 0(%%rsp)\n"
+            "mov %%r13, %%rdi\n"
+            "lea __croc_instrument_format(%%rip), %%rsi\n"
+            "mov 24(%%rbx), %%rdx\n"
+            "mov 0(%%rbx), %%rcx\n"
+            "mov 8(%%rbx), %%r8\n"
+            "mov 16(%%rbx), %%r9\n"
+            "xor %%eax, %%eax\n"
+            "call fprintf\n");
+    } else {
+        fprintf(code,
+            "mov %%rax, 48(%%rsp)\n"
+            "mov 16(%%rbx), %%rax\n"
+            "mov %%rax, 40(%%rsp)\n"
+            "mov 8(%%rbx), %%rax\n"
+            "mov %%rax, 32(%%rsp)\n"
+            "mov %%r13, %%rcx\n"
+            "lea __croc_instrument_format(%%rip), %%rdx\n"
+            "mov 24(%%rbx), %%r8\n"
+            "mov 0(%%rbx), %%r9\n"
+            "call fprintf\n");
+    }
+
+    // Closing the stream opened on stderr would close stderr itself.
+    fprintf(code,
+        ".Lcroc_instrument_report_next:\n"
+        "add $%d, %%rbx\n"
+        "dec %%r12\n"
+        "jmp .Lcroc_instrument_report_loop\n"
+        ".Lcroc_instrument_report_close:\n"
+        "mov %%r13, %s\n"
+        "call %s\n"
+        ".Lcroc_instrument_report_done:\n"
+        "add $72, %%rsp\n"
+        "pop %%r13\n"
+        "pop %%r12\n"
+        "pop %%rbx\n"
+        "pop %%rbp\n"
+        "ret\n",
+        INSTRUMENT_RECORD_SIZE, codegen_argument_register(options, 0),
+        options->instrument_output ? "fclose" : "fflush");
+}
+
+// The target of every failed bounds check, outside of any function.
+void codegen_bounds_trap_x86_64(FILE* code, CodegenContext* cg_context) {
+    if (cg_context->scratch->bounds_checks) {
+        fprintf(code, "%s:\nud2\n", CODEGEN_BOUNDS_TRAP);
+    }
+}
+
+Error codegen_program_x86_64_mswin(FILE* code, CodegenContext* cg_context, ParsingContext* context, Node* program) {
+    Error err = ok;
+    Register* r = register_create(cg_context->allocator, "%rax");
+    register_add(cg_context->allocator, r, "%r10");
+    register_add(cg_context->allocator, r, "%r11");
+
+    Environment* initial_values = environment_create(cg_context->allocator, NULL);
+    Node* first_runtime_expression = codegen_static_initializers(context, initial_values, program);
+
+    if (cg_context->options->module && first_runtime_expression) {
+        ERROR_PREP(err, ERROR_GENERIC, "the top level of a module may only define functions and declare globals with constant values");
+
+        return err;
+    }
+
+    // Every .loc names file 1.
+    if (cg_context->options->debug_info) {
+        fprintf(code, ".file 1 ");
+        codegen_quoted_x86_64(code, cg_context->options->source_path ? cg_context->options->source_path : "<source>");
+        fputc('\n', code);
+    }
+
+    err = codegen_globals_x86_64(code, context, initial_values, cg_context->options->module);
+    if (err.type) { return err; }
+
+    fprintf(code, ".section .text\n");
+
+    err = codegen_functions_x86_64(code, r, cg_context, context);
+    if (err.type) { return err; }
+
+    if (cg_context->options->module) {
+        err = codegen_lambdas_x86_64(code, r, cg_context, context);
+        if (err.type) { return err; }
+
+        codegen_bounds_trap_x86_64(code, cg_context);
+
+        if (cg_context->options->format == CG_FMT_x86_64_SYSV) {
+            fprintf(code, ".section .note.GNU-stack,\"\",@progbits\n");
+        }
+
+        return ok;
+    }
+
+    FILE* output = code;
+    double start = context->trace ? time_report_wall_seconds() : 0;
+
+    code = codegen_trace_begin(cg_context, context, code);
+
+    fprintf(code,
+        ".global main\n"
+        "main:\n");
+
+    cg_context->scratch->debug_line = 0;
+
+    if (first_runtime_expression) {
+        codegen_debug_location(code, cg_context, first_runtime_expression);
+    }
+
+    codegen_prologue(code, cg_context, 32);
+
+    Node* last_expression = NULL;
+    Node* expression = first_runtime_expression;
+    while (expression) {
+        err = codegen_expression_x86_64_mswin(code, r, cg_context, context, expression);
+        if (err.type) { return err; }
+
+        if (node_last_statementp(expression)) {
+            last_expression = expression;
+
+            break;
+        }
+
+        codegen_discard_result(r, expression);
+        expression = expression->next_child;
+    }
+
+    codegen_return_result(code, r, last_expression);
+
+    if (cg_context->options->profile_generate) {
+        fprintf(code,
+            "push %%rax\n"
+            "sub $8, %%rsp\n"
+            "call __croc_profile_dump\n"
+            "add $8, %%rsp\n"
+            "pop %%rax\n");
+    }
+
+    if (cg_context->options->instrument) {
+        fprintf(code,
+            "push %%rax\n"
+            "sub $8, %%rsp\n"
+            "call __croc_instrument_report\n"
+            "add $8, %%rsp\n"
+            "pop %%rax\n");
+    }
+
+    codegen_epilogue(code, cg_context);
+    fprintf(code, "ret\n");
+    codegen_cfi(code, cg_context, ".cfi_endproc\n");
+
+    code = output;
+    codegen_trace_end(cg_context, context, code, "main", start);
+
+    err = codegen_lambdas_x86_64(code, r, cg_context, context);
+    if (err.type) { return err; }
+
+    codegen_bounds_trap_x86_64(code, cg_context);
+
+    if (cg_context->options->profile_generate) {
+        codegen_profile_table_x86_64(code, cg_context);
+    }
+
+    if (cg_context->options->instrument) {
+        codegen_instrument_table_x86_64(code, cg_context);
+    }
+
+    if (cg_context->options->format == CG_FMT_x86_64_SYSV) {
+        fprintf(code, ".section .note.GNU-stack,\"\",@progbits\n");
+    }
+
+    return ok;
+}
+
+enum CodegenOutputFormat codegen_output_format(CodegenOptions* options) {
+    if (options->format != CG_FMT_DEFAULT) {
+        return options->format;
+    }
+
+#ifdef _WIN32
+    return CG_FMT_x86_64_MSWIN;
+#else
+    return CG_FMT_x86_64_SYSV;
+#endif
+}
+
+// The globals of `context` and the modules it imports narrower than 64
+// bits, sorted by name. A global shadows imported ones of its name.
+CodegenNarrowGlobal* codegen_narrow_globals(ParsingContext* context, size_t* count) {
+    Node* shadowing = node_allocate(context->phase_allocator);
+    size_t capacity = 0;
+
+    for (ParsingContext* it = context; it; it = it->parent) {
+        for (Binding* binding = it->variables->bind; binding; binding = binding->next) {
+            capacity++;
+        }
+    }
+
+    CodegenNarrowGlobal* globals = calloc(capacity + 1, sizeof(CodegenNarrowGlobal));
+    assert(globals && "codegen_narrow_globals: could not allocate memory for narrow globals");
+
+    *count = 0;
+
+    for (ParsingContext* it = context; it; it = it->parent) {
+        for (Binding* binding = it->variables->bind; binding; binding = binding->next) {
+            TypeLayout layout = parse_type_layout(context, binding->value->value.symbol);
+            TypeLayout element;
+            int shadowed = 0;
+
+            for (ParsingContext* nearer = context; nearer != it && !shadowed; nearer = nearer->parent) {
+                shadowed = environment_get(*nearer->variables, binding->id, shadowing);
+            }
+
+            // Arrays are only read and written element by element.
+            if (layout.size < 8 && !shadowed && !parse_array_layout(context, binding->value->value.symbol, &element)) {
+                globals[*count].name = binding->id->value.symbol;
+                globals[*count].layout = layout;
+                (*count)++;
+            }
+        }
+    }
+
+    qsort(globals, *count, sizeof(CodegenNarrowGlobal), codegen_narrow_global_compare);
+    croc_release(context->phase_allocator, shadowing);
+
+    return globals;
+}
+
+Error codegen_program_file(CodegenOptions* options, ParsingContext* context, Node* program, FILE* code) {
+    Error err = ok;
+    CodegenOptions resolved = *options;
+    ProfileCounters profile_counters = { NULL, 0, 0 };
+    ProfileCounters instrumented_functions = { NULL, 0, 0 };
+    CodegenScratch scratch;
+    CodegenContext* cg_context = codegen_context_create(context->phase_allocator, NULL);
+
+    memset(&scratch, 0, sizeof(scratch));
+
+    if (context->trace) {
+        scratch.trace_code = tmpfile();
+    }
+
+    resolved.format = codegen_output_format(options);
+
+    cg_context->options = &resolved;
+    cg_context->scratch = &scratch;
+    cg_context->profile_counters = &profile_counters;
+    cg_context->instrumented_functions = &instrumented_functions;
+    cg_context->narrow_globals = codegen_narrow_globals(context, &cg_context->narrow_global_count);
+
+    err = codegen_program_x86_64_mswin(code, cg_context, context, program);
+
+    free(cg_context->narrow_globals);
+    free(scratch.lambdas);
+
+    for (size_t i = 0; i < profile_counters.count; ++i) {
+        free(profile_counters.names[i]);
+    }
+
+    free(profile_counters.names);
+
+    for (size_t i = 0; i < instrumented_functions.count; ++i) {
+        free(instrumented_functions.names[i]);
+    }
+
+    free(instrumented_functions.names);
+
+    if (scratch.trace_code) {
+        fclose(scratch.trace_code);
+    }
+
+    return err;
+}
+
+Error codegen_program(CodegenOptions* options, ParsingContext* context, Node* program) {
+    Error err = ok;
+    char* output_path = options->output_path ? options->output_path : CODEGEN_DEFAULT_OUTPUT_PATH;
+
+    FILE* code = fopen(output_path, "w");
+    if (!code) {
+        fprintf(diagnostic_stream(), "output: \"%s\"\n", output_path);
+        ERROR_PREP(err, ERROR_GENERIC, "codegen_program: could not open output file");
+
+        return err;
+    }
+
+    err = codegen_program_file(options, context, program, code);
+
     fclose(code);
 
     return err;
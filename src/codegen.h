@@ -3,7 +3,11 @@
 
 #include "environment.h"
 #include "error.h"
+#include "line_table.h"
 #include "parser.h"
+#include "profile.h"
+
+#include <stdio.h>
 
 typedef int RegisterDescriptor;
 typedef struct Register {
@@ -12,26 +16,178 @@ typedef struct Register {
     char in_use;
 } Register;
 
-Register* register_create(char* name);
-void register_add(Register* base, char* name);
-void register_free(Register* base);
+// Register names are not copied.
+Register* register_create(CrocAllocator* allocator, char* name);
+void register_add(CrocAllocator* allocator, Register* base, char* name);
+void register_free(CrocAllocator* allocator, Register* base);
 
 RegisterDescriptor register_allocate(Register* base);
 void register_deallocate(Register* base, RegisterDescriptor register_descriptor);
+int register_in_usep(Register* base, char* name);
+// How many registers are not in use.
+size_t register_available(Register* base);
 
 char* register_name();
-char* label_generate();
+
+enum CodegenOutputFormat {
+    CG_FMT_DEFAULT = 0,
+    CG_FMT_x86_64_MSWIN,
+    CG_FMT_x86_64_SYSV,
+};
+
+#define CODEGEN_DEFAULT_OUTPUT_PATH "code.S"
+
+typedef struct CodegenOptions {
+    // CG_FMT_DEFAULT picks the format of the host.
+    enum CodegenOutputFormat format;
+
+    // File codegen_program() writes; NULL for CODEGEN_DEFAULT_OUTPUT_PATH.
+    char* output_path;
+
+    // Export every top-level function and global, and emit no main.
+    int module;
+
+    // Path the generated program writes its profile to when main returns;
+    // NULL to leave it uninstrumented.
+    char* profile_generate;
+    // Profile of an earlier run to lay out functions by; NULL for none.
+    Profile* profile_use;
+
+    // Count calls to and cycles spent in every function, and report them
+    // when main returns, to `instrument_output` or, if it is NULL, stderr.
+    int instrument;
+    char* instrument_output;
+
+    // Tell debuggers and profilers where the code came from: DWARF line
+    // information for the source named `source_path`, whose lines are in
+    // `lines`, and on SysV the call frame information to unwind through it.
+    int debug_info;
+    char* source_path;
+    LineTable* lines;
+} CodegenOptions;
+
+// Labels and operands are formatted into rings of characters that belong to
+// one compilation, each string living until the ring wraps around to it.
+#define CODEGEN_SCRATCH_SIZE 1024
+
+typedef struct CodegenScratch {
+    char labels[CODEGEN_SCRATCH_SIZE];
+    size_t label_index;
+    size_t label_count;
+    char operands[CODEGEN_SCRATCH_SIZE];
+    size_t operand_index;
+
+    // Source line of the last .loc directive, which holds until the next.
+    size_t debug_line;
+
+    // Array accesses checked against their array's length, which jump to
+    // CODEGEN_BOUNDS_TRAP when they fail.
+    size_t bounds_checks;
+
+    // When the compile is traced, where a function's code goes before it
+    // is copied to the output and its instructions counted; NULL if no
+    // file could be made, and then nothing is counted. `instructions` is
+    // the total so far.
+    FILE* trace_code;
+    size_t instructions;
+
+    // Lambdas whose closures the code builds, whose bodies are generated
+    // after the functions, and whether any closure is on the heap.
+    Node** lambdas;
+    size_t lambda_count;
+    size_t lambda_capacity;
+    int closure_allocations;
+} CodegenScratch;
+
+// Label of the one instruction every failed bounds check jumps to, which
+// traps.
+#define CODEGEN_BOUNDS_TRAP ".Lbounds_trap"
+
+// Heap closures come from blocks of at least this many bytes, which
+// CODEGEN_CLOSURE_ALLOCATE bumps through. It takes the size in %rax,
+// returns the closure there, and keeps every other register.
+#define CODEGEN_CLOSURE_BLOCK_SIZE 65536
+#define CODEGEN_CLOSURE_ALLOCATE "__croc_closure_allocate"
+
+// Loops keep the variables and loop-invariant expressions they use most in
+// these callee-saved registers while they run.
+#define CODEGEN_PROMOTION_MAX 5
+
+// A variable, named by a symbol, or a hoisted expression, which stands for
+// every expression like it in the loop.
+typedef struct CodegenPromotion {
+    Node* node;
+    const char* register_name;
+} CodegenPromotion;
+
+// Globals are laid out so that the small ones do not straddle cache lines
+// of this many bytes.
+#define CODEGEN_CACHE_LINE_SIZE 64
+
+// A global of a type narrower than 64 bits.
+typedef struct CodegenNarrowGlobal {
+    char* name;
+    TypeLayout layout;
+} CodegenNarrowGlobal;
+
+// The most integer arguments a call passes in registers, which SysV does
+// for six and Windows for four.
+#define CODEGEN_ARGUMENT_REGISTERS_MAX 6
 
 typedef struct CodegenContext {
     struct CodegenContext* parent;
     Environment* locals;
+
+    // Shared by every context of one compilation. Contexts, their locals and
+    // registers live in `allocator`, which is scratch memory of codegen.
+    CrocAllocator* allocator;
+    CodegenOptions* options;
+    ProfileCounters* profile_counters;
+    ProfileCounters* instrumented_functions;
+    CodegenScratch* scratch;
+
+    // Globals narrower than 64 bits, sorted by name. They are loaded and
+    // stored at their own width, so they are never operands in memory.
+    CodegenNarrowGlobal* narrow_globals;
+    size_t narrow_global_count;
+
+    // The function being generated and its label; NULL at top level.
+    Node* function;
+    char* function_name;
+    long long locals_offset;
+
+    // Parameters a function that makes no calls leaves in the registers
+    // they arrive in; the others are stored to the frame on entry.
+    CodegenPromotion parameter_registers[CODEGEN_ARGUMENT_REGISTERS_MAX];
+    size_t parameter_register_count;
+
+    // Record of the function in the instrumentation table, or -1.
+    long long instrument_index;
+
+    // Calls emitted so far in this function, which number its call sites.
+    size_t call_count;
+
+    // Bytes the frame reserves below the saved frame pointer, and the bytes
+    // loops being generated have pushed below that.
+    long long frame_size;
+    long long loop_saved_bytes;
+
+    // Slots of the closures the function builds in its frame. A function
+    // with any makes no tail calls, as the callee may still use them.
+    size_t closure_slots;
+
+    // Loops being generated and what they promoted, outermost first.
+    size_t loop_depth;
+    CodegenPromotion promotions[CODEGEN_PROMOTION_MAX];
+    size_t promotion_count;
 } CodegenContext;
 
-enum CodegenOutputFormat {
-    CG_FMT_DEFAULT = 0,
-    CG_FMT_x86_64_MSWIN,
-};
+// The format `options` asks for, with CG_FMT_DEFAULT resolved to the host's.
+enum CodegenOutputFormat codegen_output_format(CodegenOptions* options);
 
-Error codegen_program(enum CodegenOutputFormat, ParsingContext* context, Node* program);
+// Write the program's assembly to `code`.
+Error codegen_program_file(CodegenOptions* options, ParsingContext* context, Node* program, FILE* code);
+// Write the program's assembly to the output path of `options`.
+Error codegen_program(CodegenOptions* options, ParsingContext* context, Node* program);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "croc.h"
+#include "driver.h"
+#include "error.h"
+#include "file_io.h"
+#include "version.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A stream collecting what is written to it in memory. Windows has no
+// open_memstream(), so there it is a temporary file read back on close.
+typedef struct CrocBuffer {
+    FILE* stream;
+    char* data;
+    size_t size;
+} CrocBuffer;
+
+int croc_buffer_open(CrocBuffer* buffer) {
+    buffer->data = NULL;
+    buffer->size = 0;
+
+#ifdef _WIN32
+    buffer->stream = tmpfile();
+#else
+    buffer->stream = open_memstream(&buffer->data, &buffer->size);
+#endif
+
+    return buffer->stream != NULL;
+}
+
+// NUL-terminated contents of the buffer, which the caller frees.
+char* croc_buffer_close(CrocBuffer* buffer, size_t* size) {
+#ifdef _WIN32
+    rewind(buffer->stream);
+    buffer->data = stream_contents(buffer->stream, 0);
+    buffer->size = buffer->data ? strlen(buffer->data) : 0;
+#endif
+
+    fclose(buffer->stream);
+
+    *size = buffer->size;
+
+    return buffer->data;
+}
+
+CrocStatus croc_compile(const char* source, size_t size, const char* path, const char* const* options, size_t option_count, CrocOutput* output) {
+    CrocStatus status = CROC_OK;
+    DriverOptions driver_options;
+    CrocBuffer diagnostics;
+    CrocBuffer assembly;
+    FILE* previous_diagnostics = diagnostic_stream();
+
+    memset(output, 0, sizeof(CrocOutput));
+
+    if (!croc_buffer_open(&diagnostics)) {
+        return CROC_CODEGEN_ERROR;
+    }
+
+    diagnostic_stream_set(diagnostics.stream);
+    driver_options_init(&driver_options);
+
+    for (size_t i = 0; i < option_count && status == CROC_OK; ++i) {
+        if (!driver_option(&driver_options, (char*)options[i])) {
+            fprintf(diagnostic_stream(), "unknown option: \"%s\"\n", options[i]);
+            status = CROC_INVALID_OPTIONS;
+        }
+    }
+
+    if (status == CROC_OK && (driver_options.interpret || driver_options.cache)) {
+        fprintf(diagnostic_stream(), "--interpret and --cache are not available to croc_compile()\n");
+        status = CROC_INVALID_OPTIONS;
+    }
+
+    if (status == CROC_OK) {
+        Error err = driver_load_profile(&driver_options);
+
+        if (err.type) {
+            print_error(err);
+            status = CROC_CODEGEN_ERROR;
+        }
+    }
+
+    if (status == CROC_OK) {
+        // The parser wants a NUL-terminated buffer of its own.
+        char* contents = malloc(size + 1);
+        assert(contents && "croc_compile: could not allocate memory for source");
+
+        memcpy(contents, source, size);
+        contents[size] = '\0';
+
+        if (croc_buffer_open(&assembly)) {
+            status = (CrocStatus)driver_compile_stream(&driver_options, (char*)path, contents, assembly.stream);
+
+            output->assembly = croc_buffer_close(&assembly, &output->assembly_size);
+
+            if (status != CROC_OK) {
+                free(output->assembly);
+                output->assembly = NULL;
+                output->assembly_size = 0;
+            }
+        } else {
+            fprintf(diagnostic_stream(), "croc_compile: could not open a buffer for the assembly\n");
+            status = CROC_CODEGEN_ERROR;
+        }
+
+        free(contents);
+    }
+
+    diagnostic_stream_set(previous_diagnostics);
+    output->diagnostics = croc_buffer_close(&diagnostics, &output->diagnostics_size);
+
+    return status;
+}
+
+void croc_output_free(CrocOutput* output) {
+    free(output->assembly);
+    free(output->diagnostics);
+
+    memset(output, 0, sizeof(CrocOutput));
+}
+
+const char* croc_version(void) {
+    return CROC_VERSION;
+}
@@ -0,0 +1,61 @@
+#ifndef CROC_H
+#define CROC_H
+
+#include <stddef.h>
+
+// The compiler as a library: libcroc.a or the shared libcroc. Compiles work
+// on buffers and keep all of their state to themselves, so any number of
+// threads may compile at once. Define CROC_SHARED when linking against the
+// shared library on Windows.
+#if defined(_WIN32) && defined(CROC_BUILDING)
+#define CROC_API __declspec(dllexport)
+#elif defined(_WIN32) && defined(CROC_SHARED)
+#define CROC_API __declspec(dllimport)
+#elif defined(__GNUC__)
+#define CROC_API __attribute__((visibility("default")))
+#else
+#define CROC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The same as the exit codes of the croc executable, plus one for options
+// it would not accept.
+typedef enum CrocStatus {
+    CROC_OK = 0,
+    CROC_PARSE_ERROR = 1,
+    CROC_TYPE_ERROR = 2,
+    CROC_CODEGEN_ERROR = 3,
+    CROC_INVALID_OPTIONS = 5,
+} CrocStatus;
+
+typedef struct CrocOutput {
+    // Generated assembly, NUL-terminated; NULL unless the compile succeeded.
+    char* assembly;
+    size_t assembly_size;
+
+    // Everything the compile reported, NUL-terminated: errors, and what
+    // --stats and --time-report print.
+    char* diagnostics;
+    size_t diagnostics_size;
+} CrocOutput;
+
+// Compile `size` bytes of `source`. `options` are compile options as the
+// croc executable takes them, like "--target=x86_64-sysv" or "--stats";
+// --interpret and --cache are not among them. `path` is where the source
+// would live, which `import` and --module resolve modules against; NULL for
+// the working directory. `output` belongs to the caller, who releases it
+// with croc_output_free() whatever the status.
+CROC_API CrocStatus croc_compile(const char* source, size_t size, const char* path, const char* const* options, size_t option_count, CrocOutput* output);
+
+CROC_API void croc_output_free(CrocOutput* output);
+
+CROC_API const char* croc_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,478 @@
+#include "ctfe.h"
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void ctfe_context_init(CTFEContext* ctfe, ParsingContext* context) {
+    ctfe->context = context;
+    ctfe->stats.operators_folded = 0;
+    ctfe->stats.calls_folded = 0;
+    ctfe->stats.calls_not_constant = 0;
+    ctfe->stats.calls_over_budget = 0;
+    ctfe->stats.steps = 0;
+    ctfe->step_budget = CTFE_DEFAULT_STEP_BUDGET;
+    ctfe->memory_budget = CTFE_DEFAULT_MEMORY_BUDGET;
+    ctfe->depth_budget = CTFE_DEFAULT_DEPTH_BUDGET;
+    ctfe->steps_left = 0;
+    ctfe->memory_used = 0;
+    ctfe->depth = 0;
+}
+
+// Frames come and go with every call evaluated, so they live on the heap
+// instead of in an arena that would keep them until the phase ends.
+Environment* ctfe_frame_create(CTFEContext* ctfe) {
+    ctfe->memory_used += sizeof(Environment);
+
+    return environment_create(&croc_heap, NULL);
+}
+
+void ctfe_frame_free(CTFEContext* ctfe, Environment* frame) {
+    for (Binding* binding = frame->bind; binding; binding = binding->next) {
+        croc_release(frame->allocator, binding->value);
+        ctfe->memory_used -= sizeof(Binding) + sizeof(Node);
+    }
+
+    environment_free(frame);
+    ctfe->memory_used -= sizeof(Environment);
+}
+
+Binding* ctfe_frame_find(Environment* frame, Node* id) {
+    Binding* binding = frame ? frame->bind : NULL;
+
+    while (binding) {
+        if (node_compare(binding->id, id)) {
+            return binding;
+        }
+
+        binding = binding->next;
+    }
+
+    return NULL;
+}
+
+CTFEStatus ctfe_frame_bind(CTFEContext* ctfe, Environment* frame, Node* id, long long value) {
+    Binding* binding = ctfe_frame_find(frame, id);
+
+    if (binding) {
+        binding->value->value.integer = value;
+
+        return CTFE_OK;
+    }
+
+    ctfe->memory_used += sizeof(Binding) + sizeof(Node);
+    if (ctfe->memory_used > ctfe->memory_budget) {
+        ctfe->memory_used -= sizeof(Binding) + sizeof(Node);
+
+        return CTFE_BUDGET_EXCEEDED;
+    }
+
+    environment_set(frame, id, node_integer(frame->allocator, value));
+
+    return CTFE_OK;
+}
+
+// Evaluate every argument of `call` in the caller's frame.
+CTFEStatus ctfe_arguments(CTFEContext* ctfe, Environment* frame, Node* call, long long** values, size_t* count) {
+    CTFEStatus status = CTFE_OK;
+    Node* argument = call->children->next_child->children;
+    size_t index = 0;
+
+    *count = 0;
+
+    for (Node* it = argument; it; it = it->next_child) {
+        (*count)++;
+    }
+
+    *values = calloc(*count + 1, sizeof(long long));
+    assert(*values && "ctfe_arguments: could not allocate memory for argument values");
+
+    while (argument && status == CTFE_OK) {
+        status = ctfe_evaluate(ctfe, frame, argument, *values + index);
+
+        argument = argument->next_child;
+        index++;
+    }
+
+    if (status != CTFE_OK) {
+        free(*values);
+        *values = NULL;
+    }
+
+    return status;
+}
+
+// Whether `call`, the last statement of a function returning `layout`,
+// gives what the function returns without narrowing it again.
+int ctfe_tail_callp(CTFEContext* ctfe, TypeLayout layout, Node* call) {
+    if (layout.size >= 8) {
+        return 1;
+    }
+
+    Node* callee = node_allocate(ctfe->context->phase_allocator);
+    int status = environment_get_function(ctfe->context, call->children, callee)
+        && callee->children->next_child->next_child
+        && type_layout_containsp(layout, parse_type_layout(ctfe->context, callee->children->next_child->value.symbol));
+
+    croc_release(ctfe->context->phase_allocator, callee);
+
+    return status;
+}
+
+// Calls in tail position replace the current frame instead of nesting, just
+// like the code codegen emits for them, so deep tail recursion only costs
+// steps. Parameters and results keep what their types do.
+CTFEStatus ctfe_call(CTFEContext* ctfe, Environment* frame, Node* call, long long* result) {
+    CTFEStatus status = CTFE_OK;
+    CrocAllocator* allocator = ctfe->context->phase_allocator;
+    Node* function = node_allocate(allocator);
+    long long* values = NULL;
+    size_t count = 0;
+
+    if (ctfe->depth >= ctfe->depth_budget) {
+        croc_release(allocator, function);
+
+        return CTFE_BUDGET_EXCEEDED;
+    }
+
+    status = ctfe_arguments(ctfe, frame, call, &values, &count);
+
+    ctfe->depth++;
+
+    while (status == CTFE_OK) {
+        // Imported functions have no body to evaluate.
+        if (!environment_get_function(ctfe->context, call->children, function) || !function->children->next_child->next_child) {
+            status = CTFE_NOT_CONSTANT;
+
+            break;
+        }
+
+        Environment* callee_frame = ctfe_frame_create(ctfe);
+        Node* parameter = function->children->children;
+        size_t index = 0;
+
+        while (parameter && index < count && status == CTFE_OK) {
+            TypeLayout layout = parse_type_layout(ctfe->context, parameter->children->next_child->value.symbol);
+
+            status = ctfe_frame_bind(ctfe, callee_frame, parameter->children, type_layout_narrow(layout, values[index]));
+
+            parameter = parameter->next_child;
+            index++;
+        }
+
+        free(values);
+        values = NULL;
+
+        TypeLayout result_layout = parse_type_layout(ctfe->context, function->children->next_child->value.symbol);
+        Node* expression = function->children->next_child->next_child->children;
+        *result = 0;
+
+        while (expression && status == CTFE_OK) {
+            if (!expression->next_child && expression->type == NODE_TYPE_FUNCTION_CALL && ctfe_tail_callp(ctfe, result_layout, expression)) {
+                status = ctfe_arguments(ctfe, callee_frame, expression, &values, &count);
+                call = expression;
+
+                break;
+            }
+
+            status = ctfe_evaluate(ctfe, callee_frame, expression, result);
+
+            // Statements without a value leave zero as the return value.
+            if (expression->type != NODE_TYPE_INTEGER && expression->type != NODE_TYPE_SYMBOL
+                && expression->type != NODE_TYPE_FUNCTION_CALL && expression->type != NODE_TYPE_BINARY_OPERATOR) {
+                *result = 0;
+            }
+
+            expression = expression->next_child;
+        }
+
+        ctfe_frame_free(ctfe, callee_frame);
+
+        if (!values) {
+            *result = type_layout_narrow(result_layout, *result);
+
+            break;
+        }
+    }
+
+    ctfe->depth--;
+
+    free(values);
+    croc_release(allocator, function);
+
+    return status;
+}
+
+CTFEStatus ctfe_evaluate(CTFEContext* ctfe, Environment* frame, Node* expression, long long* result) {
+    Binding* binding = NULL;
+    CTFEStatus status = CTFE_OK;
+    long long left = 0;
+    long long right = 0;
+
+    if (ctfe->steps_left == 0) {
+        return CTFE_BUDGET_EXCEEDED;
+    }
+
+    ctfe->steps_left--;
+    ctfe->stats.steps++;
+
+    switch (expression->type) {
+    default:
+        return CTFE_NOT_CONSTANT;
+
+    case NODE_TYPE_NONE:
+        *result = 0;
+
+        break;
+
+    case NODE_TYPE_INTEGER:
+        *result = expression->value.integer;
+
+        break;
+
+    // Globals can change at runtime, so only names bound in the frame of the
+    // call being evaluated are constant.
+    case NODE_TYPE_SYMBOL:
+        binding = ctfe_frame_find(frame, expression);
+        if (!binding) {
+            return CTFE_NOT_CONSTANT;
+        }
+
+        *result = binding->value->value.integer;
+
+        break;
+
+    case NODE_TYPE_VARIABLE_DECLARATION:
+        if (!frame) {
+            return CTFE_NOT_CONSTANT;
+        }
+
+        status = ctfe_evaluate(ctfe, frame, expression->children->next_child, result);
+        if (status != CTFE_OK) { return status; }
+
+        *result = type_layout_narrow(parse_type_layout(ctfe->context, expression->value.symbol), *result);
+        status = ctfe_frame_bind(ctfe, frame, expression->children, *result);
+
+        break;
+
+    case NODE_TYPE_VARIABLE_REASSIGNMENT:
+        binding = ctfe_frame_find(frame, expression->children);
+        if (!binding) {
+            return CTFE_NOT_CONSTANT;
+        }
+
+        status = ctfe_evaluate(ctfe, frame, expression->children->next_child, result);
+        if (status != CTFE_OK) { return status; }
+
+        *result = type_layout_narrow(parse_type_layout(ctfe->context, expression->value.symbol), *result);
+        binding->value->value.integer = *result;
+
+        break;
+
+    case NODE_TYPE_FUNCTION_CALL:
+        status = ctfe_call(ctfe, frame, expression, result);
+
+        break;
+
+    // Every pass through the loop costs steps, so one that does not end
+    // runs out of budget.
+    case NODE_TYPE_WHILE:
+        for (;;) {
+            status = ctfe_evaluate(ctfe, frame, expression->children, &left);
+            if (status != CTFE_OK || !left) { break; }
+
+            for (Node* statement = expression->children->next_child->children; statement && status == CTFE_OK; statement = statement->next_child) {
+                status = ctfe_evaluate(ctfe, frame, statement, &right);
+            }
+
+            if (status == CTFE_OK && expression->children->next_child->next_child) {
+                status = ctfe_evaluate(ctfe, frame, expression->children->next_child->next_child, &right);
+            }
+
+            if (status != CTFE_OK) { break; }
+        }
+
+        *result = 0;
+
+        break;
+
+    // Division that would trap is left for runtime to trap on.
+    case NODE_TYPE_BINARY_OPERATOR:
+        status = ctfe_evaluate(ctfe, frame, expression->children, &left);
+        if (status != CTFE_OK) { return status; }
+
+        status = ctfe_evaluate(ctfe, frame, expression->children->next_child, &right);
+        if (status != CTFE_OK) { return status; }
+
+        if (!binary_operator_evaluate((int)expression->value.integer, left, right, result)) {
+            return CTFE_NOT_CONSTANT;
+        }
+
+        break;
+    }
+
+    return status;
+}
+
+// Whether `value` as the right operand of `binary_operator`, or as the left
+// one of a commutative operator, gives back the other operand.
+int ctfe_identityp(int binary_operator, long long value) {
+    switch (binary_operator) {
+    case BINARY_OPERATOR_ADD:
+    case BINARY_OPERATOR_SUBTRACT:
+    case BINARY_OPERATOR_SHIFT_LEFT:
+    case BINARY_OPERATOR_SHIFT_RIGHT:
+    case BINARY_OPERATOR_OR:
+    case BINARY_OPERATOR_XOR:
+        return value == 0;
+
+    case BINARY_OPERATOR_MULTIPLY:
+    case BINARY_OPERATOR_DIVIDE:
+        return value == 1;
+
+    case BINARY_OPERATOR_AND:
+        return value == -1;
+
+    default:
+        return 0;
+    }
+}
+
+// Put `operand` of `expression` in its place and free the rest of it.
+void ctfe_replace(CrocAllocator* allocator, Node* expression, Node* operand) {
+    Node* next_child = expression->next_child;
+
+    for (Node* child = expression->children; child;) {
+        Node* next = child->next_child;
+
+        if (child != operand) {
+            node_free(allocator, child);
+        }
+
+        child = next;
+    }
+
+    *expression = *operand;
+    expression->next_child = next_child;
+
+    croc_release(allocator, operand);
+}
+
+void ctfe_fold_operator(CTFEContext* ctfe, Node* expression) {
+    CrocAllocator* allocator = ctfe->context->allocator;
+    int binary_operator = (int)expression->value.integer;
+    Node* left = expression->children;
+    Node* right = left->next_child;
+    long long value = 0;
+
+    if (integerp(*left) && integerp(*right)) {
+        if (!binary_operator_evaluate(binary_operator, left->value.integer, right->value.integer, &value)) {
+            return;
+        }
+
+        node_free(allocator, left);
+        node_free(allocator, right);
+
+        expression->type = NODE_TYPE_INTEGER;
+        expression->value.integer = value;
+        expression->children = NULL;
+    } else if (integerp(*right) && ctfe_identityp(binary_operator, right->value.integer)) {
+        ctfe_replace(allocator, expression, left);
+    } else if (integerp(*left) && binary_operator_commutativep(binary_operator) && ctfe_identityp(binary_operator, left->value.integer)) {
+        ctfe_replace(allocator, expression, right);
+    } else {
+        return;
+    }
+
+    ctfe->stats.operators_folded++;
+}
+
+int ctfe_constant_argumentsp(Node* call) {
+    Node* argument = call->children->next_child->children;
+
+    while (argument) {
+        if (!integerp(*argument)) {
+            return 0;
+        }
+
+        argument = argument->next_child;
+    }
+
+    return 1;
+}
+
+void ctfe_fold_expression(CTFEContext* ctfe, Node* expression) {
+    Node* child = expression->children;
+
+    while (child) {
+        ctfe_fold_expression(ctfe, child);
+
+        child = child->next_child;
+    }
+
+    if (expression->type == NODE_TYPE_BINARY_OPERATOR) {
+        ctfe_fold_operator(ctfe, expression);
+
+        return;
+    }
+
+    if (expression->type != NODE_TYPE_FUNCTION_CALL || !ctfe_constant_argumentsp(expression)) {
+        return;
+    }
+
+    long long value = 0;
+
+    ctfe->steps_left = ctfe->step_budget;
+    ctfe->memory_used = 0;
+    ctfe->depth = 0;
+
+    switch (ctfe_evaluate(ctfe, NULL, expression, &value)) {
+    case CTFE_OK:
+        child = expression->children;
+
+        while (child) {
+            Node* next_child = child->next_child;
+
+            node_free(ctfe->context->allocator, child);
+
+            child = next_child;
+        }
+
+        expression->type = NODE_TYPE_INTEGER;
+        expression->value.integer = value;
+        expression->children = NULL;
+
+        ctfe->stats.calls_folded++;
+
+        break;
+
+    case CTFE_NOT_CONSTANT:
+        ctfe->stats.calls_not_constant++;
+
+        break;
+
+    case CTFE_BUDGET_EXCEEDED:
+        ctfe->stats.calls_over_budget++;
+
+        break;
+    }
+}
+
+void ctfe_fold_program(CTFEContext* ctfe, Node* program) {
+    Node* expression = program->children;
+
+    while (expression) {
+        ctfe_fold_expression(ctfe, expression);
+
+        expression = expression->next_child;
+    }
+}
+
+void print_ctfe_stats(CTFEStats stats) {
+    fprintf(diagnostic_stream(), "ctfe: %zu operators folded, %zu calls folded, %zu not constant, %zu over budget, %zu steps\n",
+        stats.operators_folded, stats.calls_folded, stats.calls_not_constant, stats.calls_over_budget, stats.steps);
+}
@@ -0,0 +1,58 @@
+#ifndef COMPILER_CTFE_H
+#define COMPILER_CTFE_H
+
+#include <stddef.h>
+
+#include "environment.h"
+#include "parser.h"
+
+typedef enum CTFEStatus {
+    CTFE_OK = 0,
+    // The expression depends on something only known at runtime.
+    CTFE_NOT_CONSTANT,
+    // Evaluation ran out of steps, memory or call depth.
+    CTFE_BUDGET_EXCEEDED,
+} CTFEStatus;
+
+// Limits for evaluating one call; a call that exceeds them is left to run at
+// runtime.
+#define CTFE_DEFAULT_STEP_BUDGET    1000000
+#define CTFE_DEFAULT_MEMORY_BUDGET  (1 << 20)
+#define CTFE_DEFAULT_DEPTH_BUDGET   256
+
+typedef struct CTFEStats {
+    // Operators with constant operands, or an operand that leaves the other
+    // unchanged, like x + 0.
+    size_t operators_folded;
+    size_t calls_folded;
+    size_t calls_not_constant;
+    size_t calls_over_budget;
+    size_t steps;
+} CTFEStats;
+
+typedef struct CTFEContext {
+    ParsingContext* context;
+    CTFEStats stats;
+
+    size_t step_budget;
+    size_t memory_budget;
+    size_t depth_budget;
+
+    // What the call currently being folded has left.
+    size_t steps_left;
+    size_t memory_used;
+    size_t depth;
+} CTFEContext;
+
+void ctfe_context_init(CTFEContext* ctfe, ParsingContext* context);
+
+CTFEStatus ctfe_evaluate(CTFEContext* ctfe, Environment* frame, Node* expression, long long* result);
+
+// Replace every call in `program` whose arguments are constant and whose
+// evaluation only touches its own parameters and locals with its value, and
+// every operator whose operands are constant with its result.
+void ctfe_fold_program(CTFEContext* ctfe, Node* program);
+
+void print_ctfe_stats(CTFEStats stats);
+
+#endif
@@ -0,0 +1,281 @@
+#include "dead_code.h"
+#include "environment.h"
+#include "error.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A top-level function or global, and for a global the top-level
+// declaration whose initializer is only walked once the global is live.
+typedef struct DeadCodeEntry {
+    Binding* binding;
+    Node* declaration;
+    int live;
+} DeadCodeEntry;
+
+// Entries are sorted by name, so each reference is a binary search. What
+// is found live but not yet walked waits in `pending`. Bodies a lazy parse
+// skipped are parsed as their functions are found live, keeping the first
+// error.
+typedef struct DeadCodeReach {
+    ParsingContext* context;
+    Error err;
+
+    DeadCodeEntry* functions;
+    size_t function_count;
+    DeadCodeEntry* globals;
+    size_t global_count;
+
+    Node** pending;
+    size_t pending_count;
+    size_t pending_capacity;
+} DeadCodeReach;
+
+int dead_code_entry_compare(const void* a, const void* b) {
+    return strcmp(((const DeadCodeEntry*)a)->binding->id->value.symbol, ((const DeadCodeEntry*)b)->binding->id->value.symbol);
+}
+
+DeadCodeEntry* dead_code_entries(Environment* env, size_t* count) {
+    size_t capacity = 0;
+
+    for (Binding* it = env->bind; it; it = it->next) {
+        capacity++;
+    }
+
+    DeadCodeEntry* entries = calloc(capacity + 1, sizeof(DeadCodeEntry));
+    assert(entries && "dead_code_entries: could not allocate memory for entries");
+
+    *count = 0;
+
+    for (Binding* it = env->bind; it; it = it->next) {
+        entries[(*count)++].binding = it;
+    }
+
+    qsort(entries, *count, sizeof(DeadCodeEntry), dead_code_entry_compare);
+
+    return entries;
+}
+
+DeadCodeEntry* dead_code_find(DeadCodeEntry* entries, size_t count, char* name) {
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(name, entries[middle].binding->id->value.symbol);
+
+        if (!order) {
+            return entries + middle;
+        }
+
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return NULL;
+}
+
+void dead_code_pend(DeadCodeReach* reach, Node* node) {
+    if (reach->pending_count == reach->pending_capacity) {
+        reach->pending_capacity = reach->pending_capacity ? reach->pending_capacity * 2 : 64;
+        reach->pending = realloc(reach->pending, reach->pending_capacity * sizeof(Node*));
+        assert(reach->pending && "dead_code_pend: could not allocate memory for pending nodes");
+    }
+
+    reach->pending[reach->pending_count++] = node;
+}
+
+// Everything a function or global found live for the first time refers to
+// is walked in turn: a function's body, and a global's initializer if its
+// declaration was held back.
+void dead_code_reach(DeadCodeReach* reach, char* name) {
+    DeadCodeEntry* function = dead_code_find(reach->functions, reach->function_count, name);
+    DeadCodeEntry* global = dead_code_find(reach->globals, reach->global_count, name);
+
+    if (function && !function->live) {
+        Error err = parse_function_body(reach->context, function->binding->value);
+
+        if (err.type && !reach->err.type) {
+            reach->err = err;
+        }
+
+        function->live = 1;
+        dead_code_pend(reach, function->binding->value->children->next_child->next_child);
+    }
+
+    if (global && !global->live) {
+        global->live = 1;
+
+        if (global->declaration) {
+            dead_code_pend(reach, global->declaration->children->next_child);
+        }
+    }
+}
+
+void dead_code_walk(DeadCodeReach* reach, Node* node) {
+    if (node->type == NODE_TYPE_SYMBOL) {
+        dead_code_reach(reach, node->value.symbol);
+
+        return;
+    }
+
+    if (node->type == NODE_TYPE_FUNCTION_CALL) {
+        dead_code_reach(reach, node->children->value.symbol);
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        dead_code_walk(reach, child);
+    }
+}
+
+int dead_code_callsp(Node* node) {
+    if (node->type == NODE_TYPE_FUNCTION_CALL) {
+        return 1;
+    }
+
+    for (Node* child = node->children; child; child = child->next_child) {
+        if (dead_code_callsp(child)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void dead_code_removed(DeadCodeStats* stats, char* name) {
+    if (stats->removed_count == stats->removed_capacity) {
+        stats->removed_capacity = stats->removed_capacity ? stats->removed_capacity * 2 : 16;
+        stats->removed = realloc(stats->removed, stats->removed_capacity * sizeof(char*));
+        assert(stats->removed && "dead_code_removed: could not allocate memory for removed names");
+    }
+
+    stats->removed[stats->removed_count++] = name;
+}
+
+// Unlink the bindings of `env` whose entry is not live, recording their
+// names.
+size_t dead_code_unbind(Environment* env, DeadCodeEntry* entries, size_t count, DeadCodeStats* stats) {
+    size_t removed = 0;
+
+    for (Binding** it = &env->bind; *it;) {
+        DeadCodeEntry* entry = dead_code_find(entries, count, (*it)->id->value.symbol);
+
+        if (entry && !entry->live) {
+            dead_code_removed(stats, (*it)->id->value.symbol);
+            *it = (*it)->next;
+            removed++;
+        } else {
+            it = &(*it)->next;
+        }
+    }
+
+    return removed;
+}
+
+// Mark what the statements of `program` reach, leaving `reach` to be freed
+// with dead_code_reach_free().
+void dead_code_mark(DeadCodeReach* reach, ParsingContext* context, Node* program) {
+    memset(reach, 0, sizeof(DeadCodeReach));
+
+    reach->context = context;
+    reach->err = ok;
+    reach->functions = dead_code_entries(context->functions, &reach->function_count);
+    reach->globals = dead_code_entries(context->variables, &reach->global_count);
+
+    // Declarations without calls in their initializer wait for their
+    // global to be found live.
+    for (Node* statement = program->children; statement; statement = statement->next_child) {
+        if (statement->type != NODE_TYPE_VARIABLE_DECLARATION || dead_code_callsp(statement->children->next_child)) {
+            continue;
+        }
+
+        DeadCodeEntry* global = dead_code_find(reach->globals, reach->global_count, statement->children->value.symbol);
+
+        if (global) {
+            global->declaration = statement;
+        }
+    }
+
+    // Every other statement runs, except that functions only define.
+    for (Node* statement = program->children; statement; statement = statement->next_child) {
+        if (statement->type == NODE_TYPE_FUNCTION) {
+            continue;
+        }
+
+        if (statement->type == NODE_TYPE_VARIABLE_DECLARATION) {
+            DeadCodeEntry* global = dead_code_find(reach->globals, reach->global_count, statement->children->value.symbol);
+
+            if (global && global->declaration == statement) {
+                continue;
+            }
+        }
+
+        dead_code_pend(reach, statement);
+    }
+
+    while (reach->pending_count) {
+        dead_code_walk(reach, reach->pending[--reach->pending_count]);
+    }
+}
+
+void dead_code_reach_free(DeadCodeReach* reach) {
+    free(reach->pending);
+    free(reach->globals);
+    free(reach->functions);
+}
+
+void dead_code_eliminate_program(ParsingContext* context, Node* program, DeadCodeStats* stats) {
+    DeadCodeReach reach;
+
+    memset(stats, 0, sizeof(DeadCodeStats));
+    dead_code_mark(&reach, context, program);
+
+    stats->functions_removed = dead_code_unbind(context->functions, reach.functions, reach.function_count, stats);
+    stats->globals_removed = dead_code_unbind(context->variables, reach.globals, reach.global_count, stats);
+
+    for (Node** it = &program->children; *it;) {
+        DeadCodeEntry* global = NULL;
+
+        if ((*it)->type == NODE_TYPE_VARIABLE_DECLARATION) {
+            global = dead_code_find(reach.globals, reach.global_count, (*it)->children->value.symbol);
+        }
+
+        if (global && !global->live) {
+            *it = (*it)->next_child;
+        } else {
+            it = &(*it)->next_child;
+        }
+    }
+
+    dead_code_reach_free(&reach);
+}
+
+Error dead_code_parse_reachable(ParsingContext* context, Node* program) {
+    DeadCodeReach reach;
+
+    dead_code_mark(&reach, context, program);
+    dead_code_reach_free(&reach);
+
+    return reach.err;
+}
+
+void dead_code_stats_free(DeadCodeStats* stats) {
+    free(stats->removed);
+
+    memset(stats, 0, sizeof(DeadCodeStats));
+}
+
+void print_dead_code_stats(DeadCodeStats* stats) {
+    fprintf(diagnostic_stream(), "dead code: %zu functions, %zu globals removed", stats->functions_removed, stats->globals_removed);
+
+    for (size_t i = 0; i < stats->removed_count; ++i) {
+        fprintf(diagnostic_stream(), "%s%s", i ? ", " : ": ", stats->removed[i]);
+    }
+
+    fputc('\n', diagnostic_stream());
+}
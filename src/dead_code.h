@@ -0,0 +1,38 @@
+#ifndef COMPILER_DEAD_CODE_H
+#define COMPILER_DEAD_CODE_H
+
+#include <stddef.h>
+
+#include "error.h"
+#include "parser.h"
+
+typedef struct DeadCodeStats {
+    size_t functions_removed;
+    size_t globals_removed;
+
+    // Names of what was removed, functions first, pointing into the
+    // program's nodes.
+    char** removed;
+    size_t removed_count;
+    size_t removed_capacity;
+} DeadCodeStats;
+
+// Remove the top-level functions and globals of `context` that nothing
+// reachable from the statements of `program` calls or mentions, following
+// the calls and global references of every function found. A global whose
+// initializer makes no calls goes with its declaration; one whose
+// initializer does is kept, as the calls still have to run. A name a
+// function shadows with a parameter or local counts as a reference all the
+// same.
+void dead_code_eliminate_program(ParsingContext* context, Node* program, DeadCodeStats* stats);
+
+// Parse the bodies a lazy parse of `context` skipped of every function the
+// statements of `program` reach, as dead_code_eliminate_program() would
+// find them, returning the first error.
+Error dead_code_parse_reachable(ParsingContext* context, Node* program);
+
+void dead_code_stats_free(DeadCodeStats* stats);
+
+void print_dead_code_stats(DeadCodeStats* stats);
+
+#endif
@@ -0,0 +1,542 @@
+#include "driver.h"
+#include "allocator.h"
+#include "bounds.h"
+#include "bytecode.h"
+#include "cache.h"
+#include "closure.h"
+#include "codegen.h"
+#include "ctfe.h"
+#include "dead_code.h"
+#include "error.h"
+#include "file_io.h"
+#include "module.h"
+#include "parser.h"
+#include "profile.h"
+#include "time_report.h"
+#include "trace.h"
+#include "typechecker.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void driver_options_init(DriverOptions* options) {
+    memset(options, 0, sizeof(DriverOptions));
+
+    options->codegen.format = CG_FMT_DEFAULT;
+    options->cache_max_size = CACHE_DEFAULT_MAX_SIZE;
+}
+
+// A byte count with an optional K, M or G suffix; zero if it is not one.
+unsigned long long driver_size(char* size) {
+    char* end = NULL;
+    unsigned long long bytes = strtoull(size, &end, 10);
+
+    if (end == size) {
+        return 0;
+    }
+
+    switch (*end) {
+    case 'K': case 'k': bytes <<= 10; end++; break;
+    case 'M': case 'm': bytes <<= 20; end++; break;
+    case 'G': case 'g': bytes <<= 30; end++; break;
+    default: break;
+    }
+
+    return *end ? 0 : bytes;
+}
+
+int driver_option(DriverOptions* options, char* argument) {
+    if (strcmp(argument, "--stats") == 0) {
+        options->print_stats = 1;
+    } else if (strcmp(argument, "--time-report") == 0) {
+        options->print_time = 1;
+    } else if (strcmp(argument, "--memory-report") == 0) {
+        options->print_memory = 1;
+    } else if (strcmp(argument, "--dump-ast") == 0) {
+        options->dump_ast = 1;
+    } else if (strcmp(argument, "--interpret") == 0) {
+        options->interpret = 1;
+    } else if (strcmp(argument, "--lazy-parse") == 0) {
+        options->lazy_parse = 1;
+    } else if (strcmp(argument, "--target=x86_64-mswin") == 0) {
+        options->codegen.format = CG_FMT_x86_64_MSWIN;
+    } else if (strcmp(argument, "--target=x86_64-sysv") == 0) {
+        options->codegen.format = CG_FMT_x86_64_SYSV;
+    } else if (strcmp(argument, "--profile-generate") == 0) {
+        options->codegen.profile_generate = "croc.profdata";
+    } else if (strncmp(argument, "--profile-generate=", 19) == 0) {
+        options->codegen.profile_generate = argument + 19;
+    } else if (strncmp(argument, "--profile-use=", 14) == 0) {
+        options->profile_use_path = argument + 14;
+    } else if (strcmp(argument, "--instrument") == 0) {
+        options->codegen.instrument = 1;
+    } else if (strncmp(argument, "--instrument=", 13) == 0) {
+        options->codegen.instrument = 1;
+        options->codegen.instrument_output = argument + 13;
+    } else if (strcmp(argument, "-g") == 0) {
+        options->codegen.debug_info = 1;
+    } else if (strcmp(argument, "--module") == 0) {
+        options->codegen.module = 1;
+    } else if (strcmp(argument, "--cache") == 0) {
+        options->cache = 1;
+    } else if (strncmp(argument, "--cache=", 8) == 0) {
+        options->cache = 1;
+        options->cache_directory = argument + 8;
+    } else if (strncmp(argument, "--trace=", 8) == 0 && argument[8]) {
+        options->trace_path = argument + 8;
+    } else if (strncmp(argument, "--cache-size=", 13) == 0) {
+        options->cache_max_size = driver_size(argument + 13);
+
+        return options->cache_max_size != 0;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+Error driver_load_profile(DriverOptions* options) {
+    Error err = ok;
+
+    if (!options->profile_use_path) {
+        return err;
+    }
+
+    err = profile_read(options->profile_use_path, &options->profile);
+    if (err.type) { return err; }
+
+    options->codegen.profile_use = &options->profile;
+
+    return err;
+}
+
+// Memory of one compile: the program's, which lasts until the compile ends,
+// and the scratch memory of the phase running, released when the next one
+// begins. With --memory-report, both go through counting allocators.
+typedef struct DriverMemory {
+    CrocArena program_arena;
+    CrocArena phase_arena;
+    CountingAllocator program_counts;
+    CountingAllocator phase_counts;
+    int counting;
+
+    CrocAllocator* program;
+    CrocAllocator* phase;
+} DriverMemory;
+
+void driver_memory_init(DriverMemory* memory, int counting) {
+    arena_init(&memory->program_arena, &croc_heap);
+    arena_init(&memory->phase_arena, &croc_heap);
+
+    memory->counting = counting;
+    memory->program = &memory->program_arena.allocator;
+    memory->phase = &memory->phase_arena.allocator;
+
+    if (counting) {
+        counting_allocator_init(&memory->program_counts, memory->program);
+        counting_allocator_init(&memory->phase_counts, memory->phase);
+
+        memory->program = &memory->program_counts.allocator;
+        memory->phase = &memory->phase_counts.allocator;
+    }
+}
+
+void driver_memory_phase_end(DriverMemory* memory) {
+    arena_reset(&memory->phase_arena);
+
+    if (memory->counting) {
+        counting_allocator_reset(&memory->phase_counts);
+    }
+}
+
+void driver_memory_free(DriverMemory* memory) {
+    arena_free(&memory->program_arena);
+    arena_free(&memory->phase_arena);
+
+    if (memory->counting) {
+        counting_allocator_free(&memory->program_counts);
+        counting_allocator_free(&memory->phase_counts);
+    }
+}
+
+void print_driver_memory(DriverMemory* memory) {
+    print_allocation_sites(&memory->program_counts, "program memory");
+    print_allocation_sites(&memory->phase_counts, "phase memory");
+    fprintf(diagnostic_stream(), "arena peak: %zu bytes program, %zu bytes phase\n", memory->program_arena.peak_bytes, memory->phase_arena.peak_bytes);
+}
+
+// Write the assembly to `output` if it is not NULL, or else to the file at
+// `output_path`, going through the cache if it is enabled. Phases, forms and
+// functions are recorded in `trace` if it is not NULL.
+int driver_compile_in(DriverOptions* options, DriverMemory* memory, TraceBuffer* trace, char* input_path, char* source, char* output_path, FILE* output) {
+    CodegenOptions codegen_options = options->codegen;
+    TimeReport time_report;
+    memset(&time_report, 0, sizeof(TimeReport));
+
+    time_report.trace = trace;
+
+    codegen_options.output_path = output_path;
+
+    // A module's interface is linked by name, and it has no main to run or
+    // to report from.
+    if (codegen_options.module && (options->interpret || codegen_options.profile_generate || codegen_options.instrument || !input_path || strcmp(input_path, "-") == 0)) {
+        fprintf(diagnostic_stream(), "--module needs a source file and cannot be combined with --interpret, --profile-generate or --instrument\n");
+
+        return 3;
+    }
+
+    // Every later return goes through `done`, which frees the import
+    // directory and the source read here.
+    int status = 0;
+    char* import_directory = module_directory(input_path);
+
+    if (codegen_options.debug_info) {
+        codegen_options.source_path = input_path && strcmp(input_path, "-") != 0 ? input_path : "<stdin>";
+    }
+
+    // The VM and --dump-ast need the program itself, and a module its
+    // interface written.
+    int cached = options->cache && !output && !options->interpret && !options->dump_ast && !codegen_options.module;
+    char* cache_directory = options->cache_directory;
+    char default_cache_directory[1024];
+    char key[CACHE_KEY_SIZE];
+    char* read_source = NULL;
+
+    if (cached) {
+        time_report_begin(&time_report, "cache");
+
+        if (!cache_directory) {
+            cache_default_directory(default_cache_directory, sizeof(default_cache_directory));
+            cache_directory = default_cache_directory;
+        }
+
+        // Read here so it is hashed; a file that cannot be read is reported
+        // by the parser.
+        if (!source) {
+            source = read_source = file_contents(input_path);
+        }
+
+        if (source) {
+            char** interface_paths = NULL;
+            size_t interface_count = module_scan_imports(source, import_directory, &interface_paths);
+
+            cache_key(&codegen_options, options->profile_use_path, interface_paths, interface_count, source, key);
+
+            for (size_t i = 0; i < interface_count; ++i) {
+                free(interface_paths[i]);
+            }
+
+            free(interface_paths);
+
+            if (cache_lookup(cache_directory, key, output_path ? output_path : CODEGEN_DEFAULT_OUTPUT_PATH)) {
+                time_report_end(&time_report);
+
+                if (options->print_stats) {
+                    fprintf(diagnostic_stream(), "cache: hit %s\n", key);
+                }
+
+                if (options->print_time) {
+                    print_time_report(&time_report);
+                }
+
+                goto done;
+            }
+        } else {
+            cached = 0;
+        }
+    }
+
+    // Line information is looked up in the source long after parsing, and
+    // bodies a lazy parse skipped once the reachable ones are known.
+    if (!source && (codegen_options.debug_info || options->lazy_parse)) {
+        source = read_source = file_contents(input_path);
+    }
+
+    time_report_begin(&time_report, "parse");
+
+    Node* program = node_allocate(memory->program);
+    ParsingContext* context = parse_context_default_create(memory->program, memory->phase);
+    context->import_directory = import_directory;
+    context->lazy = options->lazy_parse;
+    context->trace = trace;
+
+    Error err = source ? parse_source(source, context, program) : parse_program(input_path, context, program);
+
+    // A module exports every function and --dump-ast prints them all;
+    // otherwise only the bodies of functions the program may call are
+    // parsed, and the rest are removed as dead code.
+    if (!err.type && context->lazy) {
+        err = codegen_options.module || options->dump_ast ? parse_function_bodies(context) : dead_code_parse_reachable(context, program);
+    }
+
+    if (!codegen_options.debug_info) {
+        free(read_source);
+        read_source = NULL;
+    }
+
+    if (options->dump_ast) {
+        print_node(program, 0);
+        fputc('\n', diagnostic_stream());
+    }
+
+    if (err.type) {
+        print_error(err);
+        status = 1;
+
+        goto done;
+    }
+
+    driver_memory_phase_end(memory);
+    time_report_begin(&time_report, "typecheck");
+
+    err = typecheck_program(context, program);
+    if (err.type) {
+        print_error(err);
+        status = 2;
+
+        goto done;
+    }
+
+    driver_memory_phase_end(memory);
+    time_report_begin(&time_report, "closures");
+
+    ClosureStats closures;
+
+    err = closure_analyze_program(context, program, &closures);
+    if (err.type) {
+        print_error(err);
+        status = 2;
+
+        goto done;
+    }
+
+    driver_memory_phase_end(memory);
+
+    int interface_written = 0;
+
+    if (codegen_options.module) {
+        time_report_begin(&time_report, "interface");
+
+        char* interface_path = module_source_interface_path(input_path);
+
+        err = module_write_interface(context, interface_path, &interface_written);
+        free(interface_path);
+
+        if (err.type) {
+            print_error(err);
+            status = 3;
+
+            goto done;
+        }
+    }
+
+    time_report_begin(&time_report, "ctfe");
+
+    CTFEContext ctfe;
+    ctfe_context_init(&ctfe, context);
+    ctfe_fold_program(&ctfe, program);
+
+    size_t inlined = 0;
+
+    if (codegen_options.profile_use) {
+        time_report_begin(&time_report, "pgo");
+
+        inlined = profile_inline_program(context, program, codegen_options.profile_use);
+    }
+
+    // After folding and inlining, which can leave functions without
+    // callers. A module exports everything.
+    DeadCodeStats dead_code;
+    memset(&dead_code, 0, sizeof(DeadCodeStats));
+
+    if (!codegen_options.module) {
+        time_report_begin(&time_report, "dead code");
+
+        dead_code_eliminate_program(context, program, &dead_code);
+    }
+
+    time_report_begin(&time_report, "bounds");
+
+    BoundsStats bounds;
+    bounds_check_eliminate(context, program, &bounds);
+
+    if (options->interpret) {
+        BytecodeModule module;
+        long long result = 0;
+
+        time_report_begin(&time_report, "bytecode");
+
+        err = bytecode_compile_program(context, program, &module);
+        driver_memory_phase_end(memory);
+
+        if (!err.type) {
+            time_report_begin(&time_report, "vm");
+
+            err = vm_run(&module, &result);
+        }
+
+        time_report_end(&time_report);
+
+        bytecode_module_free(&module);
+
+        if (err.type) {
+            dead_code_stats_free(&dead_code);
+            print_error(err);
+            status = 3;
+
+            goto done;
+        }
+
+        if (options->print_stats) {
+            if (context->lazy) {
+                fprintf(diagnostic_stream(), "lazy parse: %zu of %zu function bodies parsed\n", context->lazy_bodies_parsed, context->lazy_body_count);
+            }
+
+            print_ctfe_stats(ctfe.stats);
+            print_dead_code_stats(&dead_code);
+            print_bounds_stats(bounds);
+            print_closure_stats(closures);
+        }
+
+        dead_code_stats_free(&dead_code);
+
+        if (options->print_time) {
+            print_time_report(&time_report);
+        }
+
+        status = (int)result;
+
+        goto done;
+    }
+
+    driver_memory_phase_end(memory);
+    time_report_begin(&time_report, "codegen");
+
+    LineTable lines;
+    line_table_init(&lines, codegen_options.debug_info ? source : NULL);
+
+    if (codegen_options.debug_info) {
+        codegen_options.lines = &lines;
+    }
+
+    err = output ? codegen_program_file(&codegen_options, context, program, output) : codegen_program(&codegen_options, context, program);
+
+    line_table_free(&lines);
+    free(read_source);
+    read_source = NULL;
+    driver_memory_phase_end(memory);
+
+    int stored = 0;
+    size_t evicted = 0;
+
+    if (cached && !err.type) {
+        time_report_begin(&time_report, "cache");
+
+        stored = cache_store(cache_directory, key, output_path ? output_path : CODEGEN_DEFAULT_OUTPUT_PATH, options->cache_max_size, &evicted);
+    }
+
+    time_report_end(&time_report);
+
+    if (err.type) {
+        dead_code_stats_free(&dead_code);
+        print_error(err);
+        status = 3;
+
+        goto done;
+    }
+
+    if (options->print_stats) {
+        if (context->lazy) {
+            fprintf(diagnostic_stream(), "lazy parse: %zu of %zu function bodies parsed\n", context->lazy_bodies_parsed, context->lazy_body_count);
+        }
+
+        print_ctfe_stats(ctfe.stats);
+
+        if (!codegen_options.module) {
+            print_dead_code_stats(&dead_code);
+        }
+
+        print_bounds_stats(bounds);
+        print_closure_stats(closures);
+
+        if (codegen_options.profile_use) {
+            fprintf(diagnostic_stream(), "pgo: %zu call sites inlined\n", inlined);
+        }
+
+        if (codegen_options.module) {
+            fprintf(diagnostic_stream(), "module: interface %s\n", interface_written ? "written" : "unchanged");
+        }
+
+        if (cached) {
+            fprintf(diagnostic_stream(), "cache: miss %s, %s, %zu evicted\n", key, stored ? "stored" : "could not store", evicted);
+        }
+    }
+
+    dead_code_stats_free(&dead_code);
+
+    if (options->print_time) {
+        print_time_report(&time_report);
+    }
+
+done:
+    free(read_source);
+    free(import_directory);
+
+    return status;
+}
+
+int driver_compile_to(DriverOptions* options, char* input_path, char* source, char* output_path, FILE* output) {
+    DriverMemory memory;
+    Trace* trace = options->trace;
+    TraceBuffer trace_buffer;
+    char* name = input_path && strcmp(input_path, "-") != 0 ? input_path : "<stdin>";
+
+    if (!trace && options->trace_path) {
+        trace = trace_create(options->trace_path);
+    }
+
+    double start = time_report_wall_seconds();
+
+    if (trace) {
+        trace_buffer_init(&trace_buffer, trace, name);
+    }
+
+    driver_memory_init(&memory, options->print_memory);
+
+    int status = driver_compile_in(options, &memory, trace ? &trace_buffer : NULL, input_path, source, output_path, output);
+
+    if (options->print_memory) {
+        print_driver_memory(&memory);
+    }
+
+    driver_memory_free(&memory);
+
+    if (trace) {
+        trace_span(&trace_buffer, "compile", name, start, NULL, 0);
+        trace_buffer_flush(&trace_buffer);
+    }
+
+    if (trace && trace != options->trace) {
+        Error err = trace_write(trace);
+
+        if (err.type) {
+            print_error(err);
+
+            status = status ? status : 3;
+        }
+
+        trace_free(trace);
+    }
+
+    return status;
+}
+
+int driver_compile(DriverOptions* options, char* input_path, char* source, char* output_path) {
+    return driver_compile_to(options, input_path, source, output_path, NULL);
+}
+
+int driver_compile_stream(DriverOptions* options, char* input_path, char* source, FILE* output) {
+    return driver_compile_to(options, input_path, source, NULL, output);
+}
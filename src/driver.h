@@ -0,0 +1,59 @@
+#ifndef COMPILER_DRIVER_H
+#define COMPILER_DRIVER_H
+
+#include <stdio.h>
+
+#include "codegen.h"
+#include "error.h"
+#include "profile.h"
+#include "trace.h"
+
+typedef struct DriverOptions {
+    int print_stats;
+    int print_time;
+    // Report the allocations of the compile and the most bytes they held at
+    // once by the function that made them.
+    int print_memory;
+    int dump_ast;
+    int interpret;
+    // Parse only the bodies of functions the program may call; the others
+    // are found by matching braces and never checked.
+    int lazy_parse;
+    CodegenOptions codegen;
+
+    // Profile read from `profile_use_path` by driver_load_profile().
+    char* profile_use_path;
+    Profile profile;
+
+    // Serve and store assembly in the compilation cache at
+    // `cache_directory`, or the default one if it is NULL, keeping it under
+    // `cache_max_size` bytes.
+    int cache;
+    char* cache_directory;
+    unsigned long long cache_max_size;
+
+    // Write a Chrome trace of each phase, top-level form and function to
+    // `trace_path`. Compiles record into `trace` if it is not NULL, leaving
+    // it to be written once they are all done; otherwise each writes a
+    // trace of its own.
+    char* trace_path;
+    Trace* trace;
+} DriverOptions;
+
+void driver_options_init(DriverOptions* options);
+
+// Apply a compile option, returning zero if `argument` is not one.
+int driver_option(DriverOptions* options, char* argument);
+
+Error driver_load_profile(DriverOptions* options);
+
+// Compile the file at `input_path`, or `source` if it is not NULL, reporting
+// to the thread's diagnostic stream. Returns the exit code for it: 1 for a
+// parse error, 2 for a type error, 3 for a codegen error, or the program's
+// result with --interpret.
+int driver_compile(DriverOptions* options, char* input_path, char* source, char* output_path);
+// Compile as driver_compile() does, writing the assembly to `output` and
+// bypassing the cache.
+int driver_compile_stream(DriverOptions* options, char* input_path, char* source, FILE* output);
+
+#endif
@@ -1,4 +1,5 @@
 #include "environment.h"
+#include "time_report.h"
 
 #include <assert.h>
 #include <stddef.h>
@@ -6,17 +7,32 @@
 
 #include <parser.h>
 
-Environment* environment_create(Environment* parent) {
-    Environment* env = malloc(sizeof(Environment));
+Environment* environment_create(CrocAllocator* allocator, Environment* parent) {
+    Environment* env = croc_allocate(allocator, sizeof(Environment));
 
-    assert(env && "environment_create: could not allocate memory for new environment");
+    compiler_counters.environments++;
+    count_allocation(sizeof(Environment));
 
     env->parent = parent;
     env->bind = NULL;
+    env->allocator = allocator;
 
     return env;
 }
 
+void environment_free(Environment* env) {
+    Binding* binding = env->bind;
+
+    while (binding) {
+        Binding* next = binding->next;
+
+        croc_release(env->allocator, binding);
+        binding = next;
+    }
+
+    croc_release(env->allocator, env);
+}
+
 int environment_set(Environment* env, Node* id, Node* value) {
     if (!env || !id || !value) {
         return 0;
@@ -34,16 +50,21 @@ int environment_set(Environment* env, Node* id, Node* value) {
         binding_it = binding_it->next;
     }
 
-    Binding* binding = malloc(sizeof(Binding));
+    environment_push(env, id, value);
+
+    return 1;
+}
+
+void environment_push(Environment* env, Node* id, Node* value) {
+    Binding* binding = croc_allocate(env->allocator, sizeof(Binding));
 
-    assert(binding && "environment_set: could not allocate binding for environment");
+    compiler_counters.bindings++;
+    count_allocation(sizeof(Binding));
 
     binding->id = id;
     binding->value = value;
     binding->next = env->bind;
     env->bind = binding;
-
-    return 1;
 }
 
 int environment_get(Environment env, Node* id, Node* result) {
@@ -63,10 +84,22 @@ int environment_get(Environment env, Node* id, Node* result) {
 }
 
 int environment_get_by_symbol(Environment env, char* symbol, Node* result) {
-    Node* symbol_node = node_symbol(symbol);
+    Node* symbol_node = node_symbol(env.allocator, symbol);
     int status = environment_get(env, symbol_node, result);
 
-    free(symbol_node);
+    node_free(env.allocator, symbol_node);
 
     return status;
 }
+
+int environment_get_function(ParsingContext* context, Node* id, Node* result) {
+    while (context) {
+        if (environment_get(*context->functions, id, result)) {
+            return 1;
+        }
+
+        context = context->parent;
+    }
+
+    return 0;
+}
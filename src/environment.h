@@ -1,7 +1,10 @@
 #ifndef COMPILER_ENVIRONMENT_H
 #define COMPILER_ENVIRONMENT_H
 
+#include "allocator.h"
+
 typedef struct Node Node;
+typedef struct ParsingContext ParsingContext;
 
 typedef struct Binding {
     Node* id;
@@ -9,15 +12,26 @@ typedef struct Binding {
     struct Binding* next;
 } Binding;
 
+// Bindings are allocated from the environment's allocator.
 typedef struct Environment {
     struct Environment* parent;
     Binding* bind;
+    CrocAllocator* allocator;
 } Environment;
 
-Environment* environment_create(Environment* parent);
+Environment* environment_create(CrocAllocator* allocator, Environment* parent);
+// Give the environment and its bindings, but not what they bind, back to
+// its allocator.
+void environment_free(Environment* env);
 
 int environment_set(Environment* env, Node* id, Node* value);
+// Bind `id` in front of any binding it already has, without looking for
+// one, so lookups find `value` but both stay in the list.
+void environment_push(Environment* env, Node* id, Node* value);
 int environment_get(Environment env, Node* id, Node* result);
 int environment_get_by_symbol(Environment env, char* symbol, Node* result);
+// Look `id` up among the functions of `context` and of the contexts it is
+// nested in, innermost first.
+int environment_get_function(ParsingContext* context, Node* id, Node* result);
 
 #endif
\ No newline at end of file
@@ -6,32 +6,42 @@
 
 Error ok = { ERROR_NONE, NULL };
 
+_Thread_local FILE* diagnostics = NULL;
+
+FILE* diagnostic_stream() {
+    return diagnostics ? diagnostics : stdout;
+}
+
+void diagnostic_stream_set(FILE* stream) {
+    diagnostics = stream;
+}
+
 void print_error(Error err) {
     if (err.type == ERROR_NONE) {
         return;
     }
 
-    printf("error: ");
+    fprintf(diagnostic_stream(), "error: ");
     assert(ERROR_MAX == 6);
 
     switch (err.type) {
     case ERROR_TODO:
-        printf("TODO (not implemented)");
+        fprintf(diagnostic_stream(), "TODO (not implemented)");
 
         break;
 
     case ERROR_SYNTAX:
-        printf("invalid syntax");
+        fprintf(diagnostic_stream(), "invalid syntax");
 
         break;
     
     case ERROR_TYPE:
-        printf("mismatched types");
+        fprintf(diagnostic_stream(), "mismatched types");
 
         break;
 
     case ERROR_ARGUMENTS:
-        printf("invalid arguments");
+        fprintf(diagnostic_stream(), "invalid arguments");
 
         break;
 
@@ -40,14 +50,14 @@ void print_error(Error err) {
         break;
 
     default:
-        printf("unknown error type");
+        fprintf(diagnostic_stream(), "unknown error type");
 
         break;
     }
     
-    putchar('\n');
+    fputc('\n', diagnostic_stream());
 
     if (err.msg) {
-        printf("    : %s\n", err.msg);
+        fprintf(diagnostic_stream(), "    : %s\n", err.msg);
     }
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef COMPILER_ERROR_H
 #define COMPILER_ERROR_H
 
+#include <stdio.h>
+
 typedef struct Error {
     enum ErrorType {
         ERROR_NONE = 0,
@@ -17,6 +19,12 @@ typedef struct Error {
 
 void print_error(Error err);
 
+// Everything the compiler reports goes to the calling thread's diagnostic
+// stream, stdout unless a compile job has pointed it at its own buffer so
+// that jobs running in parallel keep their reports apart.
+FILE* diagnostic_stream();
+void diagnostic_stream_set(FILE* stream);
+
 extern Error ok;
 
 #define ERROR_CREATE(n, t, msg)     Error (n) = { (t), (msg) }
@@ -1,4 +1,6 @@
 #include "file_io.h"
+#include "error.h"
+#include "time_report.h"
 
 #include <assert.h>
 #include <stddef.h>
@@ -14,7 +16,7 @@ size_t file_size(FILE* file) {
     fpos_t original;
 
     if (fgetpos(file, &original) != 0) {
-        printf("file_size: fgetpos() failed: %i\n", errno);
+        fprintf(diagnostic_stream(), "file_size: fgetpos() failed: %i\n", errno);
 
         return 0;
     }
@@ -23,7 +25,7 @@ size_t file_size(FILE* file) {
     long out = ftell(file);
 
     if (fsetpos(file, &original) != 0) {
-        printf("file_size: fsetpos() failed: %i\n", errno);
+        fprintf(diagnostic_stream(), "file_size: fsetpos() failed: %i\n", errno);
     }
 
     return out;
@@ -33,7 +35,7 @@ char* file_contents(char* path) {
     FILE* file = fopen(path, "r");
 
     if (!file) {
-        printf("file_contents: could not open file '%s'\n", path);
+        fprintf(diagnostic_stream(), "file_contents: could not open file '%s'\n", path);
 
         return NULL;
     }
@@ -41,6 +43,7 @@ char* file_contents(char* path) {
     size_t size = file_size(file);
     char* contents = malloc(size + 1);
     assert(contents && "file_contents: could not allocate memory for buffer");
+    count_allocation(size + 1);
 
     char* write_it = contents;
     size_t bytes_read = 0;
@@ -49,8 +52,9 @@ char* file_contents(char* path) {
         size_t bytes_read_this_iteration = fread(write_it, 1, size - bytes_read, file);
 
         if (ferror(file)) {
-            printf("file_contents: error while reading: %i\n", errno);
+            fprintf(diagnostic_stream(), "file_contents: error while reading: %i\n", errno);
             free(contents);
+            fclose(file);
 
             return NULL;
         }
@@ -65,5 +69,46 @@ char* file_contents(char* path) {
 
     contents[bytes_read] = '\0';
 
+    fclose(file);
+
+    return contents;
+}
+
+char* stream_contents(FILE* stream, size_t length) {
+    size_t capacity = length ? length + 1 : 4096;
+    size_t bytes_read = 0;
+    char* contents = malloc(capacity);
+    assert(contents && "stream_contents: could not allocate memory for buffer");
+
+    for (;;) {
+        size_t wanted = length ? length - bytes_read : capacity - bytes_read - 1;
+
+        if (!wanted) {
+            if (length) { break; }
+
+            capacity *= 2;
+            contents = realloc(contents, capacity);
+            assert(contents && "stream_contents: could not allocate memory for buffer");
+
+            continue;
+        }
+
+        size_t bytes_read_this_iteration = fread(contents + bytes_read, 1, wanted, stream);
+        bytes_read += bytes_read_this_iteration;
+
+        if (bytes_read_this_iteration < wanted) {
+            if (ferror(stream) || (length && bytes_read < length)) {
+                free(contents);
+
+                return NULL;
+            }
+
+            break;
+        }
+    }
+
+    count_allocation(capacity);
+    contents[bytes_read] = '\0';
+
     return contents;
 }
\ No newline at end of file
@@ -6,5 +6,8 @@
 
 size_t file_size(FILE* file);
 char* file_contents(char* path);
+// Read exactly `length` bytes of `stream`, or all of it if `length` is zero,
+// into a NUL-terminated buffer; NULL if it ends early or cannot be read.
+char* stream_contents(FILE* stream, size_t length);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "line_table.h"
+#include "time_report.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+void line_table_init(LineTable* table, char* source) {
+    table->source = source;
+    table->starts = NULL;
+    table->count = 0;
+}
+
+void line_table_free(LineTable* table) {
+    free(table->starts);
+
+    table->starts = NULL;
+    table->count = 0;
+}
+
+void line_table_build(LineTable* table) {
+    size_t capacity = 256;
+    char* it = table->source;
+
+    table->starts = malloc(capacity * sizeof(size_t));
+    assert(table->starts && "line_table_build: could not allocate memory for line starts");
+
+    table->starts[table->count++] = 0;
+
+    while ((it = strchr(it, '\n'))) {
+        it++;
+
+        if (table->count == capacity) {
+            capacity *= 2;
+            table->starts = realloc(table->starts, capacity * sizeof(size_t));
+            assert(table->starts && "line_table_build: could not allocate memory for line starts");
+        }
+
+        table->starts[table->count++] = (size_t)(it - table->source);
+    }
+
+    count_allocation(capacity * sizeof(size_t));
+}
+
+void line_table_locate(LineTable* table, unsigned int location, size_t* line, size_t* column) {
+    *line = 0;
+    *column = 0;
+
+    if (!location || !table->source) {
+        return;
+    }
+
+    if (!table->starts) {
+        line_table_build(table);
+    }
+
+    size_t offset = location - 1;
+    size_t low = 0;
+    size_t high = table->count;
+
+    // The last line starting at or before `offset`.
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+
+        if (table->starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    *line = low + 1;
+    *column = offset - table->starts[low] + 1;
+}
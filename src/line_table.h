@@ -0,0 +1,22 @@
+#ifndef COMPILER_LINE_TABLE_H
+#define COMPILER_LINE_TABLE_H
+
+#include <stddef.h>
+
+// Turns node locations into lines and columns. The offsets at which lines
+// start are only collected the first time a location is looked up, so
+// compiles that never ask pay nothing.
+typedef struct LineTable {
+    char* source;
+    size_t* starts;
+    size_t count;
+} LineTable;
+
+void line_table_init(LineTable* table, char* source);
+void line_table_free(LineTable* table);
+
+// Line and column, both counted from 1, of the node location `location`;
+// zero for both if it is zero.
+void line_table_locate(LineTable* table, unsigned int location, size_t* line, size_t* column);
+
+#endif
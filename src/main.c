@@ -3,52 +3,257 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "codegen.h"
+#include "driver.h"
 #include "error.h"
-#include "environment.h"
 #include "file_io.h"
-#include "parser.h"
-#include "typechecker.h"
+#include "server.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 void print_usage(char** argv) {
-    printf("Usage: %s <file.croc>\n", argv[0]);
+    printf("Usage: %s [options] <file.croc>...\n", argv[0]);
+    printf("Options:\n");
+    printf("    -j <n>                      compile up to <n> files at once\n");
+    printf("    -o <path>                   write the assembly of a single input to <path>\n");
+    printf("    --server[=<socket>]         stay resident and compile what clients send\n");
+    printf("    --client[=<socket>]         have the server compile the input; \"-\" reads stdin\n");
+    printf("    --stats                     report what the optimizations did\n");
+    printf("    --time-report               report time, allocations and peak memory per phase\n");
+    printf("    --memory-report             report allocations and peak bytes per allocating function\n");
+    printf("    --dump-ast                  print the parsed program\n");
+    printf("    --interpret                 run the program in the bytecode VM\n");
+    printf("    --lazy-parse                parse only the bodies of functions the program may call\n");
+    printf("    --target=<target>           x86_64-mswin or x86_64-sysv; defaults to the host\n");
+    printf("    -g                          emit line information, and on SysV unwind information,\n");
+    printf("                                for debuggers and profilers\n");
+    printf("    --profile-generate[=<path>] make the program write a profile to <path> on exit\n");
+    printf("                                (default \"croc.profdata\")\n");
+    printf("    --profile-use=<path>        optimize for the profile at <path>\n");
+    printf("    --instrument[=<path>]       make the program report calls and cycles per function\n");
+    printf("                                on exit, to <path> or stderr\n");
+    printf("    --module                    compile a module for other files to import: export its\n");
+    printf("                                functions and globals, emit no main, and write its\n");
+    printf("                                interface to <file>.crocmod\n");
+    printf("    --cache[=<dir>]             reuse assembly from earlier compiles of the same input\n");
+    printf("                                and options (default dir \"$XDG_CACHE_HOME/croc\")\n");
+    printf("    --cache-size=<bytes>        evict the least recently used entries past <bytes>;\n");
+    printf("                                K, M and G suffixes work (default 256M)\n");
+    printf("    --trace=<path>              write a Chrome trace event file of the time each phase,\n");
+    printf("                                top-level form and function takes to <path>\n");
+    printf("A single input is compiled to " CODEGEN_DEFAULT_OUTPUT_PATH ", several each to their own path with the\n");
+    printf("extension replaced by .S. The exit code is that of the first input that failed:\n");
+    printf("1 for a parse error, 2 for a type error, 3 for a codegen error, and %d\n", SERVER_UNREACHABLE);
+    printf("if --client finds no server.\n");
+}
+
+typedef struct CompileJob {
+    DriverOptions* options;
+    char* input_path;
+    char* output_path;
+    // What the job reported, replayed once every job is done; NULL if it
+    // went straight to stdout.
+    FILE* diagnostics;
+    int status;
+} CompileJob;
+
+void compile_job_run(void* data, size_t index) {
+    CompileJob* job = (CompileJob*)data + index;
+
+    diagnostic_stream_set(job->diagnostics);
+    job->status = driver_compile(job->options, job->input_path, NULL, job->output_path);
+    diagnostic_stream_set(NULL);
+}
+
+// `input.croc` becomes `input.S`; a path without an extension gets one.
+char* compile_output_path(char* input_path) {
+    char* extension = strrchr(input_path, '.');
+    char* separator = strrchr(input_path, '/');
+    char* backslash = strrchr(input_path, '\\');
+
+    if (backslash > separator) {
+        separator = backslash;
+    }
+
+    size_t length = extension && extension > separator ? (size_t)(extension - input_path) : strlen(input_path);
+    char* output_path = malloc(length + 3);
+    assert(output_path && "compile_output_path: could not allocate memory for output path");
+
+    memcpy(output_path, input_path, length);
+    memcpy(output_path + length, ".S", 3);
+
+    return output_path;
 }
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
+    char** input_paths = calloc(argc, sizeof(char*));
+    size_t input_count = 0;
+    // Compile options as given, for --client to pass on.
+    char** forwarded = calloc(argc, sizeof(char*));
+    size_t forwarded_count = 0;
+    size_t jobs = 1;
+    char* output_path = NULL;
+    int server = 0;
+    int client = 0;
+    char socket_path[256];
+    DriverOptions options;
+
+    assert(input_paths && forwarded && "main: could not allocate memory for arguments");
+
+    driver_options_init(&options);
+    server_default_socket_path(socket_path, sizeof(socket_path));
+
+    for (int i = 1; i < argc; ++i) {
+        if (driver_option(&options, argv[i])) {
+            forwarded[forwarded_count++] = argv[i];
+        } else if (strcmp(argv[i], "--server") == 0 || strncmp(argv[i], "--server=", 9) == 0) {
+            server = 1;
+
+            if (argv[i][8]) {
+                snprintf(socket_path, sizeof(socket_path), "%s", argv[i] + 9);
+            }
+        } else if (strcmp(argv[i], "--client") == 0 || strncmp(argv[i], "--client=", 9) == 0) {
+            client = 1;
+
+            if (argv[i][8]) {
+                snprintf(socket_path, sizeof(socket_path), "%s", argv[i] + 9);
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            char* count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            char* end = NULL;
+
+            jobs = strtoul(count, &end, 10);
+
+            if (!*count || *end || jobs == 0) {
+                printf("invalid job count: \"%s\"\n", count);
+                print_usage(argv);
+
+                return 1;
+            }
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            printf("unknown option: \"%s\"\n", argv[i]);
+            print_usage(argv);
+
+            return 1;
+        } else {
+            input_paths[input_count++] = argv[i];
+        }
+    }
+
+    if (server) {
+        return server_run(socket_path);
+    }
+
+    if (!input_count) {
         print_usage(argv);
 
         return 0;
     }
 
-    Node* program = node_allocate();
-    ParsingContext* context = parse_context_default_create();
-    Error err = parse_program(argv[1], context, program);
+    if (input_count > 1 && (options.interpret || output_path || client)) {
+        printf("--interpret, -o and --client take a single input\n");
 
-    print_node(program, 0);
-    putchar('\n');
+        return 1;
+    }
 
+    if (client) {
+        return client_run(socket_path, forwarded, forwarded_count, input_paths[0], output_path);
+    }
+
+    // Read once and shared, read-only, by every job.
+    Error err = driver_load_profile(&options);
     if (err.type) {
         print_error(err);
 
-        return 1;
+        return 3;
     }
 
-    err = typecheck_program(context, program);
-    if (err.type) {
-        print_error(err);
+    if (input_count == 1) {
+        char* source = NULL;
+
+        if (strcmp(input_paths[0], "-") == 0) {
+            source = stream_contents(stdin, 0);
+
+            if (!source) {
+                printf("could not read the program from stdin\n");
 
-        return 2;
+                return 1;
+            }
+        }
+
+        return driver_compile(&options, input_paths[0], source, output_path);
     }
 
-    err = codegen_program(CG_FMT_DEFAULT, context, program);
-    if (err.type) {
-        print_error(err);
+    CompileJob* compile_jobs = calloc(input_count, sizeof(CompileJob));
+    assert(compile_jobs && "main: could not allocate memory for compile jobs");
 
-        return 3;
+    for (size_t i = 0; i < input_count; ++i) {
+        compile_jobs[i].options = &options;
+        compile_jobs[i].input_path = input_paths[i];
+        compile_jobs[i].output_path = compile_output_path(input_paths[i]);
+        // Without a temporary file the job reports as it goes.
+        compile_jobs[i].diagnostics = tmpfile();
+    }
+
+    // One trace for all of the jobs, each on a track of its own.
+    if (options.trace_path) {
+        options.trace = trace_create(options.trace_path);
+    }
+
+    thread_pool_run(jobs, input_count, compile_job_run, compile_jobs);
+
+    int status = 0;
+    size_t failed = 0;
+    char buffer[4096];
+
+    for (size_t i = 0; i < input_count; ++i) {
+        CompileJob* job = compile_jobs + i;
+
+        if (job->diagnostics) {
+            size_t length = 0;
+
+            rewind(job->diagnostics);
+
+            while ((length = fread(buffer, 1, sizeof(buffer), job->diagnostics)) > 0) {
+                fwrite(buffer, 1, length, stdout);
+            }
+
+            fclose(job->diagnostics);
+        }
+
+        if (job->status) {
+            printf("%s: failed with status %d\n", job->input_path, job->status);
+
+            if (!status) {
+                status = job->status;
+            }
+
+            failed++;
+        }
+
+        free(job->output_path);
     }
 
-    node_free(program);
+    if (failed) {
+        printf("%zu of %zu files failed\n", failed, input_count);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    if (options.trace) {
+        err = trace_write(options.trace);
+
+        if (err.type) {
+            print_error(err);
+
+            status = status ? status : 3;
+        }
+
+        trace_free(options.trace);
+    }
+
+    free(compile_jobs);
+    free(forwarded);
+    free(input_paths);
+
+    return status;
+}
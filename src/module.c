@@ -0,0 +1,502 @@
+#include "module.h"
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+char* module_directory(char* path) {
+    if (!path || strcmp(path, "-") == 0) {
+        return NULL;
+    }
+
+    char* separator = strrchr(path, '/');
+    char* backslash = strrchr(path, '\\');
+
+    if (backslash > separator) {
+        separator = backslash;
+    }
+
+    if (!separator) {
+        return NULL;
+    }
+
+    // The root keeps its separator.
+    size_t length = separator == path ? 1 : (size_t)(separator - path);
+    char* directory = malloc(length + 1);
+    assert(directory && "module_directory: could not allocate memory for directory");
+
+    memcpy(directory, path, length);
+    directory[length] = '\0';
+
+    return directory;
+}
+
+char* module_interface_path(char* directory, char* name) {
+    size_t length = (directory ? strlen(directory) + 1 : 0) + strlen(name) + sizeof(MODULE_INTERFACE_EXTENSION);
+    char* path = malloc(length);
+    assert(path && "module_interface_path: could not allocate memory for path");
+
+    if (directory) {
+        snprintf(path, length, "%s/%s%s", directory, name, MODULE_INTERFACE_EXTENSION);
+    } else {
+        snprintf(path, length, "%s%s", name, MODULE_INTERFACE_EXTENSION);
+    }
+
+    return path;
+}
+
+char* module_source_interface_path(char* path) {
+    char* extension = strrchr(path, '.');
+    char* separator = strrchr(path, '/');
+    char* backslash = strrchr(path, '\\');
+
+    if (backslash > separator) {
+        separator = backslash;
+    }
+
+    size_t length = extension && extension > separator ? (size_t)(extension - path) : strlen(path);
+    char* interface_path = malloc(length + sizeof(MODULE_INTERFACE_EXTENSION));
+    assert(interface_path && "module_source_interface_path: could not allocate memory for path");
+
+    memcpy(interface_path, path, length);
+    memcpy(interface_path + length, MODULE_INTERFACE_EXTENSION, sizeof(MODULE_INTERFACE_EXTENSION));
+
+    return interface_path;
+}
+
+typedef struct ModuleBuffer {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} ModuleBuffer;
+
+void module_buffer_append(ModuleBuffer* buffer, const void* data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        while (buffer->size + size > buffer->capacity) {
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        }
+
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        assert(buffer->data && "module_buffer_append: could not allocate memory for interface");
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+uint32_t module_string(ModuleBuffer* strings, char* string) {
+    uint32_t offset = (uint32_t)strings->size;
+
+    module_buffer_append(strings, string, strlen(string) + 1);
+
+    return offset;
+}
+
+size_t module_binding_count(Environment* environment) {
+    size_t count = 0;
+
+    for (Binding* it = environment->bind; it; it = it->next) {
+        count++;
+    }
+
+    return count;
+}
+
+// Nonzero if the file at `path` holds exactly `size` bytes of `data`.
+int module_file_equalp(char* path, unsigned char* data, size_t size) {
+    unsigned char buffer[4096];
+    size_t offset = 0;
+    size_t length = 0;
+    int equal = 1;
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        return 0;
+    }
+
+    while (equal && (length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        equal = offset + length <= size && memcmp(buffer, data + offset, length) == 0;
+        offset += length;
+    }
+
+    fclose(file);
+
+    return equal && offset == size;
+}
+
+Error module_write_interface(ParsingContext* context, char* path, int* written) {
+    Error err = ok;
+    ModuleInterfaceHeader header;
+    ModuleBuffer strings = { NULL, 0, 0 };
+    ModuleBuffer records = { NULL, 0, 0 };
+
+    *written = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODULE_INTERFACE_MAGIC, sizeof(header.magic));
+    header.version = MODULE_INTERFACE_VERSION;
+    header.type_count = (uint32_t)module_binding_count(context->types);
+    header.function_count = (uint32_t)module_binding_count(context->functions);
+    header.variable_count = (uint32_t)module_binding_count(context->variables);
+
+    module_buffer_append(&records, &header, sizeof(header));
+
+    for (Binding* it = context->types->bind; it; it = it->next) {
+        ModuleInterfaceType type;
+
+        type.name = module_string(&strings, it->id->value.symbol);
+        type.kind = (uint32_t)it->value->type;
+        type.size = (uint64_t)it->value->children->value.integer;
+        type.alignment = (uint32_t)it->value->children->next_child->value.integer;
+        type.is_signed = (uint32_t)it->value->value.integer;
+
+        module_buffer_append(&records, &type, sizeof(type));
+    }
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        ModuleInterfaceFunction function;
+
+        function.name = module_string(&strings, it->id->value.symbol);
+        function.return_type = module_string(&strings, it->value->children->next_child->value.symbol);
+        function.first_parameter = header.parameter_count;
+        function.parameter_count = (uint32_t)node_count_children(it->value->children);
+
+        header.parameter_count += function.parameter_count;
+
+        module_buffer_append(&records, &function, sizeof(function));
+    }
+
+    for (Binding* it = context->variables->bind; it; it = it->next) {
+        ModuleInterfaceVariable variable;
+
+        variable.name = module_string(&strings, it->id->value.symbol);
+        variable.type = module_string(&strings, it->value->value.symbol);
+
+        module_buffer_append(&records, &variable, sizeof(variable));
+    }
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        for (Node* parameter = it->value->children->children; parameter; parameter = parameter->next_child) {
+            ModuleInterfaceParameter record;
+
+            record.name = module_string(&strings, parameter->children->value.symbol);
+            record.type = module_string(&strings, parameter->children->next_child->value.symbol);
+
+            module_buffer_append(&records, &record, sizeof(record));
+        }
+    }
+
+    // Keep the file, and so the size of the names, a multiple of 8 bytes.
+    while (strings.size % 8) {
+        module_buffer_append(&strings, "", 1);
+    }
+
+    header.string_size = (uint32_t)strings.size;
+    memcpy(records.data, &header, sizeof(header));
+
+    if (strings.size) {
+        module_buffer_append(&records, strings.data, strings.size);
+    }
+
+    free(strings.data);
+
+    if (module_file_equalp(path, records.data, records.size)) {
+        free(records.data);
+
+        return err;
+    }
+
+    // Written aside and renamed into place, so an importer never maps half
+    // an interface.
+    size_t temporary_length = strlen(path) + 32;
+    char* temporary = malloc(temporary_length);
+    assert(temporary && "module_write_interface: could not allocate memory for path");
+
+#ifdef _WIN32
+    snprintf(temporary, temporary_length, "%s.%lu.tmp", path, (unsigned long)_getpid());
+#else
+    snprintf(temporary, temporary_length, "%s.%lu.tmp", path, (unsigned long)getpid());
+#endif
+
+    FILE* file = fopen(temporary, "wb");
+    int status = file && fwrite(records.data, 1, records.size, file) == records.size;
+
+    if (file && fclose(file) != 0) {
+        status = 0;
+    }
+
+    if (status) {
+#ifdef _WIN32
+        status = MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        status = rename(temporary, path) == 0;
+#endif
+    }
+
+    if (status) {
+        *written = 1;
+    } else {
+        remove(temporary);
+        fprintf(diagnostic_stream(), "interface: \"%s\"\n", path);
+        ERROR_PREP(err, ERROR_GENERIC, "could not write module interface");
+    }
+
+    free(temporary);
+    free(records.data);
+
+    return err;
+}
+
+// Check that every record and name of the interface lies inside the file,
+// and that every type has a size a type of croc can have.
+int module_interface_validp(unsigned char* data, size_t size) {
+    ModuleInterfaceHeader* header = (ModuleInterfaceHeader*)data;
+
+    if (size < sizeof(ModuleInterfaceHeader)
+        || memcmp(header->magic, MODULE_INTERFACE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != MODULE_INTERFACE_VERSION) {
+        return 0;
+    }
+
+    uint64_t expected = sizeof(ModuleInterfaceHeader)
+        + (uint64_t)header->type_count * sizeof(ModuleInterfaceType)
+        + (uint64_t)header->function_count * sizeof(ModuleInterfaceFunction)
+        + (uint64_t)header->variable_count * sizeof(ModuleInterfaceVariable)
+        + (uint64_t)header->parameter_count * sizeof(ModuleInterfaceParameter)
+        + header->string_size;
+
+    // With the last name terminated, every offset inside the table is a
+    // terminated name.
+    if (expected != size || (header->string_size && data[size - 1] != '\0')) {
+        return 0;
+    }
+
+    ModuleInterfaceType* types = (ModuleInterfaceType*)(header + 1);
+
+    for (uint32_t i = 0; i < header->type_count; ++i) {
+        if (!types[i].size || types[i].size > (uint64_t)ARRAY_SIZE_MAX) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// module_interface_validp() checked the sizes; each name offset is checked
+// here, as it is used.
+char* module_interface_name(ModuleInterfaceHeader* header, char* strings, uint32_t offset) {
+    return offset < header->string_size ? strings + offset : NULL;
+}
+
+// Returns zero if a record refers past the end of the names or parameters,
+// a type has an alignment that is not a power of two, or an array type a
+// name or size that does not fit it.
+int module_bind_interface(ParsingContext* imports, unsigned char* data) {
+    ModuleInterfaceHeader* header = (ModuleInterfaceHeader*)data;
+    ModuleInterfaceType* types = (ModuleInterfaceType*)(header + 1);
+    ModuleInterfaceFunction* functions = (ModuleInterfaceFunction*)(types + header->type_count);
+    ModuleInterfaceVariable* variables = (ModuleInterfaceVariable*)(functions + header->function_count);
+    ModuleInterfaceParameter* parameters = (ModuleInterfaceParameter*)(variables + header->variable_count);
+    char* strings = (char*)(parameters + header->parameter_count);
+    CrocAllocator* allocator = imports->allocator;
+    Node* existing = node_allocate(imports->phase_allocator);
+    int status = 1;
+
+    for (uint32_t i = 0; i < header->type_count && status; ++i) {
+        char* name = module_interface_name(header, strings, types[i].name);
+        uint32_t alignment = types[i].alignment;
+
+        if (!name || !alignment || (alignment & (alignment - 1))) {
+            status = 0;
+            break;
+        }
+
+        // Every module knows the builtin types.
+        if (environment_get_by_symbol(*imports->types, name, existing)) { continue; }
+
+        // An array type is named after its length and element type.
+        if (types[i].kind == NODE_TYPE_ARRAY) {
+            long long length = 0;
+            int element_name = 0;
+            TypeLayout element = { 0, (long long)alignment, types[i].is_signed != 0 };
+
+            sscanf(name, "[%lld]%n", &length, &element_name);
+
+            if (!element_name || length <= 0 || types[i].size % (uint64_t)length) {
+                status = 0;
+                break;
+            }
+
+            element.size = (long long)types[i].size / length;
+
+            if (element.size != 1 && element.size != 2 && element.size != 4 && element.size != 8) {
+                status = 0;
+                break;
+            }
+
+            status = define_array_type(imports->types, node_symbol(allocator, name), length, name + element_name, element).type == ERROR_NONE;
+
+            continue;
+        }
+
+        status = define_type(imports->types, (int)types[i].kind, node_symbol(allocator, name), (long long)types[i].size, (long long)types[i].alignment, (int)types[i].is_signed).type == ERROR_NONE;
+    }
+
+    for (uint32_t i = 0; i < header->function_count && status; ++i) {
+        ModuleInterfaceFunction* record = functions + i;
+        char* name = module_interface_name(header, strings, record->name);
+        char* return_type = module_interface_name(header, strings, record->return_type);
+
+        if (!name || !return_type || (uint64_t)record->first_parameter + record->parameter_count > header->parameter_count) {
+            status = 0;
+            break;
+        }
+
+        Node* function = node_allocate(allocator);
+        Node* parameter_list = node_allocate(allocator);
+
+        function->type = NODE_TYPE_FUNCTION;
+        node_add_child(function, parameter_list);
+        node_add_child(function, node_symbol(allocator, return_type));
+
+        for (uint32_t p = 0; p < record->parameter_count && status; ++p) {
+            ModuleInterfaceParameter* parameter_record = parameters + record->first_parameter + p;
+            char* parameter_name = module_interface_name(header, strings, parameter_record->name);
+            char* parameter_type = module_interface_name(header, strings, parameter_record->type);
+
+            if (!parameter_name || !parameter_type) {
+                status = 0;
+                break;
+            }
+
+            Node* parameter = node_allocate(allocator);
+            node_add_child(parameter, node_symbol(allocator, parameter_name));
+            node_add_child(parameter, node_symbol(allocator, parameter_type));
+            node_add_child(parameter_list, parameter);
+        }
+
+        if (!status) {
+            node_free(allocator, function);
+            break;
+        }
+
+        environment_set(imports->functions, node_symbol(allocator, name), function);
+    }
+
+    for (uint32_t i = 0; i < header->variable_count && status; ++i) {
+        char* name = module_interface_name(header, strings, variables[i].name);
+        char* type = module_interface_name(header, strings, variables[i].type);
+
+        if (!name || !type) {
+            status = 0;
+            break;
+        }
+
+        environment_set(imports->variables, node_symbol(allocator, name), node_symbol(allocator, type));
+    }
+
+    croc_release(imports->phase_allocator, existing);
+
+    return status;
+}
+
+Error module_import(ParsingContext* imports, char* path) {
+    Error err = ok;
+    unsigned char* data = NULL;
+    size_t size = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE mapping = NULL;
+    LARGE_INTEGER file_size;
+
+    if (file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        size = (size_t)file_size.QuadPart;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+#else
+    struct stat status;
+    int file = open(path, O_RDONLY);
+
+    if (file >= 0 && fstat(file, &status) == 0 && status.st_size > 0) {
+        size = (size_t)status.st_size;
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+        if (data == MAP_FAILED) {
+            data = NULL;
+        }
+    }
+#endif
+
+    if (!data) {
+        fprintf(diagnostic_stream(), "interface: \"%s\"\n", path);
+        ERROR_PREP(err, ERROR_GENERIC, "could not map module interface; compile the module with --module first");
+    } else if (!module_interface_validp(data, size) || !module_bind_interface(imports, data)) {
+        fprintf(diagnostic_stream(), "interface: \"%s\"\n", path);
+        ERROR_PREP(err, ERROR_GENERIC, "file is not a croc module interface, or is from another version of croc");
+    }
+
+#ifdef _WIN32
+    if (data) { UnmapViewOfFile(data); }
+    if (mapping) { CloseHandle(mapping); }
+    if (file != INVALID_HANDLE_VALUE) { CloseHandle(file); }
+#else
+    if (data) { munmap(data, size); }
+    if (file >= 0) { close(file); }
+#endif
+
+    return err;
+}
+
+size_t module_scan_imports(char* source, char* directory, char*** paths) {
+    Token token;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    *paths = NULL;
+    token.end = source;
+
+    while (lex(token.end, &token).type == ERROR_NONE && token.end && token.end != token.beginning) {
+        if (token.end - token.beginning != 6 || strncmp(token.beginning, "import", 6) != 0) {
+            continue;
+        }
+
+        if (lex(token.end, &token).type != ERROR_NONE || !token.end || token.end == token.beginning) {
+            break;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            *paths = realloc(*paths, capacity * sizeof(char*));
+            assert(*paths && "module_scan_imports: could not allocate memory for paths");
+        }
+
+        Node* name = node_symbol_from_buffer(&croc_heap, token.beginning, (size_t)(token.end - token.beginning));
+
+        (*paths)[count++] = module_interface_path(directory, name->value.symbol);
+
+        node_free(&croc_heap, name);
+    }
+
+    return count;
+}
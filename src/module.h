@@ -0,0 +1,77 @@
+#ifndef COMPILER_MODULE_H
+#define COMPILER_MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+#include "parser.h"
+
+// A module compiled with --module exports its top-level types, globals and
+// functions through an interface file next to its source, which `import`
+// maps into memory instead of parsing the module again. The file is a
+// header, then the type, function, variable and parameter records, then a
+// table of NUL-terminated names the records refer to by offset. Every
+// record is a multiple of 8 bytes, so all of them are aligned in the
+// mapping. Integers are in the byte order of the compiler that wrote it.
+#define MODULE_INTERFACE_MAGIC      "CROCMODI"
+#define MODULE_INTERFACE_VERSION    2
+#define MODULE_INTERFACE_EXTENSION  ".crocmod"
+
+typedef struct ModuleInterfaceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t type_count;
+    uint32_t function_count;
+    uint32_t variable_count;
+    uint32_t parameter_count;
+    uint32_t string_size;
+} ModuleInterfaceHeader;
+
+typedef struct ModuleInterfaceType {
+    uint32_t name;
+    uint32_t kind;
+    uint64_t size;
+    uint32_t alignment;
+    uint32_t is_signed;
+} ModuleInterfaceType;
+
+// Parameters of a function are consecutive parameter records.
+typedef struct ModuleInterfaceFunction {
+    uint32_t name;
+    uint32_t return_type;
+    uint32_t first_parameter;
+    uint32_t parameter_count;
+} ModuleInterfaceFunction;
+
+typedef struct ModuleInterfaceVariable {
+    uint32_t name;
+    uint32_t type;
+} ModuleInterfaceVariable;
+
+typedef struct ModuleInterfaceVariable ModuleInterfaceParameter;
+
+// Directory of the file at `path`, or NULL for the working directory.
+char* module_directory(char* path);
+
+// Where `import name` finds the interface: `directory/name.crocmod`.
+char* module_interface_path(char* directory, char* name);
+
+// Interface path of the module whose source is at `path`: its extension
+// replaced by .crocmod.
+char* module_source_interface_path(char* path);
+
+// Write the interface of the top-level bindings of `context` to `path`,
+// leaving the file untouched if it already holds the same interface so that
+// importers do not look out of date. `written` is set if it changed.
+Error module_write_interface(ParsingContext* context, char* path, int* written);
+
+// Bind what the interface at `path` exports in `imports`. Imported
+// functions have no body, only their parameters and return type.
+Error module_import(ParsingContext* imports, char* path);
+
+// Interface paths of the modules `source` imports, found without parsing
+// it; returns how many there are.
+size_t module_scan_imports(char* source, char* directory, char*** paths);
+
+#endif
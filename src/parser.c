@@ -2,15 +2,34 @@
 #include "error.h"
 #include "file_io.h"
 #include "environment.h"
+#include "module.h"
+#include "time_report.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 const char* comment_delimiters = ";#";
 const char* whitespace = " \r\n";
-const char* delimiters = " \r\n,():";
+const char* delimiters = " \r\n,():[]{}+-*/%&|^~<>=!";
+
+// Delimiters are tokens of one character, except for these.
+const char* two_character_operators[] = { "<<", ">>", "<=", ">=", "==", "!=" };
+
+const char* binary_operator_names[BINARY_OPERATOR_COUNT] = {
+    "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "<", "<=", ">", ">=", "==", "!=",
+};
+
+// As in C.
+const int binary_operator_precedences[BINARY_OPERATOR_COUNT] = {
+    9, 9, 10, 10, 10, 8, 8, 5, 3, 4, 7, 7, 7, 7, 6, 6,
+};
+
+// Prefix operators bind tighter than any binary one.
+#define UNARY_OPERATOR_PRECEDENCE 11
 
 int comment_at_beginning(Token token) {
     const char* comment_it = comment_delimiters;
@@ -44,9 +63,10 @@ Error lex(char* source, Token* token) {
     }
 
     while (comment_at_beginning(*token)) {
-        token->beginning = strpbrk(token->beginning, "\n");
+        // A comment on the last line ends at the end of the source.
+        token->beginning += strcspn(token->beginning, "\n");
 
-        if (!token->beginning) {
+        if (*(token->beginning) == '\0') {
             token->end = token->beginning;
 
             return err;
@@ -64,8 +84,18 @@ Error lex(char* source, Token* token) {
 
     if (token->end == token->beginning) {
         token->end += 1;
+
+        for (size_t i = 0; i < sizeof(two_character_operators) / sizeof(*two_character_operators); ++i) {
+            if (strncmp(token->beginning, two_character_operators[i], 2) == 0) {
+                token->end += 1;
+
+                break;
+            }
+        }
     }
 
+    compiler_counters.tokens++;
+
     return err;
 }
 
@@ -88,17 +118,98 @@ int token_string_equalp(char* string, Token* token) {
     return 1;
 }
 
+const char* binary_operator_name(int binary_operator) {
+    if (binary_operator < 0 || binary_operator >= BINARY_OPERATOR_COUNT) {
+        return "?";
+    }
+
+    return binary_operator_names[binary_operator];
+}
+
+int binary_operator_precedence(int binary_operator) {
+    return binary_operator_precedences[binary_operator];
+}
+
+int binary_operator_commutativep(int binary_operator) {
+    switch (binary_operator) {
+    case BINARY_OPERATOR_ADD:
+    case BINARY_OPERATOR_MULTIPLY:
+    case BINARY_OPERATOR_AND:
+    case BINARY_OPERATOR_OR:
+    case BINARY_OPERATOR_XOR:
+    case BINARY_OPERATOR_EQUAL:
+    case BINARY_OPERATOR_NOT_EQUAL:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+int binary_operator_evaluate(int binary_operator, long long a, long long b, long long* result) {
+    // Unsigned arithmetic wraps around where signed overflow is undefined.
+    unsigned long long unsigned_a = (unsigned long long)a;
+    unsigned long long unsigned_b = (unsigned long long)b;
+
+    switch (binary_operator) {
+    default:
+        return 0;
+
+    case BINARY_OPERATOR_ADD:           *result = (long long)(unsigned_a + unsigned_b); break;
+    case BINARY_OPERATOR_SUBTRACT:      *result = (long long)(unsigned_a - unsigned_b); break;
+    case BINARY_OPERATOR_MULTIPLY:      *result = (long long)(unsigned_a * unsigned_b); break;
+    case BINARY_OPERATOR_SHIFT_LEFT:    *result = (long long)(unsigned_a << (b & 63)); break;
+    case BINARY_OPERATOR_SHIFT_RIGHT:   *result = a >> (b & 63); break;
+    case BINARY_OPERATOR_AND:           *result = a & b; break;
+    case BINARY_OPERATOR_OR:            *result = a | b; break;
+    case BINARY_OPERATOR_XOR:           *result = a ^ b; break;
+    case BINARY_OPERATOR_LESS:          *result = a < b; break;
+    case BINARY_OPERATOR_LESS_EQUAL:    *result = a <= b; break;
+    case BINARY_OPERATOR_GREATER:       *result = a > b; break;
+    case BINARY_OPERATOR_GREATER_EQUAL: *result = a >= b; break;
+    case BINARY_OPERATOR_EQUAL:         *result = a == b; break;
+    case BINARY_OPERATOR_NOT_EQUAL:     *result = a != b; break;
+
+    case BINARY_OPERATOR_DIVIDE:
+    case BINARY_OPERATOR_MODULO:
+        if (b == 0 || (a == LLONG_MIN && b == -1)) {
+            return 0;
+        }
+
+        *result = binary_operator == BINARY_OPERATOR_DIVIDE ? a / b : a % b;
+
+        break;
+    }
+
+    return 1;
+}
+
+// The binary operator `token` spells, or -1.
+int parse_binary_operator(Token* token) {
+    size_t length = (size_t)(token->end - token->beginning);
+
+    for (int i = 0; i < BINARY_OPERATOR_COUNT; ++i) {
+        if (strlen(binary_operator_names[i]) == length && memcmp(binary_operator_names[i], token->beginning, length) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 void print_token(Token t) {
     if (t.end - t.beginning < 1) {
-        printf("print_token: invalid token pointers");
+        fprintf(diagnostic_stream(), "print_token: invalid token pointers");
     } else {
-        printf("%.*s", (int)(t.end - t.beginning), t.beginning);
+        fprintf(diagnostic_stream(), "%.*s", (int)(t.end - t.beginning), t.beginning);
     }
 }
 
-Node* node_allocate() {
-    Node* node = calloc(1, sizeof(Node));
-    assert(node && "node_allocate: could not allocate memory for AST node");
+Node* node_allocate_from(CrocAllocator* allocator, const char* site) {
+    Node* node = allocator->allocate(allocator, sizeof(Node), site);
+
+    compiler_counters.nodes++;
+    count_allocation(sizeof(Node));
 
     return node;
 }
@@ -121,6 +232,19 @@ void node_add_child(Node* parent, Node* new_child) {
     }
 }
 
+size_t node_count_children(Node* node) {
+    size_t count = 0;
+    Node* child = node->children;
+
+    while (child) {
+        count++;
+
+        child = child->next_child;
+    }
+
+    return count;
+}
+
 int node_compare(Node* a, Node* b) {
     if (!a || !b) {
         if (!a && !b) {
@@ -130,7 +254,7 @@ int node_compare(Node* a, Node* b) {
         return 0;
     }
 
-    assert(NODE_TYPE_MAX == 10 && "node_compare: node_compare() does not handle all node types");
+    assert(NODE_TYPE_MAX == 14 && "node_compare: node_compare() does not handle all node types");
 
     if (a->type != b->type) {
         return 0;
@@ -165,37 +289,82 @@ int node_compare(Node* a, Node* b) {
         break;
     
     case NODE_TYPE_BINARY_OPERATOR:
-        printf("TODO: node_compare() binary operator\n");
+        if (a->value.integer == b->value.integer
+            && node_compare(a->children, b->children)
+            && node_compare(a->children->next_child, b->children->next_child)) {
+            return 1;
+        }
+
+        break;
+
+    case NODE_TYPE_INDEX:
+        if (a->value.integer == b->value.integer
+            && node_compare(a->children, b->children)
+            && node_compare(a->children->next_child, b->children->next_child)
+            && node_compare(a->children->next_child->next_child, b->children->next_child->next_child)) {
+            return 1;
+        }
+
+        break;
+
+    // Array types compare by signedness, size, alignment, length and
+    // element type.
+    case NODE_TYPE_ARRAY:
+        if (a->value.integer == b->value.integer) {
+            Node* a_child = a->children;
+            Node* b_child = b->children;
+
+            while (a_child && b_child && node_compare(a_child, b_child)) {
+                a_child = a_child->next_child;
+                b_child = b_child->next_child;
+            }
+
+            return !a_child && !b_child;
+        }
+
+        break;
+
+    // Only operands and hoisted expressions are compared, and a loop is
+    // never one.
+    case NODE_TYPE_WHILE:
+        assert(0 && "node_compare: loops are statements and are never compared");
 
         break;
 
     case NODE_TYPE_FUNCTION:
-        printf("TODO: node_compare() function\n");
+        fprintf(diagnostic_stream(), "TODO: node_compare() function\n");
+
+        break;
+
+    // Values of type `function` are never computed with, so a lambda is
+    // never an operand.
+    case NODE_TYPE_LAMBDA:
+        assert(0 && "node_compare: lambdas are never compared");
 
         break;
 
     case NODE_TYPE_FUNCTION_CALL:
-        printf("TODO: node_compare() function call\n");
+        fprintf(diagnostic_stream(), "TODO: node_compare() function call\n");
         
         break;
 
     case NODE_TYPE_VARIABLE_REASSIGNMENT:
-        printf("TODO: node_compare() variable reassignment\n");
+        fprintf(diagnostic_stream(), "TODO: node_compare() variable reassignment\n");
 
         break;
 
     case NODE_TYPE_VARIABLE_DECLARATION:
-        printf("TODO: node_compare() variable declaration\n");
+        fprintf(diagnostic_stream(), "TODO: node_compare() variable declaration\n");
 
         break;
 
     case NODE_TYPE_VARIABLE_DECLARATION_INITIALIZED:
-        printf("TODO: node_compare() variable declaration initialized\n");
+        fprintf(diagnostic_stream(), "TODO: node_compare() variable declaration initialized\n");
 
         break;
 
     case NODE_TYPE_PROGRAM:
-        printf("TODO: compare two programs\n");
+        fprintf(diagnostic_stream(), "TODO: compare two programs\n");
 
         break;
     }
@@ -203,38 +372,44 @@ int node_compare(Node* a, Node* b) {
     return 0;
 }
 
-Node* node_none() {
-    Node* none = node_allocate();
+int node_last_statementp(Node* statement) {
+    for (Node* it = statement->next_child; it; it = it->next_child) {
+        if (!nonep(*it)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+Node* node_none(CrocAllocator* allocator) {
+    Node* none = node_allocate(allocator);
     none->type = NODE_TYPE_NONE;
 
     return none;
 }
 
-Node* node_integer(long long value) {
-    Node* integer = node_allocate();
+Node* node_integer(CrocAllocator* allocator, long long value) {
+    Node* integer = node_allocate(allocator);
     integer->type = NODE_TYPE_INTEGER;
     integer->value.integer = value;
 
     return integer;
 }
 
-Node* node_symbol(char* symbol_string) {
-    Node* symbol = node_allocate();
-    symbol->type = NODE_TYPE_SYMBOL;
-    symbol->value.symbol = strdup(symbol_string);
-
-    return symbol;
+Node* node_symbol(CrocAllocator* allocator, char* symbol_string) {
+    return node_symbol_from_buffer(allocator, symbol_string, strlen(symbol_string));
 }
 
-Node* node_symbol_from_buffer(char* buffer, size_t length) {
+Node* node_symbol_from_buffer(CrocAllocator* allocator, char* buffer, size_t length) {
     assert(buffer && "node_symbol_from_buffer: cannot create AST Symbol Node from NULL buffer");
-    char* symbol_string = malloc(length + 1);
-    assert(symbol_string && "could not allocate memory for symbol string");
+    char* symbol_string = croc_allocate(allocator, length + 1);
+    count_allocation(length + 1);
 
     memcpy(symbol_string, buffer, length);
     symbol_string[length] = '\0';
 
-    Node* symbol = node_allocate();
+    Node* symbol = node_allocate(allocator);
     symbol->type = NODE_TYPE_SYMBOL;
     symbol->value.symbol = symbol_string;
 
@@ -242,100 +417,137 @@ Node* node_symbol_from_buffer(char* buffer, size_t length) {
 }
 
 // Take owner of type symbol
-Error define_type(Environment* types, int type, Node* type_symbol, long long byte_size) {
+Error define_type(Environment* types, int type, Node* type_symbol, long long byte_size, long long alignment, int is_signed) {
     assert(types && "node_add_type: cannot add type to NULL types environment");
     assert(type_symbol && "node_add_type: cannot add NULL type symbol to types environment");
     assert(byte_size >= 0 && "node_add_type: cannot define new type with zero or negative byte size");
+    assert(alignment > 0 && !(alignment & (alignment - 1)) && "node_add_type: alignment must be a power of two");
 
-    Node* size_node = node_allocate();
-    size_node->type = NODE_TYPE_INTEGER;
-    size_node->value.integer = byte_size;
-
-    Node* type_node = node_allocate();
+    Node* type_node = node_allocate(types->allocator);
     type_node->type = type;
-    type_node->children = size_node;
+    type_node->value.integer = is_signed;
+
+    node_add_child(type_node, node_integer(types->allocator, byte_size));
+    node_add_child(type_node, node_integer(types->allocator, alignment));
 
     if (environment_set(types, type_symbol, type_node) == 1) {
         return ok;
     }
 
-    printf("type that was redefined: \"%s\"\n", type_symbol->value.symbol);
+    fprintf(diagnostic_stream(), "type that was redefined: \"%s\"\n", type_symbol->value.symbol);
     ERROR_CREATE(err, ERROR_TYPE, "redefinition of type");
 
     return err;
 }
 
+Error define_array_type(Environment* types, Node* type_symbol, long long length, char* element_name, TypeLayout element) {
+    assert(length > 0 && length <= ARRAY_SIZE_MAX / element.size && "define_array_type: array length out of range");
+
+    Error err = define_type(types, NODE_TYPE_ARRAY, type_symbol, length * element.size, element.alignment, element.is_signed);
+    if (err.type) { return err; }
+
+    // define_type() bound the new type first.
+    node_add_child(types->bind->value, node_integer(types->allocator, length));
+    node_add_child(types->bind->value, node_symbol(types->allocator, element_name));
+
+    return err;
+}
+
 void print_node(Node* node, size_t indent_level) {
     if (!node) {
         return;
     }
 
     for (size_t i = 0; i < indent_level; ++i) {
-        putchar(' ');
+        fputc(' ', diagnostic_stream());
     }
 
-    assert(NODE_TYPE_MAX == 10 && "print_node: print_node() does not handle all node types");
+    assert(NODE_TYPE_MAX == 14 && "print_node: print_node() does not handle all node types");
 
     switch (node->type) {
     default:
-        printf("UNKNOWN");
+        fprintf(diagnostic_stream(), "UNKNOWN");
 
         break;
 
     case NODE_TYPE_NONE:
-        printf("NONE");
+        fprintf(diagnostic_stream(), "NONE");
 
         break;
     
     case NODE_TYPE_INTEGER:
-        printf("INT:%lld", node->value.integer);
+        fprintf(diagnostic_stream(), "INT:%lld", node->value.integer);
 
         break;
 
     case NODE_TYPE_SYMBOL:
-        printf("SYM");
+        fprintf(diagnostic_stream(), "SYM");
 
         if (node->value.symbol) {
-            printf(":%s", node->value.symbol);
+            fprintf(diagnostic_stream(), ":%s", node->value.symbol);
         }
 
         break;
 
     case NODE_TYPE_BINARY_OPERATOR:
-        printf("BINARY OPERATOR");
+        fprintf(diagnostic_stream(), "BINARY OPERATOR:%s", binary_operator_name((int)node->value.integer));
+
+        break;
+
+    case NODE_TYPE_INDEX:
+        fprintf(diagnostic_stream(), "INDEX%s", node->value.integer ? ":IN RANGE" : "");
+
+        break;
+
+    case NODE_TYPE_ARRAY:
+        fprintf(diagnostic_stream(), "ARRAY TYPE");
+
+        break;
+
+    case NODE_TYPE_WHILE:
+        fprintf(diagnostic_stream(), "WHILE");
 
         break;
 
     case NODE_TYPE_VARIABLE_REASSIGNMENT:
-        printf("VARIABLE REASSIGNMENT");
+        fprintf(diagnostic_stream(), "VARIABLE REASSIGNMENT");
 
         break;
     
     case NODE_TYPE_VARIABLE_DECLARATION:
-        printf("VARIABLE DECLARATION");
+        fprintf(diagnostic_stream(), "VARIABLE DECLARATION");
 
         break;
 
     case NODE_TYPE_VARIABLE_DECLARATION_INITIALIZED:
-        printf("VARIABLE DECLARATION INITIALIZED");
+        fprintf(diagnostic_stream(), "VARIABLE DECLARATION INITIALIZED");
     
     case NODE_TYPE_PROGRAM:
-        printf("PROGRAM");
+        fprintf(diagnostic_stream(), "PROGRAM");
 
         break;
 
     case NODE_TYPE_FUNCTION:
-        printf("FUNCTION");
+        fprintf(diagnostic_stream(), "FUNCTION");
+
+        break;
+
+    case NODE_TYPE_LAMBDA:
+        fprintf(diagnostic_stream(), "LAMBDA");
+
+        if (node->value.symbol) {
+            fprintf(diagnostic_stream(), ":%s", node->value.symbol);
+        }
 
         break;
 
     case NODE_TYPE_FUNCTION_CALL:
-        printf("FUNCTION CALL");
+        fprintf(diagnostic_stream(), "FUNCTION CALL");
 
         break;
     }
 
-    putchar('\n');
+    fputc('\n', diagnostic_stream());
 
     Node* child = node->children;
 
@@ -347,12 +559,13 @@ void print_node(Node* node, size_t indent_level) {
 }
 
 // Copy `a` into `b`
-void node_copy(Node* a, Node* b) {
+void node_copy(CrocAllocator* allocator, Node* a, Node* b) {
     if (!a || !b) {
         return;
     }
 
     b->type = a->type;
+    b->location = a->location;
 
     switch (a->type) {
     default:
@@ -361,9 +574,10 @@ void node_copy(Node* a, Node* b) {
         break;
 
     case NODE_TYPE_SYMBOL:
-        b->value.symbol = strdup(a->value.symbol);
+        b->value.symbol = croc_allocate(allocator, strlen(a->value.symbol) + 1);
+        count_allocation(strlen(a->value.symbol) + 1);
 
-        assert(b->value.symbol && "node_copy: could not allocate memory for new symbol");
+        strcpy(b->value.symbol, a->value.symbol);
 
         break;
     }
@@ -372,7 +586,7 @@ void node_copy(Node* a, Node* b) {
     Node* child_it = NULL;
 
     while (child) {
-        Node* new_child = node_allocate();
+        Node* new_child = node_allocate(allocator);
 
         if (child_it) {
             child_it->next_child = new_child;
@@ -382,32 +596,87 @@ void node_copy(Node* a, Node* b) {
             child_it = new_child;
         }
 
-        node_copy(child, child_it);
+        node_copy(allocator, child, child_it);
 
         child = child->next_child;
     }
 }
 
-ParsingContext* parse_context_create(ParsingContext* parent) {
-    ParsingContext* ctx = calloc(1, sizeof(ParsingContext));
-    assert(ctx && "parse_context_create: could not allocate memory for parsing context");
-    
+// A context in `memory`, with environments of its own there.
+ParsingContext* parse_context_allocate(CrocAllocator* memory, CrocAllocator* allocator, CrocAllocator* phase_allocator, ParsingContext* parent) {
+    ParsingContext* ctx = croc_allocate(memory, sizeof(ParsingContext));
+    count_allocation(sizeof(ParsingContext));
+
     ctx->parent = parent;
+    ctx->source = parent ? parent->source : NULL;
     ctx->operator = NULL;
     ctx->result = NULL;
-    ctx->types = environment_create(NULL);
-    ctx->variables = environment_create(NULL);
-    ctx->functions = environment_create(NULL);
+    ctx->types = environment_create(memory, NULL);
+    ctx->variables = environment_create(memory, NULL);
+    ctx->functions = environment_create(memory, NULL);
+    ctx->lazy = 0;
+    ctx->lazy_bodies = NULL;
+    ctx->lazy_body_count = 0;
+    ctx->lazy_body_capacity = 0;
+    ctx->lazy_bodies_parsed = 0;
+    ctx->trace = NULL;
+    ctx->allocator = allocator;
+    ctx->phase_allocator = phase_allocator;
 
     return ctx;
 }
 
-ParsingContext* parse_context_default_create() {
-    ParsingContext* ctx = parse_context_create(NULL);
-    Error err = define_type(ctx->types, NODE_TYPE_INTEGER, node_symbol("integer"), sizeof(long long));
+ParsingContext* parse_context_create(ParsingContext* parent) {
+    return parse_context_allocate(parent->phase_allocator, parent->allocator, parent->phase_allocator, parent);
+}
 
-    if (err.type != ERROR_NONE) {
-        printf("ERROR: failed to set builtin integer type in types environment\n");
+ParsingContext* parse_context_create_nested(ParsingContext* parent) {
+    ParsingContext* ctx = croc_allocate(parent->phase_allocator, sizeof(ParsingContext));
+    count_allocation(sizeof(ParsingContext));
+
+    ctx->parent = parent;
+    ctx->source = parent->source;
+    ctx->types = parent->types;
+    ctx->variables = parent->variables;
+    ctx->functions = parent->functions;
+    ctx->lazy = 0;
+    ctx->lazy_bodies = NULL;
+    ctx->lazy_body_count = 0;
+    ctx->lazy_body_capacity = 0;
+    ctx->lazy_bodies_parsed = 0;
+    ctx->trace = NULL;
+    ctx->allocator = parent->allocator;
+    ctx->phase_allocator = parent->phase_allocator;
+
+    return ctx;
+}
+
+ParsingContext* parse_context_default_create(CrocAllocator* allocator, CrocAllocator* phase_allocator) {
+    // `integer` is bound last, so the type most programs use is found
+    // first.
+    static const struct {
+        char* name;
+        long long size;
+        int is_signed;
+    } builtins[] = {
+        { "u64", 8, 0 }, { "u32", 4, 0 }, { "u16", 2, 0 }, { "u8", 1, 0 },
+        { "i64", 8, 1 }, { "i32", 4, 1 }, { "i16", 2, 1 }, { "i8", 1, 1 },
+        { "integer", sizeof(long long), 1 },
+    };
+    ParsingContext* ctx = parse_context_allocate(allocator, allocator, phase_allocator, NULL);
+
+    // Values of type `function` are lambdas, kept as a pointer to their
+    // closure.
+    if (define_type(ctx->types, NODE_TYPE_FUNCTION, node_symbol(allocator, "function"), 8, 8, 0).type != ERROR_NONE) {
+        fprintf(diagnostic_stream(), "ERROR: failed to set builtin function type in types environment\n");
+    }
+
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        Error err = define_type(ctx->types, NODE_TYPE_INTEGER, node_symbol(allocator, builtins[i].name), builtins[i].size, builtins[i].size, builtins[i].is_signed);
+
+        if (err.type != ERROR_NONE) {
+            fprintf(diagnostic_stream(), "ERROR: failed to set builtin %s type in types environment\n", builtins[i].name);
+        }
     }
 
     return ctx;
@@ -491,205 +760,803 @@ Error parse_get_type(ParsingContext* context, Node* id, Node* result) {
     return err;
 }
 
-#define EXPECT(expected, expected_string, current_token, current_length, end) \
-    expected = lex_expect(expected_string, &current_token, &current_length, end); \
-    if (expected.err.type) { return expected.err; } \
-    if (expected.done) { return ok; }
+TypeLayout parse_type_layout(ParsingContext* context, char* type_name) {
+    TypeLayout layout = { 8, 8, 1 };
 
-int parse_integer(Token* token, Node* node) {
-    if (!token || !node) {
-        return 0;
-    }
+    for (; context && type_name; context = context->parent) {
+        for (Binding* it = context->types->bind; it; it = it->next) {
+            if (strcmp(it->id->value.symbol, type_name) == 0) {
+                Node* size = it->value->children;
 
-    char* end = NULL;
+                layout.size = size->value.integer;
+                layout.alignment = size->next_child ? size->next_child->value.integer : size->value.integer;
+                layout.is_signed = it->value->value.integer != 0;
 
-    if (token->end - token->beginning == 1 && *(token->beginning) == '0') {
-        node->type = NODE_TYPE_INTEGER;
-        node->value.integer = 0;
-    } else if ((node->value.integer = strtoll(token->beginning, &end, 10)) != 0) {
-        if (end != token->end) {
-            return 0;
+                return layout;
+            }
         }
-
-        node->type = NODE_TYPE_INTEGER;
-    } else {
-        return 0;
     }
 
-    return 1;
+    return layout;
 }
 
-// FIXME: make more efficient by keeping track of all
-//        pointers and freeing them in one go
-void node_free(Node* root) {
-    if (!root) {
-        return;
-    }
+long long parse_array_layout(ParsingContext* context, char* type_name, TypeLayout* element) {
+    for (; context && type_name; context = context->parent) {
+        for (Binding* it = context->types->bind; it; it = it->next) {
+            if (strcmp(it->id->value.symbol, type_name)) {
+                continue;
+            }
 
-    Node* child = root->children;
-    Node* next_child = NULL;
+            if (it->value->type != NODE_TYPE_ARRAY) {
+                return 0;
+            }
 
-    while (child) {
-        next_child = child->next_child;
+            Node* size = it->value->children;
+            Node* length = size->next_child->next_child;
 
-        node_free(child);
+            element->size = size->value.integer / length->value.integer;
+            element->alignment = size->next_child->value.integer;
+            element->is_signed = it->value->value.integer != 0;
 
-        child = next_child;
+            return length->value.integer;
+        }
     }
 
-    if (symbolp(*root) && root->value.symbol) {
-        free(root->value.symbol);
+    return 0;
+}
+
+long long type_layout_narrow(TypeLayout layout, long long value) {
+    if (layout.size >= 8) {
+        return value;
     }
 
-    free(root);
+    int shift = 64 - (int)layout.size * 8;
+    unsigned long long bits = (unsigned long long)value << shift;
+
+    return layout.is_signed ? (long long)bits >> shift : (long long)(bits >> shift);
 }
 
-Error parse_expr(ParsingContext* context, char* source, char** end, Node* result) {
-    ExpectReturnValue expected;
-    size_t token_length = 0;
-    Token current_token;
-    current_token.beginning = source;
-    current_token.end = source;
+int type_layout_containsp(TypeLayout outer, TypeLayout inner) {
+    if (outer.size >= 8) {
+        return 1;
+    }
 
-    Error err = ok;
-    Node* working_result = result;
+    if (inner.size == outer.size) {
+        return inner.is_signed == outer.is_signed;
+    }
 
-    while ((err = lex_advance(&current_token, &token_length, end)).type == ERROR_NONE) {
-        // printf("lexed: ");
-        // print_token(current_token);
-        // putchar('\n');
+    return inner.size < outer.size && (outer.is_signed || !inner.is_signed);
+}
 
-        if (token_length == 0) {
-            return ok;
+char* parse_variable_type(ParsingContext* context, Node* id) {
+    CrocAllocator* allocator = context->phase_allocator;
+    Node* variable_binding = node_allocate(allocator);
+    char* type_name = NULL;
+
+    while (context) {
+        if (environment_get(*context->variables, id, variable_binding)) {
+            type_name = variable_binding->value.symbol;
+
+            break;
         }
 
-        if (parse_integer(&current_token, working_result)) {
-            
-        } else {
-            Node* symbol = node_symbol_from_buffer(current_token.beginning, token_length);
-            
-            if (strcmp("defun", symbol->value.symbol) == 0) {
-                working_result->type = NODE_TYPE_FUNCTION;
+        context = context->parent;
+    }
 
-                lex_advance(&current_token, &token_length, end);
-                Node* function_name = node_symbol_from_buffer(current_token.beginning, token_length);
-                
-                EXPECT(expected, "(", current_token, token_length, end);
-                if (!expected.found) {
-                    printf("function name: \"%s\"\n", function_name->value.symbol);
-                    ERROR_PREP(err, ERROR_SYNTAX, "expected opening parenthesis for parameter list after function name");
+    croc_release(allocator, variable_binding);
 
-                    return err;
-                }
+    return type_name;
+}
 
-                Node* parameter_list = node_allocate();
-                node_add_child(working_result, parameter_list);
+int parse_variable_declared(ParsingContext* context, Node* id) {
+    return parse_variable_type(context, id) != NULL;
+}
 
-                for (;;) {
-                    EXPECT(expected, ")", current_token, token_length, end);
-                    if (expected.found) { break; }
-                    if (expected.done) {
-                        ERROR_PREP(err, ERROR_SYNTAX, "expected closing parenthesis for parameter list");
-                        
-                        return err;
-                    }
+Error parse_unexpected_end(char* expected) {
+    Error err = ok;
 
-                    err = lex_advance(&current_token, &token_length, end);
-                    if (err.type) { return err; }
+    fprintf(diagnostic_stream(), "expected: \"%s\"\n", expected);
+    ERROR_PREP(err, ERROR_SYNTAX, "file ends in the middle of a statement");
 
-                    Node* parameter_name = node_symbol_from_buffer(current_token.beginning, token_length);
+    return err;
+}
 
-                    EXPECT(expected, ":", current_token, token_length, end);
-                    if (expected.done || !expected.found) {
-                        ERROR_PREP(err, ERROR_SYNTAX, "parameter declaration requires a type annotation");
-                        
-                        return err;
-                    }
+// The source running out where `expected_string` may follow is an error.
+#define EXPECT(expected, expected_string, current_token, current_length, end) \
+    expected = lex_expect(expected_string, &current_token, &current_length, end); \
+    if (expected.err.type) { return expected.err; } \
+    if (expected.done) { return parse_unexpected_end(expected_string); }
 
-                    lex_advance(&current_token, &token_length, end);
-                    
-                    Node* parameter_type = node_symbol_from_buffer(current_token.beginning, token_length);
-                    Node* parameter = node_allocate();
+int parse_integer(Token* token, Node* node) {
+    if (!token || !node) {
+        return 0;
+    }
 
-                    node_add_child(parameter, parameter_name);
-                    node_add_child(parameter, parameter_type);
-                    node_add_child(parameter_list, parameter);
+    char* end = NULL;
+    long long value = strtoll(token->beginning, &end, 10);
 
-                    EXPECT(expected, ",", current_token, token_length, end);
-                    if (expected.found) { continue; }
+    if (end == token->beginning || end != token->end) {
+        return 0;
+    }
 
-                    EXPECT(expected, ")", current_token, token_length, end);
-                    if (!expected.found) {
-                        ERROR_PREP(err, ERROR_SYNTAX, "expected closing parenthesis following parameter list");
+    node->type = NODE_TYPE_INTEGER;
+    node->value.integer = value;
 
-                        return err;
-                    }
+    return 1;
+}
 
-                    break;
-                }
+// Parse the rest of an array type once its opening bracket is lexed, its
+// length, closing bracket and element type, and give its name, always
+// spelled "[length]element", in `type_symbol`. The type is bound in the
+// types of `context` unless it already is there.
+Error parse_array_type(ParsingContext* context, Token* current_token, size_t* token_length, char** end, Node** type_symbol) {
+    Error err = ok;
+    Node length;
+    Node element_type;
 
-                EXPECT(expected, ":", current_token, token_length, end);
-                if (expected.done || !expected.found) {
-                    ERROR_PREP(err, ERROR_SYNTAX, "function definition requires a return type annotation following parameter list");
+    err = lex_advance(current_token, token_length, end);
+    if (err.type) { return err; }
 
-                    return err;
-                }
+    if (!*token_length || !parse_integer(current_token, &length) || length.value.integer <= 0) {
+        ERROR_PREP(err, ERROR_SYNTAX, "expected the length of an array, a positive integer, after its opening bracket");
 
-                lex_advance(&current_token, &token_length, end);
+        return err;
+    }
 
-                Node* function_return_type = node_symbol_from_buffer(current_token.beginning, token_length);
-                node_add_child(working_result, function_return_type);
-                environment_set(context->functions, function_name, working_result);
+    ExpectReturnValue expected = lex_expect("]", current_token, token_length, end);
+    if (expected.err.type) { return expected.err; }
+    if (!expected.found) {
+        ERROR_PREP(err, ERROR_SYNTAX, "expected closing bracket after the length of an array");
 
-                EXPECT(expected, "{", current_token, token_length, end);
-                if (expected.done || !expected.found) {
-                    ERROR_PREP(err, ERROR_SYNTAX, "function definition requires body following return type \"{ body! }\"");
-                    
-                    return err;
-                }
+        return err;
+    }
 
-                context = parse_context_create(context);
-                context->operator = node_symbol("defun");
+    err = lex_advance(current_token, token_length, end);
+    if (err.type) { return err; }
 
-                Node* param_it = working_result->children->children;
-                while (param_it) {
-                    environment_set(context->variables, param_it->children, param_it->children->next_child);
+    Node* element_symbol = node_symbol_from_buffer(context->phase_allocator, current_token->beginning, *token_length);
 
-                    param_it = param_it->next_child;
-                }
+    if (!*token_length || parse_get_type(context, element_symbol, &element_type).type || element_type.type != NODE_TYPE_INTEGER) {
+        fprintf(diagnostic_stream(), "element type: \"%s\"\n", element_symbol->value.symbol);
+        ERROR_PREP(err, ERROR_TYPE, "elements of an array must be of an integer type");
 
-                Node* function_body = node_allocate();
-                Node* function_first_expression = node_allocate();
-                node_add_child(function_body, function_first_expression);
-                node_add_child(working_result, function_body);
+        return err;
+    }
 
-                working_result = function_first_expression;
-                context->result = working_result;
+    TypeLayout element = parse_type_layout(context, element_symbol->value.symbol);
 
-                continue;
-            } else {
-                EXPECT(expected, ":", current_token, token_length, end);
-                if (expected.found) {
-                    EXPECT(expected, "=", current_token, token_length, end);
-                    if (expected.found) {
-                        Node* variable_binding = node_allocate();
+    if (length.value.integer > ARRAY_SIZE_MAX / element.size) {
+        fprintf(diagnostic_stream(), "length: %lld\n", length.value.integer);
+        ERROR_PREP(err, ERROR_TYPE, "array is larger than 2 GiB");
 
-                        if (!environment_get(*context->variables, symbol, variable_binding)) {
-                            printf("id of undeclared variable: \"%s\"\n", symbol->value.symbol);
-                            ERROR_PREP(err, ERROR_GENERIC, "reassignment of variable that has not been declared");
+        return err;
+    }
 
-                            return err;
-                        }
-                        
-                        free(variable_binding);
+    int name_length = snprintf(NULL, 0, "[%lld]%s", length.value.integer, element_symbol->value.symbol);
+    char* name = croc_allocate(context->phase_allocator, (size_t)name_length + 1);
+    snprintf(name, (size_t)name_length + 1, "[%lld]%s", length.value.integer, element_symbol->value.symbol);
 
-                        working_result->type = NODE_TYPE_VARIABLE_REASSIGNMENT;
-                        node_add_child(working_result, symbol);
+    *type_symbol = node_symbol(context->allocator, name);
 
-                        Node* reassign_expr = node_allocate();
-                        node_add_child(working_result, reassign_expr);
+    if (!environment_get(*context->types, *type_symbol, &element_type)) {
+        err = define_array_type(context->types, node_symbol(context->types->allocator, name), length.value.integer, element_symbol->value.symbol, element);
+    }
 
-                        working_result = reassign_expr;
+    croc_release(context->phase_allocator, name);
+    node_free(context->phase_allocator, element_symbol);
+
+    return err;
+}
+
+// Parse the parameters of a function or lambda once the opening
+// parenthesis of their list is lexed, up to and including the closing one,
+// adding a node with the name and type of each to `parameter_list`.
+Error parse_parameter_list(ParsingContext* context, Token* current_token, size_t* token_length, char** end, Node* parameter_list) {
+    Error err = ok;
+    ExpectReturnValue expected;
+
+    for (;;) {
+        EXPECT(expected, ")", *current_token, *token_length, end);
+        if (expected.found) { break; }
+
+        err = lex_advance(current_token, token_length, end);
+        if (err.type) { return err; }
+
+        Node* parameter_name = node_symbol_from_buffer(context->allocator, current_token->beginning, *token_length);
+
+        EXPECT(expected, ":", *current_token, *token_length, end);
+        if (!expected.found) {
+            ERROR_PREP(err, ERROR_SYNTAX, "parameter declaration requires a type annotation");
+
+            return err;
+        }
+
+        lex_advance(current_token, token_length, end);
+
+        Node* parameter_type = node_symbol_from_buffer(context->allocator, current_token->beginning, *token_length);
+        Node* parameter = node_allocate(context->allocator);
+
+        node_add_child(parameter, parameter_name);
+        node_add_child(parameter, parameter_type);
+        node_add_child(parameter_list, parameter);
+
+        EXPECT(expected, ",", *current_token, *token_length, end);
+        if (expected.found) { continue; }
+
+        EXPECT(expected, ")", *current_token, *token_length, end);
+        if (!expected.found) {
+            ERROR_PREP(err, ERROR_SYNTAX, "expected closing parenthesis following parameter list");
+
+            return err;
+        }
+
+        break;
+    }
+
+    return err;
+}
+
+// Open operators and parentheses bind operands to what is inside them; 0 for
+// every other context.
+int parse_precedence(ParsingContext* context) {
+    if (!context->operator) {
+        return 0;
+    }
+
+    if (strcmp(context->operator->value.symbol, "binary") == 0) {
+        return binary_operator_precedence((int)context->expression->value.integer);
+    }
+
+    if (strcmp(context->operator->value.symbol, "unary") == 0) {
+        return UNARY_OPERATOR_PRECEDENCE;
+    }
+
+    return 0;
+}
+
+int parse_operatorp(ParsingContext* context, char* operator) {
+    return context->operator && strcmp(context->operator->value.symbol, operator) == 0;
+}
+
+// Operands, indices and loop conditions are expressions, not statements
+// that define or assign.
+int parse_operand_contextp(ParsingContext* context) {
+    return parse_precedence(context) || parse_operatorp(context, "group") || parse_operatorp(context, "index")
+        || parse_operatorp(context, "while") || parse_operatorp(context, "for condition");
+}
+
+// Contexts whose results are lists of statements.
+int parse_statement_contextp(ParsingContext* context) {
+    return !context->operator || parse_operatorp(context, "defun") || parse_operatorp(context, "loop") || parse_operatorp(context, "lambda");
+}
+
+// Whether a newline between `from` and `to` ends the statement being
+// parsed, so that a `(` or an operator after it starts the next one. Inside
+// parentheses, brackets and loop headers, it does not.
+int parse_newline_endsp(ParsingContext* context, char* from, char* to) {
+    if (to <= from || !memchr(from, '\n', (size_t)(to - from))) {
+        return 0;
+    }
+
+    while (parse_precedence(context)) {
+        context = context->parent;
+    }
+
+    return parse_statement_contextp(context);
+}
+
+// Make `loop` a loop with an empty body, whose condition `context` parses
+// next.
+void parse_loop_begin(ParsingContext* context, Node* loop) {
+    Node* condition = node_allocate(context->allocator);
+
+    loop->type = NODE_TYPE_WHILE;
+    node_add_child(loop, condition);
+    node_add_child(loop, node_allocate(context->allocator));
+
+    context->expression = loop;
+    context->result = condition;
+}
+
+// Make `expression` the left operand of a new `binary_operator` in its place
+// in the tree, and return its empty right operand.
+Node* parse_binary_operator_wrap(CrocAllocator* allocator, Node* expression, int binary_operator) {
+    Node* left = node_allocate(allocator);
+    *left = *expression;
+    left->next_child = NULL;
+
+    expression->type = NODE_TYPE_BINARY_OPERATOR;
+    expression->value.integer = binary_operator;
+    expression->children = left;
+
+    Node* right = node_allocate(allocator);
+    node_add_child(expression, right);
+
+    return right;
+}
+
+void node_free(CrocAllocator* allocator, Node* root) {
+    if (!root) {
+        return;
+    }
+
+    Node* child = root->children;
+    Node* next_child = NULL;
+
+    while (child) {
+        next_child = child->next_child;
+
+        node_free(allocator, child);
+
+        child = next_child;
+    }
+
+    if (symbolp(*root) && root->value.symbol) {
+        croc_release(allocator, root->value.symbol);
+    }
+
+    croc_release(allocator, root);
+}
+
+// Record the body of `function`, which begins at `*end`, for
+// parse_function_body() and move `*end` past its closing brace. Braces are
+// counted outside of comments, which begin where a token would.
+Error parse_function_body_skip(ParsingContext* context, Node* function, char* name, char** end) {
+    Error err = ok;
+    char* it = *end;
+    char previous = ' ';
+    size_t depth = 1;
+
+    while (*it && depth) {
+        if (strchr(comment_delimiters, *it) && strchr(delimiters, previous)) {
+            it += strcspn(it, "\n");
+
+            continue;
+        }
+
+        if (*it == '{') {
+            depth++;
+        } else if (*it == '}') {
+            depth--;
+        }
+
+        previous = *it++;
+    }
+
+    if (depth) {
+        ERROR_PREP(err, ERROR_SYNTAX, "expected closing brace of function body");
+
+        return err;
+    }
+
+    if (context->lazy_body_count == context->lazy_body_capacity) {
+        size_t capacity = context->lazy_body_capacity ? context->lazy_body_capacity * 2 : 64;
+        ParsingLazyBody* bodies = croc_allocate(context->allocator, capacity * sizeof(ParsingLazyBody));
+        assert(bodies && "parse_function_body_skip: could not allocate memory for lazy bodies");
+
+        if (context->lazy_bodies) {
+            memcpy(bodies, context->lazy_bodies, context->lazy_body_count * sizeof(ParsingLazyBody));
+            croc_release(context->allocator, context->lazy_bodies);
+        }
+
+        context->lazy_bodies = bodies;
+        context->lazy_body_capacity = capacity;
+    }
+
+    ParsingLazyBody* lazy = context->lazy_bodies + context->lazy_body_count++;
+
+    lazy->body = function->children->next_child->next_child;
+    lazy->name = name;
+    lazy->source = *end;
+    lazy->variables = context->variables->bind;
+    lazy->body->value.integer = (long long)context->lazy_body_count;
+
+    *end = it;
+
+    return err;
+}
+
+Error parse_function_body(ParsingContext* context, Node* function) {
+    Error err = ok;
+    Node* body = function->children->next_child->next_child;
+
+    // Imported functions have no body.
+    if (!body || !body->value.integer) {
+        return err;
+    }
+
+    size_t index = (size_t)body->value.integer - 1;
+
+    while (context && (index >= context->lazy_body_count || context->lazy_bodies[index].body != body)) {
+        context = context->parent;
+    }
+
+    if (!context) {
+        ERROR_PREP(err, ERROR_ARGUMENTS, "parse_function_body: body was not skipped by a lazy parse of the context");
+
+        return err;
+    }
+
+    ParsingLazyBody* lazy = context->lazy_bodies + index;
+    double start = context->trace ? time_report_wall_seconds() : 0;
+    size_t nodes = compiler_counters.nodes;
+
+    // The top level as it was when the function was defined, and the
+    // imports.
+    ParsingContext* scope = parse_context_create_nested(context);
+    scope->parent = context->parent;
+    scope->operator = NULL;
+    scope->variables = environment_create(context->phase_allocator, NULL);
+    scope->variables->bind = lazy->variables;
+
+    ParsingContext* body_context = parse_context_create(scope);
+    body_context->operator = node_symbol(context->phase_allocator, "defun");
+
+    for (Node* parameter = function->children->children; parameter; parameter = parameter->next_child) {
+        environment_set(body_context->variables, parameter->children, parameter->children->next_child);
+    }
+
+    Node* first_expression = node_allocate(context->allocator);
+    body->value.integer = 0;
+    node_add_child(body, first_expression);
+    body_context->result = first_expression;
+
+    char* end = lazy->source;
+
+    err = parse_expr(body_context, lazy->source, &end, first_expression);
+    if (err.type) {
+        body->children = NULL;
+        body->value.integer = (long long)index + 1;
+
+        return err;
+    }
+
+    context->lazy_bodies_parsed++;
+
+    if (context->trace) {
+        trace_span(context->trace, "parse", lazy->name, start, "nodes", compiler_counters.nodes - nodes);
+    }
+
+    return err;
+}
+
+char* parse_function_name(ParsingContext* context, Node* function) {
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        if (it->value == function) {
+            return it->id->value.symbol;
+        }
+    }
+
+    return NULL;
+}
+
+Error parse_function_bodies(ParsingContext* context) {
+    Error err = ok;
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        err = parse_function_body(context, it->value);
+        if (err.type) { return err; }
+    }
+
+    return err;
+}
+
+Error parse_expr(ParsingContext* context, char* source, char** end, Node* result) {
+    ExpectReturnValue expected;
+    size_t token_length = 0;
+    Token current_token;
+    current_token.beginning = source;
+    current_token.end = source;
+
+    Error err = ok;
+    Node* working_result = result;
+    // Whether `working_result` is a statement rather than the value of one.
+    int statement = 1;
+    TypeLayout element;
+
+    while ((err = lex_advance(&current_token, &token_length, end)).type == ERROR_NONE) {
+        // printf("lexed: ");
+        // print_token(current_token);
+        // putchar('\n');
+
+        // Only the top level may end with the file.
+        if (token_length == 0) {
+            if (context->operator) {
+                fprintf(diagnostic_stream(), "open: \"%s\"\n", context->operator->value.symbol);
+                ERROR_PREP(err, ERROR_SYNTAX, "file ends in the middle of a statement");
+            }
+
+            return err;
+        }
+
+        if (context->source) {
+            working_result->location = (unsigned int)(current_token.beginning - context->source) + 1;
+        }
+
+        // A minus sign right before a digit is part of a literal.
+        if (token_length == 1 && *current_token.beginning == '-' && isdigit((unsigned char)*current_token.end)) {
+            current_token.end += strcspn(current_token.end, delimiters);
+            token_length = (size_t)(current_token.end - current_token.beginning);
+            *end = current_token.end;
+        }
+
+        if (parse_integer(&current_token, working_result)) {
+
+        } else if (token_length == 1 && *current_token.beginning == '(') {
+            // The parenthesized operand is parsed in place.
+            context = parse_context_create(context);
+            context->operator = node_symbol(context->phase_allocator, "group");
+            context->expression = working_result;
+            context->result = working_result;
+
+            continue;
+        } else if (token_length == 1 && strchr("-~!", *current_token.beginning)) {
+            // -x is 0 - x, ~x is -1 ^ x and !x is 0 == x.
+            char prefix = *current_token.beginning;
+
+            working_result->type = NODE_TYPE_BINARY_OPERATOR;
+            working_result->value.integer = prefix == '-' ? BINARY_OPERATOR_SUBTRACT : prefix == '~' ? BINARY_OPERATOR_XOR : BINARY_OPERATOR_EQUAL;
+            node_add_child(working_result, node_integer(context->allocator, prefix == '~' ? -1 : 0));
+
+            Node* operand = node_allocate(context->allocator);
+            node_add_child(working_result, operand);
+
+            context = parse_context_create(context);
+            context->operator = node_symbol(context->phase_allocator, "unary");
+            context->expression = working_result;
+            context->result = operand;
+
+            working_result = operand;
+
+            continue;
+        } else if (token_length == 1 && *current_token.beginning == '[') {
+            // A lambda, [return_type (parameters) { body }], whose body is
+            // parsed in a scope of its own that sees the variables around it.
+            working_result->type = NODE_TYPE_LAMBDA;
+
+            err = lex_advance(&current_token, &token_length, end);
+            if (err.type) { return err; }
+
+            Node* return_type = node_symbol_from_buffer(context->allocator, current_token.beginning, token_length);
+
+            EXPECT(expected, "(", current_token, token_length, end);
+            if (!expected.found) {
+                fprintf(diagnostic_stream(), "return type: \"%s\"\n", return_type->value.symbol);
+                ERROR_PREP(err, ERROR_SYNTAX, "expected opening parenthesis for parameter list after the return type of a lambda");
+
+                return err;
+            }
+
+            Node* parameter_list = node_allocate(context->allocator);
+            node_add_child(working_result, parameter_list);
+
+            err = parse_parameter_list(context, &current_token, &token_length, end, parameter_list);
+            if (err.type) { return err; }
+
+            node_add_child(working_result, return_type);
+
+            EXPECT(expected, "{", current_token, token_length, end);
+            if (!expected.found) {
+                ERROR_PREP(err, ERROR_SYNTAX, "lambda requires body following its parameter list \"{ body! }\"");
+
+                return err;
+            }
+
+            Node* lambda_body = node_allocate(context->allocator);
+            node_add_child(working_result, lambda_body);
+
+            EXPECT(expected, "}", current_token, token_length, end);
+            if (expected.found) {
+                EXPECT(expected, "]", current_token, token_length, end);
+                if (!expected.found) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected closing bracket after the body of a lambda");
+
+                    return err;
+                }
+            } else {
+                context = parse_context_create(context);
+                context->operator = node_symbol(context->phase_allocator, "lambda");
+                context->expression = working_result;
+
+                for (Node* parameter = parameter_list->children; parameter; parameter = parameter->next_child) {
+                    environment_set(context->variables, parameter->children, parameter->children->next_child);
+                }
+
+                Node* lambda_first_expression = node_allocate(context->allocator);
+                node_add_child(lambda_body, lambda_first_expression);
+
+                working_result = lambda_first_expression;
+                context->result = working_result;
+                statement = 1;
+
+                continue;
+            }
+        } else {
+            Node* symbol = node_symbol_from_buffer(context->allocator, current_token.beginning, token_length);
+            
+            if (strcmp("import", symbol->value.symbol) == 0) {
+                if (context->operator) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "import is only allowed at top level");
+
+                    return err;
+                }
+
+                err = lex_advance(&current_token, &token_length, end);
+                if (err.type) { return err; }
+                if (token_length == 0) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected module name after import");
+
+                    return err;
+                }
+
+                Node* module_name = node_symbol_from_buffer(context->phase_allocator, current_token.beginning, token_length);
+                char* interface_path = module_interface_path(context->import_directory, module_name->value.symbol);
+
+                if (!context->parent) {
+                    context->parent = parse_context_allocate(context->allocator, context->allocator, context->phase_allocator, NULL);
+                }
+
+                err = module_import(context->parent, interface_path);
+
+                free(interface_path);
+                node_free(context->phase_allocator, module_name);
+                node_free(context->allocator, symbol);
+
+                return err;
+            } else if (strcmp("while", symbol->value.symbol) == 0 || strcmp("for", symbol->value.symbol) == 0) {
+                if (!statement || !parse_statement_contextp(context)) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "a loop must be a statement of its own");
+
+                    return err;
+                }
+
+                context = parse_context_create_nested(context);
+
+                // The initializer of a for loop is the statement before the
+                // loop, which follows it once it is parsed.
+                if (strcmp("for", symbol->value.symbol) == 0) {
+                    context->operator = node_symbol(context->phase_allocator, "for");
+                    context->result = working_result;
+                } else {
+                    context->operator = node_symbol(context->phase_allocator, "while");
+                    parse_loop_begin(context, working_result);
+                    working_result = context->result;
+                }
+
+                node_free(context->allocator, symbol);
+
+                continue;
+            } else if (strcmp("defun", symbol->value.symbol) == 0) {
+                if (parse_operand_contextp(context)) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "a function definition cannot be an operand");
+
+                    return err;
+                }
+
+                // Functions are emitted and called by name, so they all live
+                // at the top level.
+                if (context->operator) {
+                    fprintf(diagnostic_stream(), "inside: \"%s\"\n", context->operator->value.symbol);
+                    ERROR_PREP(err, ERROR_SYNTAX, "a function can only be defined at the top level; use a lambda");
+
+                    return err;
+                }
+
+                working_result->type = NODE_TYPE_FUNCTION;
+
+                lex_advance(&current_token, &token_length, end);
+                Node* function_name = node_symbol_from_buffer(context->allocator, current_token.beginning, token_length);
+                
+                EXPECT(expected, "(", current_token, token_length, end);
+                if (!expected.found) {
+                    fprintf(diagnostic_stream(), "function name: \"%s\"\n", function_name->value.symbol);
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected opening parenthesis for parameter list after function name");
+
+                    return err;
+                }
+
+                Node* parameter_list = node_allocate(context->allocator);
+                node_add_child(working_result, parameter_list);
+
+                err = parse_parameter_list(context, &current_token, &token_length, end, parameter_list);
+                if (err.type) { return err; }
+
+                EXPECT(expected, ":", current_token, token_length, end);
+                if (expected.done || !expected.found) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "function definition requires a return type annotation following parameter list");
+
+                    return err;
+                }
+
+                lex_advance(&current_token, &token_length, end);
+
+                Node* function_return_type = node_symbol_from_buffer(context->allocator, current_token.beginning, token_length);
+                node_add_child(working_result, function_return_type);
+
+                // Redefinitions are merged once the whole source is parsed.
+                if (context->lazy) {
+                    environment_push(context->functions, function_name, working_result);
+                } else {
+                    environment_set(context->functions, function_name, working_result);
+                }
+
+                EXPECT(expected, "{", current_token, token_length, end);
+                if (expected.done || !expected.found) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "function definition requires body following return type \"{ body! }\"");
+                    
+                    return err;
+                }
+
+                Node* function_body = node_allocate(context->allocator);
+                node_add_child(working_result, function_body);
+
+                EXPECT(expected, "}", current_token, token_length, end);
+                if (!expected.found && context->lazy) {
+                    err = parse_function_body_skip(context, working_result, function_name->value.symbol, end);
+                    if (err.type) { return err; }
+
+                    current_token.beginning = *end - 1;
+                    current_token.end = *end;
+                } else if (!expected.found) {
+                    context = parse_context_create(context);
+                    context->operator = node_symbol(context->phase_allocator, "defun");
+
+                    Node* param_it = working_result->children->children;
+                    while (param_it) {
+                        environment_set(context->variables, param_it->children, param_it->children->next_child);
+
+                        param_it = param_it->next_child;
+                    }
+
+                    Node* function_first_expression = node_allocate(context->allocator);
+                    node_add_child(function_body, function_first_expression);
+
+                    working_result = function_first_expression;
+                    context->result = working_result;
+                    statement = 1;
+
+                    continue;
+                }
+            } else {
+                // A symbol may be the last token of the source, so running out
+                // of input here is not the end of the expression.
+                expected = lex_expect(":", &current_token, &token_length, end);
+                if (expected.err.type) { return expected.err; }
+                if (expected.found) {
+                    if (parse_operand_contextp(context)) {
+                        fprintf(diagnostic_stream(), "variable: \"%s\"\n", symbol->value.symbol);
+                        ERROR_PREP(err, ERROR_SYNTAX, "a declaration or reassignment cannot be an operand");
+
+                        return err;
+                    }
+
+                    EXPECT(expected, "=", current_token, token_length, end);
+                    if (expected.found) {
+                        char* type_name = parse_variable_type(context, symbol);
+
+                        if (!type_name) {
+                            fprintf(diagnostic_stream(), "id of undeclared variable: \"%s\"\n", symbol->value.symbol);
+                            ERROR_PREP(err, ERROR_GENERIC, "reassignment of variable that has not been declared");
+
+                            return err;
+                        }
+
+                        if (parse_array_layout(context, type_name, &element)) {
+                            fprintf(diagnostic_stream(), "array: \"%s\"\n", symbol->value.symbol);
+                            ERROR_PREP(err, ERROR_TYPE, "an array cannot be reassigned, only its elements, as in \"array[index] := value\"");
+
+                            return err;
+                        }
+
+                        working_result->type = NODE_TYPE_VARIABLE_REASSIGNMENT;
+                        working_result->value.symbol = type_name;
+                        node_add_child(working_result, symbol);
+
+                        Node* reassign_expr = node_allocate(context->allocator);
+                        node_add_child(working_result, reassign_expr);
+
+                        working_result = reassign_expr;
+                        statement = 0;
 
                         continue;
                     }
@@ -697,163 +1564,567 @@ Error parse_expr(ParsingContext* context, char* source, char** end, Node* result
                     err = lex_advance(&current_token, &token_length, end);
 
                     if (err.type != ERROR_NONE) { return err; }
-                    if (token_length == 0) { break; }
+                    if (token_length == 0) { return parse_unexpected_end("type"); }
 
-                    Node* type_symbol = node_symbol_from_buffer(current_token.beginning, token_length);
-                    Node* type_value = node_allocate();
-                    if (environment_get(*context->types, type_symbol, type_value) == 0) {
+                    Node* type_symbol = NULL;
+                    int array = token_length == 1 && *current_token.beginning == '[';
+
+                    // Arrays are globals, which take no space in the binary
+                    // until they are initialized, and never are.
+                    if (array) {
+                        if (context->operator) {
+                            fprintf(diagnostic_stream(), "array: \"%s\"\n", symbol->value.symbol);
+                            ERROR_PREP(err, ERROR_SYNTAX, "arrays can only be declared at top level");
+
+                            return err;
+                        }
+
+                        err = parse_array_type(context, &current_token, &token_length, end, &type_symbol);
+                        if (err.type) { return err; }
+                    } else {
+                        type_symbol = node_symbol_from_buffer(context->allocator, current_token.beginning, token_length);
+                    }
+
+                    Node* type_value = node_allocate(context->phase_allocator);
+                    if (parse_get_type(context, type_symbol, type_value).type != ERROR_NONE) {
                         ERROR_PREP(err, ERROR_TYPE, "invalid type within variable declaration");
-                        printf("\ninvalid type: \"%s\"\n", type_symbol->value.symbol);
+                        fprintf(diagnostic_stream(), "\ninvalid type: \"%s\"\n", type_symbol->value.symbol);
 
                         return err;
                     }
 
-                    free(type_value);
+                    croc_release(context->phase_allocator, type_value);
 
-                    Node* variable_binding = node_allocate();
+                    Node* variable_binding = node_allocate(context->phase_allocator);
                     if (environment_get(*context->variables, symbol, variable_binding)) {
                         ERROR_PREP(err, ERROR_GENERIC, "redefinition of variable");
-                        printf("id of redefined variable: \"%s\"\n", symbol->value.symbol);
+                        fprintf(diagnostic_stream(), "id of redefined variable: \"%s\"\n", symbol->value.symbol);
 
                         return err;
                     }
 
-                    free(variable_binding);
+                    croc_release(context->phase_allocator, variable_binding);
 
                     working_result->type = NODE_TYPE_VARIABLE_DECLARATION;
-                    Node* value_expression = node_none();
+                    working_result->value.symbol = type_symbol->value.symbol;
+                    Node* value_expression = node_none(context->allocator);
 
                     node_add_child(working_result, symbol);
                     node_add_child(working_result, value_expression);
 
-                    Node* symbol_for_env = node_allocate();
-                    node_copy(symbol, symbol_for_env);
+                    Node* symbol_for_env = node_allocate(context->allocator);
+                    node_copy(context->allocator, symbol, symbol_for_env);
 
                     int status = environment_set(context->variables, symbol_for_env, type_symbol);
                     if (status != 1) {
-                        printf("variable: \"%s\", status: %d\n", symbol_for_env->value.symbol, status);
+                        fprintf(diagnostic_stream(), "variable: \"%s\", status: %d\n", symbol_for_env->value.symbol, status);
                         ERROR_PREP(err, ERROR_GENERIC, "failed to define variable");
 
                         return err;
                     }
 
-                    EXPECT(expected, "=", current_token, token_length, end);
+                    // A declaration may be the last statement of the source.
+                    expected = lex_expect("=", &current_token, &token_length, end);
+                    if (expected.err.type) { return expected.err; }
+                    if (expected.found && array) {
+                        fprintf(diagnostic_stream(), "array: \"%s\"\n", symbol->value.symbol);
+                        ERROR_PREP(err, ERROR_SYNTAX, "an array cannot be initialized; its elements start at zero");
+
+                        return err;
+                    }
+
                     if (expected.found) {
                         working_result = value_expression;
+                        statement = 0;
 
                         continue;
                     }
-
-                    return ok;
                 } else {
-                    EXPECT(expected, "(", current_token, token_length, end);
+                    Token symbol_token = current_token;
+                    size_t symbol_length = token_length;
+                    char* symbol_end = *end;
+
+                    expected = lex_expect("(", &current_token, &token_length, end);
+                    if (expected.err.type) { return expected.err; }
+
+                    // A parenthesized expression on the next line is not an
+                    // argument list.
+                    if (expected.found && parse_newline_endsp(context, symbol_end, current_token.beginning)) {
+                        current_token = symbol_token;
+                        token_length = symbol_length;
+                        *end = symbol_end;
+                        expected.found = 0;
+                    }
+
                     if (expected.found) {
                         working_result->type = NODE_TYPE_FUNCTION_CALL;
 
                         node_add_child(working_result, symbol);
 
-                        Node* argument_list = node_allocate();
-                        Node* first_argument = node_allocate();
-
-                        node_add_child(argument_list, first_argument);
+                        Node* argument_list = node_allocate(context->allocator);
                         node_add_child(working_result, argument_list);
 
-                        working_result = first_argument;
+                        EXPECT(expected, ")", current_token, token_length, end);
+                        if (!expected.found) {
+                            Node* first_argument = node_allocate(context->allocator);
+                            node_add_child(argument_list, first_argument);
+
+                            context = parse_context_create(context);
+                            context->operator = node_symbol(context->phase_allocator, "funcall");
+                            context->expression = working_result;
+                            context->result = first_argument;
+
+                            working_result = first_argument;
+
+                            continue;
+                        }
+                    } else if (parse_array_layout(context, parse_variable_type(context, symbol), &element)) {
+                        expected = lex_expect("[", &current_token, &token_length, end);
+                        if (expected.err.type) { return expected.err; }
+                        if (!expected.found) {
+                            fprintf(diagnostic_stream(), "array: \"%s\"\n", symbol->value.symbol);
+                            ERROR_PREP(err, ERROR_TYPE, "an array can only be indexed, as in \"array[index]\"");
+
+                            return err;
+                        }
+
+                        working_result->type = NODE_TYPE_INDEX;
+                        working_result->value.integer = 0;
+                        node_add_child(working_result, symbol);
+
+                        Node* index = node_allocate(context->allocator);
+                        node_add_child(working_result, index);
 
                         context = parse_context_create(context);
-                        context->operator = node_symbol("funcall");
-                        context->result = working_result;
+                        context->operator = node_symbol(context->phase_allocator, "index");
+                        context->expression = working_result;
+                        context->result = index;
+
+                        working_result = index;
 
                         continue;
+                    } else if (parse_variable_declared(context, symbol)) {
+                        working_result->type = NODE_TYPE_SYMBOL;
+                        working_result->value.symbol = symbol->value.symbol;
+
+                        croc_release(context->allocator, symbol);
                     } else {
-                        // TOOD: check for variable access
+                        fprintf(diagnostic_stream(), "unrecognized token: ");
+                        print_token(current_token);
+                        fputc('\n', diagnostic_stream());
+
+                        ERROR_PREP(err, ERROR_SYNTAX, "unrecognized token reached during parsing");
+
+                        return err;
                     }
                 }
+            }
+        }
+
+        // The expression in `working_result` is complete; close every
+        // context it completes and find where the next expression goes.
+        // `complete` is the expression completed last, which a binary
+        // operator following it takes as its left operand. A function
+        // definition or a declaration is not one.
+        Node* complete = working_result->type == NODE_TYPE_FUNCTION || working_result->type == NODE_TYPE_VARIABLE_DECLARATION ? NULL : working_result;
+        int closed = 1;
+
+        while (closed) {
+            int binary_operator = -1;
+            Token operator_token = current_token;
+            size_t operator_length = 0;
+            char* operator_end = *end;
+
+            if (complete) {
+                err = lex_advance(&operator_token, &operator_length, &operator_end);
+                if (err.type) { return err; }
+
+                binary_operator = operator_length ? parse_binary_operator(&operator_token) : -1;
+
+                // An operator starting a line starts a statement of its own.
+                if (binary_operator >= 0 && parse_newline_endsp(context, *end, operator_token.beginning)) {
+                    binary_operator = -1;
+                }
+            }
+
+            // Precedence climbing: an open operator that binds at least as
+            // tightly takes `complete` as its right operand and becomes the
+            // complete expression itself, until one binds more loosely than
+            // the operator that follows.
+            if (parse_precedence(context) && (binary_operator < 0 || parse_precedence(context) >= binary_operator_precedence(binary_operator))) {
+                complete = context->expression;
+                context = context->parent;
+
+                continue;
+            }
+
+            if (binary_operator >= 0) {
+                current_token = operator_token;
+                token_length = operator_length;
+                *end = operator_end;
+
+                Node* right = parse_binary_operator_wrap(context->allocator, complete, binary_operator);
+
+                context = parse_context_create(context);
+                context->operator = node_symbol(context->phase_allocator, "binary");
+                context->expression = complete;
+                context->result = right;
+
+                working_result = right;
 
-                printf("unrecognized token: ");
-                print_token(current_token);
-                putchar('\n');
+                break;
+            }
 
-                ERROR_PREP(err, ERROR_SYNTAX, "unrecognized token reached during parsing");
+            // Only the top-level context has no operator; its parent, if
+            // any, holds imports.
+            if (!context->operator) {
+                return ok;
+            }
+
+            Node* operator = context->operator;
+            if (operator->type != NODE_TYPE_SYMBOL) {
+                ERROR_PREP(err, ERROR_TYPE, "[ likely interal error :( ] parsing context operator must be symbol.");
 
                 return err;
             }
-        }
 
-        if (!context->parent) {
-            break;
-        }
+            closed = 0;
 
-        Node* operator = context->operator;
-        if (operator->type != NODE_TYPE_SYMBOL) {
-            ERROR_PREP(err, ERROR_TYPE, "[ likely interal error :( ] parsing context operator must be symbol.");
+            if (strcmp(operator->value.symbol, "defun") == 0) {
+                EXPECT(expected, "}", current_token, token_length, end);
+                if (expected.found) {
+                    context = context->parent;
+                    complete = NULL;
+                    closed = 1;
 
-            return err;
-        }
+                    continue;
+                }
+            } else if (strcmp(operator->value.symbol, "lambda") == 0) {
+                EXPECT(expected, "}", current_token, token_length, end);
+                if (expected.found) {
+                    EXPECT(expected, "]", current_token, token_length, end);
+                    if (!expected.found) {
+                        print_token(current_token);
+                        fputc('\n', diagnostic_stream());
+                        ERROR_PREP(err, ERROR_SYNTAX, "expected closing bracket after the body of a lambda");
 
-        if (strcmp(operator->value.symbol, "defun") == 0) {
-            EXPECT(expected, "}", current_token, token_length, end);
-            if (expected.done || expected.found) { break; }
+                        return err;
+                    }
 
-            context->result->next_child = node_allocate();
-            working_result = context->result->next_child;
-            context->result = working_result;
+                    complete = context->expression;
+                    context = context->parent;
+                    closed = 1;
 
-            continue;
-        }
+                    continue;
+                }
+            } else if (strcmp(operator->value.symbol, "group") == 0) {
+                EXPECT(expected, ")", current_token, token_length, end);
+                if (!expected.found) {
+                    print_token(current_token);
+                    fputc('\n', diagnostic_stream());
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected closing parenthesis after parenthesized expression");
 
-        if (strcmp(operator->value.symbol, "funcall") == 0) {
-            EXPECT(expected, ")", current_token, token_length, end);
-            if (expected.done || expected.found) { break; }
+                    return err;
+                }
 
-            EXPECT(expected, ",", current_token, token_length, end);
-            if (expected.done || !expected.found) {
-                print_token(current_token);
-                ERROR_PREP(err, ERROR_SYNTAX, "parameter list expected closing parenthesis or comma for another parameter");
+                complete = context->expression;
+                context = context->parent;
+                closed = 1;
 
-                return err;
+                continue;
+            } else if (strcmp(operator->value.symbol, "for") == 0) {
+                EXPECT(expected, ",", current_token, token_length, end);
+                if (!expected.found) {
+                    print_token(current_token);
+                    fputc('\n', diagnostic_stream());
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected comma after the initializer of a for loop");
+
+                    return err;
+                }
+
+                Node* loop = node_allocate(context->allocator);
+                loop->location = context->result->location;
+                context->result->next_child = loop;
+                context->parent->result = loop;
+
+                node_free(context->phase_allocator, operator);
+                context->operator = node_symbol(context->phase_allocator, "for condition");
+                parse_loop_begin(context, loop);
+                working_result = context->result;
+
+                break;
+            } else if (strcmp(operator->value.symbol, "for condition") == 0) {
+                EXPECT(expected, ",", current_token, token_length, end);
+                if (!expected.found) {
+                    print_token(current_token);
+                    fputc('\n', diagnostic_stream());
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected comma after the condition of a for loop");
+
+                    return err;
+                }
+
+                Node* step = node_allocate(context->allocator);
+                node_add_child(context->expression, step);
+
+                node_free(context->phase_allocator, operator);
+                context->operator = node_symbol(context->phase_allocator, "for step");
+                context->result = step;
+                working_result = step;
+
+                break;
+            } else if (strcmp(operator->value.symbol, "while") == 0 || strcmp(operator->value.symbol, "for step") == 0) {
+                EXPECT(expected, "{", current_token, token_length, end);
+                if (!expected.found) {
+                    print_token(current_token);
+                    fputc('\n', diagnostic_stream());
+                    ERROR_PREP(err, ERROR_SYNTAX, "loop requires body following its condition \"{ body! }\"");
+
+                    return err;
+                }
+
+                EXPECT(expected, "}", current_token, token_length, end);
+                if (expected.found) {
+                    context = context->parent;
+                    complete = NULL;
+                    closed = 1;
+
+                    continue;
+                }
+
+                Node* first_statement = node_allocate(context->allocator);
+                node_add_child(context->expression->children->next_child, first_statement);
+
+                node_free(context->phase_allocator, operator);
+                context->operator = node_symbol(context->phase_allocator, "loop");
+                context->result = first_statement;
+                working_result = first_statement;
+                statement = 1;
+
+                break;
+            } else if (strcmp(operator->value.symbol, "loop") == 0) {
+                EXPECT(expected, "}", current_token, token_length, end);
+                if (expected.found) {
+                    context = context->parent;
+                    complete = NULL;
+                    closed = 1;
+
+                    continue;
+                }
+            } else if (strcmp(operator->value.symbol, "index") == 0) {
+                EXPECT(expected, "]", current_token, token_length, end);
+                if (!expected.found) {
+                    print_token(current_token);
+                    fputc('\n', diagnostic_stream());
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected closing bracket after index");
+
+                    return err;
+                }
+
+                complete = context->expression;
+                context = context->parent;
+                closed = 1;
+
+                // An element followed by := is stored to, and the value
+                // stored is parsed in place like that of a reassignment.
+                expected = lex_expect(":", &current_token, &token_length, end);
+                if (expected.err.type) { return expected.err; }
+                if (!expected.found) {
+                    continue;
+                }
+
+                // At top level, each statement is the result of a call.
+                if (!parse_statement_contextp(context) || complete != (context->operator ? context->result : result)) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "a store to an array element must be a statement of its own");
+
+                    return err;
+                }
+
+                expected = lex_expect("=", &current_token, &token_length, end);
+                if (expected.err.type) { return expected.err; }
+                if (!expected.found) {
+                    ERROR_PREP(err, ERROR_SYNTAX, "expected \":=\" after an array element to store to it");
+
+                    return err;
+                }
+
+                Node* stored = node_allocate(context->allocator);
+                node_add_child(complete, stored);
+
+                working_result = stored;
+                statement = 0;
+
+                break;
+            } else if (strcmp(operator->value.symbol, "funcall") == 0) {
+                EXPECT(expected, ")", current_token, token_length, end);
+                if (expected.found) {
+                    complete = context->expression;
+                    context = context->parent;
+                    closed = 1;
+
+                    continue;
+                }
+
+                EXPECT(expected, ",", current_token, token_length, end);
+                if (!expected.found) {
+                    print_token(current_token);
+                    fputc('\n', diagnostic_stream());
+                    ERROR_PREP(err, ERROR_SYNTAX, "parameter list expected closing parenthesis or comma for another parameter");
+
+                    return err;
+                }
             }
 
-            context->result->next_child = node_allocate();
+            context->result->next_child = node_allocate(context->allocator);
             working_result = context->result->next_child;
             context->result = working_result;
-
-            continue;
+            statement = 1;
         }
     }
 
     return err;
 }
 
-Error parse_program(char* filepath, ParsingContext* context, Node* result) {
-    Error err = ok;
-    char* contents = file_contents(filepath);
+typedef struct ParsingDefinition {
+    Binding* binding;
+    // Position in the list, newest first.
+    size_t order;
+} ParsingDefinition;
 
-    if (!contents) {
-        printf("filepath: \"%s\"\n", filepath);
-        ERROR_PREP(err, ERROR_GENERIC, "parse_program: failed to get file contents");
+int parse_definition_compare(const void* a, const void* b) {
+    const ParsingDefinition* definition_a = a;
+    const ParsingDefinition* definition_b = b;
+    int order = strcmp(definition_a->binding->id->value.symbol, definition_b->binding->id->value.symbol);
 
-        return err;
+    if (order) {
+        return order;
+    }
+
+    return (definition_a->order > definition_b->order) - (definition_a->order < definition_b->order);
+}
+
+// Leave the functions a lazy parse pushed bound as environment_set() would
+// have: each name once, where it was first defined, to its last definition.
+void parse_merge_functions(ParsingContext* context) {
+    size_t count = 0;
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        count++;
+    }
+
+    ParsingDefinition* definitions = calloc(count + 1, sizeof(ParsingDefinition));
+    assert(definitions && "parse_merge_functions: could not allocate memory for definitions");
+
+    count = 0;
+
+    for (Binding* it = context->functions->bind; it; it = it->next, count++) {
+        definitions[count].binding = it;
+        definitions[count].order = count;
+    }
+
+    qsort(definitions, count, sizeof(ParsingDefinition), parse_definition_compare);
+
+    // The older of two definitions keeps its place and takes the value of
+    // the newer, which goes.
+    for (size_t i = 0; i + 1 < count; ++i) {
+        if (strcmp(definitions[i].binding->id->value.symbol, definitions[i + 1].binding->id->value.symbol) == 0) {
+            definitions[i + 1].binding->value = definitions[i].binding->value;
+            definitions[i].binding->id = NULL;
+        }
+    }
+
+    for (Binding** it = &context->functions->bind; *it;) {
+        if (!(*it)->id) {
+            *it = (*it)->next;
+        } else {
+            it = &(*it)->next;
+        }
+    }
+
+    free(definitions);
+}
+
+// Record the parse of the top-level form `form`, named after the function
+// it defines if it does, or else after its statement's index in the
+// program, counted from 1.
+void parse_trace_form(ParsingContext* context, Node* form, size_t index, double start, size_t nodes) {
+    char* name = form->type == NODE_TYPE_FUNCTION ? parse_function_name(context, form) : NULL;
+    char form_name[32];
+
+    if (!name) {
+        snprintf(form_name, sizeof(form_name), "form %zu", index);
+        name = form_name;
     }
 
+    trace_span(context->trace, "parse", name, start, "nodes", nodes);
+}
+
+Error parse_source(char* source, ParsingContext* context, Node* result) {
+    Error err = ok;
+
     result->type = NODE_TYPE_PROGRAM;
-    char* contents_it = contents;
+    context->source = source;
+    char* contents_it = source;
+    Node* last = NULL;
+    size_t statement_count = 0;
+    size_t parse_nodes = compiler_counters.nodes;
 
+    // Statements are appended after the last, not by walking them all.
     for (;;) {
-        Node* expression = node_allocate();
-        node_add_child(result, expression);
+        double start = context->trace ? time_report_wall_seconds() : 0;
+        size_t nodes = compiler_counters.nodes;
+        Node* expression = node_allocate(context->allocator);
+
+        if (last) {
+            last->next_child = expression;
+        } else {
+            node_add_child(result, expression);
+        }
 
         err = parse_expr(context, contents_it, &contents_it, expression);
         if (err.type != ERROR_NONE) {
-            free(contents);
-
             return err;
         }
 
+        if (context->trace) {
+            parse_trace_form(context, expression, statement_count + 1, start, compiler_counters.nodes - nodes);
+            trace_counter(context->trace, "nodes", compiler_counters.nodes - parse_nodes);
+        }
+
+        // A for loop follows its initializer.
+        last = expression;
+        statement_count++;
+        while (last->next_child) { last = last->next_child; statement_count++; }
+
         if (!(*contents_it)) { break; }
     }
 
-    free(contents);
+    if (context->lazy) {
+        parse_merge_functions(context);
+    }
 
     return ok;
+}
+
+Error parse_program(char* filepath, ParsingContext* context, Node* result) {
+    Error err = ok;
+    char* contents = file_contents(filepath);
+
+    if (!contents) {
+        fprintf(diagnostic_stream(), "filepath: \"%s\"\n", filepath);
+        ERROR_PREP(err, ERROR_GENERIC, "parse_program: failed to get file contents");
+
+        return err;
+    }
+
+    err = parse_source(contents, context, result);
+
+    // Skipped bodies point into the contents.
+    if (!err.type && context->lazy) {
+        err = parse_function_bodies(context);
+    }
+
+    free(contents);
+    context->source = NULL;
+
+    return err;
 }
\ No newline at end of file
@@ -1,9 +1,12 @@
 #ifndef COMPILER_PARSER_H
 #define COMPILER_PARSER_H
 
+#include "allocator.h"
 #include "error.h"
+#include "trace.h"
 #include <stddef.h>
 
+typedef struct Binding Binding;
 typedef struct Environment Environment;
 
 typedef struct Token {
@@ -19,21 +22,79 @@ typedef enum NodeType {
     NODE_TYPE_INTEGER,
     NODE_TYPE_SYMBOL,
     NODE_TYPE_FUNCTION,
+    // Children are the name of the function called and the arguments.
+    // Closure analysis sets `value.node` of a call through a variable of
+    // type `function` to the lambda it always calls, if it found one, and
+    // to the name of the variable otherwise; calls by name keep NULL.
     NODE_TYPE_FUNCTION_CALL,
+    // Declarations and reassignments keep the name of the type of their
+    // variable in `value.symbol`, which belongs to the variable's binding.
     NODE_TYPE_VARIABLE_DECLARATION,
     NODE_TYPE_VARIABLE_DECLARATION_INITIALIZED,
     NODE_TYPE_VARIABLE_REASSIGNMENT,
     NODE_TYPE_BINARY_OPERATOR,
+    // Children are the condition, the body, whose children are its
+    // statements, and for `for` loops the step run after the body.
+    NODE_TYPE_WHILE,
     NODE_TYPE_PROGRAM,
+    // Children are the array, named by a symbol, the index and, for a store,
+    // the value stored. `value.integer` is nonzero once the index is known
+    // to be in range, so the access needs no bounds check.
+    NODE_TYPE_INDEX,
+    // Kind of the array types bound in a types environment; never in a
+    // program.
+    NODE_TYPE_ARRAY,
+    // Children are the parameters, the return type and the body, as those
+    // of a function are, then once closure_analyze_program() has run the
+    // captured variables, whose node keeps its ClosurePlacement in
+    // `value.integer`. `value.symbol` is then the label of the body.
+    NODE_TYPE_LAMBDA,
     NODE_TYPE_MAX,
 } NodeType;
 
+// Operators of NODE_TYPE_BINARY_OPERATOR nodes, which keep theirs in
+// `value.integer` and their left and right operands as children.
+typedef enum BinaryOperator {
+    BINARY_OPERATOR_ADD = 0,
+    BINARY_OPERATOR_SUBTRACT,
+    BINARY_OPERATOR_MULTIPLY,
+    BINARY_OPERATOR_DIVIDE,
+    BINARY_OPERATOR_MODULO,
+    BINARY_OPERATOR_SHIFT_LEFT,
+    BINARY_OPERATOR_SHIFT_RIGHT,
+    BINARY_OPERATOR_AND,
+    BINARY_OPERATOR_OR,
+    BINARY_OPERATOR_XOR,
+    BINARY_OPERATOR_LESS,
+    BINARY_OPERATOR_LESS_EQUAL,
+    BINARY_OPERATOR_GREATER,
+    BINARY_OPERATOR_GREATER_EQUAL,
+    BINARY_OPERATOR_EQUAL,
+    BINARY_OPERATOR_NOT_EQUAL,
+    BINARY_OPERATOR_COUNT,
+} BinaryOperator;
+
+const char* binary_operator_name(int binary_operator);
+// Higher binds tighter; every operator is left-associative.
+int binary_operator_precedence(int binary_operator);
+int binary_operator_commutativep(int binary_operator);
+// Integers wrap around, division truncates, shift counts are taken modulo 64
+// and comparisons give 0 or 1, as on x86_64. Returns zero, leaving `result`
+// alone, where x86_64 would trap: dividing by zero, or the smallest integer
+// by -1.
+int binary_operator_evaluate(int binary_operator, long long a, long long b, long long* result);
+
 typedef struct Node {
     int type;
+    // One more than the offset into the source of the node's first token,
+    // or zero for nodes the compiler made up. Sits in what would otherwise
+    // be padding after `type`.
+    unsigned int location;
 
     union NodeValue {
         long long integer;
         char* symbol;
+        struct Node* node;
     } value;
 
     struct Node* children;
@@ -41,23 +102,61 @@ typedef struct Node {
     int result_register;
 } Node;
 
-Node* node_allocate();
+// Nodes are counted by the function that allocates them.
+Node* node_allocate_from(CrocAllocator* allocator, const char* site);
+#define node_allocate(allocator)    node_allocate_from((allocator), __func__)
 
 #define nonep(node)     ((node).type == NODE_TYPE_NONE)
 #define integerp(node)  ((node).type == NODE_TYPE_INTEGER)
 #define symbolp(node)   ((node).type == NODE_TYPE_SYMBOL)
 
 void node_add_child(Node* parent, Node* new_child);
+size_t node_count_children(Node* node);
+// Whether only empty statements, like the one the parser leaves when a
+// file ends in a newline, follow `statement`.
+int node_last_statementp(Node* statement);
 int node_compare(Node* a, Node* b);
-Node* node_integer(long long value);
-Node* node_symbol(char* symbol_string);
-Node* node_symbol_from_buffer(char* buffer, size_t length);
+Node* node_none(CrocAllocator* allocator);
+Node* node_integer(CrocAllocator* allocator, long long value);
+Node* node_symbol(CrocAllocator* allocator, char* symbol_string);
+Node* node_symbol_from_buffer(CrocAllocator* allocator, char* buffer, size_t length);
 
 void print_node(Node* node, size_t indent_level);
-void node_free(Node* root);
-void node_copy(Node* a, Node* b);
+// Give `root`, its children and their symbols back to the `allocator` they
+// came from.
+void node_free(CrocAllocator* allocator, Node* root);
+void node_copy(CrocAllocator* allocator, Node* a, Node* b);
 
 int token_string_equalp(char* string, Token* token);
+// Bind `type_symbol`, which it takes ownership of, to a new type of
+// `byte_size` bytes aligned to `alignment`. The type node has the two as its
+// children and keeps whether the type is signed in `value.integer`.
+Error define_type(Environment* types, int type, Node* type_symbol, long long byte_size, long long alignment, int is_signed);
+
+// How a variable of an integer type keeps its value: in `size` bytes
+// aligned to `alignment`, read back as 64 bits with its sign extended if
+// `is_signed` and zeros otherwise.
+typedef struct TypeLayout {
+    long long size;
+    long long alignment;
+    int is_signed;
+} TypeLayout;
+
+// What storing `value` in a variable of `layout` and reading it back gives.
+long long type_layout_narrow(TypeLayout layout, long long value);
+// Whether every value of `inner` is kept unchanged by a variable of `outer`.
+int type_layout_containsp(TypeLayout outer, TypeLayout inner);
+
+// Arrays are laid out like C's, so the largest are limited by how far
+// RIP-relative addressing reaches.
+#define ARRAY_SIZE_MAX  0x7fffffffLL
+
+// Bind `type_symbol`, which it takes ownership of, to an array of `length`
+// elements of the integer type `element_name` laid out as `element`. The
+// type node of kind NODE_TYPE_ARRAY has the size and alignment of the whole
+// array as its first two children, as define_type() gives them, then the
+// length and the element type's name.
+Error define_array_type(Environment* types, Node* type_symbol, long long length, char* element_name, TypeLayout element);
 int parse_integer(Token* token, Node* node);
 
 typedef struct ParsingStack {
@@ -66,22 +165,90 @@ typedef struct ParsingStack {
     Node* result;
 } ParsingStack;
 
+// The body of a function a lazy parse skipped: the source right after its
+// opening brace, and the top-level variables bound when the function was
+// defined, which are all the body may refer to.
+typedef struct ParsingLazyBody {
+    Node* body;
+    char* name;
+    char* source;
+    Binding* variables;
+} ParsingLazyBody;
+
 typedef struct ParsingContext {
     struct ParsingContext* parent;
     Node* operator;
     Node* result;
+    // What the operator builds, if anything but `result`: the call of
+    // "funcall", the operator node whose right operand `result` is of
+    // "binary" and "unary", the parenthesized operand of "group", the
+    // element whose index `result` is of "index", the loop of "while",
+    // "for condition", "for step" and "loop", and the lambda of "lambda".
+    Node* expression;
 
     Environment* types;
     Environment* variables;
     Environment* functions;
+
+    // Source being parsed, which node locations are offsets into.
+    char* source;
+
+    // With `lazy` set, the body of a function defined at top level is only
+    // scanned for its closing brace and left for parse_function_body(). The
+    // body node of one not parsed yet keeps one more than its index in
+    // `lazy_bodies` in `value.integer`.
+    int lazy;
+    ParsingLazyBody* lazy_bodies;
+    size_t lazy_body_count;
+    size_t lazy_body_capacity;
+    size_t lazy_bodies_parsed;
+
+    // Where `import` looks for interfaces; NULL for the working directory.
+    // Imported bindings go in a parent of the top-level context, created by
+    // the first import.
+    char* import_directory;
+
+    // Where parsing, type checking and code generation record a span per
+    // top-level form or function they handle, if not NULL.
+    TraceBuffer* trace;
+
+    // Memory of what lives as long as the program: its nodes and the
+    // top-level and imported contexts. Everything else, like the contexts
+    // made while parsing a function, is scratch memory of the phase running,
+    // released when the phase ends.
+    CrocAllocator* allocator;
+    CrocAllocator* phase_allocator;
 } ParsingContext;
 
 Error parse_get_type(ParsingContext* context, Node* id, Node* result);
-
+// Layout of the type named `type_name` in `context` or its parents. A NULL
+// name, which nodes the compiler makes up have, is a 64-bit integer.
+TypeLayout parse_type_layout(ParsingContext* context, char* type_name);
+// Length of the array type named `type_name` in `context` or its parents,
+// with the layout of its elements in `element`; zero if it is not an array.
+long long parse_array_layout(ParsingContext* context, char* type_name, TypeLayout* element);
+// Name of the type of the variable `id`, or NULL if it is not declared.
+char* parse_variable_type(ParsingContext* context, Node* id);
+int parse_variable_declared(ParsingContext* context, Node* id);
+
+// A context in scratch memory, binding names in a scope of its own.
 ParsingContext* parse_context_create(ParsingContext* parent);
-ParsingContext* parse_context_default_create();
+// A context for part of a statement, binding names in the scope of `parent`.
+ParsingContext* parse_context_create_nested(ParsingContext* parent);
+// The top-level context, with the builtin types bound.
+ParsingContext* parse_context_default_create(CrocAllocator* allocator, CrocAllocator* phase_allocator);
 
 Error parse_expr(ParsingContext* context, char* source, char** end, Node* result);
+// Parse the body of `function` if a lazy parse of `context` skipped it. A
+// body that does not parse is left empty and still unparsed.
+Error parse_function_body(ParsingContext* context, Node* function);
+// Name `function` is bound to in `context`, or NULL if it is bound to
+// none, looking at the functions defined last first.
+char* parse_function_name(ParsingContext* context, Node* function);
+// Parse every skipped body of the functions bound in `context`.
+Error parse_function_bodies(ParsingContext* context);
+// Parse a NUL-terminated program already in memory.
+Error parse_source(char* source, ParsingContext* context, Node* result);
 Error parse_program(char* filepath, ParsingContext* context, Node* result);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,371 @@
+#include "profile.h"
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Error profile_read(char* path, Profile* profile) {
+    Error err = ok;
+    unsigned char record[PROFILE_RECORD_SIZE];
+    long long count = 0;
+
+    // A profile outlives the compiles that use it.
+    profile->counts = environment_create(&croc_heap, NULL);
+    profile->counter_count = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(diagnostic_stream(), "profile: \"%s\"\n", path);
+        ERROR_PREP(err, ERROR_GENERIC, "could not open profile");
+
+        return err;
+    }
+
+    if (fread(record, 1, PROFILE_RECORD_SIZE, file) != PROFILE_RECORD_SIZE
+        || memcmp(record, PROFILE_MAGIC, 8) != 0) {
+        fprintf(diagnostic_stream(), "profile: \"%s\"\n", path);
+        ERROR_PREP(err, ERROR_GENERIC, "file is not a croc profile");
+
+        fclose(file);
+
+        return err;
+    }
+
+    memcpy(&count, record + 8, sizeof(long long));
+
+    for (long long i = 0; i < count; ++i) {
+        long long value = 0;
+
+        if (fread(record, 1, PROFILE_RECORD_SIZE, file) != PROFILE_RECORD_SIZE) {
+            fprintf(diagnostic_stream(), "profile: \"%s\"\n", path);
+            ERROR_PREP(err, ERROR_GENERIC, "profile is truncated");
+
+            break;
+        }
+
+        memcpy(&value, record, sizeof(long long));
+        record[PROFILE_RECORD_SIZE - 1] = '\0';
+
+        environment_set(profile->counts, node_symbol(&croc_heap, (char*)record + 8), node_integer(&croc_heap, value));
+        profile->counter_count++;
+    }
+
+    fclose(file);
+
+    return err;
+}
+
+long long profile_count(Profile* profile, char* name) {
+    Node* value = node_allocate(&croc_heap);
+    long long count = -1;
+
+    if (profile && environment_get_by_symbol(*profile->counts, name, value)) {
+        count = value->value.integer;
+    }
+
+    croc_release(&croc_heap, value);
+
+    return count;
+}
+
+void profile_site_name(char* buffer, size_t size, char* caller, size_t ordinal, char* callee) {
+    snprintf(buffer, size, "%s:%zu:%s", caller, ordinal, callee);
+}
+
+size_t profile_counter_add(ProfileCounters* counters, char* name) {
+    if (counters->count == counters->capacity) {
+        counters->capacity = counters->capacity ? counters->capacity * 2 : 64;
+        counters->names = realloc(counters->names, counters->capacity * sizeof(char*));
+        assert(counters->names && "profile_counter_add: could not allocate memory for counter names");
+    }
+
+    counters->names[counters->count] = strdup(name);
+    assert(counters->names[counters->count] && "profile_counter_add: could not allocate memory for counter name");
+
+    return counters->count++;
+}
+
+typedef struct ProfileSite {
+    Node* call;
+    // Function containing the call; NULL for the top level.
+    Node* caller;
+    long long count;
+} ProfileSite;
+
+typedef struct ProfileSites {
+    ProfileSite* sites;
+    size_t count;
+    size_t capacity;
+} ProfileSites;
+
+// Number the calls in `expression` the way codegen does, outer calls before
+// the calls in their arguments.
+void profile_collect_sites(Profile* profile, ProfileSites* sites, Node* expression, Node* caller, char* caller_name, size_t* ordinal) {
+    char name[PROFILE_NAME_SIZE];
+
+    // Lambdas are generated as functions of their own, numbering their
+    // calls apart.
+    if (expression->type == NODE_TYPE_FUNCTION || expression->type == NODE_TYPE_LAMBDA) {
+        return;
+    }
+
+    if (expression->type == NODE_TYPE_FUNCTION_CALL) {
+        if (sites->count == sites->capacity) {
+            sites->capacity = sites->capacity ? sites->capacity * 2 : 64;
+            sites->sites = realloc(sites->sites, sites->capacity * sizeof(ProfileSite));
+            assert(sites->sites && "profile_collect_sites: could not allocate memory for call sites");
+        }
+
+        profile_site_name(name, sizeof(name), caller_name, (*ordinal)++, expression->children->value.symbol);
+
+        sites->sites[sites->count].call = expression;
+        sites->sites[sites->count].caller = caller;
+        sites->sites[sites->count].count = profile_count(profile, name);
+        sites->count++;
+    }
+
+    for (Node* child = expression->children; child; child = child->next_child) {
+        profile_collect_sites(profile, sites, child, caller, caller_name, ordinal);
+    }
+}
+
+int profile_site_compare(const void* a, const void* b) {
+    long long count_a = ((const ProfileSite*)a)->count;
+    long long count_b = ((const ProfileSite*)b)->count;
+
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+long long profile_parameter_index(Node* parameters, Node* symbol) {
+    long long index = 0;
+
+    for (Node* parameter = parameters->children; parameter; parameter = parameter->next_child, index++) {
+        if (node_compare(parameter->children, symbol)) {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+// Bodies made of literals, operators, calls and parameters, each parameter
+// used at most once, can be substituted into the caller without changing
+// what runs.
+int profile_inlinable_expressionp(Node* expression, Node* parameters, char* uses, int* has_calls, size_t* size) {
+    long long index = 0;
+
+    (*size)++;
+
+    switch (expression->type) {
+    default:
+        return 0;
+
+    case NODE_TYPE_INTEGER:
+        return 1;
+
+    case NODE_TYPE_SYMBOL:
+        index = profile_parameter_index(parameters, expression);
+
+        if (index < 0 || uses[index]) {
+            return 0;
+        }
+
+        uses[index] = 1;
+
+        return 1;
+
+    case NODE_TYPE_BINARY_OPERATOR:
+        return profile_inlinable_expressionp(expression->children, parameters, uses, has_calls, size)
+            && profile_inlinable_expressionp(expression->children->next_child, parameters, uses, has_calls, size);
+
+    // The function a parameter holds is not substituted.
+    case NODE_TYPE_FUNCTION_CALL:
+        if (profile_parameter_index(parameters, expression->children) >= 0) {
+            return 0;
+        }
+
+        *has_calls = 1;
+
+        for (Node* argument = expression->children->next_child->children; argument; argument = argument->next_child) {
+            if (!profile_inlinable_expressionp(argument, parameters, uses, has_calls, size)) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+}
+
+int profile_caller_localp(Node* caller, Node* symbol) {
+    if (!caller) {
+        return 0;
+    }
+
+    if (profile_parameter_index(caller->children, symbol) >= 0) {
+        return 1;
+    }
+
+    for (Node* expression = caller->children->next_child->next_child->children; expression; expression = expression->next_child) {
+        if (expression->type == NODE_TYPE_VARIABLE_DECLARATION && node_compare(expression->children, symbol)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+Node* profile_substitute(CrocAllocator* allocator, Node* expression, Node* parameters, Node* arguments) {
+    Node* result = node_allocate(allocator);
+    long long index = symbolp(*expression) ? profile_parameter_index(parameters, expression) : -1;
+
+    if (index >= 0) {
+        Node* argument = arguments->children;
+
+        while (index--) {
+            argument = argument->next_child;
+        }
+
+        node_copy(allocator, argument, result);
+
+        return result;
+    }
+
+    result->type = expression->type;
+    result->value = expression->value;
+
+    if (symbolp(*expression)) {
+        result->value.symbol = croc_allocate(allocator, strlen(expression->value.symbol) + 1);
+        strcpy(result->value.symbol, expression->value.symbol);
+    }
+
+    for (Node* child = expression->children; child; child = child->next_child) {
+        // The name of a called function is never a parameter reference.
+        if (expression->type == NODE_TYPE_FUNCTION_CALL && child == expression->children) {
+            Node* name = node_allocate(allocator);
+
+            node_copy(allocator, child, name);
+            node_add_child(result, name);
+
+            continue;
+        }
+
+        node_add_child(result, profile_substitute(allocator, child, parameters, arguments));
+    }
+
+    return result;
+}
+
+// Whether the parameters and result of `function` are all 64 bits, so
+// substituting its body narrows nothing a call would.
+int profile_wide_signaturep(ParsingContext* context, Node* function) {
+    if (parse_type_layout(context, function->children->next_child->value.symbol).size < 8) {
+        return 0;
+    }
+
+    for (Node* parameter = function->children->children; parameter; parameter = parameter->next_child) {
+        if (parse_type_layout(context, parameter->children->next_child->value.symbol).size < 8) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Returns the number of nodes the inlined body adds, or zero if the call was
+// left alone.
+size_t profile_inline_site(ParsingContext* context, ProfileSite* site, size_t budget) {
+    Node* callee = node_allocate(context->phase_allocator);
+    Node* call = site->call;
+    char uses[256] = { 0 };
+    int has_calls = 0;
+    size_t size = 0;
+
+    if (!environment_get(*context->functions, call->children, callee)) {
+        croc_release(context->phase_allocator, callee);
+
+        return 0;
+    }
+
+    Node* parameters = callee->children;
+    Node* body = callee->children->next_child->next_child->children;
+    int inlinable = body && !body->next_child && node_count_children(parameters) < sizeof(uses)
+        && profile_wide_signaturep(context, callee)
+        && profile_inlinable_expressionp(body, parameters, uses, &has_calls, &size)
+        && size <= budget;
+
+    // Arguments are only substituted when reading them later gives the same
+    // value: literals always do, and so do variables nothing else can
+    // assign while the inlined body runs.
+    for (Node* argument = call->children->next_child->children; inlinable && argument; argument = argument->next_child) {
+        inlinable = integerp(*argument)
+            || (symbolp(*argument) && (!has_calls || profile_caller_localp(site->caller, argument)));
+    }
+
+    if (!inlinable) {
+        croc_release(context->phase_allocator, callee);
+
+        return 0;
+    }
+
+    Node* replacement = profile_substitute(context->allocator, body, parameters, call->children->next_child);
+
+    for (Node* child = call->children; child;) {
+        Node* next_child = child->next_child;
+
+        node_free(context->allocator, child);
+
+        child = next_child;
+    }
+
+    call->type = replacement->type;
+    call->value = replacement->value;
+    call->children = replacement->children;
+
+    croc_release(context->allocator, replacement);
+    croc_release(context->phase_allocator, callee);
+
+    return size;
+}
+
+size_t profile_inline_program(ParsingContext* context, Node* program, Profile* profile) {
+    ProfileSites sites = { NULL, 0, 0 };
+    size_t ordinal = 0;
+    size_t inlined = 0;
+    size_t budget = PROFILE_INLINE_BUDGET;
+
+    for (Binding* it = context->functions->bind; it; it = it->next) {
+        ordinal = 0;
+
+        for (Node* expression = it->value->children->next_child->next_child->children; expression; expression = expression->next_child) {
+            profile_collect_sites(profile, &sites, expression, it->value, it->id->value.symbol, &ordinal);
+        }
+    }
+
+    ordinal = 0;
+
+    for (Node* expression = program->children; expression; expression = expression->next_child) {
+        profile_collect_sites(profile, &sites, expression, NULL, "main", &ordinal);
+    }
+
+    if (sites.count) {
+        qsort(sites.sites, sites.count, sizeof(ProfileSite), profile_site_compare);
+    }
+
+    for (size_t i = 0; i < sites.count && sites.sites[i].count > 0; ++i) {
+        size_t size = profile_inline_site(context, sites.sites + i, budget);
+
+        if (size) {
+            budget -= size;
+            inlined++;
+        }
+    }
+
+    free(sites.sites);
+
+    return inlined;
+}
@@ -0,0 +1,50 @@
+#ifndef COMPILER_PROFILE_H
+#define COMPILER_PROFILE_H
+
+#include <stddef.h>
+
+#include "environment.h"
+#include "error.h"
+#include "parser.h"
+
+// A program built with --profile-generate writes its counter table verbatim
+// when main returns: a header record holding the magic and the number of
+// counters, followed by one record per counter holding its count and its
+// NUL-padded name. Counters are named after the function whose entries they
+// count, or "caller:ordinal:callee" for the ordinal-th call in the caller,
+// counting calls in the order they appear in its body.
+#define PROFILE_MAGIC           "CROCPROF"
+#define PROFILE_RECORD_SIZE     64
+#define PROFILE_NAME_SIZE       (PROFILE_RECORD_SIZE - 8)
+
+// Most nodes profile-guided inlining may add to the program.
+#define PROFILE_INLINE_BUDGET   4096
+
+typedef struct Profile {
+    // Counter name to INTEGER node holding its count.
+    Environment* counts;
+    size_t counter_count;
+} Profile;
+
+Error profile_read(char* path, Profile* profile);
+
+// Count recorded for `name`, or -1 if the profile has no such counter.
+long long profile_count(Profile* profile, char* name);
+
+void profile_site_name(char* buffer, size_t size, char* caller, size_t ordinal, char* callee);
+
+// Counters emitted by codegen, in table order.
+typedef struct ProfileCounters {
+    char** names;
+    size_t count;
+    size_t capacity;
+} ProfileCounters;
+
+size_t profile_counter_add(ProfileCounters* counters, char* name);
+
+// Inline the callees of the hottest call sites in `profile`, hottest first,
+// until PROFILE_INLINE_BUDGET is used up. Returns the number of sites
+// inlined.
+size_t profile_inline_program(ParsingContext* context, Node* program, Profile* profile);
+
+#endif
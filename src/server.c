@@ -0,0 +1,412 @@
+#include "server.h"
+#include "driver.h"
+#include "error.h"
+#include "file_io.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+void server_default_socket_path(char* buffer, size_t size) {
+    snprintf(buffer, size, "croc.sock");
+}
+
+int server_run(char* socket_path) {
+    (void)socket_path;
+    printf("--server is not supported on Windows\n");
+
+    return 1;
+}
+
+int client_run(char* socket_path, char** options, size_t option_count, char* input_path, char* output_path) {
+    (void)socket_path; (void)options; (void)option_count; (void)input_path; (void)output_path;
+    printf("--client is not supported on Windows\n");
+
+    return SERVER_UNREACHABLE;
+}
+
+#else
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_LINE_MAX     (PATH_MAX + 64)
+#define SERVER_OPTION_MAX   64
+
+void server_default_socket_path(char* buffer, size_t size) {
+    char* runtime_directory = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_directory && *runtime_directory) {
+        snprintf(buffer, size, "%s/croc.sock", runtime_directory);
+    } else {
+        snprintf(buffer, size, "/tmp/croc-%lu.sock", (unsigned long)getuid());
+    }
+}
+
+int server_address(char* socket_path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        printf("socket path is too long: \"%s\"\n", socket_path);
+
+        return 0;
+    }
+
+    strcpy(address->sun_path, socket_path);
+
+    return 1;
+}
+
+// Strip the newline fgets() leaves, returning zero at the end of the stream
+// or on a line too long for the buffer.
+int server_read_line(FILE* stream, char* line, size_t size) {
+    if (!fgets(line, (int)size, stream)) {
+        return 0;
+    }
+
+    size_t length = strlen(line);
+
+    if (!length || line[length - 1] != '\n') {
+        return 0;
+    }
+
+    line[length - 1] = '\0';
+
+    return 1;
+}
+
+typedef struct ServerRequest {
+    char* options[SERVER_OPTION_MAX];
+    size_t option_count;
+    char* input_path;
+    char* source;
+    char* output_path;
+} ServerRequest;
+
+void server_request_free(ServerRequest* request) {
+    for (size_t i = 0; i < request->option_count; ++i) {
+        free(request->options[i]);
+    }
+
+    free(request->input_path);
+    free(request->source);
+    free(request->output_path);
+}
+
+int server_read_request(FILE* stream, ServerRequest* request) {
+    char line[SERVER_LINE_MAX];
+
+    while (server_read_line(stream, line, sizeof(line))) {
+        if (strcmp(line, "end") == 0) {
+            return (request->input_path || request->source) && request->output_path;
+        }
+
+        if (strncmp(line, "option ", 7) == 0) {
+            if (request->option_count == SERVER_OPTION_MAX) {
+                return 0;
+            }
+
+            request->options[request->option_count++] = strdup(line + 7);
+        } else if (strncmp(line, "input ", 6) == 0 && !request->input_path) {
+            request->input_path = strdup(line + 6);
+        } else if (strncmp(line, "output ", 7) == 0 && !request->output_path) {
+            request->output_path = strdup(line + 7);
+        } else if (strncmp(line, "source ", 7) == 0 && !request->source) {
+            size_t length = strtoull(line + 7, NULL, 10);
+
+            // An empty program is a single NUL.
+            request->source = length ? stream_contents(stream, length) : strdup("");
+            if (!request->source) {
+                return 0;
+            }
+        } else {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+// Sockets cannot seek, so reading and writing each get a stream of their own.
+int server_streams(int connection, FILE** input, FILE** output) {
+    int duplicate = dup(connection);
+
+    *input = fdopen(connection, "r");
+    *output = duplicate >= 0 ? fdopen(duplicate, "w") : NULL;
+
+    if (*input && *output) {
+        return 1;
+    }
+
+    if (*input) { fclose(*input); } else { close(connection); }
+    if (*output) { fclose(*output); } else if (duplicate >= 0) { close(duplicate); }
+
+    return 0;
+}
+
+void server_respond(int connection) {
+    FILE* input = NULL;
+    FILE* stream = NULL;
+    ServerRequest request;
+    DriverOptions options;
+    int status = 1;
+
+    if (!server_streams(connection, &input, &stream)) {
+        return;
+    }
+
+    memset(&request, 0, sizeof(ServerRequest));
+    driver_options_init(&options);
+
+    char* report = NULL;
+    size_t report_length = 0;
+    FILE* diagnostics = open_memstream(&report, &report_length);
+    diagnostic_stream_set(diagnostics);
+
+    if (!server_read_request(input, &request)) {
+        fprintf(diagnostic_stream(), "croc server: malformed request\n");
+    } else {
+        status = 0;
+
+        for (size_t i = 0; i < request.option_count; ++i) {
+            if (!driver_option(&options, request.options[i])) {
+                fprintf(diagnostic_stream(), "unknown option: \"%s\"\n", request.options[i]);
+                status = 1;
+            }
+        }
+
+        // The program would run on the server's thread, not the client's.
+        if (!status && options.interpret) {
+            fprintf(diagnostic_stream(), "--interpret is not available to --client\n");
+            status = 1;
+        }
+
+        if (!status) {
+            Error err = driver_load_profile(&options);
+
+            if (err.type) {
+                print_error(err);
+                status = 3;
+            } else {
+                status = driver_compile(&options, request.input_path ? request.input_path : "<stdin>", request.source, request.output_path);
+            }
+        }
+    }
+
+    diagnostic_stream_set(NULL);
+
+    if (diagnostics) {
+        fclose(diagnostics);
+    }
+
+    fprintf(stream, "status %d %zu\n", status, report_length);
+    fwrite(report, 1, report_length, stream);
+    free(report);
+
+    fclose(stream);
+    fclose(input);
+    server_request_free(&request);
+}
+
+void* server_connection_thread(void* connection) {
+    server_respond((int)(size_t)connection);
+
+    return NULL;
+}
+
+int server_run(char* socket_path) {
+    struct sockaddr_un address;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listener < 0 || !server_address(socket_path, &address)) {
+        printf("croc server: could not create socket\n");
+
+        return 1;
+    }
+
+    // A client hanging up mid-response must not take the server with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    // The socket of a server that is gone is in the way; one that still
+    // answers is not ours to take over.
+    if (connect(listener, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        printf("croc server: already running at \"%s\"\n", socket_path);
+        close(listener);
+
+        return 1;
+    }
+
+    close(listener);
+    unlink(socket_path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(0077);
+
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        umask(mask);
+        printf("croc server: could not listen at \"%s\": %s\n", socket_path, strerror(errno));
+
+        return 1;
+    }
+
+    umask(mask);
+    printf("croc server: listening at \"%s\"\n", socket_path);
+    fflush(stdout);
+
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        pthread_t thread;
+
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+
+            printf("croc server: accept failed: %s\n", strerror(errno));
+
+            break;
+        }
+
+        if (pthread_create(&thread, NULL, server_connection_thread, (void*)(size_t)connection) != 0) {
+            server_respond(connection);
+
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    unlink(socket_path);
+
+    return 1;
+}
+
+// Paths in a request are resolved against the client's directory.
+char* client_absolute_path(char* path) {
+    char directory[PATH_MAX];
+
+    if (path[0] == '/' || !getcwd(directory, sizeof(directory))) {
+        return strdup(path);
+    }
+
+    size_t length = strlen(directory) + strlen(path) + 2;
+    char* absolute_path = malloc(length);
+
+    if (absolute_path) {
+        snprintf(absolute_path, length, "%s/%s", directory, path);
+    }
+
+    return absolute_path;
+}
+
+int client_run(char* socket_path, char** options, size_t option_count, char* input_path, char* output_path) {
+    struct sockaddr_un address;
+    char line[SERVER_LINE_MAX];
+    int status = 0;
+    long length = 0;
+    char* source = NULL;
+
+    if (strcmp(input_path, "-") == 0) {
+        source = stream_contents(stdin, 0);
+
+        if (!source) {
+            printf("could not read the program from stdin\n");
+
+            return 1;
+        }
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (connection < 0 || !server_address(socket_path, &address)
+        || connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("no croc server at \"%s\"\n", socket_path);
+
+        if (connection >= 0) { close(connection); }
+        free(source);
+
+        return SERVER_UNREACHABLE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    FILE* input = NULL;
+    FILE* stream = NULL;
+
+    if (!server_streams(connection, &input, &stream)) {
+        printf("could not talk to the croc server at \"%s\"\n", socket_path);
+        free(source);
+
+        return SERVER_UNREACHABLE;
+    }
+
+    char* absolute_output_path = client_absolute_path(output_path ? output_path : CODEGEN_DEFAULT_OUTPUT_PATH);
+
+    // The profile, the cache and the trace are used by the server;
+    // everything else with a path is used by the compiled program.
+    for (size_t i = 0; i < option_count; ++i) {
+        char* value = strchr(options[i], '=');
+
+        if (value && (strncmp(options[i], "--profile-use=", 14) == 0 || strncmp(options[i], "--cache=", 8) == 0
+                      || strncmp(options[i], "--trace=", 8) == 0)) {
+            char* absolute_path = client_absolute_path(value + 1);
+
+            fprintf(stream, "option %.*s=%s\n", (int)(value - options[i]), options[i], absolute_path);
+            free(absolute_path);
+        } else {
+            fprintf(stream, "option %s\n", options[i]);
+        }
+    }
+
+    if (source) {
+        fprintf(stream, "source %zu\n", strlen(source));
+        fputs(source, stream);
+    } else {
+        char* absolute_input_path = client_absolute_path(input_path);
+
+        fprintf(stream, "input %s\n", absolute_input_path);
+        free(absolute_input_path);
+    }
+
+    fprintf(stream, "output %s\n", absolute_output_path);
+    fprintf(stream, "end\n");
+    fflush(stream);
+
+    free(absolute_output_path);
+    free(source);
+
+    if (!server_read_line(input, line, sizeof(line)) || sscanf(line, "status %d %ld", &status, &length) != 2) {
+        printf("croc server at \"%s\" did not answer\n", socket_path);
+        fclose(stream);
+        fclose(input);
+
+        return SERVER_UNREACHABLE;
+    }
+
+    char buffer[4096];
+
+    while (length > 0) {
+        size_t count = fread(buffer, 1, length < (long)sizeof(buffer) ? (size_t)length : sizeof(buffer), input);
+
+        if (!count) { break; }
+
+        fwrite(buffer, 1, count, stdout);
+        length -= (long)count;
+    }
+
+    fclose(stream);
+    fclose(input);
+
+    return status;
+}
+
+#endif
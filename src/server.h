@@ -0,0 +1,30 @@
+#ifndef COMPILER_SERVER_H
+#define COMPILER_SERVER_H
+
+#include <stddef.h>
+
+// A client connects to the server's Unix domain socket and sends one compile
+// request as lines of text:
+//
+//     option <driver option>      any number of times
+//     input <absolute path>       or: source <length>, then <length> bytes
+//     output <absolute path>
+//     end
+//
+// and the server answers with a line "status <exit code> <length>" followed
+// by <length> bytes of diagnostics, then closes the connection.
+
+// Exit code of the client when there is no server to talk to.
+#define SERVER_UNREACHABLE  4
+
+// $XDG_RUNTIME_DIR/croc.sock, or /tmp/croc-<uid>.sock without it.
+void server_default_socket_path(char* buffer, size_t size);
+
+// Serve requests, each on its own thread, until the process is killed.
+int server_run(char* socket_path);
+
+// Send a request for `input_path`, or for the program on stdin if it is "-",
+// print the diagnostics and return the exit code the server gave it.
+int client_run(char* socket_path, char** options, size_t option_count, char* input_path, char* output_path);
+
+#endif
@@ -0,0 +1,121 @@
+#include "sha256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// FIPS 180-4.
+
+static const uint32_t sha256_round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROTATE(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+void sha256_block(SHA256* sha, const unsigned char* block) {
+    uint32_t w[64];
+    uint32_t s[8];
+
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16
+            | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = SHA256_ROTATE(w[i - 15], 7) ^ SHA256_ROTATE(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTATE(w[i - 2], 17) ^ SHA256_ROTATE(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, sha->state, sizeof(s));
+
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = SHA256_ROTATE(s[4], 6) ^ SHA256_ROTATE(s[4], 11) ^ SHA256_ROTATE(s[4], 25);
+        uint32_t choice = (s[4] & s[5]) ^ (~s[4] & s[6]);
+        uint32_t t1 = s[7] + s1 + choice + sha256_round_constants[i] + w[i];
+        uint32_t s0 = SHA256_ROTATE(s[0], 2) ^ SHA256_ROTATE(s[0], 13) ^ SHA256_ROTATE(s[0], 22);
+        uint32_t majority = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+        uint32_t t2 = s0 + majority;
+
+        s[7] = s[6];
+        s[6] = s[5];
+        s[5] = s[4];
+        s[4] = s[3] + t1;
+        s[3] = s[2];
+        s[2] = s[1];
+        s[1] = s[0];
+        s[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        sha->state[i] += s[i];
+    }
+}
+
+void sha256_init(SHA256* sha) {
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(sha->state, initial_state, sizeof(initial_state));
+    sha->length = 0;
+    sha->block_length = 0;
+}
+
+void sha256_update(SHA256* sha, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+
+    sha->length += length;
+
+    while (length) {
+        size_t count = sizeof(sha->block) - sha->block_length;
+
+        if (count > length) {
+            count = length;
+        }
+
+        memcpy(sha->block + sha->block_length, bytes, count);
+        sha->block_length += count;
+        bytes += count;
+        length -= count;
+
+        if (sha->block_length == sizeof(sha->block)) {
+            sha256_block(sha, sha->block);
+            sha->block_length = 0;
+        }
+    }
+}
+
+void sha256_final(SHA256* sha, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = sha->length * 8;
+    unsigned char padding = 0x80;
+    unsigned char length[8];
+
+    sha256_update(sha, &padding, 1);
+
+    padding = 0;
+    while (sha->block_length != 56) {
+        sha256_update(sha, &padding, 1);
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        length[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+
+    sha256_update(sha, length, 8);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[i * 4] = (unsigned char)(sha->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(sha->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(sha->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)sha->state[i];
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef COMPILER_SHA256_H
+#define COMPILER_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE  32
+
+typedef struct SHA256 {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t block_length;
+} SHA256;
+
+void sha256_init(SHA256* sha);
+void sha256_update(SHA256* sha, const void* data, size_t length);
+void sha256_final(SHA256* sha, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,131 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef struct ThreadPool {
+    ThreadPoolTask task;
+    void* data;
+    size_t count;
+    size_t next;
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} ThreadPool;
+
+int thread_pool_take(ThreadPool* pool, size_t* index) {
+    int status = 0;
+
+#ifdef _WIN32
+    EnterCriticalSection(&pool->lock);
+#else
+    pthread_mutex_lock(&pool->lock);
+#endif
+
+    if (pool->next < pool->count) {
+        *index = pool->next++;
+        status = 1;
+    }
+
+#ifdef _WIN32
+    LeaveCriticalSection(&pool->lock);
+#else
+    pthread_mutex_unlock(&pool->lock);
+#endif
+
+    return status;
+}
+
+void thread_pool_work(ThreadPool* pool) {
+    size_t index = 0;
+
+    while (thread_pool_take(pool, &index)) {
+        pool->task(pool->data, index);
+    }
+}
+
+#ifdef _WIN32
+DWORD WINAPI thread_pool_worker(LPVOID pool) {
+    thread_pool_work(pool);
+
+    return 0;
+}
+#else
+void* thread_pool_worker(void* pool) {
+    thread_pool_work(pool);
+
+    return NULL;
+}
+#endif
+
+void thread_pool_run(size_t threads, size_t count, ThreadPoolTask task, void* data) {
+    ThreadPool pool;
+
+    pool.task = task;
+    pool.data = data;
+    pool.count = count;
+    pool.next = 0;
+
+    if (threads > count) {
+        threads = count;
+    }
+
+    // A pool of one is just a loop.
+    if (threads <= 1) {
+        for (size_t index = 0; index < count; ++index) {
+            task(data, index);
+        }
+
+        return;
+    }
+
+#ifdef _WIN32
+    HANDLE* workers = calloc(threads - 1, sizeof(HANDLE));
+    InitializeCriticalSection(&pool.lock);
+#else
+    pthread_t* workers = calloc(threads - 1, sizeof(pthread_t));
+    pthread_mutex_init(&pool.lock, NULL);
+#endif
+
+    assert(workers && "thread_pool_run: could not allocate memory for workers");
+
+    size_t started = 0;
+
+    // If a thread cannot be started, the threads that were do its share.
+    for (; started < threads - 1; ++started) {
+#ifdef _WIN32
+        workers[started] = CreateThread(NULL, 0, thread_pool_worker, &pool, 0, NULL);
+        if (!workers[started]) { break; }
+#else
+        if (pthread_create(workers + started, NULL, thread_pool_worker, &pool) != 0) { break; }
+#endif
+    }
+
+    thread_pool_work(&pool);
+
+    for (size_t i = 0; i < started; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(workers[i], INFINITE);
+        CloseHandle(workers[i]);
+#else
+        pthread_join(workers[i], NULL);
+#endif
+    }
+
+#ifdef _WIN32
+    DeleteCriticalSection(&pool.lock);
+#else
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    free(workers);
+}
@@ -0,0 +1,13 @@
+#ifndef COMPILER_THREAD_POOL_H
+#define COMPILER_THREAD_POOL_H
+
+#include <stddef.h>
+
+typedef void (*ThreadPoolTask)(void* data, size_t index);
+
+// Call `task(data, index)` for every index below `count` on up to
+// `threads` threads, the calling thread among them, and return when all
+// calls have. Indices are handed out in increasing order.
+void thread_pool_run(size_t threads, size_t count, ThreadPoolTask task, void* data);
+
+#endif
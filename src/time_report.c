@@ -0,0 +1,166 @@
+#include "time_report.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+_Thread_local CompilerCounters compiler_counters;
+
+double time_report_wall_seconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+// CPU time of the calling thread, so that compile jobs running in parallel
+// each see only their own.
+double time_report_cpu_seconds() {
+#ifdef _WIN32
+    FILETIME creation;
+    FILETIME exit;
+    FILETIME kernel;
+    FILETIME user;
+
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return (double)clock() / CLOCKS_PER_SEC;
+    }
+
+    ULARGE_INTEGER kernel_time = { .LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime };
+    ULARGE_INTEGER user_time = { .LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime };
+
+    return (double)(kernel_time.QuadPart + user_time.QuadPart) / 1e7;
+#else
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+        return (double)clock() / CLOCKS_PER_SEC;
+    }
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+// Peak resident set size of the process in KiB, or zero if unknown.
+size_t time_report_peak_rss_kib() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS memory;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory))) {
+        return 0;
+    }
+
+    return memory.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss / 1024;
+#else
+    return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+void time_report_begin(TimeReport* report, const char* name) {
+    time_report_end(report);
+
+    if (report->phase_count == TIME_REPORT_PHASE_MAX) {
+        return;
+    }
+
+    TimeReportPhase* phase = report->phases + report->phase_count;
+
+    phase->name = name;
+    phase->wall_seconds = time_report_wall_seconds();
+    phase->cpu_seconds = time_report_cpu_seconds();
+    phase->counters = compiler_counters;
+}
+
+void time_report_end(TimeReport* report) {
+    if (report->phase_count == TIME_REPORT_PHASE_MAX) {
+        return;
+    }
+
+    TimeReportPhase* phase = report->phases + report->phase_count;
+
+    if (!phase->name) {
+        return;
+    }
+
+    double start = phase->wall_seconds;
+
+    phase->wall_seconds = time_report_wall_seconds() - phase->wall_seconds;
+    phase->cpu_seconds = time_report_cpu_seconds() - phase->cpu_seconds;
+    phase->counters.nodes = compiler_counters.nodes - phase->counters.nodes;
+    phase->counters.tokens = compiler_counters.tokens - phase->counters.tokens;
+    phase->counters.bindings = compiler_counters.bindings - phase->counters.bindings;
+    phase->counters.environments = compiler_counters.environments - phase->counters.environments;
+    phase->counters.allocations = compiler_counters.allocations - phase->counters.allocations;
+    phase->counters.bytes_allocated = compiler_counters.bytes_allocated - phase->counters.bytes_allocated;
+
+    if (report->trace) {
+        trace_span(report->trace, "phase", phase->name, start, "nodes", phase->counters.nodes);
+    }
+
+    report->phase_count++;
+}
+
+void print_time_report_row(const char* name, double wall_seconds, double cpu_seconds, CompilerCounters* counters) {
+    fprintf(diagnostic_stream(), "%-12s %10.3f %10.3f %10zu %10zu %10zu %8zu %10zu %12zu\n",
+        name, wall_seconds * 1000.0, cpu_seconds * 1000.0,
+        counters->nodes, counters->tokens, counters->bindings,
+        counters->environments, counters->allocations, counters->bytes_allocated);
+}
+
+void print_time_report(TimeReport* report) {
+    double wall_seconds = 0;
+    double cpu_seconds = 0;
+    CompilerCounters total;
+
+    memset(&total, 0, sizeof(CompilerCounters));
+
+    fprintf(diagnostic_stream(), "%-12s %10s %10s %10s %10s %10s %8s %10s %12s\n",
+        "phase", "wall ms", "cpu ms", "nodes", "tokens", "bindings", "envs", "allocs", "bytes");
+
+    for (size_t i = 0; i < report->phase_count; ++i) {
+        TimeReportPhase* phase = report->phases + i;
+
+        print_time_report_row(phase->name, phase->wall_seconds, phase->cpu_seconds, &phase->counters);
+
+        wall_seconds += phase->wall_seconds;
+        cpu_seconds += phase->cpu_seconds;
+        total.nodes += phase->counters.nodes;
+        total.tokens += phase->counters.tokens;
+        total.bindings += phase->counters.bindings;
+        total.environments += phase->counters.environments;
+        total.allocations += phase->counters.allocations;
+        total.bytes_allocated += phase->counters.bytes_allocated;
+    }
+
+    print_time_report_row("total", wall_seconds, cpu_seconds, &total);
+    fprintf(diagnostic_stream(), "peak rss: %zu KiB\n", time_report_peak_rss_kib());
+}
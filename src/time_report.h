@@ -0,0 +1,59 @@
+#ifndef COMPILER_TIME_REPORT_H
+#define COMPILER_TIME_REPORT_H
+
+#include <stddef.h>
+
+#include "trace.h"
+
+// Running totals of what the compiler has created. Allocations cover nodes,
+// symbol strings, environments, bindings, parsing contexts and the source
+// buffer, which is nearly everything the front end allocates.
+typedef struct CompilerCounters {
+    size_t nodes;
+    size_t tokens;
+    size_t bindings;
+    size_t environments;
+    size_t allocations;
+    size_t bytes_allocated;
+} CompilerCounters;
+
+// Per thread, so parallel compile jobs count only their own work.
+extern _Thread_local CompilerCounters compiler_counters;
+
+static inline void count_allocation(size_t bytes) {
+    compiler_counters.allocations++;
+    compiler_counters.bytes_allocated += bytes;
+}
+
+#define TIME_REPORT_PHASE_MAX   16
+
+typedef struct TimeReportPhase {
+    const char* name;
+    double wall_seconds;
+    double cpu_seconds;
+    // Counters at the start of the phase, then what the phase added.
+    CompilerCounters counters;
+} TimeReportPhase;
+
+typedef struct TimeReport {
+    TimeReportPhase phases[TIME_REPORT_PHASE_MAX];
+    size_t phase_count;
+
+    // Where each phase is also recorded as a span once it ends, if not
+    // NULL.
+    TraceBuffer* trace;
+} TimeReport;
+
+// Phases do not nest; a phase lasts until the next one begins or the report
+// ends.
+void time_report_begin(TimeReport* report, const char* name);
+void time_report_end(TimeReport* report);
+
+void print_time_report(TimeReport* report);
+
+// Seconds on a monotonic clock and of CPU time used by the calling thread,
+// both from an arbitrary origin.
+double time_report_wall_seconds();
+double time_report_cpu_seconds();
+
+#endif
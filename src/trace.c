@@ -0,0 +1,238 @@
+#include "trace.h"
+#include "error.h"
+#include "time_report.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+struct Trace {
+    char* path;
+    // Wall time events are timed from.
+    double origin;
+
+    TraceEvent* events;
+    size_t event_count;
+    size_t event_capacity;
+    size_t track_count;
+
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+void trace_lock(Trace* trace) {
+#ifdef _WIN32
+    EnterCriticalSection(&trace->lock);
+#else
+    pthread_mutex_lock(&trace->lock);
+#endif
+}
+
+void trace_unlock(Trace* trace) {
+#ifdef _WIN32
+    LeaveCriticalSection(&trace->lock);
+#else
+    pthread_mutex_unlock(&trace->lock);
+#endif
+}
+
+Trace* trace_create(char* path) {
+    Trace* trace = calloc(1, sizeof(Trace));
+    assert(trace && "trace_create: could not allocate memory for trace");
+
+    trace->path = path;
+    trace->origin = time_report_wall_seconds();
+
+#ifdef _WIN32
+    InitializeCriticalSection(&trace->lock);
+#else
+    pthread_mutex_init(&trace->lock, NULL);
+#endif
+
+    return trace;
+}
+
+void trace_free(Trace* trace) {
+    for (size_t i = 0; i < trace->event_count; ++i) {
+        free(trace->events[i].name);
+    }
+
+    free(trace->events);
+
+#ifdef _WIN32
+    DeleteCriticalSection(&trace->lock);
+#else
+    pthread_mutex_destroy(&trace->lock);
+#endif
+
+    free(trace);
+}
+
+// `string` as a JSON string literal.
+void trace_write_string(FILE* file, const char* string) {
+    fputc('"', file);
+
+    for (; *string; ++string) {
+        unsigned char c = (unsigned char)*string;
+
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+void trace_write_event(FILE* file, Trace* trace, TraceEvent* event) {
+    fprintf(file, "{\"ph\":\"%c\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f", event->phase, event->track, (event->start - trace->origin) * 1e6);
+
+    switch (event->phase) {
+    default:
+        break;
+
+    case 'X':
+        fprintf(file, ",\"dur\":%.3f,\"cat\":", event->duration * 1e6);
+        trace_write_string(file, event->category);
+
+        break;
+
+    case 'C':
+        fprintf(file, ",\"id\":%zu", event->track);
+
+        break;
+
+    case 'M':
+        fprintf(file, ",\"name\":\"thread_name\",\"args\":{\"name\":");
+        trace_write_string(file, event->name);
+        fprintf(file, "}}");
+
+        return;
+    }
+
+    fprintf(file, ",\"name\":");
+    trace_write_string(file, event->name);
+
+    if (event->argument) {
+        fprintf(file, ",\"args\":{");
+        trace_write_string(file, event->argument);
+        fprintf(file, ":%zu}", event->value);
+    }
+
+    fputc('}', file);
+}
+
+Error trace_write(Trace* trace) {
+    Error err = ok;
+    FILE* file = fopen(trace->path, "w");
+
+    if (!file) {
+        fprintf(diagnostic_stream(), "trace: \"%s\"\n", trace->path);
+        ERROR_PREP(err, ERROR_GENERIC, "trace_write: could not open trace file");
+
+        return err;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (size_t i = 0; i < trace->event_count; ++i) {
+        fprintf(file, "%s\n", i ? "," : "");
+        trace_write_event(file, trace, trace->events + i);
+    }
+
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        fprintf(diagnostic_stream(), "trace: \"%s\"\n", trace->path);
+        ERROR_PREP(err, ERROR_GENERIC, "trace_write: could not write trace file");
+    }
+
+    return err;
+}
+
+TraceEvent* trace_buffer_event(TraceBuffer* buffer, char phase, const char* category, const char* name) {
+    if (buffer->event_count == buffer->event_capacity) {
+        buffer->event_capacity = buffer->event_capacity ? buffer->event_capacity * 2 : 64;
+        buffer->events = realloc(buffer->events, buffer->event_capacity * sizeof(TraceEvent));
+        assert(buffer->events && "trace_buffer_event: could not allocate memory for events");
+    }
+
+    TraceEvent* event = buffer->events + buffer->event_count++;
+    size_t length = strlen(name);
+
+    memset(event, 0, sizeof(TraceEvent));
+
+    event->phase = phase;
+    event->category = category;
+    event->name = malloc(length + 1);
+    assert(event->name && "trace_buffer_event: could not allocate memory for event name");
+    memcpy(event->name, name, length + 1);
+    event->track = buffer->track;
+
+    return event;
+}
+
+void trace_buffer_init(TraceBuffer* buffer, Trace* trace, const char* name) {
+    memset(buffer, 0, sizeof(TraceBuffer));
+
+    buffer->trace = trace;
+
+    trace_lock(trace);
+    buffer->track = ++trace->track_count;
+    trace_unlock(trace);
+
+    trace_buffer_event(buffer, 'M', NULL, name)->start = time_report_wall_seconds();
+}
+
+void trace_span(TraceBuffer* buffer, const char* category, const char* name, double start, const char* argument, size_t value) {
+    TraceEvent* event = trace_buffer_event(buffer, 'X', category, name);
+
+    event->start = start;
+    event->duration = time_report_wall_seconds() - start;
+    event->argument = argument;
+    event->value = value;
+}
+
+void trace_counter(TraceBuffer* buffer, const char* name, size_t value) {
+    TraceEvent* event = trace_buffer_event(buffer, 'C', NULL, name);
+
+    event->start = time_report_wall_seconds();
+    event->argument = name;
+    event->value = value;
+}
+
+void trace_buffer_flush(TraceBuffer* buffer) {
+    Trace* trace = buffer->trace;
+
+    trace_lock(trace);
+
+    if (trace->event_count + buffer->event_count > trace->event_capacity) {
+        trace->event_capacity = trace->event_count + buffer->event_count + trace->event_capacity;
+        trace->events = realloc(trace->events, trace->event_capacity * sizeof(TraceEvent));
+        assert(trace->events && "trace_buffer_flush: could not allocate memory for events");
+    }
+
+    memcpy(trace->events + trace->event_count, buffer->events, buffer->event_count * sizeof(TraceEvent));
+    trace->event_count += buffer->event_count;
+
+    trace_unlock(trace);
+
+    free(buffer->events);
+
+    buffer->events = NULL;
+    buffer->event_count = 0;
+    buffer->event_capacity = 0;
+}
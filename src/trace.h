@@ -0,0 +1,52 @@
+#ifndef COMPILER_TRACE_H
+#define COMPILER_TRACE_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+// A span of `duration` seconds from `start` ('X'), the value of a counter
+// at `start` ('C'), or the name of a track ('M'). Spans and counters carry
+// one argument, `argument`, unless it is NULL.
+typedef struct TraceEvent {
+    char phase;
+    const char* category;
+    char* name;
+    double start;
+    double duration;
+    const char* argument;
+    size_t value;
+    size_t track;
+} TraceEvent;
+
+// Events of every compile writing to one trace file, in the Chrome trace
+// event format that chrome://tracing and Perfetto read. Compiles record
+// into buffers of their own and hand their events over when done, so
+// threads only take the trace's lock once per compile.
+typedef struct Trace Trace;
+
+// What one thread of one compile records, shown as a track of its own.
+typedef struct TraceBuffer {
+    Trace* trace;
+    size_t track;
+
+    TraceEvent* events;
+    size_t event_count;
+    size_t event_capacity;
+} TraceBuffer;
+
+Trace* trace_create(char* path);
+// Write the events of `trace` to its path.
+Error trace_write(Trace* trace);
+void trace_free(Trace* trace);
+
+// Start a track named `name`.
+void trace_buffer_init(TraceBuffer* buffer, Trace* trace, const char* name);
+// Record a span from `start`, in time_report_wall_seconds(), until now.
+void trace_span(TraceBuffer* buffer, const char* category, const char* name, double start, const char* argument, size_t value);
+// Record the value of the counter `name` now.
+void trace_counter(TraceBuffer* buffer, const char* name, size_t value);
+// Hand the events of `buffer` over to its trace, leaving it empty.
+void trace_buffer_flush(TraceBuffer* buffer);
+
+#endif
@@ -2,84 +2,216 @@
 #include "error.h"
 #include "environment.h"
 #include "parser.h"
+#include "time_report.h"
+#include "trace.h"
 
+#include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 int expression_return_type(ParsingContext* context, Node* expression) {
-	Node* result;
+	CrocAllocator* allocator = context->phase_allocator;
+	Node* binding = node_allocate(allocator);
+	Node* result = node_allocate(allocator);
+	int type = expression->type;
 
 	switch (expression->type) {
 	default:
-		return expression->type;
+		break;
 
-	case NODE_TYPE_FUNCTION_CALL:
+	case NODE_TYPE_BINARY_OPERATOR:
+	case NODE_TYPE_INDEX:
+		type = NODE_TYPE_INTEGER;
+
+		break;
+
+	case NODE_TYPE_LAMBDA:
+		type = NODE_TYPE_FUNCTION;
+
+		break;
+
+	case NODE_TYPE_SYMBOL:
 		while (context) {
-			if (environment_get(*context->functions, expression->children, result)) {
+			if (environment_get(*context->variables, expression, binding)) {
+				if (parse_get_type(context, binding, result).type == ERROR_NONE) {
+					type = result->type;
+				}
+
 				break;
 			}
 
 			context = context->parent;
 		}
 
-		print_node(result, 0);
+		break;
+
+	case NODE_TYPE_FUNCTION_CALL:
+		while (context) {
+			if (environment_get(*context->functions, expression->children, binding)) {
+				if (parse_get_type(context, binding->children->next_child, result).type == ERROR_NONE) {
+					type = result->type;
+				}
+
+				break;
+			}
+
+			// Lambdas, which calls through variables reach, return integers.
+			if (parse_variable_declared(context, expression->children)) {
+				type = NODE_TYPE_INTEGER;
+
+				break;
+			}
+
+			context = context->parent;
+		}
 
 		break;
 	}
 
-	return result->type;
+	croc_release(allocator, result);
+	croc_release(allocator, binding);
+
+	return type;
 }
 
 Error typecheck_expression(ParsingContext* context, Node* expression) {
 	Error err = ok;
-	Node* value = node_allocate();
-	Node* tmpnode = node_allocate();
-	Node* iterator = node_allocate();
-	Node* result = node_allocate();
-	int type = NODE_TYPE_NONE;
+	Node* value = node_allocate(context->phase_allocator);
+	Node* result = node_allocate(context->phase_allocator);
+	Node* iterator = NULL;
+	Node* parameter = NULL;
+	ParsingContext* scope = context;
 
 	switch (expression->type) {
 	default:
 		break;
 
+	case NODE_TYPE_VARIABLE_DECLARATION:
+	case NODE_TYPE_VARIABLE_REASSIGNMENT:
+		err = typecheck_expression(context, expression->children->next_child);
+
+		break;
+
+	case NODE_TYPE_BINARY_OPERATOR:
+		for (iterator = expression->children; iterator; iterator = iterator->next_child) {
+			err = typecheck_expression(context, iterator);
+			if (err.type) { break; }
+
+			if (expression_return_type(context, iterator) != NODE_TYPE_INTEGER) {
+				fprintf(diagnostic_stream(), "operator: \"%s\"\n", binary_operator_name((int)expression->value.integer));
+				ERROR_PREP(err, ERROR_TYPE, "operands of arithmetic, bitwise and comparison operators must be integers");
+
+				break;
+			}
+		}
+
+		break;
+
+	case NODE_TYPE_INDEX:
+		for (iterator = expression->children->next_child; iterator; iterator = iterator->next_child) {
+			err = typecheck_expression(context, iterator);
+			if (err.type) { break; }
+
+			if (expression_return_type(context, iterator) != NODE_TYPE_INTEGER) {
+				fprintf(diagnostic_stream(), "array: \"%s\"\n", expression->children->value.symbol);
+				ERROR_PREP(err, ERROR_TYPE, "the index of an array and the values stored in it must be integers");
+
+				break;
+			}
+		}
+
+		break;
+
+	case NODE_TYPE_WHILE:
+		err = typecheck_expression(context, expression->children);
+		if (err.type) { break; }
+
+		if (expression_return_type(context, expression->children) != NODE_TYPE_INTEGER) {
+			ERROR_PREP(err, ERROR_TYPE, "loop condition must be an integer");
+
+			break;
+		}
+
+		for (iterator = expression->children->next_child->children; iterator; iterator = iterator->next_child) {
+			err = typecheck_expression(context, iterator);
+			if (err.type) { break; }
+		}
+
+		if (!err.type && expression->children->next_child->next_child) {
+			err = typecheck_expression(context, expression->children->next_child->next_child);
+		}
+
+		break;
+
 	case NODE_TYPE_FUNCTION_CALL:
-		while (context) {
-			if (environment_get(*context->functions, expression->children, value)) {
+		while (scope) {
+			if (environment_get(*scope->functions, expression->children, value)) {
 				break;
 			}
 			
-			context = context->parent;
+			scope = scope->parent;
+		}
+
+		// A call through a variable, which has to be of type function;
+		// closure_analyze_program() checks what it holds.
+		if (!scope && parse_variable_declared(context, expression->children)) {
+			if (expression_return_type(context, expression->children) != NODE_TYPE_FUNCTION) {
+				fprintf(diagnostic_stream(), "variable: \"%s\"\n", expression->children->value.symbol);
+				ERROR_PREP(err, ERROR_TYPE, "called variable is not a function");
+
+				break;
+			}
+
+			for (iterator = expression->children->next_child->children; iterator; iterator = iterator->next_child) {
+				err = typecheck_expression(context, iterator);
+				if (err.type) { break; }
+			}
+
+			break;
+		}
+
+		if (!scope) {
+			fprintf(diagnostic_stream(), "function: \"%s\"\n", expression->children->value.symbol);
+			ERROR_PREP(err, ERROR_GENERIC, "call to undefined function");
+
+			break;
 		}
 
 		iterator = expression->children->next_child->children;
-		tmpnode = value->children->children;
+		parameter = value->children->children;
+
+		while (iterator && parameter) {
+			err = typecheck_expression(context, iterator);
+			if (err.type) { break; }
 
-		while (iterator && tmpnode) {
-			err = parse_get_type(context, tmpnode->children->next_child, result);
+			err = parse_get_type(scope, parameter->children->next_child, result);
 
 			if (err.type) { break; }
 			if (expression_return_type(context, iterator) != result->type) {
-				printf("function: \"%s\"\n", expression->children->value.symbol);
+				fprintf(diagnostic_stream(), "function: \"%s\"\n", expression->children->value.symbol);
 				ERROR_PREP(err, ERROR_TYPE, "argument type does not match declared type");
 				
-				return err;
+				break;
 			}
 
 			iterator = iterator->next_child;
-			tmpnode = tmpnode->next_child;
+			parameter = parameter->next_child;
 		}
 
-		if (tmpnode != NULL) {
-			printf("function: \"%s\"\n", expression->children->value.symbol);
+		if (err.type) { break; }
+
+		if (parameter != NULL) {
+			fprintf(diagnostic_stream(), "function: \"%s\"\n", expression->children->value.symbol);
 			ERROR_PREP(err, ERROR_ARGUMENTS, "not enough arguments passed to function");
 
 			break;
 		}
 
 		if (iterator != NULL) {
-			printf("function: \"%s\"\n", expression->children->value.symbol);
-			ERROR_CREATE(err, ERROR_ARGUMENTS, "too many arguments passed to function");
+			fprintf(diagnostic_stream(), "function: \"%s\"\n", expression->children->value.symbol);
+			ERROR_PREP(err, ERROR_ARGUMENTS, "too many arguments passed to function");
 
 			break;
 		}
@@ -87,24 +219,84 @@ Error typecheck_expression(ParsingContext* context, Node* expression) {
 		break;
 	}
 
-	free(result);
-	free(value);
-	free(tmpnode);
-	free(iterator);
+	croc_release(context->phase_allocator, result);
+	croc_release(context->phase_allocator, value);
 
 	return err;
 }
 
+int typecheck_binding_compare(const void* a, const void* b) {
+	uintptr_t function_a = (uintptr_t)(*(Binding* const*)a)->value;
+	uintptr_t function_b = (uintptr_t)(*(Binding* const*)b)->value;
+
+	return (function_a > function_b) - (function_a < function_b);
+}
+
+// Record the check of the top-level form `form`, named after the function
+// it defines if it does, or else after its statement's index in the
+// program, counted from 1. Functions are looked up by definition in
+// `functions`, sorted with typecheck_binding_compare().
+void typecheck_trace_form(TraceBuffer* trace, Binding** functions, size_t function_count, Node* form, size_t index, double start) {
+	Binding key_binding;
+	Binding* key = &key_binding;
+	Binding** function = NULL;
+	char name[32];
+
+	key_binding.value = form;
+
+	if (form->type == NODE_TYPE_FUNCTION) {
+		function = bsearch(&key, functions, function_count, sizeof(Binding*), typecheck_binding_compare);
+	}
+
+	if (function) {
+		trace_span(trace, "typecheck", (*function)->id->value.symbol, start, NULL, 0);
+
+		return;
+	}
+
+	snprintf(name, sizeof(name), "form %zu", index);
+	trace_span(trace, "typecheck", name, start, NULL, 0);
+}
+
 Error typecheck_program(ParsingContext* context, Node* program) {
 	Error err = ok;
 	Node* expression = program->children;
+	Binding** functions = NULL;
+	size_t function_count = 0;
+	size_t index = 0;
+
+	if (context->trace) {
+		for (Binding* it = context->functions->bind; it; it = it->next) {
+			function_count++;
+		}
+
+		functions = calloc(function_count + 1, sizeof(Binding*));
+		assert(functions && "typecheck_program: could not allocate memory for functions");
+
+		function_count = 0;
+		for (Binding* it = context->functions->bind; it; it = it->next) {
+			functions[function_count++] = it;
+		}
+
+		qsort(functions, function_count, sizeof(Binding*), typecheck_binding_compare);
+	}
 
 	while (expression) {
+		double start = context->trace ? time_report_wall_seconds() : 0;
+
 		err = typecheck_expression(context, expression);
-		if (err.type) { return err; }
+		index++;
+
+		if (context->trace) {
+			typecheck_trace_form(context->trace, functions, function_count, expression, index, start);
+		}
+
+		if (err.type) { break; }
 
 		expression = expression->next_child;
 	}
 
+	free(functions);
+
 	return err;
-}
\ No newline at end of file
+}
@@ -0,0 +1,8 @@
+#ifndef COMPILER_VERSION_H
+#define COMPILER_VERSION_H
+
+// Part of every compilation cache key; bump it whenever the same input and
+// options would produce different output.
+#define CROC_VERSION "0.2.0"
+
+#endif
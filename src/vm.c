@@ -0,0 +1,469 @@
+#include "vm.h"
+#include "bytecode.h"
+#include "error.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Threaded dispatch jumps straight from the end of one handler to the next
+// through a table of label addresses, which GCC and Clang support as an
+// extension; elsewhere the handlers become the cases of a switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_CASE(op)     label_##op:
+#define VM_DISPATCH()   do { instruction = *pc++; goto *dispatch_table[instruction.opcode]; } while (0)
+#else
+#define VM_CASE(op)     case op:
+#define VM_DISPATCH()   continue
+#endif
+
+// Integers wrap around like they do natively.
+#define VM_WRAP(a, op, b)   ((long long)((unsigned long long)(a) op (unsigned long long)(b)))
+
+typedef struct VMFrame {
+    Instruction* return_pc;
+    long long* base;
+} VMFrame;
+
+// Elements are kept at their width, as natively, and read back with their
+// sign extended or not.
+long long vm_element_load(unsigned char* memory, TypeLayout element, long long index) {
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64 = 0;
+
+    switch (element.size) {
+    case 1: memcpy(&u8, memory + index, 1); u64 = u8; break;
+    case 2: memcpy(&u16, memory + index * 2, 2); u64 = u16; break;
+    case 4: memcpy(&u32, memory + index * 4, 4); u64 = u32; break;
+    default: memcpy(&u64, memory + index * 8, 8); break;
+    }
+
+    return type_layout_narrow(element, (long long)u64);
+}
+
+void vm_element_store(unsigned char* memory, TypeLayout element, long long index, long long value) {
+    uint8_t u8 = (uint8_t)value;
+    uint16_t u16 = (uint16_t)value;
+    uint32_t u32 = (uint32_t)value;
+    uint64_t u64 = (uint64_t)value;
+
+    switch (element.size) {
+    case 1: memcpy(memory + index, &u8, 1); break;
+    case 2: memcpy(memory + index * 2, &u16, 2); break;
+    case 4: memcpy(memory + index * 4, &u32, 4); break;
+    default: memcpy(memory + index * 8, &u64, 8); break;
+    }
+}
+
+typedef struct VMClosures {
+    long long** blocks;
+    size_t block_count;
+    size_t block_capacity;
+    long long* next;
+    long long* end;
+} VMClosures;
+
+// Room for a closure of `size` values, or NULL if there is no memory left.
+long long* vm_closure_allocate(VMClosures* closures, size_t size) {
+    if ((size_t)(closures->end - closures->next) < size) {
+        size_t length = size + VM_CLOSURE_BLOCK_SIZE;
+        long long* block = NULL;
+
+        if (closures->block_count == closures->block_capacity) {
+            size_t capacity = closures->block_capacity ? closures->block_capacity * 2 : 16;
+            long long** blocks = realloc(closures->blocks, capacity * sizeof(long long*));
+
+            if (!blocks) {
+                return NULL;
+            }
+
+            closures->blocks = blocks;
+            closures->block_capacity = capacity;
+        }
+
+        block = malloc(length * sizeof(long long));
+
+        if (!block) {
+            return NULL;
+        }
+
+        closures->blocks[closures->block_count++] = block;
+        closures->next = block;
+        closures->end = block + length;
+    }
+
+    long long* closure = closures->next;
+    closures->next += size;
+
+    return closure;
+}
+
+void vm_closures_free(VMClosures* closures) {
+    for (size_t i = 0; i < closures->block_count; ++i) {
+        free(closures->blocks[i]);
+    }
+
+    free(closures->blocks);
+}
+
+void vm_arrays_free(unsigned char** arrays, size_t count) {
+    if (!arrays) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(arrays[i]);
+    }
+
+    free(arrays);
+}
+
+Error vm_run(BytecodeModule* module, long long* result) {
+    Error err = ok;
+    long long* registers = calloc(VM_REGISTER_STACK_SIZE, sizeof(long long));
+    long long* globals = calloc(module->global_count + 1, sizeof(long long));
+    unsigned char** arrays = calloc(module->array_count + 1, sizeof(unsigned char*));
+    VMFrame* frames = calloc(VM_FRAME_STACK_SIZE, sizeof(VMFrame));
+    int arrays_allocated = arrays != NULL;
+
+    for (size_t i = 0; arrays_allocated && i < module->array_count; ++i) {
+        arrays[i] = calloc((size_t)module->arrays[i].length, (size_t)module->arrays[i].element.size);
+        arrays_allocated = arrays[i] != NULL;
+    }
+
+    if (!registers || !globals || !arrays_allocated || !frames) {
+        ERROR_PREP(err, ERROR_GENERIC, "vm_run: could not allocate memory for the virtual machine");
+
+        free(frames);
+        vm_arrays_free(arrays, module->array_count);
+        free(globals);
+        free(registers);
+
+        return err;
+    }
+
+    long long* registers_end = registers + VM_REGISTER_STACK_SIZE;
+    size_t frame_count = 0;
+    BytecodeFunction* callee = NULL;
+    VMClosures closures;
+    long long* closure = NULL;
+    unsigned long long bits = 0;
+    int shift = 0;
+
+    // Leave one slot below the entry frame for the result of a call into it.
+    BytecodeFunction* entry = module->functions + module->entry;
+    long long* base = registers + 1;
+    Instruction* pc = entry->code;
+    Instruction instruction;
+
+    memset(&closures, 0, sizeof(VMClosures));
+
+    if (base + entry->register_count > registers_end) {
+        goto stack_overflow;
+    }
+
+#ifdef VM_COMPUTED_GOTO
+    static void* dispatch_table[OP_COUNT] = {
+        &&label_OP_LOAD_IMMEDIATE,
+        &&label_OP_LOAD_CONSTANT,
+        &&label_OP_MOVE,
+        &&label_OP_GET_GLOBAL,
+        &&label_OP_SET_GLOBAL,
+        &&label_OP_CALL,
+        &&label_OP_TAIL_CALL,
+        &&label_OP_RETURN,
+        &&label_OP_JUMP,
+        &&label_OP_JUMP_IF,
+        &&label_OP_NARROW,
+        &&label_OP_GET_ELEMENT,
+        &&label_OP_SET_ELEMENT,
+        &&label_OP_CLOSURE,
+        &&label_OP_CALL_CLOSURE,
+        &&label_OP_ADD,
+        &&label_OP_SUBTRACT,
+        &&label_OP_MULTIPLY,
+        &&label_OP_DIVIDE,
+        &&label_OP_MODULO,
+        &&label_OP_SHIFT_LEFT,
+        &&label_OP_SHIFT_RIGHT,
+        &&label_OP_AND,
+        &&label_OP_OR,
+        &&label_OP_XOR,
+        &&label_OP_LESS,
+        &&label_OP_LESS_EQUAL,
+        &&label_OP_GREATER,
+        &&label_OP_GREATER_EQUAL,
+        &&label_OP_EQUAL,
+        &&label_OP_NOT_EQUAL,
+    };
+
+    VM_DISPATCH();
+#else
+    for (;;) {
+        instruction = *pc++;
+
+        switch (instruction.opcode) {
+        default:
+            assert(0 && "vm_run: invalid opcode");
+#endif
+
+    VM_CASE(OP_LOAD_IMMEDIATE)
+        base[instruction.a] = INSTRUCTION_SBX(instruction);
+        VM_DISPATCH();
+
+    VM_CASE(OP_LOAD_CONSTANT)
+        base[instruction.a] = module->constants[INSTRUCTION_BX(instruction)];
+        VM_DISPATCH();
+
+    VM_CASE(OP_MOVE)
+        base[instruction.a] = base[instruction.b];
+        VM_DISPATCH();
+
+    VM_CASE(OP_GET_GLOBAL)
+        base[instruction.a] = globals[INSTRUCTION_BX(instruction)];
+        VM_DISPATCH();
+
+    VM_CASE(OP_SET_GLOBAL)
+        globals[INSTRUCTION_BX(instruction)] = base[instruction.a];
+        VM_DISPATCH();
+
+    // The callee's window starts just past A, so its parameters are the
+    // arguments the caller left there and its result lands back in A.
+    VM_CASE(OP_CALL)
+        callee = module->functions + INSTRUCTION_BX(instruction);
+
+        if (frame_count == VM_FRAME_STACK_SIZE || base + instruction.a + 1 + callee->register_count > registers_end) {
+            goto stack_overflow;
+        }
+
+        frames[frame_count].return_pc = pc;
+        frames[frame_count].base = base;
+        frame_count++;
+
+        base += instruction.a + 1;
+        pc = callee->code;
+        VM_DISPATCH();
+
+    VM_CASE(OP_TAIL_CALL)
+        callee = module->functions + INSTRUCTION_BX(instruction);
+
+        if (base + callee->register_count > registers_end) {
+            goto stack_overflow;
+        }
+
+        memmove(base, base + instruction.a + 1, callee->parameter_count * sizeof(long long));
+        pc = callee->code;
+        VM_DISPATCH();
+
+    VM_CASE(OP_RETURN)
+        if (frame_count == 0) {
+            *result = base[instruction.a];
+
+            goto done;
+        }
+
+        base[-1] = base[instruction.a];
+
+        frame_count--;
+        pc = frames[frame_count].return_pc;
+        base = frames[frame_count].base;
+        VM_DISPATCH();
+
+    VM_CASE(OP_JUMP)
+        pc += INSTRUCTION_SBX(instruction);
+        VM_DISPATCH();
+
+    VM_CASE(OP_JUMP_IF)
+        if (base[instruction.a]) {
+            pc += INSTRUCTION_SBX(instruction);
+        }
+
+        VM_DISPATCH();
+
+    VM_CASE(OP_NARROW)
+        shift = 64 - instruction.b * 8;
+        bits = (unsigned long long)base[instruction.a] << shift;
+        base[instruction.a] = instruction.c ? (long long)bits >> shift : (long long)(bits >> shift);
+        VM_DISPATCH();
+
+    // Every access is checked; the native code only checks those the
+    // compiler could not prove in range.
+    VM_CASE(OP_GET_ELEMENT)
+        if ((unsigned long long)base[instruction.a] >= (unsigned long long)module->arrays[INSTRUCTION_BX(instruction)].length) {
+            goto bounds_error;
+        }
+
+        base[instruction.a] = vm_element_load(arrays[INSTRUCTION_BX(instruction)], module->arrays[INSTRUCTION_BX(instruction)].element, base[instruction.a]);
+        VM_DISPATCH();
+
+    VM_CASE(OP_SET_ELEMENT)
+        if ((unsigned long long)base[instruction.a] >= (unsigned long long)module->arrays[INSTRUCTION_BX(instruction)].length) {
+            goto bounds_error;
+        }
+
+        vm_element_store(arrays[INSTRUCTION_BX(instruction)], module->arrays[INSTRUCTION_BX(instruction)].element, base[instruction.a], base[instruction.a + 1]);
+        VM_DISPATCH();
+
+    // A closure is the index of its function followed by what it captured.
+    VM_CASE(OP_CLOSURE)
+        callee = module->functions + INSTRUCTION_BX(instruction);
+        closure = vm_closure_allocate(&closures, 1 + callee->capture_count);
+
+        if (!closure) {
+            goto closure_error;
+        }
+
+        closure[0] = INSTRUCTION_BX(instruction);
+        memcpy(closure + 1, base + instruction.a + 1, callee->capture_count * sizeof(long long));
+        base[instruction.a] = (long long)(intptr_t)closure;
+        VM_DISPATCH();
+
+    // Natively a variable of type function might hold anything, so the VM
+    // checks what it calls.
+    VM_CASE(OP_CALL_CLOSURE)
+        closure = (long long*)(intptr_t)base[instruction.b];
+
+        if (!closure) {
+            goto closure_call_error;
+        }
+
+        callee = module->functions + closure[0];
+
+        if (callee->parameter_count != instruction.c) {
+            goto closure_call_error;
+        }
+
+        if (frame_count == VM_FRAME_STACK_SIZE || base + instruction.a + 1 + callee->register_count > registers_end) {
+            goto stack_overflow;
+        }
+
+        memcpy(base + instruction.a + 1 + instruction.c, closure + 1, callee->capture_count * sizeof(long long));
+
+        frames[frame_count].return_pc = pc;
+        frames[frame_count].base = base;
+        frame_count++;
+
+        base += instruction.a + 1;
+        pc = callee->code;
+        VM_DISPATCH();
+
+    VM_CASE(OP_ADD)
+        base[instruction.a] = VM_WRAP(base[instruction.b], +, base[instruction.c]);
+        VM_DISPATCH();
+
+    VM_CASE(OP_SUBTRACT)
+        base[instruction.a] = VM_WRAP(base[instruction.b], -, base[instruction.c]);
+        VM_DISPATCH();
+
+    VM_CASE(OP_MULTIPLY)
+        base[instruction.a] = VM_WRAP(base[instruction.b], *, base[instruction.c]);
+        VM_DISPATCH();
+
+    // Where native code would trap, the VM stops with an error.
+    VM_CASE(OP_DIVIDE)
+        if (base[instruction.c] == 0 || (base[instruction.b] == LLONG_MIN && base[instruction.c] == -1)) {
+            goto division_error;
+        }
+
+        base[instruction.a] = base[instruction.b] / base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_MODULO)
+        if (base[instruction.c] == 0 || (base[instruction.b] == LLONG_MIN && base[instruction.c] == -1)) {
+            goto division_error;
+        }
+
+        base[instruction.a] = base[instruction.b] % base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_SHIFT_LEFT)
+        base[instruction.a] = VM_WRAP(base[instruction.b], <<, base[instruction.c] & 63);
+        VM_DISPATCH();
+
+    VM_CASE(OP_SHIFT_RIGHT)
+        base[instruction.a] = base[instruction.b] >> (base[instruction.c] & 63);
+        VM_DISPATCH();
+
+    VM_CASE(OP_AND)
+        base[instruction.a] = base[instruction.b] & base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_OR)
+        base[instruction.a] = base[instruction.b] | base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_XOR)
+        base[instruction.a] = base[instruction.b] ^ base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_LESS)
+        base[instruction.a] = base[instruction.b] < base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_LESS_EQUAL)
+        base[instruction.a] = base[instruction.b] <= base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_GREATER)
+        base[instruction.a] = base[instruction.b] > base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_GREATER_EQUAL)
+        base[instruction.a] = base[instruction.b] >= base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_EQUAL)
+        base[instruction.a] = base[instruction.b] == base[instruction.c];
+        VM_DISPATCH();
+
+    VM_CASE(OP_NOT_EQUAL)
+        base[instruction.a] = base[instruction.b] != base[instruction.c];
+        VM_DISPATCH();
+
+#ifndef VM_COMPUTED_GOTO
+        }
+    }
+#endif
+
+division_error:
+    ERROR_PREP(err, ERROR_GENERIC, "vm_run: division by zero or overflow");
+
+    goto done;
+
+bounds_error:
+    ERROR_PREP(err, ERROR_GENERIC, "vm_run: array index out of bounds");
+
+    goto done;
+
+closure_error:
+    ERROR_PREP(err, ERROR_GENERIC, "vm_run: could not allocate memory for a closure");
+
+    goto done;
+
+closure_call_error:
+    ERROR_PREP(err, ERROR_GENERIC, "vm_run: call through a function value that is not set or takes a different number of arguments");
+
+    goto done;
+
+stack_overflow:
+    ERROR_PREP(err, ERROR_GENERIC, "vm_run: stack overflow");
+
+done:
+    vm_closures_free(&closures);
+    free(frames);
+    vm_arrays_free(arrays, module->array_count);
+    free(globals);
+    free(registers);
+
+    return err;
+}
@@ -0,0 +1,18 @@
+#ifndef COMPILER_VM_H
+#define COMPILER_VM_H
+
+#include "bytecode.h"
+#include "error.h"
+
+// Registers shared by all active frames, and the deepest non-tail call chain.
+#define VM_REGISTER_STACK_SIZE  (1 << 20)
+#define VM_FRAME_STACK_SIZE     (1 << 16)
+// Closures are made in blocks of at least this many values, which are only
+// freed when the program ends.
+#define VM_CLOSURE_BLOCK_SIZE   (1 << 13)
+
+// Run the module's top-level statements; `result` receives the value of the
+// last one, the value the native program would exit with.
+Error vm_run(BytecodeModule* module, long long* result);
+
+#endif